@@ -264,6 +264,8 @@ struct JpegParams {
   // Libjpeg parameters
   int progressive_id = -1;
   bool optimize_coding = true;
+  // Number of MCUs between restart markers, or 0 for none.
+  int restart_interval = 0;
   bool is_xyb = false;
   // Sjpeg parameters
   int libjpeg_quality = 0;
@@ -304,6 +306,7 @@ Status EncodeWithLibJpeg(const PackedImage& image, const JxlBasicInfo& info,
   cinfo.in_color_space = info.num_color_channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
   jpeg_set_defaults(&cinfo);
   cinfo.optimize_coding = static_cast<boolean>(params.optimize_coding);
+  cinfo.restart_interval = params.restart_interval;
   if (cinfo.input_components == 3) {
     JXL_RETURN_IF_ERROR(
         SetChromaSubsampling(params.chroma_subsampling, &cinfo));
@@ -600,6 +603,11 @@ class JPEGEncoder : public Encoder {
       } else if (it.first == "progressive") {
         std::istringstream is(it.second);
         JXL_RETURN_IF_ERROR(static_cast<bool>(is >> params.progressive_id));
+      } else if (it.first == "restart_interval") {
+        std::istringstream is(it.second);
+        JXL_RETURN_IF_ERROR(static_cast<bool>(is >> params.restart_interval));
+        JXL_RETURN_IF_ERROR(params.restart_interval >= 0 &&
+                            params.restart_interval <= 65535);
       } else if (it.first == "optimize" && it.second == "OFF") {
         params.optimize_coding = false;
       } else if (it.first == "adaptive_q" && it.second == "OFF") {
@@ -183,6 +183,14 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
   if (params.stats) {
     JxlEncoderCollectStats(settings, params.stats);
   }
+  if (!params.ac_entropy_preset.empty() &&
+      JXL_ENC_SUCCESS !=
+          JxlEncoderSetAcEntropyPreset(settings,
+                                       params.ac_entropy_preset.data(),
+                                       params.ac_entropy_preset.size())) {
+    fprintf(stderr, "JxlEncoderSetAcEntropyPreset failed\n");
+    return false;
+  }
 
   bool has_jpeg_bytes = (jpeg_bytes != nullptr);
   bool use_boxes = !ppf.metadata.exif.empty() || !ppf.metadata.xmp.empty() ||
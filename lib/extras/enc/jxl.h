@@ -77,6 +77,9 @@ struct JXLCompressParams {
   JxlDebugImageCallback debug_image = nullptr;
   void* debug_image_opaque = nullptr;
   JxlEncoderStats* stats = nullptr;
+  // If not empty, serialized AC entropy preset, see
+  // JxlEncoderSetAcEntropyPreset.
+  std::vector<uint8_t> ac_entropy_preset;
   bool allow_expert_options = false;
 
   void AddOption(JxlEncoderFrameSettingId id, int64_t val) {
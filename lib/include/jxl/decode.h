@@ -178,7 +178,10 @@ typedef enum {
   /** The JPEG reconstruction buffer is too small for reconstructed JPEG
    * codestream to fit. @ref JxlDecoderSetJPEGBuffer must be called again to
    * make room for remaining bytes. This event may occur multiple times
-   * after ::JXL_DEC_JPEG_RECONSTRUCTION.
+   * after ::JXL_DEC_JPEG_RECONSTRUCTION. When the input is provided in parts,
+   * the bytes of the JPEG that are already decoded are output before the
+   * whole frame is available, so this event may also occur before all input
+   * is provided.
    */
   JXL_DEC_JPEG_NEED_MORE_OUTPUT = 6,
 
@@ -379,6 +382,7 @@ typedef enum {
  * The difference to @ref JxlDecoderReset is that some state is kept, namely
  * settings set by a call to
  *  - @ref JxlDecoderSetCoalescing,
+ *  - @ref JxlDecoderSetDirtyRectCoalescing,
  *  - @ref JxlDecoderSetDesiredIntensityTarget,
  *  - @ref JxlDecoderSetDecompressBoxes,
  *  - @ref JxlDecoderSetKeepOrientation,
@@ -555,6 +559,24 @@ JxlDecoderSetRenderSpotcolors(JxlDecoder* dec, JXL_BOOL render_spotcolors);
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec,
                                                     JXL_BOOL coalescing);
 
+/** Enables or disables rendering only the changed part of coalesced frames.
+ * By default, every displayed frame is written to the image out buffer in
+ * full. When enabled, the decoder only renders and writes the part of each
+ * displayed frame that may differ from the previous displayed frame, see @ref
+ * JxlDecoderGetFrameDirtyRect; the rest of the image out buffer is left
+ * untouched. This speeds up decoding of animations where frames only update a
+ * small part of the image, but requires the image out buffer (or the image out
+ * callback's destination) of each displayed frame to hold the pixels of the
+ * previous displayed frame, in the same pixel format. Has no effect when
+ * coalescing is disabled.
+ *
+ * @param dec decoder object
+ * @param enabled JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetDirtyRectCoalescing(JxlDecoder* dec, JXL_BOOL enabled);
+
 /**
  * Decodes JPEG XL file using the available bytes. Requires input has been
  * set with @ref JxlDecoderSetInput. After @ref JxlDecoderProcessInput, input
@@ -953,6 +975,29 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetPreviewOutBuffer(
 JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameHeader(const JxlDecoder* dec,
                                                      JxlFrameHeader* header);
 
+/**
+ * Outputs the part of the current frame that is written to the image out
+ * buffer when @ref JxlDecoderSetDirtyRectCoalescing is enabled, in the
+ * orientation of the output image. Outside of this rect, the frame is the same
+ * as the previous displayed frame. Without dirty rect coalescing, this is the
+ * whole image. This function can be called when ::JXL_DEC_FRAME occurred for
+ * the current frame.
+ *
+ * @param dec decoder object
+ * @param x0 output for the horizontal offset of the rect.
+ * @param y0 output for the vertical offset of the rect.
+ * @param xsize output for the width of the rect, may be 0.
+ * @param ysize output for the height of the rect, may be 0.
+ * @return ::JXL_DEC_SUCCESS if the value is available, @ref
+ *     JXL_DEC_NEED_MORE_INPUT if not yet available, ::JXL_DEC_ERROR in
+ *     case of other error conditions.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameDirtyRect(const JxlDecoder* dec,
+                                                        uint32_t* x0,
+                                                        uint32_t* y0,
+                                                        uint32_t* xsize,
+                                                        uint32_t* ysize);
+
 /**
  * Outputs name for the current frame. The buffer for name must have at least
  * `name_length + 1` bytes allocated, gotten from the associated JxlFrameHeader.
@@ -1409,6 +1454,74 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderGetBoxSizeRaw(const JxlDecoder* dec,
 JXL_EXPORT JxlDecoderStatus JxlDecoderGetBoxSizeContents(const JxlDecoder* dec,
                                                          uint64_t* size);
 
+/**
+ * Location of a box in the container file, as recorded by the decoder when it
+ * parses the box header. See @ref JxlDecoderGetBoxIndexEntry.
+ */
+typedef struct {
+  /** Raw box type, "brob" for a compressed box. */
+  JxlBoxType type;
+  /** Underlying box type, which differs from type only for "brob" boxes. */
+  JxlBoxType decompressed_type;
+  /** Position of the box header from the start of the file, in bytes. */
+  uint64_t offset;
+  /** Size of the box header in bytes. The contents start at
+   * offset + header_size; for "brob" boxes, they start with the 4-byte
+   * underlying type, followed by the Brotli stream. */
+  uint64_t header_size;
+  /** Raw size of the box including its header in bytes, or `0` if the box
+   * extends until the end of the file. */
+  uint64_t size;
+} JxlBoxIndexEntry;
+
+/**
+ * Returns the number of boxes whose header the decoder has parsed so far. Each
+ * ::JXL_DEC_BOX event adds one entry, but the index is also built when not
+ * subscribed to ::JXL_DEC_BOX. The index is cleared by @ref JxlDecoderReset
+ * and @ref JxlDecoderRewind.
+ *
+ * When only ::JXL_DEC_BOX and ::JXL_DEC_BOX_COMPLETE are subscribed, the
+ * decoder does not parse the codestream, so scanning all boxes of a file to
+ * build the index does not touch the image data.
+ *
+ * @param dec decoder object
+ * @return number of entries available with @ref JxlDecoderGetBoxIndexEntry.
+ */
+JXL_EXPORT size_t JxlDecoderGetNumIndexedBoxes(const JxlDecoder* dec);
+
+/**
+ * Outputs the location of an already parsed box, in the order in which the
+ * boxes appear in the file. With random access to the file, this allows
+ * reading the contents of a box directly, e.g. in a later run.
+ *
+ * @param dec decoder object
+ * @param index index of the box, smaller than the value returned by
+ *     @ref JxlDecoderGetNumIndexedBoxes
+ * @param entry output for the box location
+ * @return ::JXL_DEC_SUCCESS if the entry is available, ::JXL_DEC_ERROR if
+ *     the box at that index has not been parsed yet.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetBoxIndexEntry(
+    const JxlDecoder* dec, size_t index, JxlBoxIndexEntry* entry);
+
+/**
+ * Skips the current box without requiring its contents as input, directly
+ * after a ::JXL_DEC_BOX event. If the input set with @ref JxlDecoderSetInput
+ * does not contain the full box, it is consumed entirely and the next input
+ * must start right after the box, at offset + size of its index entry. This
+ * allows a caller with random access to the file to seek over boxes it does
+ * not need, such as the codestream boxes when only box events are subscribed.
+ *
+ * Boxes that the decoder itself needs (codestream boxes when subscribed to
+ * image events, the JPEG reconstruction box and its metadata), boxes for which
+ * a box buffer was set, and a final box that extends until the end of the file
+ * cannot be skipped.
+ *
+ * @param dec decoder object
+ * @return ::JXL_DEC_SUCCESS if the box was skipped, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSkipBox(JxlDecoder* dec);
+
 /**
  * Configures at which progressive steps in frame decoding these @ref
  * JXL_DEC_FRAME_PROGRESSION event occurs. The default value for the level
@@ -348,7 +348,10 @@ typedef enum {
    (mainly for testing)
    * 1 = buffers everything for images that are 2048 x 2048 or smaller, and
    *     uses streaming input and buffered output for larger images
-   * 2 = same as 1, but the threshold to use streaming input is lower
+   * 2 = same as 1, but the threshold to use streaming input is lower; in
+   *     addition, at effort 8 and below VarDCT AC tokens are regenerated for
+   *     each group when it is written instead of being kept for the whole
+   *     frame, trading some encode time for lower peak memory
    * 3 = deprecated; same as 2, but also sets output mode to 1.
    *
    * Output buffering is controlled via @ref JXL_ENC_FRAME_SETTING_OUTPUT_MODE.
@@ -1620,6 +1623,27 @@ JXL_EXPORT void JxlEncoderSetDebugImageCallback(
 JXL_EXPORT void JxlEncoderCollectStats(JxlEncoderFrameSettings* frame_settings,
                                        JxlEncoderStats* stats);
 
+/**
+ * Sets a preset context map and histograms for the AC coefficients of VarDCT
+ * frames, as written by the train_entropy_preset developer tool. The encoder
+ * uses the preset instead of clustering the histograms of a frame whenever the
+ * statistics of the frame fit it, which saves encoding time on images similar
+ * to the training corpus. The histograms are still stored in the codestream,
+ * so decoding does not need the preset.
+ *
+ * The preset only has an effect at effort 8 and below. The data is parsed and
+ * copied, so it does not need to outlive this call.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param data serialized preset, or NULL to stop using a preset.
+ * @param size size of @p data in bytes.
+ * @return JXL_ENC_SUCCESS if the preset was set, JXL_ENC_ERROR if it could not
+ * be parsed.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetAcEntropyPreset(
+    JxlEncoderFrameSettings* frame_settings, const uint8_t* data, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -72,6 +72,7 @@ typedef enum {
   JXL_ENC_STAT_NUM_DCT32X64_BLOCKS,
   JXL_ENC_STAT_NUM_DCT64_BLOCKS,
   JXL_ENC_STAT_NUM_BUTTERAUGLI_ITERS,
+  JXL_ENC_STAT_NUM_FLAT_BLOCKS,
   JXL_ENC_NUM_STATS,
 } JxlEncoderStatsKey;
 
@@ -31,7 +31,8 @@ namespace jxl {
 namespace {
 
 void RoundtripTestcase(int n_histograms, int alphabet_size,
-                       const std::vector<Token>& input_values) {
+                       const std::vector<Token>& input_values,
+                       const HistogramParams& params = HistogramParams()) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   constexpr uint16_t kMagic1 = 0x9e33;
   constexpr uint16_t kMagic2 = 0x8b04;
@@ -49,7 +50,7 @@ void RoundtripTestcase(int n_histograms, int alphabet_size,
 
   JXL_TEST_ASSIGN_OR_DIE(
       size_t cost,
-      BuildAndEncodeHistograms(memory_manager, HistogramParams(), n_histograms,
+      BuildAndEncodeHistograms(memory_manager, params, n_histograms,
                                input_values_vec, &codes, &writer,
                                LayerType::Header, nullptr));
   (void)cost;
@@ -173,6 +174,66 @@ TEST(ANSTest, RandomUnbalancedStreamRoundtripBig) {
   RoundtripRandomUnbalancedStream(ANS_MAX_ALPHABET_SIZE);
 }
 
+TEST(ANSTest, EntropyCodePreset) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  constexpr size_t kNumContexts = 8;
+  HistogramParams params(SpeedTier::kSquirrel, kNumContexts);
+  params.lz77_method = HistogramParams::LZ77Method::kNone;
+  Rng rng(0);
+  // Two context families with different distributions.
+  const auto random_tokens = [&](size_t num_tokens) {
+    std::vector<Token> tokens;
+    for (size_t i = 0; i < num_tokens; ++i) {
+      uint32_t context = rng.UniformU(0, kNumContexts);
+      uint32_t value = rng.UniformU(0, context < kNumContexts / 2 ? 4 : 64);
+      tokens.emplace_back(context, value);
+    }
+    return tokens;
+  };
+  std::vector<Histogram> corpus(kNumContexts);
+  AddTokensToHistograms(params, random_tokens(100000), &corpus);
+  JXL_TEST_ASSIGN_OR_DIE(EntropyCodePreset preset,
+                         EntropyCodePreset::Train(params, corpus));
+  ASSERT_EQ(preset.context_map.size(), kNumContexts);
+
+  JXL_TEST_ASSIGN_OR_DIE(EntropyCodePreset deserialized,
+                         EntropyCodePreset::Deserialize(
+                             Bytes(preset.Serialize())));
+  EXPECT_EQ(deserialized.context_map, preset.context_map);
+  ASSERT_EQ(deserialized.histograms.size(), preset.histograms.size());
+  for (size_t i = 0; i < preset.histograms.size(); ++i) {
+    EXPECT_EQ(deserialized.histograms[i].total_count,
+              preset.histograms[i].total_count);
+    EXPECT_EQ(deserialized.histograms[i].alphabet_size(),
+              preset.histograms[i].alphabet_size());
+  }
+
+  const std::vector<Token> tokens = random_tokens(10000);
+  std::vector<Histogram> builder(kNumContexts);
+  AddTokensToHistograms(params, tokens, &builder);
+  ASSERT_TRUE(preset.Fits(builder));
+  params.entropy_preset = &preset;
+  RoundtripTestcase(kNumContexts, ANS_MAX_ALPHABET_SIZE, tokens, params);
+  EntropyEncodingData codes;
+  std::vector<std::vector<Token>> tokens_vec = {tokens};
+  JXL_TEST_ASSIGN_OR_DIE(
+      size_t cost,
+      BuildAndEncodeHistograms(memory_manager, params, kNumContexts,
+                               tokens_vec, &codes, nullptr, LayerType::Header,
+                               nullptr));
+  (void)cost;
+  EXPECT_EQ(codes.context_map, preset.context_map);
+
+  // A symbol that never occurred in the corpus makes the preset unusable.
+  std::vector<Token> outlier_tokens = tokens;
+  outlier_tokens.emplace_back(0, 1u << 20);
+  builder.assign(kNumContexts, Histogram());
+  AddTokensToHistograms(params, outlier_tokens, &builder);
+  EXPECT_FALSE(preset.Fits(builder));
+  RoundtripTestcase(kNumContexts, ANS_MAX_ALPHABET_SIZE, outlier_tokens,
+                    params);
+}
+
 TEST(ANSTest, UintConfigRoundtrip) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   for (size_t log_alpha_size = 5; log_alpha_size <= 8; log_alpha_size++) {
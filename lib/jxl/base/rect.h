@@ -67,6 +67,16 @@ class RectT {
                  std::min(y1(), other.y1()));
   }
 
+  // Smallest rect containing both rects; empty rects are ignored.
+  JXL_MUST_USE_RESULT RectT BoundingBox(const RectT& other) const {
+    if (other.xsize_ == 0 || other.ysize_ == 0) return *this;
+    if (xsize_ == 0 || ysize_ == 0) return other;
+    const T x0 = std::min(x0_, other.x0_);
+    const T y0 = std::min(y0_, other.y0_);
+    return RectT(x0, y0, std::max(x1(), other.x1()) - x0,
+                 std::max(y1(), other.y1()) - y0);
+  }
+
   JXL_MUST_USE_RESULT RectT Translate(int64_t x_offset,
                                       int64_t y_offset) const {
     return RectT(x0_ + x_offset, y0_ + y_offset, xsize_, ysize_);
@@ -1209,60 +1209,94 @@ void FuzzyErosion(const ImageF& from, ImageF* to) {
   }
 }
 
-// Compute values of local frequency and dc masking based on the activity
-// in the two images. img_diff_ac may be null.
-Status Mask(const ImageF& mask0, const ImageF& mask1,
-            const ButteraugliParams& params, BlurTemp* blur_temp,
-            ImageF* BUTTERAUGLI_RESTRICT mask,
-            ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
+static const float kMaskMul = 6.19424080439;
+static const float kMaskBias = 12.61050594197;
+static const float kMaskRadius = 2.7;
+
+// Computes the part of Mask() that only depends on mask0: the masking image in
+// `mask`, and the blurred activity of mask0 that is compared to the one of
+// mask1 in `blurred0`.
+Status MaskReference(const ImageF& mask0, const ButteraugliParams& params,
+                     BlurTemp* blur_temp, ImageF* BUTTERAUGLI_RESTRICT mask,
+                     ImageF* BUTTERAUGLI_RESTRICT blurred0) {
   const size_t xsize = mask0.xsize();
   const size_t ysize = mask0.ysize();
   JxlMemoryManager* memory_manager = mask0.memory_manager();
   JXL_ASSIGN_OR_RETURN(*mask, ImageF::Create(memory_manager, xsize, ysize));
-  static const float kMul = 6.19424080439;
-  static const float kBias = 12.61050594197;
-  static const float kRadius = 2.7;
+  JXL_ASSIGN_OR_RETURN(*blurred0,
+                       ImageF::Create(memory_manager, xsize, ysize));
   JXL_ASSIGN_OR_RETURN(ImageF diff0,
                        ImageF::Create(memory_manager, xsize, ysize));
+  DiffPrecompute(mask0, kMaskMul, kMaskBias, &diff0);
+  JXL_RETURN_IF_ERROR(Blur(diff0, kMaskRadius, params, blur_temp, blurred0));
+  FuzzyErosion(*blurred0, mask);
+  return true;
+}
+
+// Adds the difference in activity between mask1 and the reference, given as
+// `blurred0` computed by MaskReference(), to diff_ac.
+Status MaskDiffAc(const ImageF& blurred0, const ImageF& mask1,
+                  const ButteraugliParams& params, BlurTemp* blur_temp,
+                  ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
+  const size_t xsize = mask1.xsize();
+  const size_t ysize = mask1.ysize();
+  JxlMemoryManager* memory_manager = mask1.memory_manager();
   JXL_ASSIGN_OR_RETURN(ImageF diff1,
                        ImageF::Create(memory_manager, xsize, ysize));
-  JXL_ASSIGN_OR_RETURN(ImageF blurred0,
-                       ImageF::Create(memory_manager, xsize, ysize));
   JXL_ASSIGN_OR_RETURN(ImageF blurred1,
                        ImageF::Create(memory_manager, xsize, ysize));
-  DiffPrecompute(mask0, kMul, kBias, &diff0);
-  DiffPrecompute(mask1, kMul, kBias, &diff1);
-  JXL_RETURN_IF_ERROR(Blur(diff0, kRadius, params, blur_temp, &blurred0));
-  FuzzyErosion(blurred0, &diff0);
-  JXL_RETURN_IF_ERROR(Blur(diff1, kRadius, params, blur_temp, &blurred1));
+  DiffPrecompute(mask1, kMaskMul, kMaskBias, &diff1);
+  JXL_RETURN_IF_ERROR(Blur(diff1, kMaskRadius, params, blur_temp, &blurred1));
   for (size_t y = 0; y < ysize; ++y) {
     for (size_t x = 0; x < xsize; ++x) {
-      mask->Row(y)[x] = diff0.Row(y)[x];
-      if (diff_ac != nullptr) {
-        static const float kMaskToErrorMul = 10.0;
-        float diff = blurred0.Row(y)[x] - blurred1.Row(y)[x];
-        diff_ac->Row(y)[x] += kMaskToErrorMul * diff * diff;
-      }
+      static const float kMaskToErrorMul = 10.0;
+      float diff = blurred0.Row(y)[x] - blurred1.Row(y)[x];
+      diff_ac->Row(y)[x] += kMaskToErrorMul * diff * diff;
     }
   }
   return true;
 }
 
-// `diff_ac` may be null.
-Status MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
-                       const size_t xsize, const size_t ysize,
-                       const ButteraugliParams& params, BlurTemp* blur_temp,
-                       ImageF* BUTTERAUGLI_RESTRICT mask,
-                       ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
+// Compute values of local frequency and dc masking based on the activity
+// in the two images. img_diff_ac may be null.
+Status Mask(const ImageF& mask0, const ImageF& mask1,
+            const ButteraugliParams& params, BlurTemp* blur_temp,
+            ImageF* BUTTERAUGLI_RESTRICT mask,
+            ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
+  ImageF blurred0;
+  JXL_RETURN_IF_ERROR(MaskReference(mask0, params, blur_temp, mask, &blurred0));
+  if (diff_ac != nullptr) {
+    JXL_RETURN_IF_ERROR(
+        MaskDiffAc(blurred0, mask1, params, blur_temp, diff_ac));
+  }
+  return true;
+}
+
+// Computes the masking image of the reference `pi0` in `mask`, and in
+// `blurred0` what MaskPsychoImageDiffAc() needs to compare other images to it.
+Status MaskPsychoImageReference(const PsychoImage& pi0, const size_t xsize,
+                                const size_t ysize,
+                                const ButteraugliParams& params,
+                                BlurTemp* blur_temp,
+                                ImageF* BUTTERAUGLI_RESTRICT mask,
+                                ImageF* BUTTERAUGLI_RESTRICT blurred0) {
   JxlMemoryManager* memory_manager = pi0.hf[0].memory_manager();
   JXL_ASSIGN_OR_RETURN(ImageF mask0,
                        ImageF::Create(memory_manager, xsize, ysize));
+  CombineChannelsForMasking(&pi0.hf[0], &pi0.uhf[0], &mask0);
+  return MaskReference(mask0, params, blur_temp, mask, blurred0);
+}
+
+Status MaskPsychoImageDiffAc(const ImageF& blurred0, const PsychoImage& pi1,
+                             const size_t xsize, const size_t ysize,
+                             const ButteraugliParams& params,
+                             BlurTemp* blur_temp,
+                             ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
+  JxlMemoryManager* memory_manager = pi1.hf[0].memory_manager();
   JXL_ASSIGN_OR_RETURN(ImageF mask1,
                        ImageF::Create(memory_manager, xsize, ysize));
-  CombineChannelsForMasking(&pi0.hf[0], &pi0.uhf[0], &mask0);
   CombineChannelsForMasking(&pi1.hf[0], &pi1.uhf[0], &mask1);
-  JXL_RETURN_IF_ERROR(Mask(mask0, mask1, params, blur_temp, mask, diff_ac));
-  return true;
+  return MaskDiffAc(blurred0, mask1, params, blur_temp, diff_ac);
 }
 
 double MaskY(double delta) {
@@ -1671,7 +1705,8 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 
 HWY_EXPORT(SeparateFrequencies);       // Local function.
-HWY_EXPORT(MaskPsychoImage);           // Local function.
+HWY_EXPORT(MaskPsychoImageReference);  // Local function.
+HWY_EXPORT(MaskPsychoImageDiffAc);     // Local function.
 HWY_EXPORT(L2DiffAsymmetric);          // Local function.
 HWY_EXPORT(L2Diff);                    // Local function.
 HWY_EXPORT(SetL2Diff);                 // Local function.
@@ -1811,6 +1846,9 @@ StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
   result->ReleaseTemp();
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SeparateFrequencies)(
       xsize, ysize, params, &result->blur_temp_, xyb0, result->pi0_));
+  JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(MaskPsychoImageReference)(
+      result->pi0_, xsize, ysize, params, &result->blur_temp_, &result->mask_,
+      &result->blurred_mask_));
 
   // Awful recursive construction of samples of different resolution.
   // This is an after-thought and possibly somewhat parallel in
@@ -1821,9 +1859,91 @@ StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
   return result;
 }
 
+StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Crop(
+    const Rect& rect, bool with_sub) const {
+  JxlMemoryManager* memory_manager = temp_.memory_manager();
+  const size_t xsize = rect.xsize();
+  const size_t ysize = rect.ysize();
+  std::unique_ptr<ButteraugliComparator> result =
+      std::unique_ptr<ButteraugliComparator>(
+          new ButteraugliComparator(xsize, ysize, params_));
+  JXL_ASSIGN_OR_RETURN(result->temp_,
+                       Image3F::Create(memory_manager, xsize, ysize));
+  if (xsize_ < 8 || ysize_ < 8) {
+    return result;
+  }
+  const auto crop = [&](const ImageF& from, ImageF* to) -> Status {
+    JXL_ASSIGN_OR_RETURN(*to, ImageF::Create(memory_manager, xsize, ysize));
+    return CopyImageTo(rect, from, Rect(*to), to);
+  };
+  const auto crop3 = [&](const Image3F& from, Image3F* to) -> Status {
+    JXL_ASSIGN_OR_RETURN(*to, Image3F::Create(memory_manager, xsize, ysize));
+    return CopyImageTo(rect, from, Rect(*to), to);
+  };
+  PsychoImage& pi0 = result->pi0_;
+  for (size_t c = 0; c < 2; ++c) {
+    JXL_RETURN_IF_ERROR(crop(pi0_.uhf[c], &pi0.uhf[c]));
+    JXL_RETURN_IF_ERROR(crop(pi0_.hf[c], &pi0.hf[c]));
+  }
+  JXL_RETURN_IF_ERROR(crop3(pi0_.mf, &pi0.mf));
+  JXL_RETURN_IF_ERROR(crop3(pi0_.lf, &pi0.lf));
+  JXL_RETURN_IF_ERROR(crop(mask_, &result->mask_));
+  JXL_RETURN_IF_ERROR(crop(blurred_mask_, &result->blurred_mask_));
+  if (with_sub && sub_) {
+    // Diffmap() only uses the first subsampled level.
+    JXL_ENSURE(rect.x0() % 2 == 0 && rect.y0() % 2 == 0);
+    const size_t sub_x0 = rect.x0() / 2;
+    const size_t sub_y0 = rect.y0() / 2;
+    const Rect sub_rect(sub_x0, sub_y0, DivCeil(rect.x1(), 2) - sub_x0,
+                        DivCeil(rect.y1(), 2) - sub_y0);
+    JXL_ASSIGN_OR_RETURN(result->sub_,
+                         sub_->Crop(sub_rect, /*with_sub=*/false));
+  }
+  return result;
+}
+
 Status ButteraugliComparator::Mask(ImageF* BUTTERAUGLI_RESTRICT mask) const {
-  return HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
-      pi0_, pi0_, xsize_, ysize_, params_, &blur_temp_, mask, nullptr);
+  JXL_ASSIGN_OR_RETURN(
+      *mask, ImageF::Create(temp_.memory_manager(), xsize_, ysize_));
+  return CopyImageTo(mask_, mask);
+}
+
+Status ButteraugliComparator::DiffmapRegion(const Image3F& rgb1,
+                                            const Rect& rect,
+                                            ImageF& diffmap) const {
+  JxlMemoryManager* memory_manager = rgb1.memory_manager();
+  if (rect.xsize() == 0 || rect.ysize() == 0) {
+    return true;
+  }
+  if (xsize_ < 8 || ysize_ < 8) {
+    FillPlane(0.0f, &diffmap, rect);
+    return true;
+  }
+  // Values inside `rect` only depend on the crop if it extends kDiffmapRadius
+  // beyond it, or up to the image border. The crop starts on the 2x2 grid of
+  // the subsampled comparison. If it ends at the right image border, it also
+  // starts on a multiple of the vector size at both resolutions, so that the
+  // SIMD blur rounds the last vector of each row as for the whole image.
+  Rect crop_rect = rect.Extend(kDiffmapRadius, Rect(0, 0, xsize_, ysize_));
+  const size_t crop_x_align = crop_rect.x1() == xsize_ ? 2 * 64 : 2;
+  const size_t crop_x0 = crop_rect.x0() / crop_x_align * crop_x_align;
+  const size_t crop_y0 = crop_rect.y0() & ~static_cast<size_t>(1);
+  crop_rect = Rect(crop_x0, crop_y0, crop_rect.x1() - crop_x0,
+                   crop_rect.y1() - crop_y0);
+  JXL_ASSIGN_OR_RETURN(std::unique_ptr<ButteraugliComparator> crop,
+                       Crop(crop_rect, /*with_sub=*/true));
+  JXL_ASSIGN_OR_RETURN(Image3F crop_rgb1,
+                       Image3F::Create(memory_manager, crop_rect.xsize(),
+                                       crop_rect.ysize()));
+  JXL_RETURN_IF_ERROR(
+      CopyImageTo(crop_rect, rgb1, Rect(crop_rgb1), &crop_rgb1));
+  JXL_ASSIGN_OR_RETURN(ImageF crop_diffmap,
+                       ImageF::Create(memory_manager, crop_rect.xsize(),
+                                      crop_rect.ysize()));
+  JXL_RETURN_IF_ERROR(crop->Diffmap(crop_rgb1, crop_diffmap));
+  return CopyImageTo(Rect(rect.x0() - crop_x0, rect.y0() - crop_y0,
+                          rect.xsize(), rect.ysize()),
+                     crop_diffmap, rect, &diffmap);
 }
 
 Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
@@ -1941,13 +2061,12 @@ Status ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
     (pi0_.lf.Plane(c), pi1.lf.Plane(c), wmul[6 + c], &block_diff_dc.Plane(c));
   }
 
-  ImageF mask;
-  JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
-      pi0_, pi1, xsize_, ysize_, params_, &blur_temp_, &mask,
+  JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(MaskPsychoImageDiffAc)(
+      blurred_mask_, pi1, xsize_, ysize_, params_, &blur_temp_,
       &block_diff_ac.Plane(1)));
 
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(CombineChannelsToDiffmap)(
-      mask, block_diff_dc, block_diff_ac, xmul_, &diffmap));
+      mask_, block_diff_dc, block_diff_ac, xmul_, &diffmap));
   return true;
 }
 
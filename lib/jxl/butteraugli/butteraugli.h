@@ -17,6 +17,7 @@
 #include <memory>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image.h"
 
@@ -183,6 +184,17 @@ class ButteraugliComparator {
   // Same as above, but the frequency decomposition was already applied.
   Status DiffmapPsychoImage(const PsychoImage &pi1, ImageF &diffmap) const;
 
+  // Recomputes the part of `diffmap` (the result of Diffmap() for some other
+  // distorted image) inside `rect`, as Diffmap(rgb1) would compute it. Only
+  // the pixels of `rgb1` at most kDiffmapRadius away from `rect` are used.
+  // Calls for disjoint rects may run concurrently.
+  Status DiffmapRegion(const Image3F &rgb1, const Rect &rect,
+                       ImageF &diffmap) const;
+
+  // Each value of the diffmap only depends on pixels of the distorted image
+  // at most this far away, including the 2x subsampled comparison.
+  static constexpr size_t kDiffmapRadius = 72;
+
   Status Mask(ImageF *BUTTERAUGLI_RESTRICT mask) const;
 
  private:
@@ -191,10 +203,19 @@ class ButteraugliComparator {
   Image3F *Temp() const;
   void ReleaseTemp() const;
 
+  // Returns a comparator for the `rect` part of the reference image that
+  // reuses the precomputed reference data instead of recomputing it.
+  StatusOr<std::unique_ptr<ButteraugliComparator>> Crop(const Rect &rect,
+                                                        bool with_sub) const;
+
   const size_t xsize_;
   const size_t ysize_;
   ButteraugliParams params_;
   PsychoImage pi0_;
+  // Masking of the reference image, and the blurred activity that the
+  // masking of distorted images is compared to.
+  ImageF mask_;
+  ImageF blurred_mask_;
 
   // Shared temporary image storage to reduce the number of allocations;
   // obtained via Temp(), must call ReleaseTemp when no longer needed.
@@ -10,10 +10,12 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <utility>
 
 #include "lib/extras/metrics.h"
 #include "lib/jxl/base/random.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/test_image.h"
@@ -108,5 +110,50 @@ TEST(ButteraugliInPlaceTest, LargeImage) {
   EXPECT_NEAR(distp, distp2, 1e-7);
 }
 
+TEST(ButteraugliComparatorTest, DiffmapRegion) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 333;
+  const size_t ysize = 301;
+  TestImage img;
+  ASSERT_TRUE(img.SetDimensions(xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, img.AddFrame());
+  frame.RandomFill(777);
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img.ppf()));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb1,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(CopyImageTo(rgb0, &rgb1));
+  AddUniformNoise(&rgb1, 0.02f, 7777);
+  ButteraugliParams butteraugli_params;
+  JXL_TEST_ASSIGN_OR_DIE(
+      std::unique_ptr<ButteraugliComparator> comparator,
+      ButteraugliComparator::Make(rgb0, butteraugli_params));
+  ImageF diffmap;
+  ASSERT_TRUE(comparator->Diffmap(rgb1, diffmap));
+
+  // Change the image near the bottom right corner, and only recompute the
+  // diffmap around the change, in two parts.
+  const Rect changed(290, 270, 5, 100, xsize, ysize);
+  AddEdge(&rgb1, 0.1f, changed.x0(), changed.y0());
+  ImageF expected;
+  ASSERT_TRUE(comparator->Diffmap(rgb1, expected));
+  const Rect affected = changed.Extend(ButteraugliComparator::kDiffmapRadius,
+                                       Rect(diffmap));
+  const size_t split = affected.xsize() / 3;
+  ASSERT_TRUE(comparator->DiffmapRegion(
+      rgb1, Rect(affected.x0(), affected.y0(), split, affected.ysize()),
+      diffmap));
+  ASSERT_TRUE(comparator->DiffmapRegion(
+      rgb1,
+      Rect(affected.x0() + split, affected.y0(), affected.xsize() - split,
+           affected.ysize()),
+      diffmap));
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      ASSERT_NEAR(diffmap.Row(y)[x], expected.Row(y)[x], 1e-6)
+          << "x=" << x << " y=" << y;
+    }
+  }
+}
+
 }  // namespace
 }  // namespace jxl
@@ -9,26 +9,35 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <memory>
 #include <numeric>  // iota
 #include <utility>
 #include <vector>
 
+#include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/coeff_order_fwd.h"
+#include "lib/jxl/common.h"
+#include "lib/jxl/dct_util.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_coeff_order.h"
+#include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/test_memory_manager.h"
+#include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
 
 namespace jxl {
 namespace {
 
+using test::ThreadPoolForTests;
+
 void RoundtripPermutation(coeff_order_t* perm, coeff_order_t* out, size_t len,
                           size_t* size) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
@@ -102,5 +111,74 @@ TEST(CoeffOrderTest, FewSlidesBig) { TestPermutation(kFewSlides, 1 << 16); }
 TEST(CoeffOrderTest, FewSwapsBig) { TestPermutation(kFewSwaps, 1 << 16); }
 TEST(CoeffOrderTest, RandomBig) { TestPermutation(kRandom, 1 << 16); }
 
+// Computes the DCT8 coefficient order of a 2x2 group frame where, in each
+// group, the first 12 rows of blocks only have the `first` coefficient set and
+// the remaining 20 rows only the `second` one.
+std::vector<coeff_order_t> ComputeDCT8Order(SpeedTier speed, size_t first,
+                                            size_t second, ThreadPool* pool) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  FrameDimensions frame_dim;
+  frame_dim.Set(2 * kGroupDim, 2 * kGroupDim, /*group_size_shift=*/1,
+                /*max_hshift=*/0, /*max_vshift=*/0, /*modular_mode=*/false,
+                /*upsampling=*/1);
+  JXL_TEST_ASSIGN_OR_DIE(
+      AcStrategyImage ac_strategy,
+      AcStrategyImage::Create(memory_manager, frame_dim.xsize_blocks,
+                              frame_dim.ysize_blocks));
+  ac_strategy.FillDCT8();
+  JXL_TEST_ASSIGN_OR_DIE(
+      std::unique_ptr<ACImageT<int32_t>> ac_image,
+      ACImageT<int32_t>::Make(memory_manager, kGroupDim * kGroupDim,
+                              frame_dim.num_groups));
+  ac_image->ZeroFill();
+  const size_t group_dim_blocks = kGroupDim / kBlockDim;
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t group_index = 0; group_index < frame_dim.num_groups;
+         group_index++) {
+      int32_t* JXL_RESTRICT ac = ac_image->PlaneRow(c, group_index, 0).ptr32;
+      for (size_t by = 0; by < group_dim_blocks; by++) {
+        for (size_t bx = 0; bx < group_dim_blocks; bx++) {
+          const size_t block = by * group_dim_blocks + bx;
+          ac[block * kDCTBlockSize + (by < 12 ? first : second)] = 1;
+        }
+      }
+    }
+  }
+  std::vector<coeff_order_t> order(kCoeffOrderMaxSize);
+  uint32_t all_used_orders = 0;
+  EXPECT_TRUE(ComputeCoeffOrder(speed, *ac_image, ac_strategy, frame_dim,
+                                all_used_orders, /*prev_used_acs=*/0,
+                                /*current_used_acs=*/1,
+                                /*current_used_orders=*/1, pool,
+                                order.data()));
+  EXPECT_EQ(all_used_orders, 1u);
+  return std::vector<coeff_order_t>(order.begin(),
+                                    order.begin() + CoeffOrderOffset(0, 3));
+}
+
+TEST(CoeffOrderTest, SampledBlocks) {
+  std::vector<coeff_order_t> natural_order(kDCTBlockSize);
+  AcStrategy::FromRawStrategy(AcStrategyType::DCT)
+      .ComputeNaturalCoeffOrder(natural_order.data());
+  const size_t first = natural_order[5];
+  const size_t second = natural_order[9];
+  ThreadPoolForTests pool(4);
+  // All blocks are counted: `second` has fewer zeros and moves to the front.
+  const std::vector<coeff_order_t> all_blocks =
+      ComputeDCT8Order(SpeedTier::kKitten, first, second, pool.get());
+  for (size_t c = 0; c < 3; c++) {
+    const coeff_order_t* order = all_blocks.data() + c * kDCTBlockSize;
+    EXPECT_EQ(order[0], natural_order[0]);
+    EXPECT_EQ(order[1], second);
+    EXPECT_EQ(order[2], first);
+  }
+  // Half of the blocks, spread over each group, are counted at faster speed
+  // tiers; counting a prefix of each group instead would put `first` ahead.
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), pool.get()}) {
+    EXPECT_EQ(ComputeDCT8Order(SpeedTier::kSquirrel, first, second, p),
+              all_blocks);
+  }
+}
+
 }  // namespace
 }  // namespace jxl
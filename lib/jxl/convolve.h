@@ -61,6 +61,12 @@ Status Symmetric5(const ImageF& in, const Rect& in_rect,
                   const WeightsSymmetric5& weights, ThreadPool* pool,
                   ImageF* JXL_RESTRICT out, const Rect& out_rect);
 
+// Same as Symmetric5 on each plane of `in_out` with `weights[c]`, but writes
+// the result back into `rect` of `in_out`. Instead of a full-size temporary,
+// only a few rows around each band of rows are kept.
+Status Symmetric5InPlace(Image3F* in_out, const Rect& rect,
+                         const WeightsSymmetric5 weights[3], ThreadPool* pool);
+
 Status Separable5(const ImageF& in, const Rect& rect,
                   const WeightsSeparable5& weights, ThreadPool* pool,
                   ImageF* out);
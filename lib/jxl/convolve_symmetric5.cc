@@ -3,10 +3,14 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <jxl/memory_manager.h>
+
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
@@ -32,15 +36,11 @@ using hwy::HWY_NAMESPACE::Add;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::Vec;
 
-// Weighted sum of 1x5 pixels around ix, iy with [wx2 wx1 wx0 wx1 wx2].
-template <class WrapY>
-static float WeightedSumBorder(const ImageF& in, const WrapY wrap_y,
-                               const int64_t ix, const int64_t iy,
-                               const size_t xsize, const size_t ysize,
-                               const float wx0, const float wx1,
-                               const float wx2) {
+// Weighted sum of 1x5 pixels around ix with [wx2 wx1 wx0 wx1 wx2].
+static float WeightedSumBorder(const float* JXL_RESTRICT row, const int64_t ix,
+                               const size_t xsize, const float wx0,
+                               const float wx1, const float wx2) {
   const WrapMirror wrap_x;
-  const float* JXL_RESTRICT row = in.ConstRow(wrap_y(iy, ysize));
   const float in_m2 = row[wrap_x(ix - 2, xsize)];
   const float in_p2 = row[wrap_x(ix + 2, xsize)];
   const float in_m1 = row[wrap_x(ix - 1, xsize)];
@@ -52,12 +52,11 @@ static float WeightedSumBorder(const ImageF& in, const WrapY wrap_y,
   return sum_2 + (sum_1 + sum_0);
 }
 
-template <class WrapY, class V>
-static V WeightedSum(const ImageF& in, const WrapY wrap_y, const size_t ix,
-                     const int64_t iy, const size_t ysize, const V wx0,
-                     const V wx1, const V wx2) {
+template <class V>
+static V WeightedSum(const float* JXL_RESTRICT row, const size_t ix,
+                     const V wx0, const V wx1, const V wx2) {
   const HWY_FULL(float) d;
-  const float* JXL_RESTRICT center = in.ConstRow(wrap_y(iy, ysize)) + ix;
+  const float* JXL_RESTRICT center = row + ix;
   const auto in_m2 = LoadU(d, center - 2);
   const auto in_p2 = LoadU(d, center + 2);
   const auto in_m1 = LoadU(d, center - 1);
@@ -69,10 +68,9 @@ static V WeightedSum(const ImageF& in, const WrapY wrap_y, const size_t ix,
   return Add(sum_2, Add(sum_1, sum_0));
 }
 
-// Produces result for one pixel
-template <class WrapY>
-float Symmetric5Border(const ImageF& in, const int64_t ix, const int64_t iy,
-                       const WeightsSymmetric5& weights) {
+// Produces result for one pixel; `rows` are the input rows iy-2..iy+2.
+float Symmetric5Border(const float* const* rows, const int64_t ix,
+                       const size_t xsize, const WeightsSymmetric5& weights) {
   const float w0 = weights.c[0];
   const float w1 = weights.r[0];
   const float w2 = weights.R[0];
@@ -80,26 +78,21 @@ float Symmetric5Border(const ImageF& in, const int64_t ix, const int64_t iy,
   const float w5 = weights.L[0];
   const float w8 = weights.D[0];
 
-  const size_t xsize = in.xsize();
-  const size_t ysize = in.ysize();
-  const WrapY wrap_y;
   // Unrolled loop over all 5 rows of the kernel.
-  float sum0 = WeightedSumBorder(in, wrap_y, ix, iy, xsize, ysize, w0, w1, w2);
+  float sum0 = WeightedSumBorder(rows[2], ix, xsize, w0, w1, w2);
 
-  sum0 += WeightedSumBorder(in, wrap_y, ix, iy - 2, xsize, ysize, w2, w5, w8);
-  float sum1 =
-      WeightedSumBorder(in, wrap_y, ix, iy + 2, xsize, ysize, w2, w5, w8);
+  sum0 += WeightedSumBorder(rows[0], ix, xsize, w2, w5, w8);
+  float sum1 = WeightedSumBorder(rows[4], ix, xsize, w2, w5, w8);
 
-  sum0 += WeightedSumBorder(in, wrap_y, ix, iy - 1, xsize, ysize, w1, w4, w5);
-  sum1 += WeightedSumBorder(in, wrap_y, ix, iy + 1, xsize, ysize, w1, w4, w5);
+  sum0 += WeightedSumBorder(rows[1], ix, xsize, w1, w4, w5);
+  sum1 += WeightedSumBorder(rows[3], ix, xsize, w1, w4, w5);
 
   return sum0 + sum1;
 }
 
 // Produces result for one vector's worth of pixels
-template <class WrapY>
-static void Symmetric5Interior(const ImageF& in, const int64_t ix,
-                               const int64_t rix, const int64_t iy,
+static void Symmetric5Interior(const float* const* rows, const int64_t ix,
+                               const int64_t rix,
                                const WeightsSymmetric5& weights,
                                float* JXL_RESTRICT row_out) {
   const HWY_FULL(float) d;
@@ -111,23 +104,22 @@ static void Symmetric5Interior(const ImageF& in, const int64_t ix,
   const auto w5 = LoadDup128(d, weights.L);
   const auto w8 = LoadDup128(d, weights.D);
 
-  const size_t ysize = in.ysize();
-  const WrapY wrap_y;
   // Unrolled loop over all 5 rows of the kernel.
-  auto sum0 = WeightedSum(in, wrap_y, ix, iy, ysize, w0, w1, w2);
+  auto sum0 = WeightedSum(rows[2], ix, w0, w1, w2);
 
-  sum0 = Add(sum0, WeightedSum(in, wrap_y, ix, iy - 2, ysize, w2, w5, w8));
-  auto sum1 = WeightedSum(in, wrap_y, ix, iy + 2, ysize, w2, w5, w8);
+  sum0 = Add(sum0, WeightedSum(rows[0], ix, w2, w5, w8));
+  auto sum1 = WeightedSum(rows[4], ix, w2, w5, w8);
 
-  sum0 = Add(sum0, WeightedSum(in, wrap_y, ix, iy - 1, ysize, w1, w4, w5));
-  sum1 = Add(sum1, WeightedSum(in, wrap_y, ix, iy + 1, ysize, w1, w4, w5));
+  sum0 = Add(sum0, WeightedSum(rows[1], ix, w1, w4, w5));
+  sum1 = Add(sum1, WeightedSum(rows[3], ix, w1, w4, w5));
 
   StoreU(Add(sum0, sum1), d, row_out + rix);
 }
 
-template <class WrapY>
-static void Symmetric5Row(const ImageF& in, const Rect& rect, const int64_t iy,
-                          const WeightsSymmetric5& weights,
+// `rows` are the input rows iy-2..iy+2, mirrored at the image borders; each
+// holds at least the columns rect.x0()-2..rect.x1()+1 that are inside xsize.
+static void Symmetric5Row(const float* const* rows, const size_t xsize,
+                          const Rect& rect, const WeightsSymmetric5& weights,
                           float* JXL_RESTRICT row_out) {
   const int64_t kRadius = 2;
   const size_t xend = rect.x1();
@@ -138,13 +130,13 @@ static void Symmetric5Row(const ImageF& in, const Rect& rect, const int64_t iy,
   const size_t N = Lanes(d);
   const size_t aligned_x = RoundUpTo(kRadius, N);
   for (; ix < std::min(aligned_x, xend); ++ix, ++rix) {
-    row_out[rix] = Symmetric5Border<WrapY>(in, ix, iy, weights);
+    row_out[rix] = Symmetric5Border(rows, ix, xsize, weights);
   }
   for (; ix + N + kRadius <= xend; ix += N, rix += N) {
-    Symmetric5Interior<WrapY>(in, ix, rix, iy, weights, row_out);
+    Symmetric5Interior(rows, ix, rix, weights, row_out);
   }
   for (; ix < xend; ++ix, ++rix) {
-    row_out[rix] = Symmetric5Border<WrapY>(in, ix, iy, weights);
+    row_out[rix] = Symmetric5Border(rows, ix, xsize, weights);
   }
 }
 
@@ -161,13 +153,12 @@ Status Symmetric5(const ImageF& in, const Rect& in_rect,
     const int64_t riy = task;
     const int64_t iy = in_rect.y0() + riy;
 
-    if (iy < 2 || iy >= static_cast<ptrdiff_t>(in.ysize()) - 2) {
-      Symmetric5Row<WrapMirror>(in, in_rect, iy, weights,
-                                out_rect.Row(out, riy));
-    } else {
-      Symmetric5Row<WrapUnchanged>(in, in_rect, iy, weights,
-                                   out_rect.Row(out, riy));
+    const WrapMirror wrap_y;
+    const float* rows[5];
+    for (int64_t k = 0; k < 5; ++k) {
+      rows[k] = in.ConstRow(wrap_y(iy - 2 + k, in.ysize()));
     }
+    Symmetric5Row(rows, in.xsize(), in_rect, weights, out_rect.Row(out, riy));
     return true;
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(ysize),
@@ -176,6 +167,88 @@ Status Symmetric5(const ImageF& in, const Rect& in_rect,
   return true;
 }
 
+Status Symmetric5InPlace(Image3F* in_out, const Rect& rect,
+                         const WeightsSymmetric5* weights, ThreadPool* pool) {
+  JxlMemoryManager* memory_manager = in_out->memory_manager();
+  // Rows per band; bands are processed in parallel, top to bottom.
+  constexpr size_t kBandRows = 64;
+  const size_t xsize = in_out->xsize();
+  const size_t ysize = in_out->ysize();
+  const size_t num_bands = DivCeil(rect.ysize(), kBandRows);
+  if (num_bands == 0 || rect.xsize() == 0) return true;
+
+  // Only these columns of the input rows are read.
+  const size_t x0 = rect.x0() >= 2 ? rect.x0() - 2 : 0;
+  const size_t x1 = std::min(rect.x1() + 2, xsize);
+  const auto copy_row = [&](const float* JXL_RESTRICT from,
+                            float* JXL_RESTRICT to) {
+    memcpy(to + x0, from + x0, (x1 - x0) * sizeof(float));
+  };
+
+  // The two input rows on either side of a band belong to the neighbouring
+  // bands, which might already be overwritten when they are needed.
+  JXL_ASSIGN_OR_RETURN(Image3F borders,
+                       Image3F::Create(memory_manager, xsize, 4 * num_bands));
+  for (size_t band = 0; band < num_bands; ++band) {
+    const size_t y0 = rect.y0() + band * kBandRows;
+    const size_t y1 = std::min(y0 + kBandRows, rect.y1());
+    for (size_t c = 0; c < 3; ++c) {
+      for (size_t k = 0; k < 2; ++k) {
+        if (y0 + k >= 2) {
+          copy_row(in_out->ConstPlaneRow(c, y0 + k - 2),
+                   borders.PlaneRow(c, 4 * band + k));
+        }
+        if (y1 + k < ysize) {
+          copy_row(in_out->ConstPlaneRow(c, y1 + k),
+                   borders.PlaneRow(c, 4 * band + 2 + k));
+        }
+      }
+    }
+  }
+
+  // Per thread, the original values of the last three rows overwritten.
+  std::vector<Image3F> history;
+  const auto init = [&](const size_t num_threads) -> Status {
+    history.resize(num_threads);
+    for (Image3F& rows : history) {
+      JXL_ASSIGN_OR_RETURN(rows, Image3F::Create(memory_manager, xsize, 3));
+    }
+    return true;
+  };
+  const auto process_band = [&](const uint32_t band,
+                                const size_t thread) -> Status {
+    const size_t y0 = rect.y0() + band * kBandRows;
+    const size_t y1 = std::min(y0 + kBandRows, rect.y1());
+    Image3F& hist = history[thread];
+    const WrapMirror wrap_y;
+    for (size_t y = y0; y < y1; ++y) {
+      for (size_t c = 0; c < 3; ++c) {
+        copy_row(in_out->ConstPlaneRow(c, y), hist.PlaneRow(c, y % 3));
+        const float* rows[5];
+        for (int64_t k = 0; k < 5; ++k) {
+          const size_t iy = wrap_y(static_cast<int64_t>(y) - 2 + k, ysize);
+          if (iy >= y1) {
+            rows[k] = borders.ConstPlaneRow(c, 4 * band + 2 + iy - y1);
+          } else if (iy > y) {
+            rows[k] = in_out->ConstPlaneRow(c, iy);
+          } else if (iy >= y0) {
+            rows[k] = hist.ConstPlaneRow(c, iy % 3);
+          } else {
+            rows[k] = borders.ConstPlaneRow(c, 4 * band + iy + 2 - y0);
+          }
+        }
+        Symmetric5Row(rows, xsize, rect, weights[c],
+                      rect.PlaneRow(in_out, c, y - rect.y0()));
+      }
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(num_bands),
+                                init, process_band,
+                                "Symmetric5x5ConvolutionInPlace"));
+  return true;
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -192,5 +265,12 @@ Status Symmetric5(const ImageF& in, const Rect& in_rect,
                                           out_rect);
 }
 
+HWY_EXPORT(Symmetric5InPlace);
+Status Symmetric5InPlace(Image3F* in_out, const Rect& rect,
+                         const WeightsSymmetric5 weights[3],
+                         ThreadPool* pool) {
+  return HWY_DYNAMIC_DISPATCH(Symmetric5InPlace)(in_out, rect, weights, pool);
+}
+
 }  // namespace jxl
 #endif  // HWY_ONCE
@@ -208,6 +208,40 @@ void TestConvolve() {
                             ThreadPool::NoInit, do_test, "TestConvolve"));
 }
 
+// Ensures Symmetric5InPlace gives the same result as Symmetric5, also for
+// images with several bands of rows.
+void TestSymmetric5InPlace() {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  test::ThreadPoolForTests pool(3);
+  Rng rng(65);
+  const WeightsSymmetric5 weights[3] = {WeightsSymmetric5Lowpass(),
+                                        WeightsSymmetric5Lowpass(),
+                                        WeightsSymmetric5Lowpass()};
+  for (const size_t xsize : {5, 67, 131}) {
+    for (const size_t ysize : {3, 64, 200}) {
+      JXL_TEST_ASSIGN_OR_DIE(Image3F in,
+                             Image3F::Create(memory_manager, xsize, ysize));
+      for (size_t c = 0; c < 3; ++c) {
+        GenerateImage(rng, &in.Plane(c), 0.0f, 1.0f);
+      }
+      for (const Rect& rect : GenerateTestRectangles(xsize, ysize)) {
+        JXL_TEST_ASSIGN_OR_DIE(Image3F expected,
+                               Image3F::Create(memory_manager, xsize, ysize));
+        JXL_TEST_ASSIGN_OR_DIE(Image3F actual,
+                               Image3F::Create(memory_manager, xsize, ysize));
+        ASSERT_TRUE(CopyImageTo(in, &expected));
+        ASSERT_TRUE(CopyImageTo(in, &actual));
+        for (size_t c = 0; c < 3; ++c) {
+          ASSERT_TRUE(Symmetric5(in.Plane(c), rect, weights[c], nullptr,
+                                 &expected.Plane(c), rect));
+        }
+        ASSERT_TRUE(Symmetric5InPlace(&actual, rect, weights, pool.get()));
+        JXL_TEST_ASSERT_OK(SamePixels(expected, actual, _));
+      }
+    }
+  }
+}
+
 // Measures durations, verifies results, prints timings. `unpredictable1`
 // must have value 1 (unknown to the compiler to prevent elision).
 template <class Conv>
@@ -275,6 +309,8 @@ HWY_TARGET_INSTANTIATE_TEST_SUITE_P(ConvolveTest);
 
 HWY_EXPORT_AND_TEST_P(ConvolveTest, TestConvolve);
 
+HWY_EXPORT_AND_TEST_P(ConvolveTest, TestSymmetric5InPlace);
+
 HWY_EXPORT_AND_TEST_P(ConvolveTest, BenchmarkAll);
 
 }  // namespace jxl
@@ -85,21 +85,43 @@ class BitReader {
     if (JXL_UNLIKELY(next_byte_ > end_minus_8_)) {
       BoundsCheckedRefill();
     } else {
-      // It's safe to load 64 bits; insert valid (possibly nonzero) bits above
-      // bits_in_buf_. The shift requires bits_in_buf_ < 64.
-      buf_ |= LoadLE64(next_byte_) << bits_in_buf_;
-
-      // Advance by bytes fully absorbed into the buffer.
-      next_byte_ += (63 - bits_in_buf_) >> 3;
-
-      // We absorbed a multiple of 8 bits, so the lower 3 bits of bits_in_buf_
-      // must remain unchanged, otherwise the next refill's shifted bits will
-      // not align with buf_. Set the three upper bits so the result >= 56.
-      bits_in_buf_ |= 56;
-      JXL_DASSERT(56 <= bits_in_buf_ && bits_in_buf_ < 64);
+      RefillUnchecked();
     }
   }
 
+  // Returns whether the next `num_bits` bits can be read using
+  // RefillUnchecked() instead of Refill(), i.e. whether every refill needed
+  // until then can load 64 bits without reaching the end of the input. Lets
+  // callers hoist the bounds check out of loops over a section whose length
+  // they have already validated.
+  bool CanRefillUnchecked(size_t num_bits) const {
+    // Before any refill, next_byte_ is less than 8 bytes ahead of the
+    // consumed position, and it must not exceed end_minus_8_.
+    const size_t consumed = TotalBitsConsumed();
+    if (overread_bytes_ != 0 || num_bits > TotalBytes() * kBitsPerByte) {
+      return false;
+    }
+    return DivCeil(consumed + num_bits, kBitsPerByte) + 16 <= TotalBytes();
+  }
+
+  // Same as Refill(), but without the bounds check; only valid within the
+  // number of bits approved by CanRefillUnchecked().
+  JXL_INLINE void RefillUnchecked() {
+    JXL_DASSERT(next_byte_ <= end_minus_8_);
+    // It's safe to load 64 bits; insert valid (possibly nonzero) bits above
+    // bits_in_buf_. The shift requires bits_in_buf_ < 64.
+    buf_ |= LoadLE64(next_byte_) << bits_in_buf_;
+
+    // Advance by bytes fully absorbed into the buffer.
+    next_byte_ += (63 - bits_in_buf_) >> 3;
+
+    // We absorbed a multiple of 8 bits, so the lower 3 bits of bits_in_buf_
+    // must remain unchanged, otherwise the next refill's shifted bits will
+    // not align with buf_. Set the three upper bits so the result >= 56.
+    bits_in_buf_ |= 56;
+    JXL_DASSERT(56 <= bits_in_buf_ && bits_in_buf_ < 64);
+  }
+
   // Returns the bits that would be returned by Read without calling Advance().
   // It is legal to PEEK at more bits than present in the bitstream (required
   // by Huffman), and those bits will be zero.
@@ -134,9 +134,18 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
   if (options.use_slow_render_pipeline) {
     builder.UseSimpleImplementation();
   }
+  if (options.coalescing && options.restrict_to_dirty_rect) {
+    builder.RestrictPaddingTo(options.dirty_rect);
+  }
 
   if (!frame_header.chroma_subsampling.Is444()) {
     for (size_t c = 0; c < 3; c++) {
+      if (frame_header.chroma_subsampling.HShift(c) != 0 &&
+          frame_header.chroma_subsampling.VShift(c) != 0) {
+        // 4:2:0, as in most JPEGs.
+        JXL_RETURN_IF_ERROR(builder.AddStage(GetChromaUpsampling2DStage(c)));
+        continue;
+      }
       if (frame_header.chroma_subsampling.HShift(c) != 0) {
         JXL_RETURN_IF_ERROR(
             builder.AddStage(GetChromaUpsamplingStage(c, /*horizontal=*/true)));
@@ -156,16 +165,16 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
   {
     const LoopFilter& lf = frame_header.loop_filter;
     if (lf.epf_iters >= 3) {
-      JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::Zero)));
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetEPFStage(memory_manager, lf, sigma, EpfStage::Zero)));
     }
     if (lf.epf_iters >= 1) {
-      JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::One)));
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetEPFStage(memory_manager, lf, sigma, EpfStage::One)));
     }
     if (lf.epf_iters >= 2) {
-      JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::Two)));
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetEPFStage(memory_manager, lf, sigma, EpfStage::Two)));
     }
   }
 
@@ -239,6 +248,16 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
   }
 
+  // The fast YCbCr path writes the final pixels itself, so it requires that no
+  // stage after the color transform is needed.
+  const bool fast_ycbcr_rgb8 =
+      fast_ycbcr_rgb8_conversion && extra_output.empty() &&
+      !NeedsBlending(frame_header) &&
+      (!frame_header.CanBeReferenced() ||
+       frame_header.save_before_color_transform) &&
+      (!options.render_spotcolors ||
+       !metadata->Find(ExtraChannel::kSpotColor));
+
   if (fast_xyb_srgb8_conversion) {
 #if !JXL_HIGH_PRECISION
     JXL_ENSURE(!NeedsBlending(frame_header));
@@ -251,6 +270,14 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     JXL_RETURN_IF_ERROR(builder.AddStage(
         GetFastXYBTosRGB8Stage(rgb_output, main_output.stride, width, height,
                                is_rgba, has_alpha, alpha_c)));
+#endif
+  } else if (fast_ycbcr_rgb8) {
+#if !JXL_HIGH_PRECISION
+    bool is_rgba = (main_output.format.num_channels == 4);
+    uint8_t* rgb_output = reinterpret_cast<uint8_t*>(main_output.buffer);
+    JXL_RETURN_IF_ERROR(builder.AddStage(
+        GetFastYCbCrToRGB8Stage(rgb_output, main_output.stride, width, height,
+                                is_rgba, has_alpha, alpha_c)));
 #endif
   } else {
     bool linear = false;
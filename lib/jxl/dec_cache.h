@@ -20,6 +20,7 @@
 #include "lib/jxl/base/common.h"  // kMaxNumPasses
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/dct_util.h"
@@ -115,6 +116,9 @@ struct PassesDecoderState {
   // Whether to use int16 float-XYB-to-uint8-srgb conversion.
   bool fast_xyb_srgb8_conversion;
 
+  // Whether to convert from YCbCr and write uint8 RGB in a single stage.
+  bool fast_ycbcr_rgb8_conversion;
+
   // If true, the RGBA output will be unpremultiplied before writing to the
   // output.
   bool unpremul_alpha;
@@ -144,6 +148,10 @@ struct PassesDecoderState {
     bool coalescing;
     bool render_spotcolors;
     bool render_noise;
+    // If set, when coalescing, the image area outside of the frame is only
+    // rendered within `dirty_rect`.
+    bool restrict_to_dirty_rect = false;
+    Rect dirty_rect;
   };
 
   JxlMemoryManager* memory_manager() const { return shared->memory_manager; }
@@ -166,6 +174,7 @@ struct PassesDecoderState {
     extra_output.clear();
 
     fast_xyb_srgb8_conversion = false;
+    fast_ycbcr_rgb8_conversion = false;
     unpremul_alpha = false;
     undo_orientation = Orientation::kIdentity;
 
@@ -10,6 +10,7 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -27,6 +28,7 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/blending.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/coeff_order_fwd.h"
@@ -304,7 +306,7 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
   if (frame_header_.flags & FrameHeader::kSplines) {
     JXL_RETURN_IF_ERROR(shared.image_features.splines.InitializeDrawCache(
         frame_dim_.xsize_upsampled, frame_dim_.ysize_upsampled,
-        dec_state_->shared->cmap.base()));
+        dec_state_->shared->cmap.base(), pool_));
   }
   Status dec_status = modular_frame_decoder_.DecodeGlobalInfo(
       br, frame_header_, /*allow_truncated_group=*/false);
@@ -665,6 +667,12 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     pipeline_options.coalescing = coalescing_;
     pipeline_options.render_spotcolors = render_spotcolors_;
     pipeline_options.render_noise = true;
+    if (restrict_to_dirty_rect_) {
+      // The frame itself is always rendered in full.
+      dirty_rect_ = dirty_rect_.BoundingBox(FrameRectInImage());
+      pipeline_options.restrict_to_dirty_rect = true;
+      pipeline_options.dirty_rect = dirty_rect_;
+    }
     JXL_RETURN_IF_ERROR(dec_state_->PreparePipeline(
         frame_header_, &frame_header_.nonserialized_metadata->m, decoded_,
         pipeline_options));
@@ -699,14 +707,31 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
       }
     }
 
-    const auto prepare_storage = [this](size_t num_threads) -> Status {
+    // Groups are decoded in horizontal bands of consecutive groups, each band
+    // by a single thread and from left to right. This way the border shared
+    // by two groups of a band is rendered as part of the second group rather
+    // than as a separate rect, which would need its own vertical padding rows
+    // to be recomputed by every stage of the render pipeline. Bands are only
+    // narrower than a group row if there are too few group rows to keep all
+    // threads busy.
+    const size_t xsize_groups = frame_dim_.xsize_groups;
+    const size_t ysize_groups = frame_dim_.ysize_groups;
+    size_t band_xsize = xsize_groups;
+    size_t bands_per_row = 1;
+    std::atomic<size_t> next_band{0};
+    const auto prepare_storage = [&](size_t num_threads) -> Status {
       JXL_RETURN_IF_ERROR(
           PrepareStorage(num_threads, decoded_passes_per_ac_group_.size()));
+      constexpr size_t kBandsPerThread = 4;
+      bands_per_row = std::min(
+          xsize_groups, DivCeil(kBandsPerThread * num_threads, ysize_groups));
+      band_xsize = DivCeil(xsize_groups, bands_per_row);
+      bands_per_row = DivCeil(xsize_groups, band_xsize);
       return true;
     };
     const auto process_group = [this, &ac_group_sec, &desired_num_ac_passes,
                                 &num, &sections, &section_status](
-                                   size_t g, size_t thread) -> Status {
+                                   size_t g, size_t storage) -> Status {
       if (desired_num_ac_passes[g] == 0) {
         // no new AC pass, nothing to do
         return true;
@@ -717,16 +742,31 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
         JXL_ENSURE(ac_group_sec[g][first_pass + i] != num);
         readers[i] = sections[ac_group_sec[g][first_pass + i]].br;
       }
-      JXL_RETURN_IF_ERROR(ProcessACGroup(
-          g, readers, desired_num_ac_passes[g], GetStorageLocation(thread, g),
-          /*force_draw=*/false, /*dc_only=*/false));
+      JXL_RETURN_IF_ERROR(ProcessACGroup(g, readers, desired_num_ac_passes[g],
+                                         storage, /*force_draw=*/false,
+                                         /*dc_only=*/false));
       for (size_t i = 0; i < desired_num_ac_passes[g]; i++) {
         section_status[ac_group_sec[g][first_pass + i]] = SectionStatus::kDone;
       }
       return true;
     };
+    // Each task keeps claiming bands until there are none left, so tasks that
+    // start late have nothing to do.
+    const auto process_bands = [&](size_t task, size_t thread) -> Status {
+      size_t storage = GetStorageLocation(thread, task);
+      for (size_t band = next_band.fetch_add(1);
+           band < ysize_groups * bands_per_row; band = next_band.fetch_add(1)) {
+        size_t gy = band / bands_per_row;
+        size_t gx0 = (band % bands_per_row) * band_xsize;
+        size_t gx1 = std::min(xsize_groups, gx0 + band_xsize);
+        for (size_t gx = gx0; gx < gx1; gx++) {
+          JXL_RETURN_IF_ERROR(process_group(gy * xsize_groups + gx, storage));
+        }
+      }
+      return true;
+    };
     JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, ac_group_sec.size(),
-                                  prepare_storage, process_group,
+                                  prepare_storage, process_bands,
                                   "DecodeGroup"));
   }
 
@@ -875,10 +915,107 @@ Status FrameDecoder::FinalizeFrame() {
   if (frame_header_.CanBeReferenced()) {
     auto& info = dec_state_->shared_storage
                      .reference_frames[frame_header_.save_as_reference];
+    if (restrict_to_dirty_rect_ && coalescing_ &&
+        !frame_header_.save_before_color_transform &&
+        NeedsBlending(frame_header_)) {
+      JXL_ASSIGN_OR_RETURN(bool updated_in_place, CompleteDirtyReference());
+      if (updated_in_place) return true;
+    }
     *info.frame = std::move(dec_state_->frame_storage_for_referencing);
     info.ib_is_in_xyb = frame_header_.save_before_color_transform;
   }
   return true;
 }
 
+size_t FrameDecoder::NumCompleteRows() const {
+  const size_t num_passes = frame_header_.passes.num_passes;
+  const size_t xsize_groups = frame_dim_.xsize_groups;
+  size_t gy = 0;
+  for (; gy < frame_dim_.ysize_groups; ++gy) {
+    const uint8_t* row = &decoded_passes_per_ac_group_[gy * xsize_groups];
+    if (*std::min_element(row, row + xsize_groups) < num_passes) break;
+  }
+  return std::min(gy * frame_dim_.group_dim, frame_dim_.ysize);
+}
+
+Rect FrameDecoder::FrameRectInImage() const {
+  const CodecMetadata* metadata = frame_header_.nonserialized_metadata;
+  const ptrdiff_t x0 = frame_header_.frame_origin.x0;
+  const ptrdiff_t y0 = frame_header_.frame_origin.y0;
+  const ptrdiff_t x1 =
+      std::min<ptrdiff_t>(x0 + frame_dim_.xsize_upsampled, metadata->xsize());
+  const ptrdiff_t y1 =
+      std::min<ptrdiff_t>(y0 + frame_dim_.ysize_upsampled, metadata->ysize());
+  if (x1 <= 0 || y1 <= 0) return Rect();
+  const size_t cx0 = std::max<ptrdiff_t>(x0, 0);
+  const size_t cy0 = std::max<ptrdiff_t>(y0, 0);
+  if (static_cast<ptrdiff_t>(cx0) >= x1 || static_cast<ptrdiff_t>(cy0) >= y1) {
+    return Rect();
+  }
+  return Rect(cx0, cy0, x1 - cx0, y1 - cy0);
+}
+
+StatusOr<bool> FrameDecoder::CompleteDirtyReference() {
+  auto& reference_frames = dec_state_->shared_storage.reference_frames;
+  const size_t slot = frame_header_.save_as_reference;
+  ImageBundle& storage = dec_state_->frame_storage_for_referencing;
+  const Rect image_rect(storage);
+  const Rect dirty = dirty_rect_.Intersection(image_rect);
+  const auto& ec_info = frame_header_.extra_channel_blending_info;
+  const size_t source = frame_header_.blending_info.source;
+
+  // When the frame replaces its own blending source, that source already holds
+  // every pixel outside of the dirty rect: only copy the dirty rect into it.
+  bool same_source = (source == slot);
+  for (const auto& info : ec_info) {
+    if (info.source != slot) same_source = false;
+  }
+  ImageBundle* bg = reference_frames[slot].frame.get();
+  if (same_source && !reference_frames[slot].ib_is_in_xyb && bg->HasColor() &&
+      bg->xsize() == storage.xsize() && bg->ysize() == storage.ysize() &&
+      bg->extra_channels().size() == storage.extra_channels().size()) {
+    JXL_RETURN_IF_ERROR(
+        CopyImageTo(dirty, *storage.color(), dirty, bg->color()));
+    for (size_t i = 0; i < storage.extra_channels().size(); i++) {
+      JXL_RETURN_IF_ERROR(CopyImageTo(dirty, storage.extra_channels()[i], dirty,
+                                      &bg->extra_channels()[i]));
+    }
+    return true;
+  }
+
+  // Otherwise, fill the rest of the image from the blending sources (or with
+  // zeros, like the blending stage does for empty sources).
+  const Rect rest[4] = {
+      Rect(0, 0, image_rect.xsize(), dirty.y0()),
+      Rect(0, dirty.y1(), image_rect.xsize(), image_rect.ysize() - dirty.y1()),
+      Rect(0, dirty.y0(), dirty.x0(), dirty.ysize()),
+      Rect(dirty.x1(), dirty.y0(), image_rect.xsize() - dirty.x1(),
+           dirty.ysize()),
+  };
+  const ImageBundle& color_bg = *reference_frames[source].frame;
+  for (const Rect& rect : rest) {
+    if (rect.xsize() == 0 || rect.ysize() == 0) continue;
+    for (size_t c = 0; c < 3; c++) {
+      ImageF* to = &storage.color()->Plane(c);
+      if (!color_bg.HasColor()) {
+        FillPlane(0.0f, to, rect);
+      } else {
+        JXL_RETURN_IF_ERROR(
+            CopyImageTo(rect, color_bg.color().Plane(c), rect, to));
+      }
+    }
+    for (size_t i = 0; i < storage.extra_channels().size(); i++) {
+      const ImageBundle& ec_bg = *reference_frames[ec_info[i].source].frame;
+      ImageF* to = &storage.extra_channels()[i];
+      if (ec_bg.extra_channels().size() <= i) {
+        FillPlane(0.0f, to, rect);
+      } else {
+        JXL_RETURN_IF_ERROR(
+            CopyImageTo(rect, ec_bg.extra_channels()[i], rect, to));
+      }
+    }
+  }
+  return false;
+}
+
 }  // namespace jxl
@@ -20,6 +20,7 @@
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
 #include "lib/jxl/dec_bit_reader.h"
@@ -56,6 +57,16 @@ class FrameDecoder {
 
   void SetRenderSpotcolors(bool rsc) { render_spotcolors_ = rsc; }
   void SetCoalescing(bool c) { coalescing_ = c; }
+  // When coalescing, only renders the pixels of the image outside of the frame
+  // that lie within `rect`. The rest of the frame saved for reference is then
+  // filled from the blending sources when the frame is finalized.
+  void SetDirtyRect(const Rect& rect) {
+    restrict_to_dirty_rect_ = true;
+    dirty_rect_ = rect;
+  }
+
+  // Part of the image covered by the frame, valid after InitFrame.
+  Rect FrameRectInImage() const;
 
   // Read FrameHeader and table of contents from the given BitReader.
   Status InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
@@ -134,6 +145,10 @@ class FrameDecoder {
                              decoded_passes_per_ac_group_.end());
   }
 
+  // Returns the number of leading rows of the frame whose AC groups have
+  // decoded all their passes.
+  size_t NumCompleteRows() const;
+
   // If enabled, ProcessSections will stop and return true when the DC
   // sections have been processed, instead of starting the AC sections. This
   // will only occur if supported (that is, flushing will produce a valid
@@ -229,6 +244,17 @@ class FrameDecoder {
         HasFastXYBTosRGB8() && frame_header_.needs_color_transform()) {
       dec_state_->fast_xyb_srgb8_conversion = true;
     }
+    if (dec_state_->main_output.buffer &&
+        (format.data_type == JXL_TYPE_UINT8) && (format.num_channels >= 3) &&
+        !dec_state_->unpremul_alpha &&
+        (dec_state_->undo_orientation == Orientation::kIdentity) &&
+        frame_header_.color_transform == ColorTransform::kYCbCr &&
+        dec_state_->output_encoding_info.color_encoding_is_original &&
+        (dec_state_->output_encoding_info.desired_intensity_target ==
+         dec_state_->output_encoding_info.orig_intensity_target) &&
+        frame_header_.needs_color_transform()) {
+      dec_state_->fast_ycbcr_rgb8_conversion = true;
+    }
 #endif
     return true;
   }
@@ -252,6 +278,11 @@ class FrameDecoder {
   Status ProcessDCGroup(size_t dc_group_id, BitReader* br);
   Status FinalizeDC();
   Status AllocateOutput();
+  // Completes the frame saved for reference when only the dirty rect of the
+  // image was rendered. Returns true if the dirty rect was copied into the
+  // blending source in place, which then already is the saved frame.
+  StatusOr<bool> CompleteDirtyReference();
+
   Status ProcessACGlobal(BitReader* br);
   Status ProcessACGroup(size_t ac_group_id, PassesReaders& br,
                         size_t num_passes, size_t thread, bool force_draw,
@@ -326,6 +357,8 @@ class FrameDecoder {
   ModularFrameDecoder modular_frame_decoder_;
   bool render_spotcolors_ = true;
   bool coalescing_ = true;
+  bool restrict_to_dirty_rect_ = false;
+  Rect dirty_rect_;
 
   std::vector<uint8_t> processed_section_;
   std::vector<uint8_t> decoded_passes_per_ac_group_;
@@ -259,6 +259,15 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
     }
   }
 
+  // Runs of horizontally adjacent DCT8 blocks (the only transform used at low
+  // encoder efforts) are inverse transformed in batches: the first 1D IDCT
+  // and the transpose are done per block, and the second 1D IDCT is done on
+  // all the columns of the batch at once, directly into the pipeline input.
+  constexpr size_t kDCT8BatchSize = 8;
+  constexpr size_t kDCT8BatchStride = kDCT8BatchSize * kBlockDim;
+  HWY_ALIGN float dct8_batch[3 * kDCT8BatchSize * kDCTBlockSize];
+  bool use_dct8_batch = cs.Is444() && jpeg_data == nullptr;
+
   size_t hshift[3] = {cs.HShift(0), cs.HShift(1), cs.HShift(2)};
   size_t vshift[3] = {cs.VShift(0), cs.VShift(1), cs.VShift(2)};
   Rect r[3];
@@ -308,6 +317,30 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
       }
     }
 
+    // Blocks [batch_bx, batch_bx + num_batched) are waiting in dct8_batch for
+    // their second IDCT pass.
+    size_t batch_bx = 0;
+    size_t num_batched = 0;
+    const auto flush_dct8_batch = [&]() {
+      float* JXL_RESTRICT scratch = group_dec_cache->scratch_space;
+      for (size_t c = 0; c < 3; c++) {
+        const float* from = dct8_batch + c * kDCT8BatchSize * kDCTBlockSize;
+        float* JXL_RESTRICT pixels = idct_row[c] + batch_bx * kBlockDim;
+        if (num_batched == kDCT8BatchSize) {
+          IDCT1D<8, kDCT8BatchStride>()(DCTFrom(from, kDCT8BatchStride),
+                                        DCTTo(pixels, idct_stride[c]),
+                                        scratch);
+          continue;
+        }
+        for (size_t i = 0; i < num_batched; i++) {
+          IDCT1D<8, 8>()(DCTFrom(from + i * kBlockDim, kDCT8BatchStride),
+                         DCTTo(pixels + i * kBlockDim, idct_stride[c]),
+                         scratch);
+        }
+      }
+      num_batched = 0;
+    };
+
     size_t bx = 0;
     for (size_t tx = 0; tx < DivCeil(xsize_blocks, kColorTileDimInBlocks);
          tx++) {
@@ -439,6 +472,25 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
               dec_state->output_encoding_info.opsin_params.quant_biases, qblock,
               block, group_dec_cache->scratch_space);
 
+          if (use_dct8_batch && acs.Strategy() == AcStrategyType::DCT) {
+            if (num_batched != 0 && batch_bx + num_batched != bx) {
+              flush_dct8_batch();
+            }
+            if (num_batched == 0) batch_bx = bx;
+            float* JXL_RESTRICT scratch = group_dec_cache->scratch_space;
+            for (size_t c = 0; c < 3; c++) {
+              IDCT1D<8, 8>()(DCTFrom(block + c * size, 8), DCTTo(scratch, 8),
+                             scratch + kDCTBlockSize);
+              Transpose<8, 8>::Run(
+                  DCTFrom(scratch, 8),
+                  DCTTo(dct8_batch + c * kDCT8BatchSize * kDCTBlockSize +
+                            num_batched * kBlockDim,
+                        kDCT8BatchStride));
+            }
+            if (++num_batched == kDCT8BatchSize) flush_dct8_batch();
+            bx += llf_x;
+            continue;
+          }
           for (size_t c : {1, 0, 2}) {
             if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
               continue;
@@ -452,6 +504,7 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
         bx += llf_x;
       }
     }
+    if (num_batched != 0) flush_dct8_batch();
   }
   return true;
 }
@@ -28,8 +28,11 @@
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/blending.h"
 #include "lib/jxl/cms/color_encoding_cms.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/dec_bit_reader.h"
@@ -57,6 +60,10 @@
 
 namespace {
 
+// Stands for the whole image in dirty rects, which are clipped to the image
+// where used.
+constexpr jxl::Rect kWholeImageRect(0, 0, size_t{1} << 30, size_t{1} << 30);
+
 // Checks if a + b > size, taking possible integer overflow into account.
 bool OutOfBounds(size_t a, size_t b, size_t size) {
   size_t pos = a + b;
@@ -431,6 +438,7 @@ struct JxlDecoder {
   bool unpremul_alpha;
   bool render_spotcolors;
   bool coalescing;
+  bool dirty_rect_coalescing;
   float desired_intensity_target;
 
   // Bitfield, for which informative events (JXL_DEC_BASIC_INFO, etc...) the
@@ -444,6 +452,8 @@ struct JxlDecoder {
   size_t basic_info_size_hint;
   bool have_container;
   size_t box_count;
+  // Headers of all boxes seen so far, see JxlDecoderGetBoxIndexEntry.
+  std::vector<JxlBoxIndexEntry> box_index;
 
   // The level of progressive detail in frame decoding.
   JxlProgressiveDetail prog_detail = kDC;
@@ -526,6 +536,18 @@ struct JxlDecoder {
   // vector, it must be treated as a required frame.
   std::vector<char> frame_required;
 
+  // State of dirty-rect coalescing (see JxlDecoderSetDirtyRectCoalescing).
+  // For each reference slot, the part of the image where the frame saved there
+  // may differ from the last displayed frame written to the output buffer.
+  std::array<jxl::Rect, 4> slot_dirty_rects;
+  // Part of the output buffer written by frames that were not displayed since.
+  jxl::Rect pending_dirty_rect;
+  // For the current frame: the part of the image that must be rendered, its
+  // dirty rect if displayed, and the new dirty rect of the slot it is saved to.
+  jxl::Rect frame_render_rect;
+  jxl::Rect frame_dirty_rect;
+  jxl::Rect frame_saved_dirty_rect;
+
   // Codestream input data is copied here temporarily when the decoder needs
   // more input bytes to process the next part of the stream. We copy the input
   // data in order to be able to release it all through the API it when
@@ -708,6 +730,13 @@ struct JxlDecoder {
     }
   }
 
+  // Whether the user subscribed to any event that requires the codestream. If
+  // not, only box headers are parsed and codestream boxes are skipped like
+  // unknown ones.
+  bool CodestreamWanted() const {
+    return (orig_events_wanted & ~(JXL_DEC_BOX | JXL_DEC_BOX_COMPLETE)) != 0;
+  }
+
   // Whether the decoder can use more codestream input for a purpose it needs.
   // This returns false if the user didn't subscribe to any events that
   // require the codestream (e.g. only subscribed to metadata boxes), or all
@@ -785,6 +814,7 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->basic_info_size_hint = InitialBasicInfoSizeHint();
   dec->have_container = false;
   dec->box_count = 0;
+  dec->box_index.clear();
   dec->downsampling_target = 8;
   dec->image_out_buffer_set = false;
   dec->image_out_buffer = nullptr;
@@ -822,6 +852,9 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->skipping_frame = false;
   dec->internal_frames = 0;
   dec->external_frames = 0;
+  // Nothing is known about the output buffer yet.
+  dec->slot_dirty_rects.fill(kWholeImageRect);
+  dec->pending_dirty_rect = jxl::Rect();
 }
 
 void JxlDecoderReset(JxlDecoder* dec) {
@@ -832,6 +865,7 @@ void JxlDecoderReset(JxlDecoder* dec) {
   dec->unpremul_alpha = false;
   dec->render_spotcolors = true;
   dec->coalescing = true;
+  dec->dirty_rect_coalescing = false;
   dec->desired_intensity_target = 0;
   dec->orig_events_wanted = 0;
   dec->events_wanted = 0;
@@ -908,6 +942,11 @@ JxlDecoderStatus JxlDecoderSkipCurrentFrame(JxlDecoder* dec) {
   JXL_DASSERT(dec->frame_dec);
   dec->frame_stage = FrameStage::kHeader;
   dec->AdvanceCodestream(dec->remaining_frame_size);
+  if (dec->image_out_buffer_set) {
+    // The frame may have been partially written by a flush.
+    dec->pending_dirty_rect =
+        dec->pending_dirty_rect.BoundingBox(dec->frame_render_rect);
+  }
   if (dec->is_last_of_still) {
     dec->image_out_buffer_set = false;
   }
@@ -978,6 +1017,16 @@ JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec, JXL_BOOL coalescing) {
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetDirtyRectCoalescing(JxlDecoder* dec,
+                                                  JXL_BOOL enabled) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR(
+        "Must set dirty rect coalescing option before starting");
+  }
+  dec->dirty_rect_coalescing = FROM_JXL_BOOL(enabled);
+  return JXL_DEC_SUCCESS;
+}
+
 namespace {
 // helper function to get the dimensions of the current image buffer
 void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
@@ -1217,6 +1266,108 @@ JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
+// Whether the frame saved for reference by `header` is the composite image.
+bool SavesCompositeImage(const FrameHeader& header) {
+  return header.CanBeReferenced() && !header.save_before_color_transform &&
+         (header.frame_type == FrameType::kRegularFrame ||
+          header.frame_type == FrameType::kSkipProgressive);
+}
+
+// Computes which part of the image must be rendered for the frame whose header
+// was just read, when coalescing with dirty rects.
+void StartDirtyRectFrame(JxlDecoder* dec) {
+  const FrameHeader& header = *dec->frame_header;
+  const Rect image_rect(0, 0, dec->metadata.xsize(), dec->metadata.ysize());
+  Rect frame_rect = image_rect;
+  Rect bg_rect = image_rect;
+  if (NeedsBlending(header)) {
+    frame_rect = dec->frame_dec->FrameRectInImage();
+    bg_rect = dec->slot_dirty_rects[header.blending_info.source];
+    for (const auto& info : header.extra_channel_blending_info) {
+      bg_rect = bg_rect.BoundingBox(dec->slot_dirty_rects[info.source]);
+    }
+  }
+  // Outside of this rect, the composite image is the same as the last one
+  // written to the output buffer.
+  dec->frame_dirty_rect = bg_rect.BoundingBox(frame_rect)
+                              .BoundingBox(dec->pending_dirty_rect)
+                              .Intersection(image_rect);
+  const bool displayed = dec->is_last_of_still && !dec->skipping_frame;
+  dec->frame_render_rect = displayed ? dec->frame_dirty_rect : frame_rect;
+  dec->frame_saved_dirty_rect = SavesCompositeImage(header)
+                                    ? bg_rect.BoundingBox(frame_rect)
+                                    : kWholeImageRect;
+  // Until the frame is finalized, its slot holds an unknown image.
+  if (header.CanBeReferenced()) {
+    dec->slot_dirty_rects[header.save_as_reference] = kWholeImageRect;
+  }
+}
+
+// Updates the dirty rects once the current frame is finalized.
+void FinishDirtyRectFrame(JxlDecoder* dec, bool wrote_output) {
+  const FrameHeader& header = *dec->frame_header;
+  const bool displayed = dec->is_last_of_still && !dec->skipping_frame;
+  if (displayed && wrote_output) {
+    for (Rect& rect : dec->slot_dirty_rects) {
+      rect = rect.BoundingBox(dec->frame_dirty_rect);
+    }
+    dec->pending_dirty_rect = Rect();
+    if (SavesCompositeImage(header)) {
+      dec->slot_dirty_rects[header.save_as_reference] = Rect();
+    }
+    return;
+  }
+  if (header.CanBeReferenced()) {
+    dec->slot_dirty_rects[header.save_as_reference] =
+        dec->frame_saved_dirty_rect;
+  }
+  if (wrote_output) {
+    dec->pending_dirty_rect =
+        dec->pending_dirty_rect.BoundingBox(dec->frame_render_rect);
+  }
+}
+
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+// Copies the contents of the EXIF and XMP boxes into the JPEG data of the
+// reconstructed frame.
+JxlDecoderStatus SetJpegReconMetadata(JxlDecoder* dec) {
+  jxl::jpeg::JPEGData* jpeg_data = dec->ib->jpeg_data.get();
+  if (dec->recon_exif_size) {
+    JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetExif(
+        dec->exif_metadata.data(), dec->exif_metadata.size(), jpeg_data);
+    if (status != JXL_DEC_SUCCESS) return status;
+  }
+  if (dec->recon_xmp_size) {
+    JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetXmp(
+        dec->xmp_metadata.data(), dec->xmp_metadata.size(), jpeg_data);
+    if (status != JXL_DEC_SUCCESS) return status;
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+// Writes the part of the reconstructed JPEG whose coefficients the partially
+// decoded frame already has, so that the first bytes are output before the
+// whole frame is available.
+JxlDecoderStatus WriteCompleteJpegRows(JxlDecoder* dec) {
+  if (dec->preview_frame || !dec->jpeg_decoder.IsOutputSet() ||
+      dec->ib->jpeg_data == nullptr || dec->JbrdNeedMoreBoxes()) {
+    return JXL_DEC_SUCCESS;
+  }
+  const size_t num_rows = dec->frame_dec->NumCompleteRows();
+  const jxl::jpeg::JPEGData& jpeg_data = *dec->ib->jpeg_data;
+  // The last rows are written once the frame is finalized.
+  if (num_rows == 0 || num_rows >= static_cast<size_t>(jpeg_data.height)) {
+    return JXL_DEC_SUCCESS;
+  }
+  JxlDecoderStatus status = SetJpegReconMetadata(dec);
+  if (status != JXL_DEC_SUCCESS) return status;
+  status = dec->jpeg_decoder.WriteOutput(jpeg_data, dec->thread_pool.get(),
+                                         num_rows);
+  if (status == JXL_DEC_NEED_MORE_INPUT) return JXL_DEC_SUCCESS;
+  return status;
+}
+#endif
+
 // TODO(eustas): no CodecInOut -> no image size reinforcement -> possible OOM.
 JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
   // If no parallel runner is set, use the default
@@ -1365,6 +1516,10 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         dec->skipping_frame = false;
       }
 
+      if (dec->coalescing && dec->dirty_rect_coalescing) {
+        StartDirtyRectFrame(dec);
+      }
+
       if (external_frame_index >= dec->frame_external_to_internal.size()) {
         dec->frame_external_to_internal.push_back(internal_frame_index);
         if (dec->frame_external_to_internal.size() !=
@@ -1417,6 +1572,10 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
     if (dec->frame_stage == FrameStage::kTOC) {
       dec->frame_dec->SetRenderSpotcolors(dec->render_spotcolors);
       dec->frame_dec->SetCoalescing(dec->coalescing);
+      if (!dec->preview_frame && dec->coalescing &&
+          dec->dirty_rect_coalescing) {
+        dec->frame_dec->SetDirtyRect(dec->frame_render_rect);
+      }
 
       if (!dec->preview_frame &&
           (dec->events_wanted & JXL_DEC_FRAME_PROGRESSION)) {
@@ -1512,6 +1671,10 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       }
 
       if (!all_sections_done) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+        JxlDecoderStatus status = WriteCompleteJpegRows(dec);
+        if (status != JXL_DEC_SUCCESS) return status;
+#endif
         // Not all sections have been processed yet
         return dec->RequestMoreInput();
       }
@@ -1531,6 +1694,17 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       if (!dec->frame_dec->FinalizeFrame()) {
         return JXL_INPUT_ERROR("decoding frame failed");
       }
+      if (!dec->preview_frame && dec->coalescing &&
+          dec->dirty_rect_coalescing) {
+        if (dec->ib->jpeg_data != nullptr) {
+          // Whether the pixels of recompressed JPEG frames were written
+          // depends on the output that was requested.
+          FinishDirtyRectFrame(dec, /*wrote_output=*/false);
+          dec->pending_dirty_rect = kWholeImageRect;
+        } else {
+          FinishDirtyRectFrame(dec, dec->image_out_buffer_set);
+        }
+      }
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
       // If jpeg output was requested, we merely return the JXL_DEC_FULL_IMAGE
       // status without outputting pixels.
@@ -1760,24 +1934,15 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
     if (dec->recon_output_jpeg == JpegReconStage::kSettingMetadata &&
         !dec->JbrdNeedMoreBoxes()) {
-      jxl::jpeg::JPEGData* jpeg_data = dec->ib->jpeg_data.get();
-      if (dec->recon_exif_size) {
-        JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetExif(
-            dec->exif_metadata.data(), dec->exif_metadata.size(), jpeg_data);
-        if (status != JXL_DEC_SUCCESS) return status;
-      }
-      if (dec->recon_xmp_size) {
-        JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetXmp(
-            dec->xmp_metadata.data(), dec->xmp_metadata.size(), jpeg_data);
-        if (status != JXL_DEC_SUCCESS) return status;
-      }
+      JxlDecoderStatus status = jxl::SetJpegReconMetadata(dec);
+      if (status != JXL_DEC_SUCCESS) return status;
       dec->recon_output_jpeg = JpegReconStage::kOutputting;
     }
 
     if (dec->recon_output_jpeg == JpegReconStage::kOutputting &&
         !dec->JbrdNeedMoreBoxes()) {
-      JxlDecoderStatus status =
-          dec->jpeg_decoder.WriteOutput(*dec->ib->jpeg_data);
+      JxlDecoderStatus status = dec->jpeg_decoder.WriteOutput(
+          *dec->ib->jpeg_data, dec->thread_pool.get());
       if (status != JXL_DEC_SUCCESS) return status;
       dec->recon_output_jpeg = JpegReconStage::kNone;
       dec->ib.reset();
@@ -1887,6 +2052,14 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
           dec->box_contents_unbounded ? 0 : (box_size - header_size);
       dec->box_size = box_size;
       dec->header_size = header_size;
+      dec->box_index.emplace_back();
+      JxlBoxIndexEntry& entry = dec->box_index.back();
+      memcpy(entry.type, dec->box_type, sizeof(entry.type));
+      memcpy(entry.decompressed_type, dec->box_decoded_type,
+             sizeof(entry.decompressed_type));
+      entry.offset = dec->file_pos;
+      entry.header_size = header_size;
+      entry.size = box_size;
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
       if (dec->orig_events_wanted & JXL_DEC_JPEG_RECONSTRUCTION) {
         // Initiate storing of Exif or XMP data for JPEG reconstruction
@@ -1939,6 +2112,13 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
       } else {
         dec->box_stage = BoxStage::kSkip;
       }
+      if ((dec->box_stage == BoxStage::kCodestream ||
+           dec->box_stage == BoxStage::kPartialCodestream) &&
+          !dec->CodestreamWanted()) {
+        // Only boxes were requested: the image data is never parsed.
+        dec->stage = DecoderStage::kCodestreamFinished;
+        dec->box_stage = BoxStage::kSkip;
+      }
 
       if (dec->events_wanted & JXL_DEC_BOX) {
         dec->box_event = true;
@@ -2770,6 +2950,46 @@ JxlDecoderStatus JxlDecoderGetFrameHeader(const JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderGetFrameDirtyRect(const JxlDecoder* dec,
+                                             uint32_t* x0, uint32_t* y0,
+                                             uint32_t* xsize, uint32_t* ysize) {
+  if (!dec->frame_header || dec->frame_stage == FrameStage::kHeader) {
+    return JXL_API_ERROR("no frame header available");
+  }
+  size_t W;
+  size_t H;
+  GetCurrentDimensions(dec, W, H);
+  if (!dec->coalescing || !dec->dirty_rect_coalescing ||
+      dec->frame_header->nonserialized_is_preview) {
+    *x0 = *y0 = 0;
+    *xsize = W;
+    *ysize = H;
+    return JXL_DEC_SUCCESS;
+  }
+  const jxl::Rect& rect = dec->frame_dirty_rect;
+  size_t rx0 = rect.x0();
+  size_t ry0 = rect.y0();
+  size_t rxsize = rect.xsize();
+  size_t rysize = rect.ysize();
+  if (rxsize == 0 || rysize == 0) rx0 = ry0 = rxsize = rysize = 0;
+  const auto& metadata = dec->metadata.m;
+  if (!dec->keep_orientation) {
+    // orient the rect like the crop offset of JxlDecoderGetFrameHeader
+    if (metadata.orientation > 4) {
+      std::swap(rx0, ry0);
+      std::swap(rxsize, rysize);
+    }
+    size_t o = (metadata.orientation - 1) & 3;
+    if (o > 0 && o < 3) rx0 = W - rxsize - rx0;
+    if (o > 1) ry0 = H - rysize - ry0;
+  }
+  *x0 = rx0;
+  *y0 = ry0;
+  *xsize = rxsize;
+  *ysize = rysize;
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderGetExtraChannelBlendInfo(const JxlDecoder* dec,
                                                     size_t index,
                                                     JxlBlendInfo* blend_info) {
@@ -2964,6 +3184,52 @@ JxlDecoderStatus JxlDecoderGetBoxSizeContents(const JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+size_t JxlDecoderGetNumIndexedBoxes(const JxlDecoder* dec) {
+  return dec->box_index.size();
+}
+
+JxlDecoderStatus JxlDecoderGetBoxIndexEntry(const JxlDecoder* dec,
+                                            size_t index,
+                                            JxlBoxIndexEntry* entry) {
+  if (index >= dec->box_index.size()) {
+    return JXL_API_ERROR("box %" PRIuS " not indexed yet", index);
+  }
+  *entry = dec->box_index[index];
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSkipBox(JxlDecoder* dec) {
+  if (!dec->box_event) {
+    return JXL_API_ERROR("can only skip a box after JXL_DEC_BOX event");
+  }
+  if (dec->box_out_buffer_set_current_box) {
+    return JXL_API_ERROR("cannot skip a box after setting its box buffer");
+  }
+  if (dec->box_contents_unbounded) {
+    return JXL_API_ERROR("cannot skip a box that extends until end of file");
+  }
+  bool box_needed = dec->box_stage != BoxStage::kSkip;
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  box_needed = box_needed || dec->store_exif == 1 || dec->store_xmp == 1;
+#endif
+  if (box_needed) {
+    return JXL_API_ERROR("the decoder needs the contents of this box");
+  }
+  // The box header has not been consumed yet, so the box ends `box_size`
+  // bytes after `file_pos`.
+  if (dec->avail_in >= dec->box_size) {
+    dec->AdvanceInput(dec->box_size);
+  } else {
+    dec->next_in += dec->avail_in;
+    dec->avail_in = 0;
+    dec->file_pos += dec->box_size;
+  }
+  dec->header_size = 0;
+  dec->box_stage = BoxStage::kHeader;
+  dec->box_event = false;
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetProgressiveDetail(JxlDecoder* dec,
                                                 JxlProgressiveDetail detail) {
   if (detail != kDC && detail != kLastPasses && detail != kPasses) {
@@ -19,6 +19,7 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -40,11 +41,12 @@
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/override.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
 #include "lib/jxl/cms/color_encoding_cms.h"
 #include "lib/jxl/color_encoding_internal.h"
-#include "lib/jxl/common.h"  // SpeedTier
+#include "lib/jxl/common.h"  // JXL_HIGH_PRECISION, SpeedTier
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/dec_external_image.h"
 #include "lib/jxl/enc_aux_out.h"
@@ -3859,6 +3861,113 @@ TEST(DecodeTest, OrientedCroppedFrameTest) {
   }
 }
 
+TEST(DecodeTest, DirtyRectCoalescingTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  size_t xsize = 90;
+  size_t ysize = 120;
+  constexpr size_t num_frames = 6;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  auto io = jxl::make_unique<jxl::CodecInOut>(memory_manager);
+  ASSERT_TRUE(io->SetSize(xsize, ysize));
+  io->metadata.m.SetUintSamples(16);
+  io->metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io->metadata.m.have_animation = true;
+  io->frames.clear();
+  ASSERT_TRUE(io->SetSize(xsize, ysize));
+
+  // A full first frame followed by frames that only update a small crop.
+  const jxl::Rect crops[num_frames] = {
+      jxl::Rect(0, 0, xsize, ysize), jxl::Rect(10, 20, 16, 8),
+      jxl::Rect(50, 90, 30, 20),     jxl::Rect(12, 24, 16, 8),
+      jxl::Rect(0, 0, 5, 7),         jxl::Rect(70, 0, 20, 120)};
+  for (size_t i = 0; i < num_frames; ++i) {
+    const jxl::Rect& crop = crops[i];
+    std::vector<uint8_t> frame =
+        jxl::test::GetSomeTestImage(crop.xsize(), crop.ysize(), 3, i);
+    jxl::ImageBundle bundle(memory_manager, &io->metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Bytes(frame.data(), frame.size()), crop.xsize(), crop.ysize(),
+        jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*bits_per_sample=*/16, format,
+        /*pool=*/nullptr, &bundle));
+    bundle.origin = {static_cast<int>(crop.x0()), static_cast<int>(crop.y0())};
+    bundle.duration = 1;
+    // Frame 3 is not saved, so frame 4 is blended onto frame 2.
+    bundle.use_for_next_frame = (i != 3);
+    io->frames.push_back(std::move(bundle));
+  }
+
+  jxl::CompressParams cparams;
+  cparams.SetLossless();  // Lossless to verify pixels exactly after roundtrip.
+  cparams.speed_tier = jxl::SpeedTier::kThunder;
+  std::vector<uint8_t> compressed;
+  EXPECT_TRUE(jxl::test::EncodeFile(cparams, io.get(), &compressed));
+
+  // Decode all frames into separate buffers without dirty rects, to compare
+  // with.
+  std::vector<uint8_t> frames[num_frames];
+  {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    for (auto& frame : frames) {
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      frame.resize(xsize * ysize * 6);
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                     dec, &format, frame.data(), frame.size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+  }
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDirtyRectCoalescing(dec, JXL_TRUE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  // A single buffer that keeps the previous frame.
+  std::vector<uint8_t> pixels(xsize * ysize * 6);
+  for (size_t i = 0; i < num_frames; ++i) {
+    EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec));
+    uint32_t x0;
+    uint32_t y0;
+    uint32_t dirty_xsize;
+    uint32_t dirty_ysize;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameDirtyRect(
+                                   dec, &x0, &y0, &dirty_xsize, &dirty_ysize));
+    const jxl::Rect dirty(x0, y0, dirty_xsize, dirty_ysize);
+    // The first frame is rendered in full; frames blended onto the previous
+    // displayed frame only have to render their crop.
+    const jxl::Rect& expected = (i == 4) ? crops[4].BoundingBox(crops[3])
+                                         : crops[i];
+    EXPECT_TRUE(dirty.IsSame(expected)) << "frame " << i;
+
+    // Only the dirty rect may be written.
+    std::vector<uint8_t> previous = pixels;
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                   dec, &format, pixels.data(), pixels.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(0u, jxl::test::ComparePixels(frames[i].data(), pixels.data(),
+                                           xsize, ysize, format, format))
+        << "frame " << i;
+    for (size_t y = 0; y < ysize; ++y) {
+      for (size_t x = 0; x < xsize; ++x) {
+        if (jxl::Rect(x, y, 1, 1).IsInside(dirty)) continue;
+        EXPECT_EQ(0, memcmp(&previous[(y * xsize + x) * 6],
+                            &pixels[(y * xsize + x) * 6], 6));
+      }
+    }
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+}
+
 struct FramePositions {
   size_t frame_start;
   size_t header_end;
@@ -4990,8 +5099,16 @@ TEST_P(DecodeProgressiveTest, ProgressiveEventTest) {
 }
 
 void VerifyJPEGReconstruction(jxl::Span<const uint8_t> container,
-                              jxl::Span<const uint8_t> jpeg_bytes) {
+                              jxl::Span<const uint8_t> jpeg_bytes,
+                              bool use_runner = false) {
   JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  JxlThreadParallelRunnerPtr runner;
+  if (use_runner) {
+    runner = JxlThreadParallelRunnerMake(nullptr, 4);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetParallelRunner(dec.get(), JxlThreadParallelRunner,
+                                          runner.get()));
+  }
   EXPECT_EQ(JXL_DEC_SUCCESS,
             JxlDecoderSubscribeEvents(
                 dec.get(), JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE));
@@ -5036,10 +5153,11 @@ JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructTestCodestream) {
   VerifyJPEGReconstruction(jxl::Bytes(compressed), jxl::Bytes(jpeg_codestream));
 }
 
-JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionTest) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+// Creates a container with a jbrd box and a codestream for the JPEG `orig`.
+void CreateJPEGReconstructionContainer(const std::vector<uint8_t>& orig,
+                                       std::vector<uint8_t>* container) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
-  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
-  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
   auto orig_io = jxl::make_unique<jxl::CodecInOut>(memory_manager);
   JXL_TEST_ASSIGN_OR_DIE(std::unique_ptr<jxl::jpeg::JPEGData> jpeg_data,
                          jxl::jpeg::ParseJPG(memory_manager, jxl::Bytes(orig)));
@@ -5061,14 +5179,132 @@ JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionTest) {
   std::vector<uint8_t> encoded_jpeg_data;
   ASSERT_TRUE(EncodeJPEGData(memory_manager, jpeg_data_copy, &encoded_jpeg_data,
                              cparams));
-  std::vector<uint8_t> container = jxl::MakeContainerHeader(0);
+  *container = jxl::MakeContainerHeader(0);
   jxl::AppendBoxHeader(jxl::MakeBoxType("jbrd"), encoded_jpeg_data.size(),
-                       false, &container);
-  jxl::Bytes(encoded_jpeg_data).AppendTo(container);
-  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, &container);
+                       false, container);
+  jxl::Bytes(encoded_jpeg_data).AppendTo(*container);
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, container);
   jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
-  jxl::Bytes(codestream).AppendTo(container);
+  jxl::Bytes(codestream).AppendTo(*container);
+}
+#endif
+
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionTest) {
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  std::vector<uint8_t> container;
+  ASSERT_NO_FATAL_FAILURE(CreateJPEGReconstructionContainer(orig, &container));
   VerifyJPEGReconstruction(jxl::Bytes(container), jxl::Bytes(orig));
+  // Large enough for the scans to be encoded in parallel.
+  VerifyJPEGReconstruction(jxl::Bytes(container), jxl::Bytes(orig),
+                           /*use_runner=*/true);
+}
+
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionRestartIntervalTest) {
+  TEST_LIBJPEG_SUPPORT();
+  // With restart markers, the sequential scans are split at restart
+  // boundaries; 37 MCUs do not divide the MCU rows.
+  for (uint32_t restart_interval : {1, 37}) {
+    SCOPED_TRACE(testing::Message()
+                 << "restart_interval: " << restart_interval);
+    JXL_TEST_ASSIGN_OR_DIE(
+        std::vector<uint8_t> orig,
+        jxl::test::EncodeTestJpeg("jxl/flower/flower.png", restart_interval,
+                                  /*progressive=*/false));
+    std::vector<uint8_t> container;
+    ASSERT_NO_FATAL_FAILURE(
+        CreateJPEGReconstructionContainer(orig, &container));
+    VerifyJPEGReconstruction(jxl::Bytes(container), jxl::Bytes(orig));
+    VerifyJPEGReconstruction(jxl::Bytes(container), jxl::Bytes(orig),
+                             /*use_runner=*/true);
+  }
+}
+
+#if !JXL_HIGH_PRECISION
+// 8-bit RGB(A) output of a YCbCr JPEG goes through the fused YCbCr to RGB8
+// stage, which must match the generic path up to rounding.
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGFastYCbCrToRGB8Test) {
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  std::vector<uint8_t> container;
+  ASSERT_NO_FATAL_FAILURE(CreateJPEGReconstructionContainer(orig, &container));
+
+  for (uint32_t num_channels : {3, 4}) {
+    JxlPixelFormat format_float = {num_channels, JXL_TYPE_FLOAT,
+                                   JXL_LITTLE_ENDIAN, 0};
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Bytes(container), format_float, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    JxlPixelFormat format_u8 = {num_channels, JXL_TYPE_UINT8,
+                                JXL_LITTLE_ENDIAN, 0};
+    std::vector<uint8_t> pixels = jxl::DecodeWithAPI(
+        jxl::Bytes(container), format_u8, /*use_callback=*/false,
+        /*set_buffer_early=*/true, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    ASSERT_EQ(expected.size(), pixels.size() * sizeof(float));
+    const float* expected_float =
+        reinterpret_cast<const float*>(expected.data());
+    int max_diff = 0;
+    for (size_t i = 0; i < pixels.size(); i++) {
+      const float v = std::min(std::max(expected_float[i], 0.0f), 1.0f);
+      const int rounded = static_cast<int>(std::lround(v * 255.0f));
+      max_diff = std::max(max_diff, std::abs(rounded - pixels[i]));
+    }
+    EXPECT_LE(max_diff, 1);
+  }
+}
+#endif  // !JXL_HIGH_PRECISION
+
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionStreamingTest) {
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  std::vector<uint8_t> container;
+  ASSERT_NO_FATAL_FAILURE(CreateJPEGReconstructionContainer(orig, &container));
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec.get(), JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE));
+  // Both the input and the output go through small buffers.
+  const size_t kInputStep = 65536;
+  std::vector<uint8_t> output(4096);
+  std::vector<uint8_t> reconstructed;
+  size_t input_end = 0;
+  size_t input_end_at_first_output = 0;
+  const uint8_t* next_in = container.data();
+  size_t avail_in = 0;
+  for (;;) {
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec.get(), next_in, avail_in));
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    size_t remaining = JxlDecoderReleaseInput(dec.get());
+    next_in += avail_in - remaining;
+    avail_in = remaining;
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      ASSERT_LT(input_end, container.size());
+      size_t step = std::min(kInputStep, container.size() - input_end);
+      input_end += step;
+      avail_in += step;
+    } else if (status == JXL_DEC_JPEG_RECONSTRUCTION) {
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetJPEGBuffer(
+                                     dec.get(), output.data(), output.size()));
+    } else if (status == JXL_DEC_JPEG_NEED_MORE_OUTPUT ||
+               status == JXL_DEC_FULL_IMAGE) {
+      size_t used = output.size() - JxlDecoderReleaseJPEGBuffer(dec.get());
+      if (reconstructed.empty()) input_end_at_first_output = input_end;
+      reconstructed.insert(reconstructed.end(), output.data(),
+                           output.data() + used);
+      if (status == JXL_DEC_FULL_IMAGE) break;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetJPEGBuffer(
+                                     dec.get(), output.data(), output.size()));
+    } else {
+      FAIL() << "Unexpected status " << status;
+    }
+  }
+  EXPECT_EQ(reconstructed, orig);
+  // The JPEG is output while the frame is still decoding.
+  EXPECT_LT(input_end_at_first_output, container.size());
 }
 
 JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionMetadataTest) {
@@ -5259,6 +5495,74 @@ JXL_BOXES_TEST(DecodeTest, BoxTest) {
   JxlDecoderDestroy(dec);
 }
 
+JXL_BOXES_TEST(DecodeTest, BoxIndexRandomAccessTest) {
+  size_t xsize = 1;
+  size_t ysize = 1;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  jxl::TestCodestreamParams params;
+  params.box_format = kCSBF_Brob_Exif;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSubscribeEvents(dec, JXL_DEC_BOX));
+
+  // Simulate random access by only giving the decoder a small window of the
+  // file at `pos`, and seeking over every box that can be skipped.
+  constexpr size_t kWindow = 64;
+  size_t pos = 0;
+  bool seen_exif = false;
+  for (;;) {
+    size_t avail = std::min(compressed.size() - pos, kWindow);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data() + pos, avail));
+    if (pos + avail == compressed.size()) JxlDecoderCloseInput(dec);
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_SUCCESS) break;
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      pos += avail - JxlDecoderReleaseInput(dec);
+      continue;
+    }
+    ASSERT_EQ(JXL_DEC_BOX, status);
+    size_t num_boxes = JxlDecoderGetNumIndexedBoxes(dec);
+    ASSERT_GT(num_boxes, 0u);
+    JxlBoxIndexEntry entry;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetBoxIndexEntry(dec, num_boxes - 1, &entry));
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderGetBoxIndexEntry(dec, num_boxes, &entry));
+    if (BoxTypeEquals("brob", entry.type)) {
+      EXPECT_TRUE(BoxTypeEquals("Exif", entry.decompressed_type));
+      seen_exif = true;
+    }
+    if (BoxTypeEquals("ftyp", entry.type)) {
+      // The decoder needs the file type box.
+      EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSkipBox(dec));
+      pos += avail - JxlDecoderReleaseInput(dec);
+      EXPECT_EQ(entry.offset, pos);
+      continue;
+    }
+    ASSERT_NE(0u, entry.size);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSkipBox(dec));
+    JxlDecoderReleaseInput(dec);
+    pos = entry.offset + entry.size;
+  }
+  EXPECT_TRUE(seen_exif);
+  EXPECT_EQ(compressed.size(), pos);
+
+  size_t num_boxes = JxlDecoderGetNumIndexedBoxes(dec);
+  uint64_t expected_offset = 0;
+  for (size_t i = 0; i < num_boxes; ++i) {
+    JxlBoxIndexEntry entry;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetBoxIndexEntry(dec, i, &entry));
+    EXPECT_EQ(expected_offset, entry.offset);
+    expected_offset += entry.size;
+  }
+  EXPECT_EQ(compressed.size(), expected_offset);
+
+  JxlDecoderDestroy(dec);
+}
+
 JXL_BOXES_TEST(DecodeTest, ExifBrobBoxTest) {
   size_t xsize = 1;
   size_t ysize = 1;
@@ -16,16 +16,20 @@
 
 #include <algorithm>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <utility>
 #include <vector>
 
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"  // JPEGXL_ENABLE_TRANSCODE_JPEG
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
 #include "lib/jxl/jpeg/dec_jpeg_data_writer.h"
+#include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
 #endif  // JPEGXL_ENABLE_TRANSCODE_JPEG
 
 namespace jxl {
@@ -113,31 +117,42 @@ class JxlToJpegDecoder {
         return false;
       }
       ib->jpeg_data = std::move(jpeg_data_);
+      write_state_.reset();
     }
     return true;
   }
 
-  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& jpeg_data) {
-    // Copy JPEG bytestream if desired.
-    uint8_t* tmp_next_out = next_out_;
-    size_t tmp_avail_size = avail_size_;
-    auto write = [&tmp_next_out, &tmp_avail_size](const uint8_t* buf,
-                                                  size_t len) {
-      size_t to_write = std::min<size_t>(tmp_avail_size, len);
-      if (to_write != 0) memcpy(tmp_next_out, buf, to_write);
-      tmp_next_out += to_write;
-      tmp_avail_size -= to_write;
+  // Writes the reconstructed JPEG to the output buffer, continuing where the
+  // previous call stopped. Scans are only written up to the first
+  // `num_available_rows` rows of the image; sequential scans are encoded on
+  // `pool`, if not null. Returns JXL_DEC_SUCCESS once the whole JPEG is
+  // written, JXL_DEC_JPEG_NEED_MORE_OUTPUT if the output buffer is full and
+  // JXL_DEC_NEED_MORE_INPUT if more rows are needed.
+  JxlDecoderStatus WriteOutput(
+      const jpeg::JPEGData& jpeg_data, ThreadPool* pool,
+      size_t num_available_rows = std::numeric_limits<size_t>::max()) {
+    if (!write_state_) {
+      write_state_ = jxl::make_unique<jpeg::SerializationState>();
+    }
+    write_state_->pool = pool;
+    write_state_->num_available_rows = num_available_rows;
+    auto write = [this](const uint8_t* buf, size_t len) {
+      size_t to_write = std::min<size_t>(avail_size_, len);
+      if (to_write != 0) memcpy(next_out_, buf, to_write);
+      next_out_ += to_write;
+      avail_size_ -= to_write;
       return to_write;
     };
-    Status write_result = jpeg::WriteJpeg(jpeg_data, write);
+    Status write_result =
+        jpeg::WriteJpegIncrementally(jpeg_data, write, write_state_.get());
     if (!write_result) {
-      if (tmp_avail_size == 0) {
-        return JXL_DEC_JPEG_NEED_MORE_OUTPUT;
+      if (write_result.code() != StatusCode::kNotEnoughBytes) {
+        return JXL_DEC_ERROR;
       }
-      return JXL_DEC_ERROR;
+      if (avail_size_ == 0) return JXL_DEC_JPEG_NEED_MORE_OUTPUT;
+      return JXL_DEC_NEED_MORE_INPUT;
     }
-    next_out_ = tmp_next_out;
-    avail_size_ = tmp_avail_size;
+    write_state_.reset();
     return JXL_DEC_SUCCESS;
   }
 
@@ -163,6 +178,9 @@ class JxlToJpegDecoder {
   uint8_t* next_out_ = nullptr;
   // Available bytes to write JPEG reconstruction to.
   size_t avail_size_ = 0;
+
+  // State of the JPEG writer between calls to WriteOutput.
+  std::unique_ptr<jpeg::SerializationState> write_state_;
 };
 
 #else
@@ -208,7 +226,9 @@ class JxlToJpegDecoder {
     return JXL_DEC_ERROR;
   }
 
-  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& /* jpeg_data */) {
+  JxlDecoderStatus WriteOutput(
+      const jpeg::JPEGData& /* jpeg_data */, ThreadPool* /* pool */,
+      size_t /* num_available_rows */ = std::numeric_limits<size_t>::max()) {
     return JXL_DEC_SUCCESS;
   }
 };
@@ -296,6 +296,8 @@ using hwy::HWY_NAMESPACE::AbsDiff;
 using hwy::HWY_NAMESPACE::Eq;
 using hwy::HWY_NAMESPACE::IfThenElseZero;
 using hwy::HWY_NAMESPACE::IfThenZeroElse;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::Min;
 using hwy::HWY_NAMESPACE::Round;
 using hwy::HWY_NAMESPACE::Sqrt;
 
@@ -361,22 +363,28 @@ bool MultiBlockTransformCrossesVerticalBoundary(
   return false;
 }
 
+// Sets `entropy` to the estimated cost of coding the transform `acs` at pixel
+// (x, y). Candidates whose cost is at least `max_entropy` are rejected by the
+// callers anyway, so their estimation stops early, after the Y or X channel,
+// and sets `entropy` to the largest float.
 Status EstimateEntropy(const AcStrategy& acs, float entropy_mul, size_t x,
                        size_t y, const ACSConfig& config,
                        const float* JXL_RESTRICT cmap_factors, float* block,
                        float* full_scratch_space, uint32_t* quantized,
-                       float& entropy) {
+                       float max_entropy, float& entropy) {
   entropy = 0.0f;
   float* mem = full_scratch_space;
   float* scratch_space = full_scratch_space + AcStrategy::kMaxCoeffArea;
   const size_t size = (1 << acs.log2_covered_blocks()) * kDCTBlockSize;
 
-  // Apply transform.
-  for (size_t c = 0; c < 3; c++) {
+  // Apply transform. Y is needed by all channels, X and B are only transformed
+  // when they are reached.
+  const auto transform = [&](size_t c) {
     float* JXL_RESTRICT block_c = block + size * c;
     TransformFromPixels(acs.Strategy(), &config.Pixel(c, x, y),
                         config.src_stride, block_c, scratch_space);
-  }
+  };
+  transform(1);
   HWY_FULL(float) df;
 
   const size_t num_blocks = acs.covered_blocks_x() * acs.covered_blocks_y();
@@ -417,8 +425,48 @@ Status EstimateEntropy(const AcStrategy& acs, float entropy_mul, size_t x,
   // Compute entropy.
   const HWY_CAPPED(float, 8) df8;
 
-  auto loss = Zero(df8);
-  for (size_t c = 0; c < 3; c++) {
+  // Multi-block transforms are penalized for their X (red-green) channel,
+  // where we often see ringing.
+  const float x_weight = 1.0 + std::min(3.0, num_blocks / 8.0);
+
+  // Per-channel sums of the cost terms and loss, zero for the channels that are
+  // not processed yet.
+  float coeff_cost[3] = {};
+  size_t num_nzeros_cost[3] = {};
+  HWY_ALIGN float channel_loss[3][8] = {};
+
+  // Combines the entropy and the loss of the channels processed so far, in
+  // X, Y, B order so that the rounding does not depend on the order in which
+  // channels are processed. All terms are non-negative, so this never exceeds
+  // the final estimate.
+  const auto total = [&]() {
+    float entropy_sum = 0.0f;
+    auto loss = Zero(df8);
+    for (size_t c = 0; c < 3; c++) {
+      entropy_sum += config.cost_delta * coeff_cost[c];
+      entropy_sum += config.zeros_mul * num_nzeros_cost[c];
+      loss = Add(loss, Load(df8, channel_loss[c]));
+      if (c == 0 && num_blocks >= 2) {
+        entropy_sum *= x_weight;
+        loss = Mul(loss, Set(df8, x_weight));
+      }
+    }
+    float loss_scalar =
+        pow(GetLane(SumOfLanes(df8, loss)) / (num_blocks * kDCTBlockSize),
+            1.0f / 8.0f) *
+        (num_blocks * kDCTBlockSize) / quant_norm16;
+    float result = entropy_sum;
+    result *= entropy_mul;
+    result += config.info_loss_multiplier * loss_scalar;
+    return result;
+  };
+
+  // Y is scored first: it is already transformed, and usually carries most of
+  // the cost, so that hopeless candidates are rejected early.
+  static constexpr size_t kChannelOrder[3] = {1, 0, 2};
+  for (size_t i = 0; i < 3; i++) {
+    const size_t c = kChannelOrder[i];
+    if (c != 1) transform(c);
     const float* inv_matrix = config.dequant->InvMatrix(acs.Strategy(), c);
     const float* matrix = config.dequant->Matrix(acs.Strategy(), c);
     const auto cmap_factor = Set(df, cmap_factors[c]);
@@ -483,30 +531,22 @@ Status EstimateEntropy(const AcStrategy& acs, float entropy_mul, size_t x,
           pow(1.03, 8.0),
       };
       lossc = Mul(Set(df8, kChannelMul[c]), lossc);
-      loss = Add(loss, lossc);
+      Store(lossc, df8, channel_loss[c]);
     }
-    entropy += config.cost_delta * GetLane(SumOfLanes(df, entropy_v));
+    coeff_cost[c] = GetLane(SumOfLanes(df, entropy_v));
     size_t num_nzeros = GetLane(SumOfLanes(df, nzeros_v));
     // Add #bit of num_nonzeros, as an estimate of the cost for encoding the
     // number of non-zeros of the block.
     size_t nbits = CeilLog2Nonzero(num_nzeros + 1) + 1;
     // Also add #bit of #bit of num_nonzeros, to estimate the ANS cost, with a
     // bias.
-    entropy += config.zeros_mul * (CeilLog2Nonzero(nbits + 17) + nbits);
-    if (c == 0 && num_blocks >= 2) {
-      // It is X channel (red-green) and we often see ringing
-      // in the large blocks. Let's punish that more here.
-      float w = 1.0 + std::min(3.0, num_blocks / 8.0);
-      entropy *= w;
-      loss = Mul(loss, Set(df8, w));
+    num_nzeros_cost[c] = CeilLog2Nonzero(nbits + 17) + nbits;
+    if (i < 2 && total() >= max_entropy) {
+      entropy = std::numeric_limits<float>::max();
+      return true;
     }
   }
-  float loss_scalar =
-      pow(GetLane(SumOfLanes(df8, loss)) / (num_blocks * kDCTBlockSize),
-          1.0f / 8.0f) *
-      (num_blocks * kDCTBlockSize) / quant_norm16;
-  entropy *= entropy_mul;
-  entropy += config.info_loss_multiplier * loss_scalar;
+  entropy = total();
   return true;
 }
 
@@ -600,9 +640,9 @@ Status FindBest8x8Transform(size_t x, size_t y, int encoding_speed_tier,
       entropy_mul += kAvoidEntropyOfTransforms * mul;
     }
     float entropy;
-    JXL_RETURN_IF_ERROR(EstimateEntropy(acs, entropy_mul, x, y, config,
-                                        cmap_factors, block, scratch_space,
-                                        quantized, entropy));
+    JXL_RETURN_IF_ERROR(EstimateEntropy(
+        acs, entropy_mul, x, y, config, cmap_factors, block, scratch_space,
+        quantized, static_cast<float>(best), entropy));
     if (entropy < best) {
       best_tx = tx.type;
       best = entropy;
@@ -612,6 +652,52 @@ Status FindBest8x8Transform(size_t x, size_t y, int encoding_speed_tier,
   return true;
 }
 
+// Entropy estimates of the multi-block transforms tried in one rect, indexed
+// by strategy and by the upper left 8x8 block within the rect. The merge
+// passes try many candidates more than once, for example a DCT16X8 both as the
+// right half of one square and as the left half of the next one.
+struct EntropyCache {
+  struct Entry {
+    bool valid;
+    // If false, `entropy` is only a lower bound of the estimate.
+    bool exact;
+    float entropy_mul;
+    float entropy;
+  };
+  Entry entries[AcStrategy::kNumValidStrategies][64];
+};
+
+// Same as EstimateEntropy for the transform at block (cx, cy) of the rect at
+// block (bx, by), reusing the estimates in `cache`.
+Status EstimateEntropyCached(const AcStrategy& acs, float entropy_mul,
+                             size_t bx, size_t by, size_t cx, size_t cy,
+                             const ACSConfig& config,
+                             const float* JXL_RESTRICT cmap_factors,
+                             float* block, float* scratch_space,
+                             uint32_t* quantized, float max_entropy,
+                             EntropyCache* cache, float& entropy) {
+  EntropyCache::Entry& entry = cache->entries[acs.RawStrategy()][cy * 8 + cx];
+  if (entry.valid && entry.entropy_mul == entropy_mul) {
+    if (entry.exact) {
+      entropy = entry.entropy;
+      return true;
+    }
+    if (entry.entropy >= max_entropy) {
+      entropy = std::numeric_limits<float>::max();
+      return true;
+    }
+  }
+  JXL_RETURN_IF_ERROR(EstimateEntropy(acs, entropy_mul, (bx + cx) * 8,
+                                      (by + cy) * 8, config, cmap_factors,
+                                      block, scratch_space, quantized,
+                                      max_entropy, entropy));
+  entry.valid = true;
+  entry.exact = entropy != std::numeric_limits<float>::max();
+  entry.entropy_mul = entropy_mul;
+  entry.entropy = entry.exact ? entropy : max_entropy;
+  return true;
+}
+
 // bx, by addresses the 64x64 block at 8x8 subresolution
 // cx, cy addresses the left, upper 8x8 block position of the candidate
 // transform.
@@ -621,7 +707,8 @@ Status TryMergeAcs(AcStrategyType acs_raw, size_t bx, size_t by, size_t cx,
                    AcStrategyImage* JXL_RESTRICT ac_strategy,
                    const float entropy_mul, const uint8_t candidate_priority,
                    uint8_t* priority, float* JXL_RESTRICT entropy_estimate,
-                   float* block, float* scratch_space, uint32_t* quantized) {
+                   float* block, float* scratch_space, uint32_t* quantized,
+                   EntropyCache* cache) {
   AcStrategy acs = AcStrategy::FromRawStrategy(acs_raw);
   float entropy_current = 0;
   for (size_t iy = 0; iy < acs.covered_blocks_y(); ++iy) {
@@ -636,9 +723,9 @@ Status TryMergeAcs(AcStrategyType acs_raw, size_t bx, size_t by, size_t cx,
     }
   }
   float entropy_candidate;
-  JXL_RETURN_IF_ERROR(EstimateEntropy(
-      acs, entropy_mul, (bx + cx) * 8, (by + cy) * 8, config, cmap_factors,
-      block, scratch_space, quantized, entropy_candidate));
+  JXL_RETURN_IF_ERROR(EstimateEntropyCached(
+      acs, entropy_mul, bx, by, cx, cy, config, cmap_factors, block,
+      scratch_space, quantized, entropy_current, cache, entropy_candidate));
   if (entropy_candidate >= entropy_current) return true;
   // Accept the candidate.
   for (size_t iy = 0; iy < acs.covered_blocks_y(); iy++) {
@@ -705,7 +792,8 @@ Status FindBestFirstLevelDivisionForSquare(
     size_t cy, const ACSConfig& config, const float* JXL_RESTRICT cmap_factors,
     AcStrategyImage* JXL_RESTRICT ac_strategy, const float entropy_mul_JXK,
     const float entropy_mul_JXJ, float* JXL_RESTRICT entropy_estimate,
-    float* block, float* scratch_space, uint32_t* quantized) {
+    float* block, float* scratch_space, uint32_t* quantized,
+    EntropyCache* cache) {
   // We denote J for the larger dimension here, and K for the smaller.
   // For example, for 32x32 block splitting, J would be 32, K 16.
   const size_t blocks_half = blocks / 2;
@@ -752,69 +840,76 @@ Status FindBestFirstLevelDivisionForSquare(
   float entropy_KXJ_top = std::numeric_limits<float>::max();
   float entropy_KXJ_bottom = std::numeric_limits<float>::max();
   float entropy_JXJ = std::numeric_limits<float>::max();
+  // Candidates that cannot beat the blocks they would replace are pruned, their
+  // estimate then stays at the largest float.
+  const float entropy_left = entropy[0][0] + entropy[1][0];
+  const float entropy_right = entropy[0][1] + entropy[1][1];
+  const float entropy_top = entropy[0][0] + entropy[0][1];
+  const float entropy_bottom = entropy[1][0] + entropy[1][1];
   if (allow_JXK) {
     if (row0[bx + cx + 0].Strategy() != acs_rawJXK) {
-      JXL_RETURN_IF_ERROR(EstimateEntropy(
-          acsJXK, entropy_mul_JXK, (bx + cx + 0) * 8, (by + cy + 0) * 8, config,
-          cmap_factors, block, scratch_space, quantized, entropy_JXK_left));
+      JXL_RETURN_IF_ERROR(EstimateEntropyCached(
+          acsJXK, entropy_mul_JXK, bx, by, cx, cy, config, cmap_factors, block,
+          scratch_space, quantized, entropy_left, cache, entropy_JXK_left));
     }
     if (row0[bx + cx + blocks_half].Strategy() != acs_rawJXK) {
-      JXL_RETURN_IF_ERROR(
-          EstimateEntropy(acsJXK, entropy_mul_JXK, (bx + cx + blocks_half) * 8,
-                          (by + cy + 0) * 8, config, cmap_factors, block,
-                          scratch_space, quantized, entropy_JXK_right));
+      JXL_RETURN_IF_ERROR(EstimateEntropyCached(
+          acsJXK, entropy_mul_JXK, bx, by, cx + blocks_half, cy, config,
+          cmap_factors, block, scratch_space, quantized, entropy_right, cache,
+          entropy_JXK_right));
     }
   }
   if (allow_KXJ) {
     if (row0[bx + cx].Strategy() != acs_rawKXJ) {
-      JXL_RETURN_IF_ERROR(EstimateEntropy(
-          acsKXJ, entropy_mul_JXK, (bx + cx + 0) * 8, (by + cy + 0) * 8, config,
-          cmap_factors, block, scratch_space, quantized, entropy_KXJ_top));
+      JXL_RETURN_IF_ERROR(EstimateEntropyCached(
+          acsKXJ, entropy_mul_JXK, bx, by, cx, cy, config, cmap_factors, block,
+          scratch_space, quantized, entropy_top, cache, entropy_KXJ_top));
     }
     if (row1[bx + cx].Strategy() != acs_rawKXJ) {
-      JXL_RETURN_IF_ERROR(
-          EstimateEntropy(acsKXJ, entropy_mul_JXK, (bx + cx + 0) * 8,
-                          (by + cy + blocks_half) * 8, config, cmap_factors,
-                          block, scratch_space, quantized, entropy_KXJ_bottom));
+      JXL_RETURN_IF_ERROR(EstimateEntropyCached(
+          acsKXJ, entropy_mul_JXK, bx, by, cx, cy + blocks_half, config,
+          cmap_factors, block, scratch_space, quantized, entropy_bottom, cache,
+          entropy_KXJ_bottom));
     }
   }
+
+  // Test if this block should have JXK or KXJ transforms,
+  // because it can have only one or the other.
+  float costJxN = std::min(entropy_JXK_left, entropy_left) +
+                  std::min(entropy_JXK_right, entropy_right);
+  float costNxJ = std::min(entropy_KXJ_top, entropy_top) +
+                  std::min(entropy_KXJ_bottom, entropy_bottom);
   if (allow_square_transform) {
     // We control the exploration of the square transform separately so that
     // we can turn it off at high decoding speeds for 32x32, but still allow
     // exploring 16x32 and 32x16.
-    JXL_RETURN_IF_ERROR(EstimateEntropy(
-        acsJXJ, entropy_mul_JXJ, (bx + cx + 0) * 8, (by + cy + 0) * 8, config,
-        cmap_factors, block, scratch_space, quantized, entropy_JXJ));
+    JXL_RETURN_IF_ERROR(EstimateEntropyCached(
+        acsJXJ, entropy_mul_JXJ, bx, by, cx, cy, config, cmap_factors, block,
+        scratch_space, quantized, std::min(costJxN, costNxJ), cache,
+        entropy_JXJ));
   }
-
-  // Test if this block should have JXK or KXJ transforms,
-  // because it can have only one or the other.
-  float costJxN = std::min(entropy_JXK_left, entropy[0][0] + entropy[1][0]) +
-                  std::min(entropy_JXK_right, entropy[0][1] + entropy[1][1]);
-  float costNxJ = std::min(entropy_KXJ_top, entropy[0][0] + entropy[0][1]) +
-                  std::min(entropy_KXJ_bottom, entropy[1][0] + entropy[1][1]);
   if (entropy_JXJ < costJxN && entropy_JXJ < costNxJ) {
     JXL_RETURN_IF_ERROR(ac_strategy->Set(bx + cx, by + cy, acs_rawJXJ));
     SetEntropyForTransform(cx, cy, acs_rawJXJ, entropy_JXJ, entropy_estimate);
   } else if (costJxN < costNxJ) {
-    if (entropy_JXK_left < entropy[0][0] + entropy[1][0]) {
+    if (entropy_JXK_left < entropy_left) {
       JXL_RETURN_IF_ERROR(ac_strategy->Set(bx + cx, by + cy, acs_rawJXK));
       SetEntropyForTransform(cx, cy, acs_rawJXK, entropy_JXK_left,
                              entropy_estimate);
     }
-    if (entropy_JXK_right < entropy[0][1] + entropy[1][1]) {
+    if (entropy_JXK_right < entropy_right) {
       JXL_RETURN_IF_ERROR(
           ac_strategy->Set(bx + cx + blocks_half, by + cy, acs_rawJXK));
       SetEntropyForTransform(cx + blocks_half, cy, acs_rawJXK,
                              entropy_JXK_right, entropy_estimate);
     }
   } else {
-    if (entropy_KXJ_top < entropy[0][0] + entropy[0][1]) {
+    if (entropy_KXJ_top < entropy_top) {
       JXL_RETURN_IF_ERROR(ac_strategy->Set(bx + cx, by + cy, acs_rawKXJ));
       SetEntropyForTransform(cx, cy, acs_rawKXJ, entropy_KXJ_top,
                              entropy_estimate);
     }
-    if (entropy_KXJ_bottom < entropy[1][0] + entropy[1][1]) {
+    if (entropy_KXJ_bottom < entropy_bottom) {
       JXL_RETURN_IF_ERROR(
           ac_strategy->Set(bx + cx, by + cy + blocks_half, acs_rawKXJ));
       SetEntropyForTransform(cx, cy + blocks_half, acs_rawKXJ,
@@ -933,6 +1028,7 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
   // Priority is a tricky kludge to avoid collisions so that transforms
   // don't overlap.
   uint8_t priority[64] = {};
+  EntropyCache cache = {};
   bool enable_32x32 = cparams.decoding_speed_tier < 4;
   for (auto mt : kTransformsForMerge) {
     if (mt.decoding_speed_tier_max_limit < cparams.decoding_speed_tier) {
@@ -952,7 +1048,7 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
               JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
                   8, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
                   mt.entropy_mul, entropy_mul64X64, entropy_estimate, block,
-                  scratch_space, quantized));
+                  scratch_space, quantized, &cache));
             }
             continue;
           } else if (mt.type == AcStrategyType::DCT32X16) {
@@ -976,7 +1072,7 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
               JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
                   4, enable_32x32, bx, by, cx, cy, config, cmap_factors,
                   ac_strategy, mt.entropy_mul, entropy_mul32X32,
-                  entropy_estimate, block, scratch_space, quantized));
+                  entropy_estimate, block, scratch_space, quantized, &cache));
             }
             continue;
           } else if (mt.type == AcStrategyType::DCT32X16) {
@@ -999,7 +1095,7 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
               JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
                   2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
                   mt.entropy_mul, entropy_mul16X16, entropy_estimate, block,
-                  scratch_space, quantized));
+                  scratch_space, quantized, &cache));
             }
             continue;
           } else if (mt.type == AcStrategyType::DCT16X8) {
@@ -1020,10 +1116,10 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
         // when there is an odd number of 8x8 blocks, then the last row
         // and column will get their DCT16X8s and DCT8X16s through the
         // normal integral transform merging process.
-        JXL_RETURN_IF_ERROR(
-            TryMergeAcs(mt.type, bx, by, cx, cy, config, cmap_factors,
-                        ac_strategy, mt.entropy_mul, mt.priority, &priority[0],
-                        entropy_estimate, block, scratch_space, quantized));
+        JXL_RETURN_IF_ERROR(TryMergeAcs(
+            mt.type, bx, by, cx, cy, config, cmap_factors, ac_strategy,
+            mt.entropy_mul, mt.priority, &priority[0], entropy_estimate, block,
+            scratch_space, quantized, &cache));
       }
     }
   }
@@ -1038,7 +1134,7 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
         JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
             2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
             entropy_mul16X8, entropy_mul16X16, entropy_estimate, block,
-            scratch_space, quantized));
+            scratch_space, quantized, &cache));
       }
     }
   }
@@ -1052,7 +1148,36 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
       JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
           4, enable_32x32, bx, by, cx, cy, config, cmap_factors, ac_strategy,
           entropy_mul16X32, entropy_mul32X32, entropy_estimate, block,
-          scratch_space, quantized));
+          scratch_space, quantized, &cache));
+    }
+  }
+  return true;
+}
+
+// Returns true if, for each channel c, the pixels of `rect` (in blocks) vary by
+// at most max_range[c].
+bool IsFlatRect(const ACSConfig& config, const Rect& rect,
+                const float* JXL_RESTRICT max_range) {
+  const HWY_CAPPED(float, 8) df;
+  const size_t x0 = rect.x0() * kBlockDim;
+  const size_t x1 = rect.x1() * kBlockDim;
+  const size_t y0 = rect.y0() * kBlockDim;
+  const size_t y1 = rect.y1() * kBlockDim;
+  for (size_t c = 0; c < 3; c++) {
+    auto min = Set(df, config.Pixel(c, x0, y0));
+    auto max = min;
+    for (size_t y = y0; y < y1; y++) {
+      const float* JXL_RESTRICT row = &config.Pixel(c, 0, y);
+      for (size_t x = x0; x < x1; x += Lanes(df)) {
+        const auto v = LoadU(df, row + x);
+        min = Min(min, v);
+        max = Max(max, v);
+      }
+      // Most rects are not flat, so give up as early as possible.
+      if (GetLane(MaxOfLanes(df, max)) - GetLane(MinOfLanes(df, min)) >
+          max_range[c]) {
+        return false;
+      }
     }
   }
   return true;
@@ -1066,6 +1191,7 @@ HWY_AFTER_NAMESPACE();
 #if HWY_ONCE
 namespace jxl {
 HWY_EXPORT(ProcessRectACS);
+HWY_EXPORT(IsFlatRect);
 
 Status AcStrategyHeuristics::Init(const Image3F& src, const Rect& rect_in,
                                   const ImageF& quant_field, const ImageF& mask,
@@ -1121,6 +1247,14 @@ Status AcStrategyHeuristics::Init(const Image3F& src, const Rect& rect_in,
   config.info_loss_multiplier *= std::pow(ratio, kPow1);
   config.zeros_mul *= std::pow(ratio, kPow2);
   config.cost_delta *= std::pow(ratio, kPow3);
+
+  // Well below the X, Y and B difference of neighbouring 8-bit sRGB values
+  // near white, and of the smallest nonzero AC quantization step.
+  static const float kMaxFlatRange[3] = {2e-5f, 2e-4f, 2e-4f};
+  const float flat_mul = std::min(cparams.butteraugli_distance, 1.0f);
+  for (size_t c = 0; c < 3; c++) {
+    max_flat_range[c] = kMaxFlatRange[c] * flat_mul;
+  }
   return true;
 }
 
@@ -1151,6 +1285,52 @@ Status AcStrategyHeuristics::ProcessRect(const Rect& rect,
       qmem.address<uint32_t>() + thread * qmem_per_thread, ac_strategy);
 }
 
+bool AcStrategyHeuristics::IsFlat(const Rect& rect) const {
+  if (cparams.speed_tier >= SpeedTier::kCheetah) return false;
+  return HWY_DYNAMIC_DISPATCH(IsFlatRect)(config, rect, max_flat_range);
+}
+
+Status AcStrategyHeuristics::ProcessFlatRect(const Rect& rect,
+                                             AcStrategyImage* ac_strategy) {
+  // Same restrictions as in ProcessRectACS: 64-wide transforms only up to
+  // decoding speed tier 1, 32-wide ones below tier 4.
+  const AcStrategyType kSquares[] = {AcStrategyType::DCT64X64,
+                                     AcStrategyType::DCT32X32,
+                                     AcStrategyType::DCT16X16};
+  size_t first_square = 2;
+  if (cparams.decoding_speed_tier <= 1) {
+    first_square = 0;
+  } else if (cparams.decoding_speed_tier < 4) {
+    first_square = 1;
+  }
+  JXL_ENSURE(rect.xsize() <= 8);
+  JXL_ENSURE(rect.ysize() <= 8);
+  bool covered[64] = {};
+  for (size_t iy = 0; iy < rect.ysize(); iy++) {
+    for (size_t ix = 0; ix < rect.xsize(); ix++) {
+      if (covered[iy * 8 + ix]) continue;
+      size_t size = 1;
+      AcStrategyType type = AcStrategyType::DCT;
+      for (size_t i = first_square; i < 3; i++) {
+        size = AcStrategy::FromRawStrategy(kSquares[i]).covered_blocks_x();
+        if ((ix | iy) % size == 0 && ix + size <= rect.xsize() &&
+            iy + size <= rect.ysize()) {
+          type = kSquares[i];
+          break;
+        }
+        size = 1;
+      }
+      for (size_t y = iy; y < iy + size; y++) {
+        for (size_t x = ix; x < ix + size; x++) covered[y * 8 + x] = true;
+      }
+      JXL_RETURN_IF_ERROR(
+          ac_strategy->Set(rect.x0() + ix, rect.y0() + iy, type));
+    }
+  }
+  num_flat_blocks += rect.xsize() * rect.ysize();
+  return true;
+}
+
 Status AcStrategyHeuristics::Finalize(const FrameDimensions& frame_dim,
                                       const AcStrategyImage& ac_strategy,
                                       AuxOut* aux_out) {
@@ -1186,6 +1366,7 @@ Status AcStrategyHeuristics::Finalize(const FrameDimensions& frame_dim,
         ac_strategy.CountBlocks(AcStrategyType::DCT64X32);
     aux_out->num_dct64_blocks =
         ac_strategy.CountBlocks(AcStrategyType::DCT64X64);
+    aux_out->num_flat_blocks = num_flat_blocks;
   }
 
   if (JXL_DEBUG_AC_STRATEGY && WantDebugOutput(cparams)) {
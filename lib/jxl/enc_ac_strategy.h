@@ -8,6 +8,7 @@
 
 #include <jxl/memory_manager.h>
 
+#include <atomic>
 #include <cstddef>
 
 #include "lib/jxl/base/compiler_specific.h"
@@ -75,11 +76,22 @@ struct AcStrategyHeuristics {
   Status PrepareForThreads(std::size_t num_threads);
   Status ProcessRect(const Rect& rect, const ColorCorrelationMap& cmap,
                      AcStrategyImage* ac_strategy, size_t thread);
+  // Returns true if the pixels of `rect` (in blocks) are so close to constant
+  // that their AC coefficients are expected to quantize to zero, in which
+  // case the transform search and the CfL heuristics can be skipped for the
+  // rect and ProcessFlatRect used instead of ProcessRect. Always false in
+  // Cheetah mode or faster, where no search is done anyway.
+  bool IsFlat(const Rect& rect) const;
+  // Covers `rect` with the largest square DCTs the decoding speed tier allows.
+  Status ProcessFlatRect(const Rect& rect, AcStrategyImage* ac_strategy);
   Status Finalize(const FrameDimensions& frame_dim,
                   const AcStrategyImage& ac_strategy, AuxOut* aux_out);
   JxlMemoryManager* memory_manager;
   const CompressParams& cparams;
   ACSConfig config = {};
+  // Maximum range of the X, Y and B values of a rect considered by IsFlat.
+  float max_flat_range[3] = {};
+  std::atomic<size_t> num_flat_blocks{0};
   size_t mem_per_thread;
   AlignedMemory mem;
   size_t qmem_per_thread;
@@ -982,6 +982,10 @@ Status FindBestQuantization(const FrameHeader& frame_header,
   if (cparams.speed_tier <= SpeedTier::kTortoise) {
     iters = kMaxButteraugliIters;
   }
+  // Only blocks whose quantization changed decode differently in the next
+  // iteration, so the diffmap is only recomputed around them.
+  ImageBundle prev_dec_linear(memory_manager);
+  ImageF diffmap;
   for (int i = 0; i < iters + 1; ++i) {
     if (JXL_DEBUG_ADAPTIVE_QUANTIZATION) {
       printf("\nQuantization field:\n");
@@ -998,8 +1002,13 @@ Status FindBestQuantization(const FrameHeader& frame_header,
         ImageBundle dec_linear,
         RoundtripImage(frame_header, opsin, enc_state, cms, pool));
     float score;
-    ImageF diffmap;
-    JXL_RETURN_IF_ERROR(comparator.CompareWith(dec_linear, &diffmap, &score));
+    if (i == 0 || !lower_is_better) {
+      JXL_RETURN_IF_ERROR(
+          comparator.CompareWith(dec_linear, &diffmap, &score));
+    } else {
+      JXL_RETURN_IF_ERROR(comparator.UpdateComparison(
+          prev_dec_linear, dec_linear, pool, &diffmap, &score));
+    }
     if (!lower_is_better) {
       score = -score;
       ScaleImage(-1.0f, &diffmap);
@@ -1029,6 +1038,7 @@ Status FindBestQuantization(const FrameHeader& frame_header,
     }
 
     if (i == iters) break;
+    prev_dec_linear = std::move(dec_linear);
 
     double kPow[8] = {
         0.2, 0.2, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
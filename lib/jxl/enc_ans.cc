@@ -20,6 +20,7 @@
 #include "lib/jxl/ans_common.h"
 #include "lib/jxl/ans_params.h"
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
@@ -916,7 +917,7 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreEntropyCodes(
     JxlMemoryManager* memory_manager, const HistogramParams& params,
     const std::vector<std::vector<Token>>& tokens,
     const std::vector<Histogram>& builder, BitWriter* writer, LayerType layer,
-    AuxOut* aux_out) {
+    AuxOut* aux_out, const EntropyCodePreset* preset) {
   const size_t prev_histograms = encoding_info.size();
   std::vector<Histogram> clustered_histograms;
   for (size_t i = 0; i < prev_histograms; ++i) {
@@ -925,7 +926,16 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreEntropyCodes(
   }
   size_t context_offset = context_map.size();
   context_map.resize(context_offset + builder.size());
-  if (builder.size() > 1) {
+  if (preset != nullptr) {
+    JXL_ENSURE(prev_histograms == 0 && context_offset == 0);
+    JXL_ENSURE(preset->context_map.size() == builder.size());
+    context_map = preset->context_map;
+    clustered_histograms = preset->histograms;
+    if (writer != nullptr && builder.size() > 1) {
+      JXL_RETURN_IF_ERROR(EncodeContextMap(
+          context_map, clustered_histograms.size(), writer, layer, aux_out));
+    }
+  } else if (builder.size() > 1) {
     if (!ans_fuzzer_friendly_) {
       std::vector<uint32_t> histogram_symbols;
       JXL_RETURN_IF_ERROR(ClusterHistograms(params, builder, kClustersLimit,
@@ -1079,6 +1089,317 @@ Status EncodeHistograms(const EntropyEncodingData& codes, BitWriter* writer,
       /*finished_histogram=*/true);
 }
 
+namespace {
+
+HybridUintConfig TokenUintConfig(const HistogramParams& params) {
+  return ans_fuzzer_friendly_ ? HybridUintConfig(10, 0, 0)
+                              : params.UintConfig();
+}
+
+// Chooses between prefix codes and ANS, then clusters and encodes the
+// per-context histograms in `builder`. `tokens` is only used to select hybrid
+// uint configurations, and may be empty if `params.uint_method` is fixed.
+// Returns cost (in bits).
+StatusOr<size_t> EncodeHistogramsFromBuilder(
+    JxlMemoryManager* memory_manager, const HistogramParams& params,
+    const std::vector<std::vector<Token>>& tokens, size_t total_tokens,
+    std::vector<Histogram> builder, EntropyEncodingData* codes,
+    BitWriter* writer, LayerType layer, AuxOut* aux_out) {
+  const size_t num_contexts = builder.size();
+  if (params.add_missing_symbols) {
+    for (size_t c = 0; c < num_contexts; ++c) {
+      for (int symbol = 0; symbol < ANS_MAX_ALPHABET_SIZE; ++symbol) {
+        builder[c].Add(symbol);
+      }
+    }
+  }
+
+  if (params.initialize_global_state) {
+    bool use_prefix_code =
+        params.force_huffman || total_tokens < 100 ||
+        params.clustering == HistogramParams::ClusteringType::kFastest ||
+        ans_fuzzer_friendly_;
+    if (!use_prefix_code) {
+      bool all_singleton = true;
+      for (size_t i = 0; i < num_contexts; i++) {
+        if (builder[i].ShannonEntropy() >= 1e-5) {
+          all_singleton = false;
+        }
+      }
+      if (all_singleton) {
+        use_prefix_code = true;
+      }
+    }
+    codes->use_prefix_code = use_prefix_code;
+  }
+
+  if (params.add_fixed_histograms) {
+    // TODO(szabadka) Add more fixed histograms.
+    // TODO(szabadka) Reduce alphabet size by choosing a non-default
+    // uint_config.
+    const size_t alphabet_size = ANS_MAX_ALPHABET_SIZE;
+    codes->log_alpha_size = 8;
+    JXL_ENSURE(alphabet_size == 1u << codes->log_alpha_size);
+    static_assert(ANS_MAX_ALPHABET_SIZE <= ANS_TAB_SIZE,
+                  "Alphabet does not fit table");
+    codes->encoding_info.emplace_back();
+    codes->encoding_info.back().resize(alphabet_size);
+    codes->encoded_histograms.emplace_back(memory_manager);
+    BitWriter* histo_writer = &codes->encoded_histograms.back();
+    JXL_RETURN_IF_ERROR(histo_writer->WithMaxBits(
+        256 + alphabet_size * 24, LayerType::Header, nullptr,
+        [&]() -> Status {
+          JXL_ASSIGN_OR_RETURN(
+              size_t ans_cost,
+              codes->BuildAndStoreANSEncodingData(
+                  memory_manager, params.ans_histogram_strategy,
+                  Histogram::Flat(alphabet_size, ANS_TAB_SIZE), histo_writer));
+          (void)ans_cost;
+          return true;
+        }));
+  }
+
+  // The preset replaces clustering, so it can only be used for a fresh set of
+  // codes whose symbols are produced by the default hybrid uint config.
+  const EntropyCodePreset* preset = params.entropy_preset;
+  if (preset != nullptr &&
+      (!params.initialize_global_state || params.streaming_mode ||
+       params.add_missing_symbols || params.add_fixed_histograms ||
+       codes->lz77.enabled || !codes->encoding_info.empty() ||
+       ans_fuzzer_friendly_ ||
+       params.uint_method == HistogramParams::HybridUintMethod::kBest ||
+       params.uint_method == HistogramParams::HybridUintMethod::kFast ||
+       preset->histograms.size() > params.max_histograms ||
+       !preset->Fits(builder))) {
+    preset = nullptr;
+  }
+
+  // Encode histograms.
+  return codes->BuildAndStoreEntropyCodes(memory_manager, params, tokens,
+                                          builder, writer, layer, aux_out,
+                                          preset);
+}
+
+}  // namespace
+
+void AddTokensToHistograms(const HistogramParams& params,
+                           const std::vector<Token>& tokens,
+                           std::vector<Histogram>* builder) {
+  const HybridUintConfig uint_config = TokenUintConfig(params);
+  for (const auto& token : tokens) {
+    JXL_DASSERT(!token.is_lz77_length);
+    JXL_DASSERT(token.context < builder->size());
+    uint32_t tok, nbits, bits;
+    uint_config.Encode(token.value, &tok, &nbits, &bits);
+    (*builder)[token.context].Add(tok);
+  }
+}
+
+StatusOr<EntropyCodePreset> EntropyCodePreset::Train(
+    const HistogramParams& params, const std::vector<Histogram>& builder) {
+  JXL_ENSURE(!builder.empty());
+  EntropyCodePreset preset;
+  std::vector<uint32_t> histogram_symbols;
+  if (builder.size() > 1) {
+    JXL_RETURN_IF_ERROR(ClusterHistograms(params, builder, kClustersLimit,
+                                          &preset.histograms,
+                                          &histogram_symbols));
+  } else {
+    preset.histograms.push_back(builder[0]);
+    histogram_symbols.push_back(0);
+  }
+  preset.context_map.resize(builder.size());
+  for (size_t c = 0; c < builder.size(); ++c) {
+    preset.context_map[c] = static_cast<uint8_t>(histogram_symbols[c]);
+  }
+  // Symbols that did not occur in the corpus would force a fallback whenever
+  // they show up in an image; a count of one costs next to nothing.
+  size_t alphabet_size = 1;
+  for (const Histogram& histo : preset.histograms) {
+    alphabet_size = std::max(alphabet_size, histo.alphabet_size());
+  }
+  for (Histogram& histo : preset.histograms) {
+    histo.EnsureCapacity(std::max(alphabet_size, histo.counts.size()));
+    for (size_t i = 0; i < alphabet_size; ++i) {
+      if (histo.counts[i] == 0) histo.Add(i);
+    }
+  }
+  return preset;
+}
+
+namespace {
+constexpr uint32_t kEntropyCodePresetSignature = 0x50454A58;  // "XJEP"
+}  // namespace
+
+std::vector<uint8_t> EntropyCodePreset::Serialize() const {
+  // Signature, number of contexts, context map, number of histograms, then
+  // the alphabet size and counts of each histogram; all integers are 32-bit
+  // little-endian.
+  size_t size = 12 + context_map.size();
+  for (const Histogram& histo : histograms) {
+    size += 4 + 4 * histo.alphabet_size();
+  }
+  std::vector<uint8_t> data(size);
+  uint8_t* pos = data.data();
+  const auto store = [&pos](uint32_t value) {
+    StoreLE32(value, pos);
+    pos += 4;
+  };
+  store(kEntropyCodePresetSignature);
+  store(context_map.size());
+  std::copy(context_map.begin(), context_map.end(), pos);
+  pos += context_map.size();
+  store(histograms.size());
+  for (const Histogram& histo : histograms) {
+    const size_t alphabet_size = histo.alphabet_size();
+    store(alphabet_size);
+    for (size_t i = 0; i < alphabet_size; ++i) {
+      store(histo.counts[i]);
+    }
+  }
+  return data;
+}
+
+StatusOr<EntropyCodePreset> EntropyCodePreset::Deserialize(
+    Span<const uint8_t> data) {
+  size_t pos = 0;
+  const auto load = [&](uint32_t* value) -> Status {
+    if (data.size() - pos < 4) return JXL_FAILURE("Truncated preset");
+    *value = LoadLE32(data.data() + pos);
+    pos += 4;
+    return true;
+  };
+  uint32_t value;
+  JXL_RETURN_IF_ERROR(load(&value));
+  if (value != kEntropyCodePresetSignature) {
+    return JXL_FAILURE("Not an entropy code preset");
+  }
+  EntropyCodePreset preset;
+  uint32_t num_contexts;
+  JXL_RETURN_IF_ERROR(load(&num_contexts));
+  if (num_contexts == 0 || data.size() - pos < num_contexts) {
+    return JXL_FAILURE("Invalid context map");
+  }
+  preset.context_map.assign(data.data() + pos,
+                            data.data() + pos + num_contexts);
+  pos += num_contexts;
+  uint32_t num_histograms;
+  JXL_RETURN_IF_ERROR(load(&num_histograms));
+  if (num_histograms == 0 || num_histograms > kClustersLimit) {
+    return JXL_FAILURE("Invalid number of histograms");
+  }
+  for (uint8_t histogram_index : preset.context_map) {
+    if (histogram_index >= num_histograms) {
+      return JXL_FAILURE("Invalid context map");
+    }
+  }
+  preset.histograms.resize(num_histograms);
+  for (Histogram& histo : preset.histograms) {
+    uint32_t alphabet_size;
+    JXL_RETURN_IF_ERROR(load(&alphabet_size));
+    if (alphabet_size > ANS_MAX_ALPHABET_SIZE) {
+      return JXL_FAILURE("Invalid alphabet size");
+    }
+    histo.EnsureCapacity(alphabet_size);
+    for (size_t i = 0; i < alphabet_size; ++i) {
+      JXL_RETURN_IF_ERROR(load(&value));
+      if (value >
+          static_cast<uint32_t>(std::numeric_limits<ANSHistBin>::max())) {
+        return JXL_FAILURE("Invalid count");
+      }
+      histo.counts[i] = static_cast<ANSHistBin>(value);
+      histo.total_count += value;
+    }
+  }
+  if (pos != data.size()) return JXL_FAILURE("Trailing data in preset");
+  return preset;
+}
+
+bool EntropyCodePreset::Fits(const std::vector<Histogram>& builder) const {
+  if (builder.size() != context_map.size()) return false;
+  std::vector<Histogram> actual(histograms.size());
+  for (size_t c = 0; c < builder.size(); ++c) {
+    actual[context_map[c]].AddHistogram(builder[c]);
+  }
+  // Sum over clusters of total_count * KL(actual || preset).
+  double excess_bits = 0;
+  size_t total_tokens = 0;
+  for (size_t k = 0; k < histograms.size(); ++k) {
+    const Histogram& histo = actual[k];
+    const Histogram& trained = histograms[k];
+    if (histo.total_count == 0) continue;
+    const size_t alphabet_size = histo.alphabet_size();
+    if (alphabet_size > trained.counts.size()) return false;
+    const double inv_total = 1.0 / histo.total_count;
+    const double inv_trained_total = 1.0 / trained.total_count;
+    for (size_t i = 0; i < alphabet_size; ++i) {
+      if (histo.counts[i] == 0) continue;
+      if (trained.counts[i] == 0) return false;
+      excess_bits += histo.counts[i] *
+                     std::log2((histo.counts[i] * inv_total) /
+                               (trained.counts[i] * inv_trained_total));
+    }
+    total_tokens += histo.total_count;
+  }
+  return excess_bits <= max_kl_divergence * total_tokens;
+}
+
+StatusOr<size_t> BuildAndEncodeHistogramsFromCounts(
+    JxlMemoryManager* memory_manager, const HistogramParams& params,
+    const std::vector<Histogram>& builder, EntropyEncodingData* codes,
+    BitWriter* writer, LayerType layer, AuxOut* aux_out) {
+  // Without the tokens, neither LZ77 nor the per-histogram hybrid uint
+  // search can run.
+  JXL_ENSURE(params.lz77_method == HistogramParams::LZ77Method::kNone);
+  JXL_ENSURE(params.uint_method != HistogramParams::HybridUintMethod::kBest &&
+             params.uint_method != HistogramParams::HybridUintMethod::kFast);
+  const size_t num_contexts = builder.size();
+  codes->lz77.enabled = false;
+  codes->lz77.nonserialized_distance_context = num_contexts;
+  codes->lz77.min_symbol = params.force_huffman ? 512 : 224;
+  if (ans_fuzzer_friendly_) {
+    codes->lz77.length_uint_config = HybridUintConfig(10, 0, 0);
+    codes->lz77.min_symbol = 2048;
+  }
+
+  size_t total_tokens = 0;
+  for (const Histogram& histo : builder) {
+    total_tokens += histo.total_count;
+  }
+  const std::vector<std::vector<Token>> no_tokens;
+  size_t cost = 0;
+  const size_t max_contexts = std::min(num_contexts, kClustersLimit);
+  const auto& body = [&]() -> Status {
+    if (writer) {
+      JXL_RETURN_IF_ERROR(Bundle::Write(codes->lz77, writer, layer, aux_out));
+    } else {
+      size_t ebits, bits;
+      JXL_RETURN_IF_ERROR(Bundle::CanEncode(codes->lz77, &ebits, &bits));
+      cost += bits;
+    }
+    JXL_ASSIGN_OR_RETURN(
+        size_t entropy_bits,
+        EncodeHistogramsFromBuilder(memory_manager, params, no_tokens,
+                                    total_tokens, builder, codes, writer, layer,
+                                    aux_out));
+    cost += entropy_bits;
+    return true;
+  };
+  if (writer) {
+    JXL_RETURN_IF_ERROR(writer->WithMaxBits(
+        128 + num_contexts * 40 + max_contexts * 96, layer, aux_out, body,
+        /*finished_histogram=*/true));
+  } else {
+    JXL_RETURN_IF_ERROR(body());
+  }
+
+  if (aux_out != nullptr) {
+    aux_out->layer(layer).num_clustered_histograms +=
+        codes->encoding_info.size();
+  }
+  return cost;
+}
+
 StatusOr<size_t> BuildAndEncodeHistograms(
     JxlMemoryManager* memory_manager, const HistogramParams& params,
     size_t num_contexts, std::vector<std::vector<Token>>& tokens,
@@ -1125,10 +1446,7 @@ StatusOr<size_t> BuildAndEncodeHistograms(
     size_t total_tokens = 0;
     // Build histograms.
     std::vector<Histogram> builder(num_contexts);
-    HybridUintConfig uint_config = params.UintConfig();
-    if (ans_fuzzer_friendly_) {
-      uint_config = HybridUintConfig(10, 0, 0);
-    }
+    const HybridUintConfig uint_config = TokenUintConfig(params);
     for (const auto& stream : tokens) {
       if (codes->lz77.enabled) {
         for (const auto& token : stream) {
@@ -1158,65 +1476,11 @@ StatusOr<size_t> BuildAndEncodeHistograms(
       }
     }
 
-    if (params.add_missing_symbols) {
-      for (size_t c = 0; c < num_contexts; ++c) {
-        for (int symbol = 0; symbol < ANS_MAX_ALPHABET_SIZE; ++symbol) {
-          builder[c].Add(symbol);
-        }
-      }
-    }
-
-    if (params.initialize_global_state) {
-      bool use_prefix_code =
-          params.force_huffman || total_tokens < 100 ||
-          params.clustering == HistogramParams::ClusteringType::kFastest ||
-          ans_fuzzer_friendly_;
-      if (!use_prefix_code) {
-        bool all_singleton = true;
-        for (size_t i = 0; i < num_contexts; i++) {
-          if (builder[i].ShannonEntropy() >= 1e-5) {
-            all_singleton = false;
-          }
-        }
-        if (all_singleton) {
-          use_prefix_code = true;
-        }
-      }
-      codes->use_prefix_code = use_prefix_code;
-    }
-
-    if (params.add_fixed_histograms) {
-      // TODO(szabadka) Add more fixed histograms.
-      // TODO(szabadka) Reduce alphabet size by choosing a non-default
-      // uint_config.
-      const size_t alphabet_size = ANS_MAX_ALPHABET_SIZE;
-      codes->log_alpha_size = 8;
-      JXL_ENSURE(alphabet_size == 1u << codes->log_alpha_size);
-      static_assert(ANS_MAX_ALPHABET_SIZE <= ANS_TAB_SIZE,
-                    "Alphabet does not fit table");
-      codes->encoding_info.emplace_back();
-      codes->encoding_info.back().resize(alphabet_size);
-      codes->encoded_histograms.emplace_back(memory_manager);
-      BitWriter* histo_writer = &codes->encoded_histograms.back();
-      JXL_RETURN_IF_ERROR(histo_writer->WithMaxBits(
-          256 + alphabet_size * 24, LayerType::Header, nullptr,
-          [&]() -> Status {
-            JXL_ASSIGN_OR_RETURN(
-                size_t ans_cost,
-                codes->BuildAndStoreANSEncodingData(
-                    memory_manager, params.ans_histogram_strategy,
-                    Histogram::Flat(alphabet_size, ANS_TAB_SIZE),
-                    histo_writer));
-            (void)ans_cost;
-            return true;
-          }));
-    }
-
-    // Encode histograms.
     JXL_ASSIGN_OR_RETURN(
         size_t entropy_bits,
-        codes->BuildAndStoreEntropyCodes(memory_manager, params, tokens,
-                                         builder, writer, layer, aux_out));
+        EncodeHistogramsFromBuilder(memory_manager, params, tokens,
+                                    total_tokens, std::move(builder), codes,
+                                    writer, layer, aux_out));
     cost += entropy_bits;
     return true;
   };
@@ -1240,6 +1504,10 @@ size_t WriteTokens(const std::vector<Token>& tokens,
                    BitWriter* writer) {
   size_t num_extra_bits = 0;
   if (codes.use_prefix_code) {
+    // Accumulate the codes of consecutive tokens in a register and only hand
+    // them to the BitWriter once kMaxBitsPerCall bits would be exceeded.
+    uint64_t allbits = 0;
+    size_t numallbits = 0;
     for (const auto& token : tokens) {
       uint32_t tok, nbits, bits;
       size_t histo = codes.context_map[context_offset + token.context];
@@ -1251,12 +1519,19 @@ size_t WriteTokens(const std::vector<Token>& tokens,
       // writer->Write(codes.encoding_info[histo][tok].depth,
       //               codes.encoding_info[histo][tok].bits);
       // writer->Write(nbits, bits);
-      uint64_t data = codes.encoding_info[histo][tok].bits;
-      data |= static_cast<uint64_t>(bits)
-              << codes.encoding_info[histo][tok].depth;
-      writer->Write(codes.encoding_info[histo][tok].depth + nbits, data);
+      const ANSEncSymbolInfo& info = codes.encoding_info[histo][tok];
+      uint64_t data = info.bits;
+      data |= static_cast<uint64_t>(bits) << info.depth;
+      const size_t data_bits = info.depth + nbits;
+      if (JXL_UNLIKELY(numallbits + data_bits > BitWriter::kMaxBitsPerCall)) {
+        writer->Write(numallbits, allbits);
+        numallbits = allbits = 0;
+      }
+      allbits |= data << numallbits;
+      numallbits += data_bits;
       num_extra_bits += nbits;
     }
+    writer->Write(numallbits, allbits);
     return num_extra_bits;
   }
   std::vector<uint64_t> out;
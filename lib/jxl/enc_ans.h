@@ -16,6 +16,7 @@
 #include <vector>
 
 #include "lib/jxl/ans_params.h"
+#include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/enc_ans_params.h"
@@ -93,6 +94,33 @@ struct SizeWriter {
   void Write(size_t num, size_t bits) { size += num; }
 };
 
+// Context map and clustered histograms trained offline on a corpus of
+// similar images encoded with the same settings, see
+// tools/train_entropy_preset.cc. Set as HistogramParams::entropy_preset, it
+// replaces clustering of the actual histograms as long as the actual symbol
+// statistics stay close to the trained ones; the histograms are still written
+// to the bitstream, so decoders need no knowledge of the preset.
+struct EntropyCodePreset {
+  // Clusters the per-context histograms `builder` accumulated over a corpus
+  // (see AddTokensToHistograms), and makes every symbol up to the largest one
+  // seen have a nonzero count in each cluster.
+  static StatusOr<EntropyCodePreset> Train(
+      const HistogramParams& params, const std::vector<Histogram>& builder);
+
+  std::vector<uint8_t> Serialize() const;
+  static StatusOr<EntropyCodePreset> Deserialize(Span<const uint8_t> data);
+
+  // Returns true if every symbol in `builder` has a nonzero count in its
+  // preset histogram, and coding `builder` with the preset histograms costs
+  // at most `max_kl_divergence` bits per token more than with the actual
+  // histograms of the preset clusters.
+  bool Fits(const std::vector<Histogram>& builder) const;
+
+  std::vector<uint8_t> context_map;
+  std::vector<Histogram> histograms;
+  float max_kl_divergence = 0.05f;
+};
+
 struct EntropyEncodingData {
   std::vector<std::vector<ANSEncSymbolInfo>> encoding_info;
   bool use_prefix_code;
@@ -106,7 +134,7 @@ struct EntropyEncodingData {
       JxlMemoryManager* memory_manager, const HistogramParams& params,
       const std::vector<std::vector<Token>>& tokens,
       const std::vector<Histogram>& builder, BitWriter* writer, LayerType layer,
-      AuxOut* aux_out);
+      AuxOut* aux_out, const EntropyCodePreset* preset);
 
   StatusOr<size_t> BuildAndStoreANSEncodingData(
       JxlMemoryManager* memory_manager,
@@ -136,6 +164,23 @@ StatusOr<size_t> BuildAndEncodeHistograms(
     EntropyEncodingData* codes, BitWriter* writer, LayerType layer,
     AuxOut* aux_out);
 
+// Adds `tokens` to the per-context histograms in `builder`, using the same
+// hybrid uint configuration as BuildAndEncodeHistograms would for `params`.
+// LZ77 length tokens are not supported.
+void AddTokensToHistograms(const HistogramParams& params,
+                           const std::vector<Token>& tokens,
+                           std::vector<Histogram>* builder);
+
+// Same as BuildAndEncodeHistograms, but starts from per-context histograms
+// accumulated with AddTokensToHistograms, so that the tokens do not have to be
+// kept in memory until the histograms are built. Requires LZ77 to be disabled
+// and a fixed hybrid uint method; produces the same codes as
+// BuildAndEncodeHistograms would for the same tokens.
+StatusOr<size_t> BuildAndEncodeHistogramsFromCounts(
+    JxlMemoryManager* memory_manager, const HistogramParams& params,
+    const std::vector<Histogram>& builder, EntropyEncodingData* codes,
+    BitWriter* writer, LayerType layer, AuxOut* aux_out);
+
 // Write the tokens to a string.
 Status WriteTokens(const std::vector<Token>& tokens,
                    const EntropyEncodingData& codes, size_t context_offset,
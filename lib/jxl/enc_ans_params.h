@@ -23,6 +23,7 @@ namespace jxl {
 
 // Forward declaration to break include cycle.
 struct CompressParams;
+struct EntropyCodePreset;
 
 // RebalanceHistogram requires a signed type.
 using ANSHistBin = int32_t;
@@ -112,6 +113,10 @@ struct HistogramParams {
   bool streaming_mode = false;
   bool add_missing_symbols = false;
   bool add_fixed_histograms = false;
+  // If not null, its context map and histograms are used instead of
+  // clustering the actual histograms, as long as they fit the data well
+  // enough. Not owned.
+  const EntropyCodePreset* entropy_preset = nullptr;
 };
 
 struct Histogram {
@@ -7,6 +7,7 @@
 
 #include <cstddef>
 #include <cstdio>
+#include <vector>
 
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
@@ -83,6 +84,17 @@ void AuxOut::Assimilate(const AuxOut& victim) {
   num_dct32x64_blocks += victim.num_dct32x64_blocks;
   num_dct64_blocks += victim.num_dct64_blocks;
   num_butteraugli_iters += victim.num_butteraugli_iters;
+  num_flat_blocks += victim.num_flat_blocks;
+  AddACHistograms(victim.ac_histograms);
+}
+
+void AuxOut::AddACHistograms(const std::vector<Histogram>& histograms) {
+  if (histograms.empty()) return;
+  if (ac_histograms.empty()) ac_histograms.resize(histograms.size());
+  if (ac_histograms.size() != histograms.size()) return;
+  for (size_t c = 0; c < histograms.size(); ++c) {
+    ac_histograms[c].AddHistogram(histograms[c]);
+  }
 }
 
 void AuxOut::Print(size_t num_inputs) const {
@@ -11,6 +11,9 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <vector>
+
+#include "lib/jxl/enc_ans_params.h"
 
 namespace jxl {
 
@@ -104,6 +107,18 @@ struct AuxOut {
   size_t num_dct64_blocks = 0;
 
   int num_butteraugli_iters = 0;
+
+  // Number of blocks in tiles that skipped the AC strategy search because
+  // they are flat.
+  size_t num_flat_blocks = 0;
+
+  // If set, the per-context AC histograms of all VarDCT frames with the same
+  // number of AC contexts as the first one are summed up in `ac_histograms`,
+  // e.g. to train an EntropyCodePreset.
+  bool collect_ac_histograms = false;
+  std::vector<Histogram> ac_histograms;
+
+  void AddACHistograms(const std::vector<Histogram>& histograms);
 };
 }  // namespace jxl
 
@@ -58,10 +58,9 @@ Status BitWriter::Allotment::FinishedHistogram(BitWriter* JXL_RESTRICT writer) {
   if (writer == nullptr) return true;
   JXL_ENSURE(!called_);              // Call before ReclaimUnused
   JXL_ENSURE(histogram_bits_ == 0);  // Do not call twice
-  JXL_ENSURE(writer->BitsWritten() >= prev_bits_written_);
-  if (writer->BitsWritten() >= prev_bits_written_) {
-    histogram_bits_ = writer->BitsWritten() - prev_bits_written_;
-  }
+  const size_t own_start = prev_bits_written_ + nested_bits_;
+  JXL_ENSURE(writer->BitsWritten() >= own_start);
+  histogram_bits_ = writer->BitsWritten() - own_start;
   return true;
 }
 
@@ -88,8 +87,9 @@ Status BitWriter::Allotment::PrivateReclaim(BitWriter* JXL_RESTRICT writer,
   called_ = true;
   if (writer == nullptr) return true;
 
-  JXL_DASSERT(writer->BitsWritten() >= prev_bits_written_);
-  *used_bits = writer->BitsWritten() - prev_bits_written_;
+  JXL_DASSERT(writer->BitsWritten() >= prev_bits_written_ + nested_bits_);
+  const size_t total_bits = writer->BitsWritten() - prev_bits_written_;
+  *used_bits = total_bits - nested_bits_;
   JXL_DASSERT(*used_bits <= max_bits_);
   *unused_bits = max_bits_ - *used_bits;
 
@@ -99,12 +99,9 @@ Status BitWriter::Allotment::PrivateReclaim(BitWriter* JXL_RESTRICT writer,
   JXL_RETURN_IF_ERROR(
       writer->storage_.resize(writer->storage_.size() - unused_bytes));
   writer->current_allotment_ = parent_;
-  // Ensure we don't also charge the parent for these bits.
-  auto* parent = parent_;
-  while (parent != nullptr) {
-    parent->prev_bits_written_ += *used_bits;
-    parent = parent->parent_;
-  }
+  // Ensure we don't also charge the parent for these bits (nor the parent's
+  // ancestors, which will exclude the parent's nested bits in turn).
+  if (parent_ != nullptr) parent_->nested_bits_ += total_bits;
   return true;
 }
 
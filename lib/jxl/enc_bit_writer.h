@@ -136,6 +136,9 @@ struct BitWriter {
                           size_t* JXL_RESTRICT unused_bits);
 
     size_t prev_bits_written_;
+    // Bits written by (possibly nested) child allotments, which are charged
+    // there and not here.
+    size_t nested_bits_ = 0;
     const size_t max_bits_;
     size_t histogram_bits_ = 0;
     bool called_ = false;
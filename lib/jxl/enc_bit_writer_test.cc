@@ -70,5 +70,42 @@ TEST(BitWriterTest, RandomSequence) {
   EXPECT_EQ(num_mismatches, 0u);
 }
 
+// Each allotment is only charged for the bits it wrote itself, no matter how
+// deeply the allotments are nested.
+TEST(BitWriterTest, NestedAllotments) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  BitWriter writer{memory_manager};
+  AuxOut aux_out;
+  EXPECT_TRUE(writer.WithMaxBits(
+      10, LayerType::Header, &aux_out,
+      [&]() -> Status {
+        writer.Write(3, 5);
+        JXL_RETURN_IF_ERROR(writer.WithMaxBits(
+            20, LayerType::Toc, &aux_out, [&]() -> Status {
+              writer.Write(7, 1);
+              JXL_RETURN_IF_ERROR(writer.WithMaxBits(
+                  30, LayerType::Dc, &aux_out, [&]() -> Status {
+                    writer.Write(11, 2);
+                    return true;
+                  }));
+              writer.Write(2, 3);
+              return true;
+            }));
+        JXL_RETURN_IF_ERROR(writer.WithMaxBits(
+            30, LayerType::Dc, &aux_out, [&]() -> Status {
+              writer.Write(13, 4);
+              return true;
+            }));
+        writer.Write(1, 1);
+        return true;
+      },
+      /*finished_histogram=*/true));
+  EXPECT_EQ(writer.BitsWritten(), 37u);
+  EXPECT_EQ(aux_out.layer(LayerType::Header).total_bits, 4u);
+  EXPECT_EQ(aux_out.layer(LayerType::Header).histogram_bits, 4u);
+  EXPECT_EQ(aux_out.layer(LayerType::Toc).total_bits, 9u);
+  EXPECT_EQ(aux_out.layer(LayerType::Dc).total_bits, 24u);
+}
+
 }  // namespace
 }  // namespace jxl
@@ -8,9 +8,15 @@
 #include <jxl/cms_interface.h>
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <vector>
 
+#include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
 #include "lib/jxl/color_encoding_internal.h"
@@ -59,19 +65,123 @@ Status JxlButteraugliComparator::CompareWith(const ImageBundle& actual,
   if (xsize_ != actual.xsize() || ysize_ != actual.ysize()) {
     return JXL_FAILURE("Images must have same size");
   }
+
+  ImageF temp_diffmap;
+  JXL_RETURN_IF_ERROR(ComputeDiffmap(actual, /*rects=*/nullptr,
+                                     /*pool=*/nullptr, &temp_diffmap));
+
+  if (score != nullptr) {
+    *score = ButteraugliScoreFromDiffmap(temp_diffmap, &params_);
+  }
+  if (diffmap != nullptr) {
+    diffmap->Swap(temp_diffmap);
+  }
+
+  return true;
+}
+
+Status JxlButteraugliComparator::UpdateComparison(const ImageBundle& previous,
+                                                  const ImageBundle& actual,
+                                                  ThreadPool* pool,
+                                                  ImageF* diffmap,
+                                                  float* score) {
+  if (!comparator_) {
+    return JXL_FAILURE("Must set reference image first");
+  }
+  if (xsize_ != actual.xsize() || ysize_ != actual.ysize() ||
+      xsize_ != previous.xsize() || ysize_ != previous.ysize() ||
+      xsize_ != diffmap->xsize() || ysize_ != diffmap->ysize()) {
+    return JXL_FAILURE("Images must have same size");
+  }
+
+  // Find the blocks where the images differ.
+  constexpr size_t kChangedBlockDim = 8;
+  const size_t xblocks = DivCeil(xsize_, kChangedBlockDim);
+  const size_t yblocks = DivCeil(ysize_, kChangedBlockDim);
+  std::vector<uint8_t> changed(xblocks * yblocks);
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < ysize_; ++y) {
+      const float* JXL_RESTRICT row_previous =
+          previous.color().ConstPlaneRow(c, y);
+      const float* JXL_RESTRICT row_actual = actual.color().ConstPlaneRow(c, y);
+      uint8_t* JXL_RESTRICT row_changed =
+          changed.data() + (y / kChangedBlockDim) * xblocks;
+      for (size_t x = 0; x < xsize_; ++x) {
+        if (row_actual[x] != row_previous[x]) {
+          row_changed[x / kChangedBlockDim] = 1;
+        }
+      }
+    }
+  }
+
+  // Cover the part of the diffmap that depends on the changed blocks with
+  // disjoint rects, split into bands of rows so that distant changes do not
+  // end up in the same rect.
+  constexpr size_t kBandHeight = 128;
+  const size_t radius = ButteraugliComparator::kDiffmapRadius;
+  const Rect image_rect(0, 0, xsize_, ysize_);
+  std::vector<Rect> rects;
+  for (size_t band_y0 = 0; band_y0 < ysize_; band_y0 += kBandHeight) {
+    const Rect band(0, band_y0, xsize_, kBandHeight, xsize_, ysize_);
+    const size_t by_begin =
+        band_y0 > radius ? (band_y0 - radius) / kChangedBlockDim : 0;
+    const size_t by_end =
+        std::min(yblocks, DivCeil(band.y1() + radius, kChangedBlockDim));
+    std::vector<Rect> band_rects;
+    for (size_t by = by_begin; by < by_end; ++by) {
+      for (size_t bx = 0; bx < xblocks; ++bx) {
+        if (!changed[by * xblocks + bx]) continue;
+        const Rect block(bx * kChangedBlockDim, by * kChangedBlockDim,
+                         kChangedBlockDim, kChangedBlockDim, xsize_, ysize_);
+        const Rect affected =
+            block.Extend(radius, image_rect).Intersection(band);
+        if (affected.xsize() == 0 || affected.ysize() == 0) continue;
+        band_rects.push_back(affected);
+      }
+    }
+    std::sort(band_rects.begin(), band_rects.end(),
+              [](const Rect& a, const Rect& b) { return a.x0() < b.x0(); });
+    const size_t band_begin = rects.size();
+    for (const Rect& rect : band_rects) {
+      if (rects.size() > band_begin && rect.x0() <= rects.back().x1()) {
+        rects.back() = rects.back().BoundingBox(rect);
+      } else {
+        rects.push_back(rect);
+      }
+    }
+  }
+  size_t cost = 0;
+  for (const Rect& rect : rects) {
+    cost += (rect.xsize() + 2 * radius) * (rect.ysize() + 2 * radius);
+  }
+
+  if (cost >= xsize_ * ysize_) {
+    // Cropping would process more pixels than the whole image.
+    JXL_RETURN_IF_ERROR(
+        ComputeDiffmap(actual, /*rects=*/nullptr, pool, diffmap));
+  } else if (!rects.empty()) {
+    JXL_RETURN_IF_ERROR(ComputeDiffmap(actual, &rects, pool, diffmap));
+  }
+  if (score != nullptr) {
+    *score = ButteraugliScoreFromDiffmap(*diffmap, &params_);
+  }
+  return true;
+}
+
+Status JxlButteraugliComparator::ComputeDiffmap(const ImageBundle& actual,
+                                                const std::vector<Rect>* rects,
+                                                ThreadPool* pool,
+                                                ImageF* diffmap) {
   JxlMemoryManager* memory_manager = actual.memory_manager();
 
   const ImageBundle* actual_linear_srgb;
   ImageMetadata metadata = *actual.metadata();
   ImageBundle store(memory_manager, &metadata);
   if (!TransformIfNeeded(actual, ColorEncoding::LinearSRGB(actual.IsGray()),
-                         cms_,
-                         /*pool=*/nullptr, &store, &actual_linear_srgb)) {
+                         cms_, pool, &store, &actual_linear_srgb)) {
     return false;
   }
 
-  JXL_ASSIGN_OR_RETURN(ImageF temp_diffmap,
-                       ImageF::Create(memory_manager, xsize_, ysize_));
   const Image3F* scaled_actual_linear_srgb = &actual_linear_srgb->color();
   Image3F scaled_actual_linear_srgb_store;
   if (intensity_target_ != 0 &&
@@ -93,17 +203,19 @@ Status JxlButteraugliComparator::CompareWith(const ImageBundle& actual,
       }
     }
   }
-  JXL_RETURN_IF_ERROR(
-      comparator_->Diffmap(*scaled_actual_linear_srgb, temp_diffmap));
 
-  if (score != nullptr) {
-    *score = ButteraugliScoreFromDiffmap(temp_diffmap, &params_);
+  if (rects == nullptr) {
+    JXL_ASSIGN_OR_RETURN(*diffmap,
+                         ImageF::Create(memory_manager, xsize_, ysize_));
+    return comparator_->Diffmap(*scaled_actual_linear_srgb, *diffmap);
   }
-  if (diffmap != nullptr) {
-    diffmap->Swap(temp_diffmap);
-  }
-
-  return true;
+  const auto compute_rect = [&](const uint32_t i,
+                                size_t /* thread */) -> Status {
+    return comparator_->DiffmapRegion(*scaled_actual_linear_srgb, (*rects)[i],
+                                      *diffmap);
+  };
+  return RunOnPool(pool, 0, rects->size(), ThreadPool::NoInit, compute_rect,
+                   "ButteraugliRegions");
 }
 
 float JxlButteraugliComparator::GoodQualityScore() const {
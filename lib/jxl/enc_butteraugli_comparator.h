@@ -10,7 +10,10 @@
 #include <stddef.h>
 
 #include <memory>
+#include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
 #include "lib/jxl/enc_comparator.h"
@@ -30,10 +33,23 @@ class JxlButteraugliComparator : public Comparator {
   Status CompareWith(const ImageBundle& actual, ImageF* diffmap,
                      float* score) override;
 
+  // Same as CompareWith, but `diffmap` holds the result of CompareWith for
+  // `previous`, and only the parts of it that depend on pixels where `actual`
+  // differs from `previous` are recomputed, on `pool`.
+  Status UpdateComparison(const ImageBundle& previous,
+                          const ImageBundle& actual, ThreadPool* pool,
+                          ImageF* diffmap, float* score);
+
   float GoodQualityScore() const override;
   float BadQualityScore() const override;
 
  private:
+  // Computes the diffmap of `actual` inside `rects`, or everywhere if `rects`
+  // is null, in which case `diffmap` is reallocated.
+  Status ComputeDiffmap(const ImageBundle& actual,
+                        const std::vector<Rect>* rects, ThreadPool* pool,
+                        ImageF* diffmap);
+
   ButteraugliParams params_;
   JxlCmsInterface cms_;
   std::unique_ptr<ButteraugliComparator> comparator_;
@@ -53,8 +53,16 @@ struct PassesEncoderState {
 
   CompressParams cparams;
 
+  // If true, AC tokens are not stored in `PassData::ac_tokens`; only their
+  // histograms are computed up front, and each group is tokenized again when
+  // its bitstream is written.
+  bool retokenize_ac = false;
+
   struct PassData {
     std::vector<std::vector<Token>> ac_tokens;
+    // Per-context AC histograms, used instead of `ac_tokens` when
+    // `retokenize_ac` is set.
+    std::vector<Histogram> ac_histograms;
     std::vector<uint8_t> context_map;
     EntropyEncodingData codes;
   };
@@ -49,6 +49,7 @@ using hwy::HWY_NAMESPACE::Ge;
 using hwy::HWY_NAMESPACE::GetLane;
 using hwy::HWY_NAMESPACE::IfThenElse;
 using hwy::HWY_NAMESPACE::Lt;
+using hwy::HWY_NAMESPACE::Min;
 
 static HWY_FULL(float) df;
 
@@ -116,6 +117,33 @@ struct CFLFunction {
     return first_derivative + GetLane(SumOfLanes(df, fd_v));
   }
 
+  // Computes f(x0) and f(x1) in a single pass over the coefficients. Compute
+  // ignores residuals of at least kThres, so their cost saturates there.
+  void Cost(float x0, float x1, float* f0, float* f1) const {
+    const auto inv_color_factor = Set(df, kInvColorFactor);
+    const auto thres = Set(df, kThres);
+    const auto two = Set(df, 2.0f);
+    const auto base_v = Set(df, base);
+    const auto x0_v = Set(df, x0);
+    const auto x1_v = Set(df, x1);
+    auto f0_v = Zero(df);
+    auto f1_v = Zero(df);
+
+    for (size_t i = 0; i < num; i += Lanes(df)) {
+      const auto a = Mul(inv_color_factor, Load(df, values_m + i));
+      const auto b =
+          Sub(Mul(base_v, Load(df, values_m + i)), Load(df, values_s + i));
+      // (|v| + 1)^2 - 1 = |v| * (|v| + 2)
+      const auto av0 = Min(Abs(MulAdd(a, x0_v, b)), thres);
+      const auto av1 = Min(Abs(MulAdd(a, x1_v, b)), thres);
+      f0_v = MulAdd(av0, Add(av0, two), f0_v);
+      f1_v = MulAdd(av1, Add(av1, two), f1_v);
+    }
+
+    *f0 = kCoeff * GetLane(SumOfLanes(df, f0_v)) + distance_mul * num * x0 * x0;
+    *f1 = kCoeff * GetLane(SumOfLanes(df, f1_v)) + distance_mul * num * x1 * x1;
+  }
+
   const float* JXL_RESTRICT values_m;
   const float* JXL_RESTRICT values_s;
   size_t num;
@@ -126,12 +154,12 @@ struct CFLFunction {
 // Chroma-from-luma search, values_m will have luma -- and values_s chroma.
 int32_t FindBestMultiplier(const float* values_m, const float* values_s,
                            size_t num, float base, float distance_mul,
-                           bool fast) {
+                           CfLSearch search) {
   if (num == 0) {
     return 0;
   }
   float x;
-  if (fast) {
+  if (search != CfLSearch::kNewton) {
     static constexpr float kInvColorFactor = 1.0f / kDefaultColorFactor;
     auto ca = Zero(df);
     auto cb = Zero(df);
@@ -174,14 +202,29 @@ int32_t FindBestMultiplier(const float* values_m, const float* values_s,
   // areas and only apply this heuristic where there is a high variance.
   // This would give about 1 % more compression density.
   float towards_zero = 2.6;
+  float shift = 0;
   if (x >= towards_zero) {
-    x -= towards_zero;
+    shift = -towards_zero;
   } else if (x <= -towards_zero) {
-    x += towards_zero;
+    shift = towards_zero;
   } else {
-    x = 0;
+    return 0;
   }
-  return jxl::Clamp1(std::round(x), -128.0f, 127.0f);
+  x += shift;
+  const float lo = std::floor(x);
+  if (search != CfLSearch::kLeastSquaresRounded || lo < -128.0f ||
+      lo >= 127.0f) {
+    return jxl::Clamp1(std::round(x), -128.0f, 127.0f);
+  }
+  // The least-squares solution only approximates the minimum of the robust
+  // cost of the (quantized) residuals, so instead of rounding to nearest, pick
+  // the neighbouring multiplier with the lower cost. Both are evaluated
+  // without the shift towards zero, so that the shift is kept as is.
+  CFLFunction fn(values_m, values_s, num, base, distance_mul);
+  float cost_lo;
+  float cost_hi;
+  fn.Cost(lo - shift, lo + 1 - shift, &cost_lo, &cost_hi);
+  return cost_hi < cost_lo ? lo + 1 : lo;
 }
 
 Status InitDCStorage(JxlMemoryManager* memory_manager, size_t num_blocks,
@@ -209,8 +252,9 @@ Status ComputeTile(const Image3F& opsin, const Rect& opsin_rect,
                    const DequantMatrices& dequant,
                    const AcStrategyImage* ac_strategy,
                    const ImageI* raw_quant_field, const Quantizer* quantizer,
-                   const Rect& rect, bool fast, bool use_dct8, ImageSB* map_x,
-                   ImageSB* map_b, ImageF* dc_values, Span<float> mem) {
+                   const Rect& rect, CfLSearch search, bool use_dct8,
+                   ImageSB* map_x, ImageSB* map_b, ImageF* dc_values,
+                   Span<float> mem) {
   static_assert(kEncTileDimInBlocks == kColorTileDimInBlocks,
                 "Invalid color tile dim");
   size_t xsize_blocks = opsin_rect.xsize() / kBlockDim;
@@ -346,10 +390,10 @@ Status ComputeTile(const Image3F& opsin, const Rect& opsin_rect,
   }
   JXL_ENSURE(num_ac % Lanes(df) == 0);
   row_out_x[tx] = FindBestMultiplier(coeffs_yx, coeffs_x, num_ac, 0.0f,
-                                     kDistanceMultiplierAC, fast);
+                                     kDistanceMultiplierAC, search);
   row_out_b[tx] =
       FindBestMultiplier(coeffs_yb, coeffs_b, num_ac, jxl::cms::kYToBRatio,
-                         kDistanceMultiplierAC, fast);
+                         kDistanceMultiplierAC, search);
   return true;
 }
 
@@ -364,6 +408,15 @@ namespace jxl {
 HWY_EXPORT(InitDCStorage);
 HWY_EXPORT(ComputeTile);
 
+CfLSearch CfLSearchForSpeedTier(SpeedTier speed_tier) {
+  if (speed_tier >= SpeedTier::kWombat) return CfLSearch::kLeastSquares;
+  if (speed_tier >= SpeedTier::kSquirrel) {
+    return CfLSearch::kLeastSquaresRounded;
+  }
+  // Newton search only pays off at the slowest speeds.
+  return CfLSearch::kNewton;
+}
+
 Status CfLHeuristics::Init(const Rect& rect) {
   size_t xsize_blocks = rect.xsize() / kBlockDim;
   size_t ysize_blocks = rect.ysize() / kBlockDim;
@@ -376,14 +429,15 @@ Status CfLHeuristics::ComputeTile(const Rect& r, const Image3F& opsin,
                                   const DequantMatrices& dequant,
                                   const AcStrategyImage* ac_strategy,
                                   const ImageI* raw_quant_field,
-                                  const Quantizer* quantizer, bool fast,
-                                  size_t thread, ColorCorrelationMap* cmap) {
+                                  const Quantizer* quantizer,
+                                  CfLSearch search, size_t thread,
+                                  ColorCorrelationMap* cmap) {
   bool use_dct8 = ac_strategy == nullptr;
   Span<float> scratch(mem.address<float>() + thread * ItemsPerThread(),
                       ItemsPerThread());
   return HWY_DYNAMIC_DISPATCH(ComputeTile)(
       opsin, opsin_rect, dequant, ac_strategy, raw_quant_field, quantizer, r,
-      fast, use_dct8, &cmap->ytox_map, &cmap->ytob_map, &dc_values, scratch);
+      search, use_dct8, &cmap->ytox_map, &cmap->ytob_map, &dc_values, scratch);
 }
 
 Status ColorCorrelationEncodeDC(const ColorCorrelation& color_correlation,
@@ -18,6 +18,7 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/chroma_from_luma.h"
+#include "lib/jxl/common.h"
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/memory_manager_internal.h"
@@ -34,6 +35,19 @@ Status ColorCorrelationEncodeDC(const ColorCorrelation& color_correlation,
                                 BitWriter* writer, LayerType layer,
                                 AuxOut* aux_out);
 
+// How CfLHeuristics::ComputeTile estimates the multipliers of a color tile.
+enum class CfLSearch : uint8_t {
+  // Newton iterations on a robust cost of the color residuals.
+  kNewton,
+  // Closed-form least-squares solution, rounded to the nearest multiplier.
+  kLeastSquares,
+  // Closed-form least-squares solution, rounded to whichever of the two
+  // neighbouring multipliers has the lower robust cost.
+  kLeastSquaresRounded,
+};
+
+CfLSearch CfLSearchForSpeedTier(SpeedTier speed_tier);
+
 struct CfLHeuristics {
   explicit CfLHeuristics(JxlMemoryManager* memory_manager)
       : memory_manager(memory_manager) {}
@@ -50,7 +64,8 @@ struct CfLHeuristics {
                      const Rect& opsin_rect, const DequantMatrices& dequant,
                      const AcStrategyImage* ac_strategy,
                      const ImageI* raw_quant_field, const Quantizer* quantizer,
-                     bool fast, size_t thread, ColorCorrelationMap* cmap);
+                     CfLSearch search, size_t thread,
+                     ColorCorrelationMap* cmap);
 
   JxlMemoryManager* memory_manager;
   ImageF dc_values;
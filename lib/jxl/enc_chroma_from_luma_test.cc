@@ -0,0 +1,124 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/enc_chroma_from_luma.h"
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/rect.h"
+#include "lib/jxl/chroma_from_luma.h"
+#include "lib/jxl/cms/opsin_params.h"
+#include "lib/jxl/common.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/quant_weights.h"
+#include "lib/jxl/test_memory_manager.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace {
+
+struct Multipliers {
+  int32_t ytox;
+  int32_t ytob;
+};
+
+// Fills a single color tile whose X and B channels are the luma times
+// `ytox` / `ytob` (in units of 1 / kDefaultColorFactor, relative to the default
+// correlation), plus uniform noise of the given amplitude.
+Image3F ChromaFromLumaTile(float ytox, float ytob, float noise) {
+  JXL_TEST_ASSIGN_OR_DIE(Image3F opsin,
+                         Image3F::Create(jxl::test::MemoryManager(),
+                                         kColorTileDim, kColorTileDim));
+  Rng rng(129);
+  for (size_t y = 0; y < kColorTileDim; ++y) {
+    float* JXL_RESTRICT row_x = opsin.PlaneRow(0, y);
+    float* JXL_RESTRICT row_y = opsin.PlaneRow(1, y);
+    float* JXL_RESTRICT row_b = opsin.PlaneRow(2, y);
+    for (size_t x = 0; x < kColorTileDim; ++x) {
+      const float luma = rng.UniformF(0.2f, 0.8f);
+      row_y[x] = luma;
+      row_x[x] = luma * ytox / kDefaultColorFactor +
+                 noise * rng.UniformF(-1.0f, 1.0f);
+      row_b[x] = luma * (jxl::cms::kYToBRatio + ytob / kDefaultColorFactor) +
+                 noise * rng.UniformF(-1.0f, 1.0f);
+    }
+  }
+  return opsin;
+}
+
+Multipliers ComputeMultipliers(const Image3F& opsin, CfLSearch search) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  DequantMatrices dequant;
+  EXPECT_TRUE(dequant.EnsureComputed(memory_manager, ~0u));
+  const Rect rect(opsin);
+  JXL_TEST_ASSIGN_OR_DIE(
+      ColorCorrelationMap cmap,
+      ColorCorrelationMap::Create(memory_manager, rect.xsize(), rect.ysize()));
+  CfLHeuristics cfl_heuristics(memory_manager);
+  EXPECT_TRUE(cfl_heuristics.Init(rect));
+  EXPECT_TRUE(cfl_heuristics.PrepareForThreads(1));
+  // Without an AC strategy, the tile is transformed with DCT8 only.
+  EXPECT_TRUE(cfl_heuristics.ComputeTile(
+      Rect(0, 0, kColorTileDimInBlocks, kColorTileDimInBlocks), opsin, rect,
+      dequant, /*ac_strategy=*/nullptr, /*raw_quant_field=*/nullptr,
+      /*quantizer=*/nullptr, search, /*thread=*/0, &cmap));
+  return {cmap.ytox_map.Row(0)[0], cmap.ytob_map.Row(0)[0]};
+}
+
+TEST(EncChromaFromLumaTest, SearchForSpeedTier) {
+  // Efforts 5 and 6 keep the closed-form solution, efforts 8 and above the
+  // Newton search; only effort 7 rounds by cost.
+  EXPECT_EQ(CfLSearchForSpeedTier(SpeedTier::kHare), CfLSearch::kLeastSquares);
+  EXPECT_EQ(CfLSearchForSpeedTier(SpeedTier::kWombat),
+            CfLSearch::kLeastSquares);
+  EXPECT_EQ(CfLSearchForSpeedTier(SpeedTier::kSquirrel),
+            CfLSearch::kLeastSquaresRounded);
+  EXPECT_EQ(CfLSearchForSpeedTier(SpeedTier::kKitten), CfLSearch::kNewton);
+  EXPECT_EQ(CfLSearchForSpeedTier(SpeedTier::kTortoise), CfLSearch::kNewton);
+}
+
+TEST(EncChromaFromLumaTest, ExactCorrelation) {
+  // Without noise, the closed-form solution is exact, before it is moved
+  // towards zero by 2.6. (The robust cost of the Newton search has a kink at
+  // zero residuals, so it is only checked on noisy input below.)
+  const Image3F opsin = ChromaFromLumaTile(20.0f, -30.0f, 0.0f);
+  const Image3F uncorrelated = ChromaFromLumaTile(2.0f, -2.0f, 0.0f);
+  for (CfLSearch search :
+       {CfLSearch::kLeastSquares, CfLSearch::kLeastSquaresRounded}) {
+    const Multipliers m = ComputeMultipliers(opsin, search);
+    EXPECT_EQ(m.ytox, 17);
+    EXPECT_EQ(m.ytob, -27);
+    // Small correlations are rounded to zero.
+    const Multipliers zero = ComputeMultipliers(uncorrelated, search);
+    EXPECT_EQ(zero.ytox, 0);
+    EXPECT_EQ(zero.ytob, 0);
+  }
+}
+
+TEST(EncChromaFromLumaTest, NoisyCorrelation) {
+  const Image3F opsin = ChromaFromLumaTile(-12.0f, 25.0f, 0.05f);
+  const Multipliers newton = ComputeMultipliers(opsin, CfLSearch::kNewton);
+  const Multipliers ls = ComputeMultipliers(opsin, CfLSearch::kLeastSquares);
+  const Multipliers rounded =
+      ComputeMultipliers(opsin, CfLSearch::kLeastSquaresRounded);
+  // Rounding by cost only chooses the other neighbour of the least-squares
+  // solution.
+  EXPECT_LE(std::abs(rounded.ytox - ls.ytox), 1);
+  EXPECT_LE(std::abs(rounded.ytob - ls.ytob), 1);
+  // All searches stay close to the actual correlation.
+  for (const Multipliers& m : {newton, ls, rounded}) {
+    EXPECT_NEAR(m.ytox, -12 + 2.6, 1);
+    EXPECT_NEAR(m.ytob, 25 - 2.6, 1);
+  }
+}
+
+}  // namespace
+}  // namespace jxl
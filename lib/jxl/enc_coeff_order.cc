@@ -6,6 +6,7 @@
 #include <jxl/memory_manager.h>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
@@ -16,6 +17,7 @@
 
 #include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/coeff_order.h"
@@ -63,12 +65,36 @@ std::pair<uint32_t, uint32_t> ComputeUsedOrders(
   return {ret, ret_customize};
 }
 
+namespace {
+
+// Xorshift128+ adapted from xorshift128+-inl.h
+bool UseSample(uint64_t threshold, uint64_t* JXL_RESTRICT s) {
+  auto s1 = s[0];
+  const auto s0 = s[1];
+  const auto bits = s1 + s0;  // b, c
+  s[0] = s0;
+  s1 ^= s1 << 23;
+  s1 ^= s0 ^ (s1 >> 18) ^ (s0 >> 5);
+  s[1] = s1;
+  return (bits >> 32) <= threshold;
+}
+
+Rect GroupRectInBlocks(const FrameDimensions& frame_dim, size_t group_index) {
+  const size_t gx = group_index % frame_dim.xsize_groups;
+  const size_t gy = group_index / frame_dim.xsize_groups;
+  return Rect(gx * kGroupDimInBlocks, gy * kGroupDimInBlocks,
+              kGroupDimInBlocks, kGroupDimInBlocks, frame_dim.xsize_blocks,
+              frame_dim.ysize_blocks);
+}
+
+}  // namespace
+
 Status ComputeCoeffOrder(SpeedTier speed, const ACImage& ac_image,
                          const AcStrategyImage& ac_strategy,
                          const FrameDimensions& frame_dim,
                          uint32_t& all_used_orders, uint32_t prev_used_acs,
                          uint32_t current_used_acs,
-                         uint32_t current_used_orders,
+                         uint32_t current_used_orders, ThreadPool* pool,
                          coeff_order_t* JXL_RESTRICT order) {
   JxlMemoryManager* memory_manager = ac_strategy.memory_manager();
   std::vector<int64_t> num_zeros(kCoeffOrderMaxSize);
@@ -80,34 +106,57 @@ Status ComputeCoeffOrder(SpeedTier speed, const ACImage& ac_image,
   if (speed >= SpeedTier::kSquirrel && current_used_orders == 1) {
     block_fraction = 0.5f;
   }
-  // No need to compute number of zero coefficients if all orders are the
-  // default.
-  if (current_used_orders != 0) {
+  // Orders whose number of zero coefficients is looked at below; there is no
+  // need to count anything if all orders are the default or already fixed.
+  const uint32_t counted_orders = current_used_orders & current_used_acs &
+                                  ~prev_used_acs & ~all_used_orders;
+  if (counted_orders != 0) {
+    const bool sample = block_fraction < 1.0;
     uint64_t threshold =
         (std::numeric_limits<uint64_t>::max() >> 32) * block_fraction;
-    uint64_t s[2] = {static_cast<uint64_t>(0x94D049BB133111EBull),
-                     static_cast<uint64_t>(0xBF58476D1CE4E5B9ull)};
-    // Xorshift128+ adapted from xorshift128+-inl.h
-    auto use_sample = [&]() {
-      auto s1 = s[0];
-      const auto s0 = s[1];
-      const auto bits = s1 + s0;  // b, c
-      s[0] = s0;
-      s1 ^= s1 << 23;
-      s1 ^= s0 ^ (s1 >> 18) ^ (s0 >> 5);
-      s[1] = s1;
-      return (bits >> 32) <= threshold;
-    };
+    // Sampling state at the start of each group, so that groups can be
+    // processed in any order and still sample the same blocks.
+    std::vector<std::array<uint64_t, 2>> group_rng(
+        frame_dim.num_groups, {static_cast<uint64_t>(0x94D049BB133111EBull),
+                               static_cast<uint64_t>(0xBF58476D1CE4E5B9ull)});
+    if (sample) {
+      std::array<uint64_t, 2> s = group_rng[0];
+      for (size_t group_index = 0; group_index < frame_dim.num_groups;
+           group_index++) {
+        group_rng[group_index] = s;
+        const Rect rect = GroupRectInBlocks(frame_dim, group_index);
+        for (size_t by = 0; by < rect.ysize(); ++by) {
+          AcStrategyRow acs_row = ac_strategy.ConstRow(rect, by);
+          for (size_t bx = 0; bx < rect.xsize(); ++bx) {
+            if (acs_row[bx].IsFirstBlock()) UseSample(threshold, s.data());
+          }
+        }
+      }
+    }
+    // Only the counters of the counted orders are needed; orders are laid out
+    // by increasing transform size.
+    size_t num_counters = 0;
+    for (size_t ord = 0; ord < kNumOrders; ord++) {
+      if (counted_orders & (1u << ord)) {
+        num_counters = CoeffOrderOffset(ord, 3);
+      }
+    }
 
-    // Count number of zero coefficients, separately for each DCT band.
-    // TODO(veluca): precompute when doing DCT.
-    for (size_t group_index = 0; group_index < frame_dim.num_groups;
-         group_index++) {
-      const size_t gx = group_index % frame_dim.xsize_groups;
-      const size_t gy = group_index / frame_dim.xsize_groups;
-      const Rect rect(gx * kGroupDimInBlocks, gy * kGroupDimInBlocks,
-                      kGroupDimInBlocks, kGroupDimInBlocks,
-                      frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+    // Count number of zero coefficients, separately for each DCT band. Each
+    // thread counts into its own histogram; they are summed up at the end.
+    std::vector<std::vector<int64_t>> thread_num_zeros;
+    std::vector<uint32_t> thread_seen_orders;
+    const auto init = [&](const size_t num_threads) -> Status {
+      thread_num_zeros.assign(num_threads,
+                              std::vector<int64_t>(num_counters, 0));
+      thread_seen_orders.assign(num_threads, 0);
+      return true;
+    };
+    const auto count_zeros = [&](const uint32_t group_index,
+                                 const size_t thread) -> Status {
+      int64_t* JXL_RESTRICT zeros = thread_num_zeros[thread].data();
+      const Rect rect = GroupRectInBlocks(frame_dim, group_index);
+      std::array<uint64_t, 2> s = group_rng[group_index];
       ConstACPtr rows[3];
       ACType type = ac_image.Type();
       for (size_t c = 0; c < 3; c++) {
@@ -121,33 +170,56 @@ Status ComputeCoeffOrder(SpeedTier speed, const ACImage& ac_image,
         for (size_t bx = 0; bx < rect.xsize(); ++bx) {
           AcStrategy acs = acs_row[bx];
           if (!acs.IsFirstBlock()) continue;
-          if (!use_sample()) continue;
           size_t size = kDCTBlockSize << acs.log2_covered_blocks();
+          const size_t offset = ac_offset;
+          ac_offset += size;
+          if (sample && !UseSample(threshold, s.data())) continue;
+          const uint8_t ord = kStrategyOrder[acs.RawStrategy()];
+          if (!(counted_orders & (1u << ord))) continue;
+          thread_seen_orders[thread] |= 1u << ord;
           for (size_t c = 0; c < 3; ++c) {
-            const size_t order_offset =
-                CoeffOrderOffset(kStrategyOrder[acs.RawStrategy()], c);
+            int64_t* JXL_RESTRICT order_zeros =
+                zeros + CoeffOrderOffset(ord, c);
             if (type == ACType::k16) {
+              const int16_t* JXL_RESTRICT ac = rows[c].ptr16 + offset;
               for (size_t k = 0; k < size; k++) {
-                bool is_zero = rows[c].ptr16[ac_offset + k] == 0;
-                num_zeros[order_offset + k] += is_zero ? 1 : 0;
+                order_zeros[k] += ac[k] == 0 ? 1 : 0;
               }
             } else {
+              const int32_t* JXL_RESTRICT ac = rows[c].ptr32 + offset;
               for (size_t k = 0; k < size; k++) {
-                bool is_zero = rows[c].ptr32[ac_offset + k] == 0;
-                num_zeros[order_offset + k] += is_zero ? 1 : 0;
-              }
-            }
-            // Ensure LLFs are first in the order.
-            size_t cx = acs.covered_blocks_x();
-            size_t cy = acs.covered_blocks_y();
-            CoefficientLayout(&cy, &cx);
-            for (size_t iy = 0; iy < cy; iy++) {
-              for (size_t ix = 0; ix < cx; ix++) {
-                num_zeros[order_offset + iy * kBlockDim * cx + ix] = -1;
+                order_zeros[k] += ac[k] == 0 ? 1 : 0;
               }
             }
           }
-          ac_offset += size;
+        }
+      }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, frame_dim.num_groups, init,
+                                  count_zeros, "CountZeros"));
+
+    uint32_t seen_orders = 0;
+    for (size_t t = 0; t < thread_num_zeros.size(); t++) {
+      for (size_t i = 0; i < num_counters; i++) {
+        num_zeros[i] += thread_num_zeros[t][i];
+      }
+      seen_orders |= thread_seen_orders[t];
+    }
+    // Ensure LLFs are first in the order.
+    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
+      const uint8_t ord = kStrategyOrder[o];
+      if (!(seen_orders & (1u << ord))) continue;
+      AcStrategy acs = AcStrategy::FromRawStrategy(o);
+      size_t cx = acs.covered_blocks_x();
+      size_t cy = acs.covered_blocks_y();
+      CoefficientLayout(&cy, &cx);
+      for (size_t c = 0; c < 3; ++c) {
+        const size_t order_offset = CoeffOrderOffset(ord, c);
+        for (size_t iy = 0; iy < cy; iy++) {
+          for (size_t ix = 0; ix < cx; ix++) {
+            num_zeros[order_offset + iy * kBlockDim * cx + ix] = -1;
+          }
         }
       }
     }
@@ -11,6 +11,7 @@
 #include <utility>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/coeff_order_fwd.h"
@@ -38,7 +39,7 @@ Status ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
                          const FrameDimensions& frame_dim,
                          uint32_t& all_used_orders, uint32_t prev_used_acs,
                          uint32_t current_used_acs,
-                         uint32_t current_used_orders,
+                         uint32_t current_used_orders, ThreadPool* pool,
                          coeff_order_t* JXL_RESTRICT order);
 
 Status EncodeCoeffOrders(uint16_t used_orders,
@@ -47,13 +47,12 @@ using hwy::HWY_NAMESPACE::Add;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::Sub;
 
-StatusOr<ImageF> SumOfSquareDifferences(const Image3F& forig,
-                                        const Image3F& smooth,
+// Only the Y channel contributes to the energy.
+StatusOr<ImageF> SumOfSquareDifferences(const ImageF& forig,
+                                        const ImageF& smooth,
                                         ThreadPool* pool) {
   const HWY_FULL(float) d;
-  const auto color_coef0 = Set(d, 0.0f);
   const auto color_coef1 = Set(d, 10.0f);
-  const auto color_coef2 = Set(d, 0.0f);
   JxlMemoryManager* memory_manager = forig.memory_manager();
 
   JXL_ASSIGN_OR_RETURN(
@@ -61,22 +60,13 @@ StatusOr<ImageF> SumOfSquareDifferences(const Image3F& forig,
       ImageF::Create(memory_manager, forig.xsize(), forig.ysize()));
   const auto process_row = [&](const uint32_t task, size_t thread) -> Status {
     const size_t y = static_cast<size_t>(task);
-    const float* JXL_RESTRICT orig_row0 = forig.Plane(0).ConstRow(y);
-    const float* JXL_RESTRICT orig_row1 = forig.Plane(1).ConstRow(y);
-    const float* JXL_RESTRICT orig_row2 = forig.Plane(2).ConstRow(y);
-    const float* JXL_RESTRICT smooth_row0 = smooth.Plane(0).ConstRow(y);
-    const float* JXL_RESTRICT smooth_row1 = smooth.Plane(1).ConstRow(y);
-    const float* JXL_RESTRICT smooth_row2 = smooth.Plane(2).ConstRow(y);
+    const float* JXL_RESTRICT orig_row1 = forig.ConstRow(y);
+    const float* JXL_RESTRICT smooth_row1 = smooth.ConstRow(y);
     float* JXL_RESTRICT sos_row = sum_of_squares.Row(y);
 
     for (size_t x = 0; x < forig.xsize(); x += Lanes(d)) {
-      auto v0 = Sub(Load(d, orig_row0 + x), Load(d, smooth_row0 + x));
       auto v1 = Sub(Load(d, orig_row1 + x), Load(d, smooth_row1 + x));
-      auto v2 = Sub(Load(d, orig_row2 + x), Load(d, smooth_row2 + x));
-      v0 = Mul(Mul(v0, v0), color_coef0);
-      v1 = Mul(Mul(v1, v1), color_coef1);
-      v2 = Mul(Mul(v2, v2), color_coef2);
-      const auto sos = Add(v0, Add(v1, v2));  // weighted sum of square diffs
+      const auto sos = Mul(Mul(v1, v1), color_coef1);
       Store(sos, d, sos_row + x);
     }
     return true;
@@ -153,8 +143,7 @@ StatusOr<ImageF> ComputeEnergyImage(const Image3F& orig, Image3F* smooth,
   JxlMemoryManager* memory_manager = orig.memory_manager();
   // Prepare guidance images for dot selection.
   JXL_ASSIGN_OR_RETURN(
-      Image3F forig,
-      Image3F::Create(memory_manager, orig.xsize(), orig.ysize()));
+      ImageF forig, ImageF::Create(memory_manager, orig.xsize(), orig.ysize()));
   JXL_ASSIGN_OR_RETURN(
       *smooth, Image3F::Create(memory_manager, orig.xsize(), orig.ysize()));
   Rect rect(orig);
@@ -165,14 +154,14 @@ StatusOr<ImageF> ComputeEnergyImage(const Image3F& orig, Image3F* smooth,
   for (size_t c = 0; c < 3; ++c) {
     // Use forig as temporary storage to reduce memory and keep it warmer.
     JXL_RETURN_IF_ERROR(
-        Separable5(orig.Plane(c), rect, weights3, pool, &forig.Plane(c)));
+        Separable5(orig.Plane(c), rect, weights3, pool, &forig));
     JXL_RETURN_IF_ERROR(
-        Separable5(forig.Plane(c), rect, weights3, pool, &smooth->Plane(c)));
-    JXL_RETURN_IF_ERROR(
-        Separable5(orig.Plane(c), rect, weights1, pool, &forig.Plane(c)));
+        Separable5(forig, rect, weights3, pool, &smooth->Plane(c)));
   }
+  JXL_RETURN_IF_ERROR(Separable5(orig.Plane(1), rect, weights1, pool, &forig));
 
-  return HWY_DYNAMIC_DISPATCH(SumOfSquareDifferences)(forig, *smooth, pool);
+  return HWY_DYNAMIC_DISPATCH(SumOfSquareDifferences)(forig, smooth->Plane(1),
+                                                      pool);
 }
 
 struct Pixel {
@@ -187,10 +176,17 @@ Pixel operator+(const Pixel& a, const Pixel& b) {
 // Maximum area in pixels of a ellipse
 const size_t kMaxCCSize = 1000;
 
+// Energy of a pixel, or zero if it already belongs to a component.
+inline float RemainingEnergy(const Rect& rect, const ImageF& energy,
+                             const ImageB& taken, size_t x, size_t y) {
+  return rect.ConstRow(taken, y)[x] ? 0.0f : rect.ConstRow(energy, y)[x];
+}
+
 // Extracts a connected component from a Binary image where seed is part
 // of the component
-bool ExtractComponent(const Rect& rect, ImageF* img, std::vector<Pixel>* pixels,
-                      const Pixel& seed, double threshold) {
+bool ExtractComponent(const Rect& rect, const ImageF& energy, ImageB* taken,
+                      std::vector<Pixel>* pixels, const Pixel& seed,
+                      double threshold) {
   static const std::vector<Pixel> neighbors{{1, -1}, {1, 0},   {1, 1},  {0, -1},
                                             {0, 1},  {-1, -1}, {-1, 1}, {1, 0}};
   std::vector<Pixel> q{seed};
@@ -203,9 +199,9 @@ bool ExtractComponent(const Rect& rect, ImageF* img, std::vector<Pixel>* pixels,
       Pixel child = current + delta;
       if (child.x >= 0 && static_cast<size_t>(child.x) < rect.xsize() &&
           child.y >= 0 && static_cast<size_t>(child.y) < rect.ysize()) {
-        float* value = &rect.Row(img, child.y)[child.x];
-        if (*value > threshold) {
-          *value = 0.0;
+        if (RemainingEnergy(rect, energy, *taken, child.x, child.y) >
+            threshold) {
+          rect.Row(taken, child.y)[child.x] = 1;
           q.push_back(child);
         }
       }
@@ -294,49 +290,70 @@ Rect BoundingRectangle(const std::vector<Pixel>& pixels) {
   return Rect(low_x, low_y, high_x - low_x + 1, high_y - low_y + 1);
 }
 
-StatusOr<std::vector<ConnectedComponent>> FindCC(const ImageF& energy,
-                                                 const Rect& rect, double t_low,
-                                                 double t_high,
-                                                 uint32_t maxWindow,
-                                                 double minScore) {
+StatusOr<std::vector<ConnectedComponent>> FindCC(
+    const ImageF& energy, const Rect& rect, double t_low, double t_high,
+    uint32_t maxWindow, double minScore, ThreadPool* pool) {
   const int kExtraRect = 4;
   JxlMemoryManager* memory_manager = energy.memory_manager();
-  JXL_ASSIGN_OR_RETURN(
-      ImageF img,
-      ImageF::Create(memory_manager, energy.xsize(), energy.ysize()));
-  JXL_RETURN_IF_ERROR(CopyImageTo(energy, &img));
-  std::vector<ConnectedComponent> ans;
-  for (size_t y = 0; y < rect.ysize(); y++) {
-    float* JXL_RESTRICT row = rect.Row(&img, y);
+  // Pixels above t_high are rare, so look for them in parallel first. Only
+  // the extraction of the components is serial, as each one takes the pixels
+  // it reaches away from the components that follow.
+  std::vector<std::vector<Pixel>> row_seeds(rect.ysize());
+  const auto find_seeds = [&](const uint32_t y, size_t /* thread */) -> Status {
+    const float* JXL_RESTRICT row = rect.ConstRow(energy, y);
     for (size_t x = 0; x < rect.xsize(); x++) {
       if (row[x] > t_high) {
-        std::vector<Pixel> pixels;
-        row[x] = 0.0;
-        Pixel seed = Pixel{static_cast<int>(x), static_cast<int>(y)};
-        bool success = ExtractComponent(rect, &img, &pixels, seed, t_low);
-        if (!success) continue;
+        row_seeds[y].push_back(Pixel{static_cast<int>(x), static_cast<int>(y)});
+      }
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, rect.ysize(), ThreadPool::NoInit,
+                                find_seeds, "FindDotSeeds"));
+  JXL_ASSIGN_OR_RETURN(
+      ImageB taken,
+      ImageB::Create(memory_manager, energy.xsize(), energy.ysize()));
+  ZeroFillImage(&taken);
+  std::vector<ConnectedComponent> candidates;
+  for (const std::vector<Pixel>& seeds : row_seeds) {
+    for (const Pixel& seed : seeds) {
+      if (!(RemainingEnergy(rect, energy, taken, seed.x, seed.y) > t_high)) {
+        continue;
+      }
+      std::vector<Pixel> pixels;
+      rect.Row(&taken, seed.y)[seed.x] = 1;
+      bool success =
+          ExtractComponent(rect, energy, &taken, &pixels, seed, t_low);
+      if (!success) continue;
 #if JXL_DEBUG_DOT_DETECT
-        for (size_t i = 0; i < pixels.size(); i++) {
-          fprintf(stderr, "(%d,%d) ", pixels[i].x, pixels[i].y);
-        }
-        fprintf(stderr, "\n");
+      for (size_t i = 0; i < pixels.size(); i++) {
+        fprintf(stderr, "(%d,%d) ", pixels[i].x, pixels[i].y);
+      }
+      fprintf(stderr, "\n");
 #endif  // JXL_DEBUG_DOT_DETECT
-        Rect bounds = BoundingRectangle(pixels);
-        if (bounds.xsize() < maxWindow && bounds.ysize() < maxWindow) {
-          ConnectedComponent cc{bounds, std::move(pixels)};
-          cc.CompStats(energy, rect, kExtraRect);
-          if (cc.score < minScore) continue;
-          JXL_DEBUG(JXL_DEBUG_DOT_DETECT,
-                    "cc mode: (%d,%d), max: %f, bgMean: %f bgVar: "
-                    "%f bound:(%" PRIuS ",%" PRIuS ",%" PRIuS ",%" PRIuS ")\n",
-                    cc.mode.x, cc.mode.y, cc.maxEnergy, cc.meanEnergy,
-                    cc.varEnergy, cc.bounds.x0(), cc.bounds.y0(),
-                    cc.bounds.xsize(), cc.bounds.ysize());
-          ans.push_back(cc);
-        }
+      Rect bounds = BoundingRectangle(pixels);
+      if (bounds.xsize() < maxWindow && bounds.ysize() < maxWindow) {
+        candidates.emplace_back(bounds, std::move(pixels));
       }
     }
   }
+  const auto comp_stats = [&](const uint32_t i, size_t /* thread */) -> Status {
+    candidates[i].CompStats(energy, rect, kExtraRect);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, candidates.size(),
+                                ThreadPool::NoInit, comp_stats, "DotStats"));
+  std::vector<ConnectedComponent> ans;
+  for (ConnectedComponent& cc : candidates) {
+    if (cc.score < minScore) continue;
+    JXL_DEBUG(JXL_DEBUG_DOT_DETECT,
+              "cc mode: (%d,%d), max: %f, bgMean: %f bgVar: "
+              "%f bound:(%" PRIuS ",%" PRIuS ",%" PRIuS ",%" PRIuS ")\n",
+              cc.mode.x, cc.mode.y, cc.maxEnergy, cc.meanEnergy, cc.varEnergy,
+              cc.bounds.x0(), cc.bounds.y0(), cc.bounds.xsize(),
+              cc.bounds.ysize());
+    ans.push_back(std::move(cc));
+  }
   return ans;
 }
 
@@ -553,15 +570,12 @@ StatusOr<GaussianEllipse> FitGaussian(const ConnectedComponent& cc,
 StatusOr<std::vector<PatchInfo>> DetectGaussianEllipses(
     const Image3F& opsin, const Rect& rect, const GaussianDetectParams& params,
     const EllipseQuantParams& qParams, ThreadPool* pool) {
-  JxlMemoryManager* memory_manager = opsin.memory_manager();
   std::vector<PatchInfo> dots;
-  JXL_ASSIGN_OR_RETURN(
-      Image3F smooth,
-      Image3F::Create(memory_manager, opsin.xsize(), opsin.ysize()));
+  Image3F smooth;
   JXL_ASSIGN_OR_RETURN(ImageF energy, ComputeEnergyImage(opsin, &smooth, pool));
   JXL_ASSIGN_OR_RETURN(std::vector<ConnectedComponent> components,
                        FindCC(energy, rect, params.t_low, params.t_high,
-                              params.maxWinSize, params.minScore));
+                              params.maxWinSize, params.minScore, pool));
   size_t numCC =
       std::min(params.maxCC, (components.size() * params.percCC) / 100);
   if (components.size() > numCC) {
@@ -572,9 +586,17 @@ StatusOr<std::vector<PatchInfo>> DetectGaussianEllipses(
         });
     components.erase(components.begin() + numCC, components.end());
   }
-  for (const auto& cc : components) {
-    JXL_ASSIGN_OR_RETURN(GaussianEllipse ellipse,
-                         FitGaussian(cc, rect, opsin, smooth));
+  std::vector<GaussianEllipse> ellipses(components.size());
+  const auto fit = [&](const uint32_t i, size_t /* thread */) -> Status {
+    JXL_ASSIGN_OR_RETURN(ellipses[i],
+                         FitGaussian(components[i], rect, opsin, smooth));
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, components.size(),
+                                ThreadPool::NoInit, fit, "FitGaussian"));
+  for (size_t i = 0; i < components.size(); i++) {
+    const ConnectedComponent& cc = components[i];
+    const GaussianEllipse& ellipse = ellipses[i];
     if (ellipse.x < 0.0 ||
         std::ceil(ellipse.x) >= static_cast<double>(rect.xsize()) ||
         ellipse.y < 0.0 ||
@@ -175,11 +175,15 @@ uint32_t GetBitDepth(JxlBitDepth bit_depth, const T& metadata,
   }
 }
 
+// If `to_xyb` and the input format allows it, converts the color channels
+// directly to XYB (and their linear sRGB version to `linear`, if not null),
+// and sets `*is_xyb`.
 Status CopyColorChannels(JxlChunkedFrameInputSource input, Rect rect,
                          const FrameInfo& frame_info,
-                         const ImageMetadata& metadata, ThreadPool* pool,
-                         Image3F* color, ImageF* alpha,
-                         bool* has_interleaved_alpha) {
+                         const ImageMetadata& metadata, bool to_xyb,
+                         ThreadPool* pool, Image3F* color, Image3F* linear,
+                         ImageF* alpha, bool* has_interleaved_alpha,
+                         bool* is_xyb) {
   JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
   input.get_color_channels_pixel_format(input.opaque, &format);
   format.align = 0;  // align must be ignored.
@@ -201,14 +205,22 @@ Status CopyColorChannels(JxlChunkedFrameInputSource input, Rect rect,
                        color_channels, format.num_channels);
   }
   const uint8_t* data = reinterpret_cast<const uint8_t*>(buffer.get());
-  for (size_t c = 0; c < color_channels; ++c) {
-    JXL_RETURN_IF_ERROR(ConvertFromExternalPlaneNoSizeCheck(
-        data, rect.xsize(), rect.ysize(), row_offset, bits_per_sample, format,
-        c, pool, &color->Plane(c)));
-  }
-  if (color_channels == 1) {
-    JXL_RETURN_IF_ERROR(CopyImageTo(color->Plane(0), &color->Plane(1)));
-    JXL_RETURN_IF_ERROR(CopyImageTo(color->Plane(0), &color->Plane(2)));
+  *is_xyb = to_xyb && CanConvertExternalToXYB(metadata.color_encoding, format,
+                                              bits_per_sample);
+  if (*is_xyb) {
+    JXL_RETURN_IF_ERROR(ExternalToXYB(
+        data, row_offset, format, bits_per_sample, metadata.color_encoding,
+        metadata.IntensityTarget(), pool, color, linear));
+  } else {
+    for (size_t c = 0; c < color_channels; ++c) {
+      JXL_RETURN_IF_ERROR(ConvertFromExternalPlaneNoSizeCheck(
+          data, rect.xsize(), rect.ysize(), row_offset, bits_per_sample,
+          format, c, pool, &color->Plane(c)));
+    }
+    if (color_channels == 1) {
+      JXL_RETURN_IF_ERROR(CopyImageTo(color->Plane(0), &color->Plane(1)));
+      JXL_RETURN_IF_ERROR(CopyImageTo(color->Plane(0), &color->Plane(2)));
+    }
   }
   if (alpha) {
     if (*has_interleaved_alpha) {
@@ -691,13 +703,14 @@ void ComputeChromacityAdjustments(const CompressParams& cparams,
   frame_header->b_qm_scale = 2 + pixel_stats.HowMuchIsBChannelPixelized();
 }
 
-void ComputeNoiseParams(const CompressParams& cparams, bool streaming_mode,
-                        bool color_is_jpeg, const Image3F& opsin,
-                        const FrameDimensions& frame_dim,
-                        FrameHeader* frame_header, NoiseParams* noise_params) {
+Status ComputeNoiseParams(const CompressParams& cparams, bool streaming_mode,
+                          bool color_is_jpeg, const Image3F& opsin,
+                          const FrameDimensions& frame_dim, ThreadPool* pool,
+                          FrameHeader* frame_header,
+                          NoiseParams* noise_params) {
   if (frame_header->frame_type == FrameType::kDCFrame) {
     frame_header->flags &= ~FrameHeader::kNoise;
-    return;
+    return true;
   }
   if (cparams.photon_noise_iso > 0) {
     FrameDimensions full_frame_dim = frame_header->ToFrameDimensions();
@@ -731,10 +744,14 @@ void ComputeNoiseParams(const CompressParams& cparams, bool streaming_mode,
     if (rampup < 0.0f) {
       quality_coef = kNoiseRampupStart;
     }
-    if (!GetNoiseParameter(opsin, noise_params, quality_coef)) {
+    JXL_ASSIGN_OR_RETURN(bool has_noise,
+                         GetNoiseParameter(opsin, cparams.speed_tier,
+                                           noise_params, quality_coef, pool));
+    if (!has_noise) {
       frame_header->flags &= ~FrameHeader::kNoise;
     }
   }
+  return true;
 }
 
 Status DownsampleColorChannels(const CompressParams& cparams,
@@ -1168,17 +1185,20 @@ Status ComputeVarDCTEncodingData(const FrameHeader& frame_header,
 }
 
 Status ComputeAllCoeffOrders(PassesEncoderState& enc_state,
-                             const FrameDimensions& frame_dim) {
+                             const FrameDimensions& frame_dim,
+                             ThreadPool* pool) {
   auto used_orders_info = ComputeUsedOrders(
       enc_state.cparams.speed_tier, enc_state.shared.ac_strategy,
       Rect(enc_state.shared.raw_quant_field));
   enc_state.used_orders.resize(enc_state.progressive_splitter.GetNumPasses());
   for (size_t i = 0; i < enc_state.progressive_splitter.GetNumPasses(); i++) {
+    coeff_order_t* order =
+        &enc_state.shared.coeff_orders[i * enc_state.shared.coeff_order_size];
     JXL_RETURN_IF_ERROR(ComputeCoeffOrder(
         enc_state.cparams.speed_tier, *enc_state.coeffs[i],
         enc_state.shared.ac_strategy, frame_dim, enc_state.used_orders[i],
         enc_state.used_acs, used_orders_info.first, used_orders_info.second,
-        &enc_state.shared.coeff_orders[i * enc_state.shared.coeff_order_size]));
+        pool, order));
   }
   enc_state.used_acs |= used_orders_info.first;
   return true;
@@ -1197,43 +1217,99 @@ struct EncCache {
   }
   // TokenizeCoefficients
   Image3I num_nzeroes;
+  // Scratch tokens, used when the AC tokens are not kept per group.
+  std::vector<Token> tokens;
+  // Per-pass AC histograms of the groups tokenized by this thread.
+  std::vector<std::vector<Histogram>> histograms;
 };
 
+HistogramParams ACHistogramParams(const PassesEncoderState& enc_state) {
+  HistogramParams hist_params(enc_state.cparams.speed_tier,
+                              enc_state.shared.block_ctx_map.NumACContexts());
+  if (enc_state.cparams.speed_tier > SpeedTier::kTortoise) {
+    hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
+  }
+  if (enc_state.cparams.decoding_speed_tier >= 1) {
+    hist_params.max_histograms = 6;
+  }
+  hist_params.entropy_preset = enc_state.cparams.ac_entropy_preset.get();
+  return hist_params;
+}
+
+Status TokenizeGroup(const FrameHeader& frame_header,
+                     const PassesEncoderState& enc_state, size_t group_index,
+                     size_t idx_pass, EncCache* cache,
+                     std::vector<Token>* tokens) {
+  const PassesSharedState& shared = enc_state.shared;
+  const Rect rect = shared.frame_dim.BlockGroupRect(group_index);
+  JXL_ENSURE(enc_state.coeffs[idx_pass]->Type() == ACType::k32);
+  const int32_t* JXL_RESTRICT ac_rows[3] = {
+      enc_state.coeffs[idx_pass]->PlaneRow(0, group_index, 0).ptr32,
+      enc_state.coeffs[idx_pass]->PlaneRow(1, group_index, 0).ptr32,
+      enc_state.coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
+  };
+  // Ensure group cache is initialized.
+  JXL_RETURN_IF_ERROR(cache->InitOnce(enc_state.memory_manager()));
+  return TokenizeCoefficients(
+      &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect, ac_rows,
+      shared.ac_strategy, frame_header.chroma_subsampling, &cache->num_nzeroes,
+      tokens, shared.quant_dc, shared.raw_quant_field, shared.block_ctx_map);
+}
+
+// If `enc_state->retokenize_ac` is set, only the per-pass histograms of the
+// tokens are kept; EncodeGroups tokenizes each group again when writing it.
 Status TokenizeAllCoefficients(const FrameHeader& frame_header,
                                ThreadPool* pool,
                                PassesEncoderState* enc_state) {
   PassesSharedState& shared = enc_state->shared;
+  const size_t num_passes = enc_state->passes.size();
+  const size_t num_contexts = shared.block_ctx_map.NumACContexts();
+  const HistogramParams hist_params = ACHistogramParams(*enc_state);
+  const bool retokenize = enc_state->retokenize_ac;
   std::vector<EncCache> group_caches;
-  JxlMemoryManager* memory_manager = enc_state->memory_manager();
   const auto tokenize_group_init = [&](const size_t num_threads) -> Status {
     group_caches.resize(num_threads);
+    if (retokenize) {
+      for (EncCache& cache : group_caches) {
+        cache.histograms.assign(num_passes,
+                                std::vector<Histogram>(num_contexts));
+      }
+    }
     return true;
   };
   const auto tokenize_group = [&](const uint32_t group_index,
                                   const size_t thread) -> Status {
-    // Tokenize coefficients.
-    const Rect rect = shared.frame_dim.BlockGroupRect(group_index);
-    for (size_t idx_pass = 0; idx_pass < enc_state->passes.size(); idx_pass++) {
-      JXL_ENSURE(enc_state->coeffs[idx_pass]->Type() == ACType::k32);
-      const int32_t* JXL_RESTRICT ac_rows[3] = {
-          enc_state->coeffs[idx_pass]->PlaneRow(0, group_index, 0).ptr32,
-          enc_state->coeffs[idx_pass]->PlaneRow(1, group_index, 0).ptr32,
-          enc_state->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
-      };
-      // Ensure group cache is initialized.
-      JXL_RETURN_IF_ERROR(group_caches[thread].InitOnce(memory_manager));
-      JXL_RETURN_IF_ERROR(TokenizeCoefficients(
-          &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect,
-          ac_rows, shared.ac_strategy, frame_header.chroma_subsampling,
-          &group_caches[thread].num_nzeroes,
-          &enc_state->passes[idx_pass].ac_tokens[group_index], shared.quant_dc,
-          shared.raw_quant_field, shared.block_ctx_map));
+    EncCache& cache = group_caches[thread];
+    for (size_t idx_pass = 0; idx_pass < num_passes; idx_pass++) {
+      if (retokenize) {
+        JXL_RETURN_IF_ERROR(TokenizeGroup(frame_header, *enc_state,
+                                          group_index, idx_pass, &cache,
+                                          &cache.tokens));
+        AddTokensToHistograms(hist_params, cache.tokens,
+                              &cache.histograms[idx_pass]);
+      } else {
+        JXL_RETURN_IF_ERROR(TokenizeGroup(
+            frame_header, *enc_state, group_index, idx_pass, &cache,
+            &enc_state->passes[idx_pass].ac_tokens[group_index]));
+      }
     }
     return true;
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, shared.frame_dim.num_groups,
                                 tokenize_group_init, tokenize_group,
                                 "TokenizeGroup"));
+  if (retokenize) {
+    for (size_t idx_pass = 0; idx_pass < num_passes; idx_pass++) {
+      std::vector<Histogram>& histograms =
+          enc_state->passes[idx_pass].ac_histograms;
+      histograms.assign(num_contexts, Histogram());
+      for (const EncCache& cache : group_caches) {
+        for (size_t c = 0; c < num_contexts; c++) {
+          histograms[c].AddHistogram(cache.histograms[idx_pass][c]);
+        }
+      }
+    }
+  }
   return true;
 }
 
@@ -1286,14 +1362,7 @@ Status EncodeGlobalACInfo(PassesEncoderState* enc_state, BitWriter* writer,
     }
 
     // Encode histograms.
-    HistogramParams hist_params(enc_state->cparams.speed_tier,
-                                shared.block_ctx_map.NumACContexts());
-    if (enc_state->cparams.speed_tier > SpeedTier::kTortoise) {
-      hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
-    }
-    if (enc_state->cparams.decoding_speed_tier >= 1) {
-      hist_params.max_histograms = 6;
-    }
+    HistogramParams hist_params = ACHistogramParams(*enc_state);
     size_t num_histogram_groups = shared.num_histograms;
     if (enc_state->streaming_mode) {
       size_t prev_num_histograms =
@@ -1314,14 +1383,38 @@ Status EncodeGlobalACInfo(PassesEncoderState* enc_state, BitWriter* writer,
     }
     hist_params.streaming_mode = enc_state->streaming_mode;
     hist_params.initialize_global_state = enc_state->initialize_global_state;
-    JXL_ASSIGN_OR_RETURN(
-        size_t cost,
-        BuildAndEncodeHistograms(
-            memory_manager, hist_params,
-            num_histogram_groups * shared.block_ctx_map.NumACContexts(),
-            enc_state->passes[i].ac_tokens, &enc_state->passes[i].codes, writer,
-            LayerType::Ac, aux_out));
-    (void)cost;
+    const size_t num_contexts =
+        num_histogram_groups * shared.block_ctx_map.NumACContexts();
+    const bool collect_histograms = aux_out != nullptr &&
+                                    aux_out->collect_ac_histograms &&
+                                    !enc_state->streaming_mode;
+    if (enc_state->retokenize_ac) {
+      std::vector<Histogram>& histograms = enc_state->passes[i].ac_histograms;
+      histograms.resize(num_contexts);
+      if (collect_histograms) aux_out->AddACHistograms(histograms);
+      JXL_ASSIGN_OR_RETURN(
+          size_t cost,
+          BuildAndEncodeHistogramsFromCounts(
+              memory_manager, hist_params, histograms,
+              &enc_state->passes[i].codes, writer, LayerType::Ac, aux_out));
+      (void)cost;
+      histograms.clear();
+    } else {
+      if (collect_histograms) {
+        std::vector<Histogram> histograms(num_contexts);
+        for (const auto& tokens : enc_state->passes[i].ac_tokens) {
+          AddTokensToHistograms(hist_params, tokens, &histograms);
+        }
+        aux_out->AddACHistograms(histograms);
+      }
+      JXL_ASSIGN_OR_RETURN(
+          size_t cost,
+          BuildAndEncodeHistograms(memory_manager, hist_params, num_contexts,
+                                   enc_state->passes[i].ac_tokens,
+                                   &enc_state->passes[i].codes, writer,
+                                   LayerType::Ac, aux_out));
+      (void)cost;
+    }
   }
 
   return true;
@@ -1453,6 +1546,11 @@ Status EncodeGroups(const FrameHeader& frame_header,
         enc_state, get_output(global_ac_index), enc_modular, aux_out));
   }
 
+  std::vector<EncCache> group_caches;
+  const auto process_group_init = [&](const size_t num_threads) -> Status {
+    group_caches.resize(num_threads);
+    return resize_aux_outs(num_threads);
+  };
   const auto process_group = [&](const uint32_t group_index,
                                  const size_t thread) -> Status {
     AuxOut* my_aux_out = aux_outs[thread].get();
@@ -1467,8 +1565,18 @@ Status EncodeGroups(const FrameHeader& frame_header,
       JXL_DEBUG_V(2, "Encoding AC group %u [abs %" PRIuS "] pass %" PRIuS,
                   group_index, ac_group_id, i);
       if (frame_header.encoding == FrameEncoding::kVarDCT) {
+        const std::vector<Token>* tokens;
+        if (enc_state->retokenize_ac) {
+          EncCache& cache = group_caches[thread];
+          JXL_RETURN_IF_ERROR(TokenizeGroup(frame_header, *enc_state,
+                                            group_index, i, &cache,
+                                            &cache.tokens));
+          tokens = &cache.tokens;
+        } else {
+          tokens = &enc_state->passes[i].ac_tokens[group_index];
+        }
         JXL_RETURN_IF_ERROR(EncodeGroupTokenizedCoefficients(
-            group_index, i, enc_state->histogram_idx[group_index], *enc_state,
+            i, enc_state->histogram_idx[group_index], *tokens, *enc_state,
             ac_group_code(i, group_index), my_aux_out));
       }
       // Write all modular encoded data (color?, alpha, depth, extra channels)
@@ -1483,7 +1591,7 @@ Status EncodeGroups(const FrameHeader& frame_header,
     }
     return true;
   };
-  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_groups, resize_aux_outs,
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_groups, process_group_init,
                                 process_group, "EncodeGroupCoefficients"));
   // Resizing aux_outs to 0 also Assimilates the array.
   static_cast<void>(resize_aux_outs(0));
@@ -1580,12 +1688,25 @@ Status ComputeEncodingData(
   }
   ImageF* alpha = alpha_eci ? &extra_channels[alpha_idx] : nullptr;
   ImageF* black = black_eci ? &extra_channels[black_idx] : nullptr;
+  const bool to_xyb = frame_header.color_transform == ColorTransform::kXYB &&
+                      frame_info.ib_needs_color_transform;
+  Image3F linear_storage;
+  Image3F* linear = nullptr;
+  if (!jpeg_data && to_xyb && frame_header.encoding == FrameEncoding::kVarDCT &&
+      cparams.speed_tier <= SpeedTier::kKitten) {
+    JXL_ASSIGN_OR_RETURN(linear_storage,
+                         Image3F::Create(memory_manager, patch_rect.xsize(),
+                                         patch_rect.ysize()));
+    linear = &linear_storage;
+  }
+
   bool has_interleaved_alpha = false;
+  bool is_xyb = false;
   JxlChunkedFrameInputSource input = frame_data.GetInputSource();
   if (!jpeg_data) {
-    JXL_RETURN_IF_ERROR(CopyColorChannels(input, patch_rect, frame_info,
-                                          metadata->m, pool, &color, alpha,
-                                          &has_interleaved_alpha));
+    JXL_RETURN_IF_ERROR(CopyColorChannels(
+        input, patch_rect, frame_info, metadata->m, to_xyb, pool, &color,
+        linear, alpha, &has_interleaved_alpha, &is_xyb));
   }
   JXL_RETURN_IF_ERROR(CopyExtraChannels(input, patch_rect, frame_info,
                                         metadata->m, has_interleaved_alpha,
@@ -1593,21 +1714,12 @@ Status ComputeEncodingData(
 
   enc_state.cparams = cparams;
 
-  Image3F linear_storage;
-  Image3F* linear = nullptr;
-
   if (!jpeg_data) {
-    if (frame_header.color_transform == ColorTransform::kXYB &&
-        frame_info.ib_needs_color_transform) {
-      if (frame_header.encoding == FrameEncoding::kVarDCT &&
-          cparams.speed_tier <= SpeedTier::kKitten) {
-        JXL_ASSIGN_OR_RETURN(linear_storage,
-                             Image3F::Create(memory_manager, patch_rect.xsize(),
-                                             patch_rect.ysize()));
-        linear = &linear_storage;
+    if (to_xyb) {
+      if (!is_xyb) {
+        JXL_RETURN_IF_ERROR(ToXYB(c_enc, metadata->m.IntensityTarget(), black,
+                                  pool, &color, cms, linear));
       }
-      JXL_RETURN_IF_ERROR(ToXYB(c_enc, metadata->m.IntensityTarget(), black,
-                                pool, &color, cms, linear));
     } else {
       // Nothing to do.
       // RGB or YCbCr: forward YCbCr is not implemented, this is only used
@@ -1640,9 +1752,9 @@ Status ComputeEncodingData(
   }
 
   bool has_jpeg_data = (jpeg_data != nullptr);
-  ComputeNoiseParams(cparams, enc_state.streaming_mode, has_jpeg_data, color,
-                     frame_dim, &mutable_frame_header,
-                     &shared.image_features.noise_params);
+  JXL_RETURN_IF_ERROR(ComputeNoiseParams(
+      cparams, enc_state.streaming_mode, has_jpeg_data, color, frame_dim, pool,
+      &mutable_frame_header, &shared.image_features.noise_params));
 
   JXL_RETURN_IF_ERROR(
       DownsampleColorChannels(cparams, frame_header, has_jpeg_data, &color));
@@ -1659,8 +1771,16 @@ Status ComputeEncodingData(
 
   if (frame_header.encoding == FrameEncoding::kVarDCT) {
     enc_state.passes.resize(enc_state.progressive_splitter.GetNumPasses());
+    // With the more memory-conservative buffering modes, do not keep the AC
+    // tokens of the whole frame: only their histograms are needed before the
+    // groups are written. Requires a histogram setup without LZ77 or
+    // per-histogram hybrid uint search (effort 8 and faster).
+    enc_state.retokenize_ac = cparams.buffering >= 2 &&
+                              cparams.speed_tier > SpeedTier::kTortoise;
+    const size_t num_token_groups =
+        enc_state.retokenize_ac ? 0 : shared.frame_dim.num_groups;
     for (PassesEncoderState::PassData& pass : enc_state.passes) {
-      pass.ac_tokens.resize(shared.frame_dim.num_groups);
+      pass.ac_tokens.resize(num_token_groups);
     }
     if (jpeg_data) {
       JXL_RETURN_IF_ERROR(ComputeJPEGTranscodingData(
@@ -1670,7 +1790,7 @@ Status ComputeEncodingData(
           frame_header, linear, &color, group_rect, cms, pool, &enc_modular,
           &enc_state, aux_out));
     }
-    JXL_RETURN_IF_ERROR(ComputeAllCoeffOrders(enc_state, frame_dim));
+    JXL_RETURN_IF_ERROR(ComputeAllCoeffOrders(enc_state, frame_dim, pool));
     if (!enc_state.streaming_mode) {
       shared.num_histograms = 1;
       enc_state.histogram_idx.resize(frame_dim.num_groups);
@@ -540,8 +540,8 @@ Status ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
                                                    rect, dc);
 }
 
-Status EncodeGroupTokenizedCoefficients(size_t group_idx, size_t pass_idx,
-                                        size_t histogram_idx,
+Status EncodeGroupTokenizedCoefficients(size_t pass_idx, size_t histogram_idx,
+                                        const std::vector<Token>& tokens,
                                         const PassesEncoderState& enc_state,
                                         BitWriter* writer, AuxOut* aux_out) {
   // Select which histogram to use among those of the current pass.
@@ -560,9 +560,8 @@ Status EncodeGroupTokenizedCoefficients(size_t group_idx, size_t pass_idx,
   size_t context_offset =
       histogram_idx * enc_state.shared.block_ctx_map.NumACContexts();
   JXL_RETURN_IF_ERROR(
-      WriteTokens(enc_state.passes[pass_idx].ac_tokens[group_idx],
-                  enc_state.passes[pass_idx].codes, context_offset, writer,
-                  LayerType::AcTokens, aux_out));
+      WriteTokens(tokens, enc_state.passes[pass_idx].codes, context_offset,
+                  writer, LayerType::AcTokens, aux_out));
 
   return true;
 }
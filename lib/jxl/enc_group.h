@@ -7,9 +7,11 @@
 #define LIB_JXL_ENC_GROUP_H_
 
 #include <cstddef>
+#include <vector>
 
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/image.h"
 
@@ -22,8 +24,9 @@ struct PassesEncoderState;
 Status ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
                            const Image3F& opsin, const Rect& rect, Image3F* dc);
 
-Status EncodeGroupTokenizedCoefficients(size_t group_idx, size_t pass_idx,
-                                        size_t histogram_idx,
+// Writes the AC `tokens` of one group and pass.
+Status EncodeGroupTokenizedCoefficients(size_t pass_idx, size_t histogram_idx,
+                                        const std::vector<Token>& tokens,
                                         const PassesEncoderState& enc_state,
                                         BitWriter* writer, AuxOut* aux_out);
 
@@ -1051,7 +1051,7 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
       image_features.splines = FindSplines(*opsin);
     }
     JXL_RETURN_IF_ERROR(image_features.splines.InitializeDrawCache(
-        opsin->xsize(), opsin->ysize(), cmap.base()));
+        opsin->xsize(), opsin->ysize(), cmap.base(), pool));
     image_features.splines.SubtractFrom(opsin);
   }
 
@@ -1149,6 +1149,7 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
   }
 
   JXL_RETURN_IF_ERROR(cfl_heuristics.Init(rect));
+  const CfLSearch cfl_search = CfLSearchForSpeedTier(cparams.speed_tier);
   JXL_RETURN_IF_ERROR(acs_heuristics.Init(*opsin, rect, initial_quant_field,
                                           initial_quant_masking,
                                           initial_quant_masking1x1, &matrices));
@@ -1165,19 +1166,27 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
         std::min((tx + 1) * kEncTileDimInBlocks, frame_dim.xsize_blocks);
     Rect r(bx0, by0, bx1 - bx0, by1 - by0);
 
+    // Flat tiles have no AC left after quantization, so neither the
+    // transform search nor the color correlation map can make a difference.
+    const bool flat = acs_heuristics.IsFlat(r);
+
     // For speeds up to Wombat, we only compute the color correlation map
     // once we know the transform type and the quantization map.
-    if (cparams.speed_tier <= SpeedTier::kSquirrel) {
+    if (!flat && cparams.speed_tier <= SpeedTier::kSquirrel) {
       JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
           r, *opsin, rect, matrices,
           /*ac_strategy=*/nullptr,
           /*raw_quant_field=*/nullptr,
-          /*quantizer=*/nullptr, /*fast=*/false, thread, &cmap));
+          /*quantizer=*/nullptr, cfl_search, thread, &cmap));
     }
 
     // Choose block sizes.
-    JXL_RETURN_IF_ERROR(
-        acs_heuristics.ProcessRect(r, cmap, &ac_strategy, thread));
+    if (flat) {
+      JXL_RETURN_IF_ERROR(acs_heuristics.ProcessFlatRect(r, &ac_strategy));
+    } else {
+      JXL_RETURN_IF_ERROR(
+          acs_heuristics.ProcessRect(r, cmap, &ac_strategy, thread));
+    }
 
     // Always set the initial quant field, so we can compute the CfL map with
     // more accuracy. The initial quant field might change in slower modes, but
@@ -1188,10 +1197,10 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
     quantizer.SetQuantFieldRect(initial_quant_field, r, &raw_quant_field);
 
     // Compute a non-default CfL map if we are at Hare speed, or slower.
-    if (cparams.speed_tier <= SpeedTier::kHare) {
+    if (!flat && cparams.speed_tier <= SpeedTier::kHare) {
       JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
           r, *opsin, rect, matrices, &ac_strategy, &raw_quant_field, &quantizer,
-          /*fast=*/cparams.speed_tier >= SpeedTier::kWombat, thread, &cmap));
+          cfl_search, thread, &cmap));
     }
     return true;
   };
@@ -6,6 +6,7 @@
 #include "lib/jxl/enc_noise.h"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
@@ -15,43 +16,99 @@
 #include <utility>
 #include <vector>
 
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/enc_noise.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_optimize.h"
+#include "lib/jxl/enc_params.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/noise.h"
 
+HWY_BEFORE_NAMESPACE();
 namespace jxl {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Mul;
+
+// The noise model is built based on channel 0.5 * (X+Y) as we notice that it
+// is similar to the model 0.5 * (Y-X)
+Status ComputeNoiseChannel(const Image3F& opsin, ThreadPool* pool,
+                           ImageF* out) {
+  const HWY_FULL(float) d;
+  const auto half = Set(d, 0.5f);
+  const auto process_row = [&](const uint32_t task, size_t thread) -> Status {
+    const size_t y = static_cast<size_t>(task);
+    const float* JXL_RESTRICT row_x = opsin.ConstPlaneRow(0, y);
+    const float* JXL_RESTRICT row_y = opsin.ConstPlaneRow(1, y);
+    float* JXL_RESTRICT row_out = out->Row(y);
+    for (size_t x = 0; x < opsin.xsize(); x += Lanes(d)) {
+      const auto sum = Add(Load(d, row_y + x), Load(d, row_x + x));
+      Store(Mul(half, sum), d, row_out + x);
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, opsin.ysize(), ThreadPool::NoInit,
+                                process_row, "ComputeNoiseChannel"));
+  return true;
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+HWY_EXPORT(ComputeNoiseChannel);  // Local function
+
 namespace {
 
 using OptimizeArray = optimize::Array<double, NoiseParams::kNumNoisePoints>;
 
-float GetScoreSumsOfAbsoluteDifferences(const Image3F& opsin, const int x,
-                                        const int y, const int block_size) {
-  const int small_bl_size_x = 3;
-  const int small_bl_size_y = 4;
-  const int kNumSAD =
+// The size of a patch in decoder might be different from encoder's patch
+// size.
+// For encoder: the patch size should be big enough to estimate
+//              noise level, but, at the same time, it should be not too big
+//              to be able to estimate intensity value of the patch
+constexpr size_t kBlockSize = 8;
+
+// At lower efforts, only every other row of patches is analyzed if the image
+// has at least this many rows of patches.
+constexpr size_t kMinPatchRowsForSampling = 32;
+
+float GetScoreSumsOfAbsoluteDifferences(const ImageF& noise_channel,
+                                        const int x, const int y) {
+  constexpr int block_size = kBlockSize;
+  constexpr int small_bl_size_x = 3;
+  constexpr int small_bl_size_y = 4;
+  constexpr int kNumSAD =
       (block_size - small_bl_size_x) * (block_size - small_bl_size_y);
   // block_size x block_size reference pixels
   int counter = 0;
   const int offset = 2;
 
-  std::vector<float> sad(kNumSAD, 0);
+  std::array<float, kNumSAD> sad;
   for (int y_bl = 0; y_bl + small_bl_size_y < block_size; ++y_bl) {
     for (int x_bl = 0; x_bl + small_bl_size_x < block_size; ++x_bl) {
       float sad_sum = 0;
       // size of the center patch, we compare all the patches inside window with
       // the center one
       for (int cy = 0; cy < small_bl_size_y; ++cy) {
+        const float* JXL_RESTRICT row_wnd =
+            noise_channel.ConstRow(y + y_bl + cy) + x + x_bl;
+        const float* JXL_RESTRICT row_center =
+            noise_channel.ConstRow(y + offset + cy) + x + offset;
         for (int cx = 0; cx < small_bl_size_x; ++cx) {
-          float wnd = 0.5f * (opsin.PlaneRow(1, y + y_bl + cy)[x + x_bl + cx] +
-                              opsin.PlaneRow(0, y + y_bl + cy)[x + x_bl + cx]);
-          float center =
-              0.5f * (opsin.PlaneRow(1, y + offset + cy)[x + offset + cx] +
-                      opsin.PlaneRow(0, y + offset + cy)[x + offset + cx]);
-          sad_sum += std::abs(center - wnd);
+          sad_sum += std::abs(row_center[cx] - row_wnd[cx]);
         }
       }
       sad[counter++] = sad_sum;
@@ -125,23 +182,46 @@ class NoiseHistogram {
   uint32_t bins[kBins];
 };
 
-std::vector<float> GetSADScoresForPatches(const Image3F& opsin,
-                                          const size_t block_s,
-                                          const size_t num_bin,
-                                          NoiseHistogram* sad_histogram) {
-  std::vector<float> sad_scores(
-      (opsin.ysize() / block_s) * (opsin.xsize() / block_s), 0.0f);
-
-  int block_index = 0;
+// Returns the top rows of the patches to analyze.
+std::vector<size_t> GetPatchRows(const size_t ysize,
+                                 const SpeedTier speed_tier) {
+  const size_t num_patch_rows = ysize / kBlockSize;
+  const size_t step = (speed_tier >= SpeedTier::kWombat &&
+                       num_patch_rows >= kMinPatchRowsForSampling)
+                          ? 2
+                          : 1;
+  std::vector<size_t> patch_rows;
+  for (size_t i = 0; i < num_patch_rows; i += step) {
+    patch_rows.push_back(i * kBlockSize);
+  }
+  return patch_rows;
+}
 
-  for (size_t y = 0; y + block_s <= opsin.ysize(); y += block_s) {
-    for (size_t x = 0; x + block_s <= opsin.xsize(); x += block_s) {
-      float sad_sc = GetScoreSumsOfAbsoluteDifferences(opsin, x, y, block_s);
-      sad_scores[block_index++] = sad_sc;
-      sad_histogram->Increment(sad_sc * num_bin);
+Status GetSADScoresForPatches(const ImageF& noise_channel,
+                              const std::vector<size_t>& patch_rows,
+                              const size_t num_bin, ThreadPool* pool,
+                              NoiseHistogram* sad_histogram,
+                              std::vector<float>* sad_scores) {
+  const size_t patches_per_row = noise_channel.xsize() / kBlockSize;
+  sad_scores->assign(patch_rows.size() * patches_per_row, 0.0f);
+
+  const auto process_row = [&](const uint32_t task, size_t thread) -> Status {
+    const size_t y = patch_rows[task];
+    float* JXL_RESTRICT row_scores =
+        sad_scores->data() + task * patches_per_row;
+    for (size_t i = 0; i < patches_per_row; ++i) {
+      row_scores[i] =
+          GetScoreSumsOfAbsoluteDifferences(noise_channel, i * kBlockSize, y);
     }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, patch_rows.size(),
+                                ThreadPool::NoInit, process_row,
+                                "SADScores"));
+  for (float sad_sc : *sad_scores) {
+    sad_histogram->Increment(sad_sc * num_bin);
   }
-  return sad_scores;
+  return true;
 }
 
 float GetSADThreshold(const NoiseHistogram& histogram, const int num_bin) {
@@ -240,10 +320,13 @@ void OptimizeNoiseParameters(const std::vector<NoiseLevel>& noise_level,
   }
 }
 
-std::vector<NoiseLevel> GetNoiseLevel(
-    const Image3F& opsin, const std::vector<float>& texture_strength,
-    const float threshold, const size_t block_s) {
-  std::vector<NoiseLevel> noise_level_per_intensity;
+Status GetNoiseLevel(const ImageF& noise_channel,
+                     const std::vector<size_t>& patch_rows,
+                     const std::vector<float>& texture_strength,
+                     const float threshold, ThreadPool* pool,
+                     std::vector<NoiseLevel>* noise_level_per_intensity) {
+  const size_t block_s = kBlockSize;
+  const size_t patches_per_row = noise_channel.xsize() / block_s;
 
   const int filt_size = 1;
   static const float kLaplFilter[filt_size * 2 + 1][filt_size * 2 + 1] = {
@@ -252,81 +335,62 @@ std::vector<NoiseLevel> GetNoiseLevel(
       {-0.25f, -1.0f, -0.25f},
   };
 
-  // The noise model is built based on channel 0.5 * (X+Y) as we notice that it
-  // is similar to the model 0.5 * (Y-X)
-  size_t patch_index = 0;
-
-  for (size_t y = 0; y + block_s <= opsin.ysize(); y += block_s) {
-    for (size_t x = 0; x + block_s <= opsin.xsize(); x += block_s) {
-      if (texture_strength[patch_index] <= threshold) {
-        // Calculate mean value
-        float mean_int = 0;
-        for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
-          for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
-            mean_int += 0.5f * (opsin.PlaneRow(1, y + y_bl)[x + x_bl] +
-                                opsin.PlaneRow(0, y + y_bl)[x + x_bl]);
-          }
+  std::vector<std::vector<NoiseLevel>> row_noise_levels(patch_rows.size());
+  const auto process_row = [&](const uint32_t task, size_t thread) -> Status {
+    const size_t y = patch_rows[task];
+    for (size_t i = 0; i < patches_per_row; ++i) {
+      const size_t patch_index = task * patches_per_row + i;
+      if (texture_strength[patch_index] > threshold) continue;
+      const size_t x = i * block_s;
+      // Calculate mean value
+      float mean_int = 0;
+      for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
+        const float* JXL_RESTRICT row = noise_channel.ConstRow(y + y_bl) + x;
+        for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
+          mean_int += row[x_bl];
         }
-        mean_int /= block_s * block_s;
-
-        // Calculate Noise level
-        float noise_level = 0;
-        size_t count = 0;
-        for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
-          for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
-            float filtered_value = 0;
-            for (int y_f = -1 * filt_size; y_f <= filt_size; ++y_f) {
-              if ((static_cast<ptrdiff_t>(y_bl) + y_f) >= 0 &&
-                  (y_bl + y_f) < block_s) {
-                for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
-                  if ((static_cast<ptrdiff_t>(x_bl) + x_f) >= 0 &&
-                      (x_bl + x_f) < block_s) {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl + x_f] +
-                         opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl + x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  } else {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl - x_f] +
-                         opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl - x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  }
-                }
-              } else {
-                for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
-                  if ((static_cast<ptrdiff_t>(x_bl) + x_f) >= 0 &&
-                      (x_bl + x_f) < block_s) {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl + x_f] +
-                         opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl + x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  } else {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl - x_f] +
-                         opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl - x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  }
-                }
-              }
+      }
+      mean_int /= block_s * block_s;
+
+      // Calculate Noise level; the patch is mirrored at its borders.
+      const auto mirror = [&](size_t pos, int offset) -> size_t {
+        const ptrdiff_t p = static_cast<ptrdiff_t>(pos) + offset;
+        if (p >= 0 && p < static_cast<ptrdiff_t>(block_s)) return p;
+        return static_cast<ptrdiff_t>(pos) - offset;
+      };
+      float noise_level = 0;
+      size_t count = 0;
+      for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
+        for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
+          float filtered_value = 0;
+          for (int y_f = -1 * filt_size; y_f <= filt_size; ++y_f) {
+            const float* JXL_RESTRICT row =
+                noise_channel.ConstRow(y + mirror(y_bl, y_f)) + x;
+            for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
+              filtered_value += row[mirror(x_bl, x_f)] *
+                                kLaplFilter[y_f + filt_size][x_f + filt_size];
             }
-            noise_level += std::abs(filtered_value);
-            ++count;
           }
+          noise_level += std::abs(filtered_value);
+          ++count;
         }
-        noise_level /= count;
-        NoiseLevel nl;
-        nl.intensity = mean_int;
-        nl.noise_level = noise_level;
-        noise_level_per_intensity.push_back(nl);
       }
-      ++patch_index;
+      noise_level /= count;
+      NoiseLevel nl;
+      nl.intensity = mean_int;
+      nl.noise_level = noise_level;
+      row_noise_levels[task].push_back(nl);
     }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, patch_rows.size(),
+                                ThreadPool::NoInit, process_row,
+                                "GetNoiseLevel"));
+  for (const auto& levels : row_noise_levels) {
+    noise_level_per_intensity->insert(noise_level_per_intensity->end(),
+                                      levels.begin(), levels.end());
   }
-  return noise_level_per_intensity;
+  return true;
 }
 
 Status EncodeFloatParam(float val, float precision, BitWriter* writer) {
@@ -339,18 +403,23 @@ Status EncodeFloatParam(float val, float precision, BitWriter* writer) {
 
 }  // namespace
 
-Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
-                         float quality_coef) {
-  // The size of a patch in decoder might be different from encoder's patch
-  // size.
-  // For encoder: the patch size should be big enough to estimate
-  //              noise level, but, at the same time, it should be not too big
-  //              to be able to estimate intensity value of the patch
-  const size_t block_s = 8;
+StatusOr<bool> GetNoiseParameter(const Image3F& opsin,
+                                 const SpeedTier speed_tier,
+                                 NoiseParams* noise_params,
+                                 float quality_coef, ThreadPool* pool) {
   const size_t kNumBin = 256;
+  JXL_ASSIGN_OR_RETURN(ImageF noise_channel,
+                       ImageF::Create(opsin.memory_manager(), opsin.xsize(),
+                                      opsin.ysize()));
+  JXL_RETURN_IF_ERROR(
+      HWY_DYNAMIC_DISPATCH(ComputeNoiseChannel)(opsin, pool, &noise_channel));
+  const std::vector<size_t> patch_rows =
+      GetPatchRows(opsin.ysize(), speed_tier);
+
   NoiseHistogram sad_histogram;
-  std::vector<float> sad_scores =
-      GetSADScoresForPatches(opsin, block_s, kNumBin, &sad_histogram);
+  std::vector<float> sad_scores;
+  JXL_RETURN_IF_ERROR(GetSADScoresForPatches(
+      noise_channel, patch_rows, kNumBin, pool, &sad_histogram, &sad_scores));
   float sad_threshold = GetSADThreshold(sad_histogram, kNumBin);
   // If threshold is too large, the image has a strong pattern. This pattern
   // fools our model and it will add too much noise. Therefore, we do not add
@@ -359,8 +428,9 @@ Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
     noise_params->Clear();
     return false;
   }
-  std::vector<NoiseLevel> nl =
-      GetNoiseLevel(opsin, sad_scores, sad_threshold, block_s);
+  std::vector<NoiseLevel> nl;
+  JXL_RETURN_IF_ERROR(GetNoiseLevel(noise_channel, patch_rows, sad_scores,
+                                    sad_threshold, pool, &nl));
 
   OptimizeNoiseParameters(nl, noise_params, quality_coef * 1.4f);
   return noise_params->HasAny();
@@ -380,3 +450,4 @@ Status EncodeNoise(const NoiseParams& noise_params, BitWriter* writer,
 }
 
 }  // namespace jxl
+#endif  // HWY_ONCE
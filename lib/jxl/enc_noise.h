@@ -10,8 +10,10 @@
 
 #include <cstdint>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_params.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/noise.h"
 
@@ -21,9 +23,11 @@ struct AuxOut;
 enum class LayerType : uint8_t;
 
 // Get parameters of the noise for NoiseParams model
-// Returns whether a valid noise model (with HasAny()) is set.
-Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
-                         float quality_coef);
+// Returns whether a valid noise model (with HasAny()) is set. Speed tiers
+// faster than kSquirrel only analyze a subset of the patches of large images.
+StatusOr<bool> GetNoiseParameter(const Image3F& opsin, SpeedTier speed_tier,
+                                 NoiseParams* noise_params,
+                                 float quality_coef, ThreadPool* pool);
 
 // Does not write anything if `noise_params` are empty. Otherwise, caller must
 // set FrameHeader.flags.kNoise.
@@ -0,0 +1,86 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/enc_noise.h"
+
+#include <cstddef>
+
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/common.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/noise.h"
+#include "lib/jxl/test_memory_manager.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace {
+
+using test::ThreadPoolForTests;
+
+// A smooth opsin image with uniform noise whose amplitude grows with the
+// intensity, as for photon noise.
+Image3F NoisyOpsin(size_t xsize, size_t ysize) {
+  JXL_TEST_ASSIGN_OR_DIE(
+      Image3F opsin, Image3F::Create(jxl::test::MemoryManager(), xsize, ysize));
+  Rng rng(42);
+  for (size_t y = 0; y < ysize; ++y) {
+    float* JXL_RESTRICT row_x = opsin.PlaneRow(0, y);
+    float* JXL_RESTRICT row_y = opsin.PlaneRow(1, y);
+    float* JXL_RESTRICT row_b = opsin.PlaneRow(2, y);
+    for (size_t x = 0; x < xsize; ++x) {
+      const float luma = 0.1f + 0.7f * (x + y) / (xsize + ysize);
+      const float amplitude = 0.01f + 0.03f * luma;
+      row_x[x] = amplitude * 0.1f * rng.UniformF(-1.0f, 1.0f);
+      row_y[x] = luma + amplitude * rng.UniformF(-1.0f, 1.0f);
+      row_b[x] = luma + amplitude * rng.UniformF(-1.0f, 1.0f);
+    }
+  }
+  return opsin;
+}
+
+NoiseParams EstimateNoise(const Image3F& opsin, SpeedTier speed_tier,
+                          ThreadPool* pool) {
+  NoiseParams noise_params;
+  JXL_TEST_ASSIGN_OR_DIE(bool has_noise,
+                         GetNoiseParameter(opsin, speed_tier, &noise_params,
+                                           /*quality_coef=*/1.0f, pool));
+  EXPECT_TRUE(has_noise);
+  return noise_params;
+}
+
+TEST(EncNoiseTest, SameWithAndWithoutPool) {
+  // 40 rows of patches, so that the faster speed tiers sample them.
+  const Image3F opsin = NoisyOpsin(384, 320);
+  ThreadPoolForTests pool(8);
+  for (SpeedTier speed_tier : {SpeedTier::kSquirrel, SpeedTier::kWombat}) {
+    const NoiseParams serial = EstimateNoise(opsin, speed_tier, nullptr);
+    const NoiseParams parallel = EstimateNoise(opsin, speed_tier, pool.get());
+    EXPECT_EQ(serial.lut, parallel.lut);
+  }
+}
+
+TEST(EncNoiseTest, SampledPatchRows) {
+  const Image3F opsin = NoisyOpsin(384, 320);
+  ThreadPoolForTests pool(8);
+  // Speed tiers up to kSquirrel analyze all rows of patches, faster ones
+  // every other row.
+  const NoiseParams all_rows =
+      EstimateNoise(opsin, SpeedTier::kSquirrel, pool.get());
+  const NoiseParams sampled =
+      EstimateNoise(opsin, SpeedTier::kWombat, pool.get());
+  EXPECT_TRUE(all_rows.HasAny());
+  EXPECT_TRUE(sampled.HasAny());
+  EXPECT_NE(sampled.lut, all_rows.lut);
+  EXPECT_ARRAY_NEAR(sampled.lut, all_rows.lut, 0.005f);
+
+  // Images with fewer than 32 rows of patches are always analyzed fully.
+  const Image3F small_opsin = NoisyOpsin(384, 31 * 8);
+  EXPECT_EQ(EstimateNoise(small_opsin, SpeedTier::kWombat, pool.get()).lut,
+            EstimateNoise(small_opsin, SpeedTier::kSquirrel, pool.get()).lut);
+}
+
+}  // namespace
+}  // namespace jxl
@@ -12,6 +12,7 @@
 #include <jxl/encode.h>
 #include <stddef.h>
 
+#include <memory>
 #include <vector>
 
 #include "lib/jxl/base/override.h"
@@ -25,6 +26,8 @@
 
 namespace jxl {
 
+struct EntropyCodePreset;
+
 // NOLINTNEXTLINE(clang-analyzer-optin.performance.Padding)
 struct CompressParams {
   float butteraugli_distance = 1.0f;
@@ -183,6 +186,10 @@ struct CompressParams {
   // If not empty, these custom splines will be used instead of the computed
   // ones. Used in jxl_from_tee tool.
   SplineDataView custom_splines{};
+  // If not null, AC histograms are taken from this preset instead of being
+  // clustered, whenever the token statistics of the frame fit it. Trained by
+  // the train_entropy_preset tool.
+  std::shared_ptr<const EntropyCodePreset> ac_entropy_preset;
   // If not null, overrides progressive mode settings. Used in decode_test.
   const ProgressiveMode* custom_progressive_mode = nullptr;
 
@@ -14,6 +14,8 @@
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -43,6 +45,7 @@
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_ops.h"
+#include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/modular/options.h"
 #include "lib/jxl/pack_signed.h"
 #include "lib/jxl/patch_dictionary_internal.h"
@@ -204,11 +207,11 @@ struct PatchColorspaceInfo {
     }
   }
 
-  float ScaleForQuantization(float val, size_t c) {
+  float ScaleForQuantization(float val, size_t c) const {
     return val / kChannelDequant[c];
   }
 
-  int Quantize(float val, size_t c) {
+  int Quantize(float val, size_t c) const {
     float scaled = ScaleForQuantization(val, c);
     // Clamping allows values outside of target range (int8_t); caller should
     // deal with out-of-range values.
@@ -216,7 +219,7 @@ struct PatchColorspaceInfo {
     return std::trunc(scaled);
   }
 
-  bool is_similar_v(const Color& v1, const Color& v2, float threshold) {
+  bool is_similar_v(const Color& v1, const Color& v2, float threshold) const {
     float distance = 0;
     for (size_t c = 0; c < 3; c++) {
       distance += std::abs(v1[c] - v2[c]) * kChannelWeights[c];
@@ -228,6 +231,41 @@ struct PatchColorspaceInfo {
 using XY = std::pair<int32_t, int32_t>;
 constexpr const size_t kPatchSide = 4;
 
+// Bounding box of a connected component of non-background pixels, and the
+// background color around it.
+struct PatchCandidate {
+  uint32_t x0;
+  uint32_t y0;
+  uint32_t xsize;
+  uint32_t ysize;
+  Color ref;
+  // Offset of the quantized pixels, three planes of xsize * ysize values.
+  size_t pixels_offset;
+  // Set if the candidate passes all heuristics.
+  bool accepted = false;
+  uint64_t hash = 0;
+};
+
+// Hashes the size and the quantized pixels of a candidate, eight at a time,
+// so that repeated patches can be found without sorting all candidates.
+uint64_t HashPatchPixels(const PatchCandidate& candidate,
+                         const int8_t* JXL_RESTRICT pixels) {
+  constexpr uint64_t kMul = 0x9E3779B97F4A7C15ull;
+  const size_t size = 3 * candidate.xsize * candidate.ysize;
+  uint64_t hash = (candidate.xsize * kMaxPatchSize + candidate.ysize) * kMul;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, pixels + i, sizeof(word));
+    hash = (hash ^ word) * kMul;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ static_cast<uint8_t>(pixels[i])) * kMul;
+  }
+  return hash ^ (hash >> 32);
+}
+
 StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
     const CompressParams& cparams, const Image3F& opsin,
     const PassesEncoderState* JXL_RESTRICT state, ThreadPool* pool,
@@ -367,9 +405,12 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
   const auto is_bg = [&](const XY& p) -> uint8_t& {
     return is_background_row[p.second * is_background_stride + p.first];
   };
+  // Multi-source BFS from the seeds, one level at a time so that the pixels of
+  // each level can be processed in parallel. A pixel is claimed by the first
+  // pixel of the previous level, in queue order, that reaches it and finds it
+  // similar to its source, exactly as in a serial BFS.
   std::vector<std::pair<XY, XY>> queue;
-  queue.reserve(2 * num_seeds * kPatchSide * kPatchSide);
-  size_t queue_front = 0;
+  queue.reserve(num_seeds * kPatchSide * kPatchSide);
   // TODO(eustas): coalesce neighbours, leave only border.
   if (can_have_seeds) {
     for (size_t py = 1; py < ph - 1; py++) {
@@ -386,38 +427,84 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
       }
     }
   }
-  while (queue_front < queue.size()) {
-    XY cur = queue[queue_front].first;
-    XY src = queue[queue_front].second;
-    queue_front++;
-    Color src_color;
-    for (size_t c = 0; c < 3; c++) {
-      float clr = opsin_rows[c][src.second * opsin_stride + src.first];
-      src_color[c] = clr;
-      background_rows[c][cur.second * background_stride + cur.first] = clr;
+  struct Claim {
+    uint64_t key;
+    XY pixel;
+    XY src;
+  };
+  constexpr size_t kQueuePerTask = 4096;
+  constexpr uint64_t kUnclaimed = ~uint64_t{0};
+  // Lowest key of the pixels of the current level that reach each pixel; only
+  // needed if there are seeds.
+  AlignedArray<std::atomic<uint64_t>> claims;
+  if (!queue.empty()) {
+    const size_t num_pixels = frame_dim.xsize * frame_dim.ysize;
+    JXL_ASSIGN_OR_RETURN(claims, AlignedArray<std::atomic<uint64_t>>::Create(
+                                     memory_manager, num_pixels));
+    for (size_t i = 0; i < num_pixels; i++) {
+      claims[i].store(kUnclaimed, std::memory_order_relaxed);
     }
-    for (int dx = -kSearchRadius; dx <= kSearchRadius; dx++) {
-      for (int dy = -kSearchRadius; dy <= kSearchRadius; dy++) {
-        XY next{cur.first + dx, cur.second + dy};
-        if (next.first < 0 || next.second < 0 ||
-            static_cast<uint32_t>(next.first) >= frame_dim.xsize ||
-            static_cast<uint32_t>(next.second) >= frame_dim.ysize) {
-          continue;
+  }
+  std::vector<std::vector<Claim>> task_claims;
+  const auto process_queue = [&](const uint32_t task,
+                                 size_t /* thread */) -> Status {
+    std::vector<Claim>& out = task_claims[task];
+    out.clear();
+    const size_t end = std::min(queue.size(), (task + 1) * kQueuePerTask);
+    for (size_t i = task * kQueuePerTask; i < end; i++) {
+      XY cur = queue[i].first;
+      XY src = queue[i].second;
+      for (size_t c = 0; c < 3; c++) {
+        background_rows[c][cur.second * background_stride + cur.first] =
+            opsin_rows[c][src.second * opsin_stride + src.first];
+      }
+      uint64_t key = i * 9;
+      for (int dx = -kSearchRadius; dx <= kSearchRadius; dx++) {
+        for (int dy = -kSearchRadius; dy <= kSearchRadius; dy++, key++) {
+          XY next{cur.first + dx, cur.second + dy};
+          if (next.first < 0 || next.second < 0 ||
+              static_cast<uint32_t>(next.first) >= frame_dim.xsize ||
+              static_cast<uint32_t>(next.second) >= frame_dim.ysize) {
+            continue;
+          }
+          if (is_bg(next)) continue;
+          if (static_cast<uint32_t>(
+                  std::abs(next.first - static_cast<int>(src.first)) +
+                  std::abs(next.second - static_cast<int>(src.second))) >
+              kDistanceLimit) {
+            continue;
+          }
+          if (!is_similar(src, next)) continue;
+          std::atomic<uint64_t>& claim =
+              claims[next.second * frame_dim.xsize + next.first];
+          uint64_t prev = claim.load(std::memory_order_relaxed);
+          while (key < prev && !claim.compare_exchange_weak(
+                                   prev, key, std::memory_order_relaxed)) {
+          }
+          out.push_back({key, next, src});
         }
-        uint8_t& bg = is_bg(next);
-        if (bg) continue;
-        if (static_cast<uint32_t>(
-                std::abs(next.first - static_cast<int>(src.first)) +
-                std::abs(next.second - static_cast<int>(src.second))) >
-            kDistanceLimit) {
+      }
+    }
+    return true;
+  };
+  std::vector<std::pair<XY, XY>> next_queue;
+  while (!queue.empty()) {
+    const size_t num_tasks = DivCeil(queue.size(), kQueuePerTask);
+    task_claims.resize(std::max(task_claims.size(), num_tasks));
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_tasks, ThreadPool::NoInit,
+                                  process_queue, "FindBackground"));
+    next_queue.clear();
+    for (size_t task = 0; task < num_tasks; task++) {
+      for (const Claim& claim : task_claims[task]) {
+        if (claims[claim.pixel.second * frame_dim.xsize + claim.pixel.first]
+                .load(std::memory_order_relaxed) != claim.key) {
           continue;
         }
-        if (is_similar(src, next)) {
-          queue.emplace_back(next, src);
-          bg = 1;
-        }
+        next_queue.emplace_back(claim.pixel, claim.src);
+        is_bg(claim.pixel) = 1;
       }
     }
+    queue.swap(next_queue);
   }
   queue.clear();
 
@@ -452,13 +539,19 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
   constexpr int kHasSimilarRadius = 2;
 
   // Find small CC outside the "similar enough" areas, compute bounding boxes,
-  // and run heuristics to exclude some patches.
+  // and run heuristics to exclude some patches. The connected components are
+  // found serially, as the reference background pixel depends on the order in
+  // which they are visited; the remaining checks and the quantization of each
+  // candidate are done in parallel below.
   JXL_ASSIGN_OR_RETURN(
       ImageB visited,
       ImageB::Create(memory_manager, frame_dim.xsize, frame_dim.ysize));
   ZeroFillImage(&visited);
   uint8_t* JXL_RESTRICT visited_row = visited.Row(0);
   const size_t visited_stride = visited.PixelsPerRow();
+  std::vector<PatchCandidate> candidates;
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> candidate_ccs;
+  size_t quantized_size = 0;
   std::vector<std::pair<uint32_t, uint32_t>> cc;
   std::vector<std::pair<uint32_t, uint32_t>> stack;
   for (size_t y = 0; y < frame_dim.ysize; y++) {
@@ -504,8 +597,8 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
               if (!found_border) {
                 reference = next;
                 found_border = true;
-              } else {
-                if (!is_similar_b(next, reference)) all_similar = false;
+              } else if (all_similar && !is_similar_b(next, reference)) {
+                all_similar = false;
               }
             }
           }
@@ -516,11 +609,38 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
         continue;
       }
       size_t bpos = background_stride * reference.second + reference.first;
-      Color ref = {background_rows[0][bpos], background_rows[1][bpos],
-                   background_rows[2][bpos]};
+      PatchCandidate candidate;
+      candidate.x0 = static_cast<uint32_t>(min_x);
+      candidate.y0 = static_cast<uint32_t>(min_y);
+      candidate.xsize = static_cast<uint32_t>(max_x - min_x + 1);
+      candidate.ysize = static_cast<uint32_t>(max_y - min_y + 1);
+      candidate.ref = {background_rows[0][bpos], background_rows[1][bpos],
+                       background_rows[2][bpos]};
+      candidate.pixels_offset = quantized_size;
+      quantized_size += 3 * candidate.xsize * candidate.ysize;
+      candidates.push_back(candidate);
+      if (paint_ccs) candidate_ccs.push_back(cc);
+    }
+  }
+
+  std::vector<int8_t> quantized(quantized_size);
+  constexpr size_t kCandidatesPerTask = 64;
+  const auto process_candidates = [&](const uint32_t task,
+                                      size_t /* thread */) -> Status {
+    const size_t begin = task * kCandidatesPerTask;
+    const size_t end =
+        std::min(begin + kCandidatesPerTask, candidates.size());
+    for (size_t i = begin; i < end; i++) {
+      PatchCandidate& candidate = candidates[i];
+      const Color& ref = candidate.ref;
+      const size_t min_x = candidate.x0;
+      const size_t min_y = candidate.y0;
+      const size_t max_x = min_x + candidate.xsize - 1;
+      const size_t max_y = min_y + candidate.ysize - 1;
       bool has_similar = false;
       for (size_t iy = std::max<int>(
                static_cast<int32_t>(min_y) - kHasSimilarRadius, 0);
+           !has_similar &&
            iy < std::min(max_y + kHasSimilarRadius + 1, frame_dim.ysize);
            iy++) {
         for (size_t ix = std::max<int>(
@@ -532,72 +652,113 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
                       opsin_rows[2][opos]};
           if (pci.is_similar_v(ref, px, kHasSimilarThreshold)) {
             has_similar = true;
+            break;
           }
         }
       }
       if (!has_similar) continue;
-      info.emplace_back();
-      info.back().second.emplace_back(static_cast<uint32_t>(min_x),
-                                      static_cast<uint32_t>(min_y));
-      QuantizedPatch& patch = info.back().first;
-      patch.xsize = max_x - min_x + 1;
-      patch.ysize = max_y - min_y + 1;
+      const size_t area = candidate.xsize * candidate.ysize;
+      int8_t* JXL_RESTRICT pixels = quantized.data() + candidate.pixels_offset;
       bool too_big = false;
       bool too_small = true;
-      for (size_t c : {1, 0, 2}) {
+      for (size_t c = 0; c < 3; c++) {
         for (size_t iy = min_y; iy <= max_y; iy++) {
+          const float* JXL_RESTRICT row = opsin_rows[c] + iy * opsin_stride;
           for (size_t ix = min_x; ix <= max_x; ix++) {
-            size_t offset = (iy - min_y) * patch.xsize + ix - min_x;
-            float fval = opsin_rows[c][iy * opsin_stride + ix] - ref[c];
-            patch.fpixels[c][offset] = fval;
-            int val = pci.Quantize(patch.fpixels[c][offset], c);
+            int val = pci.Quantize(row[ix] - ref[c], c);
             int8_t qval = static_cast<int8_t>(val);
-            patch.pixels[c][offset] = qval;
+            pixels[c * area + (iy - min_y) * candidate.xsize + ix - min_x] =
+                qval;
             too_big |= (val != static_cast<int>(qval));
             too_small &= (val < kMinPeak) && (val > -kMinPeak);
           }
         }
       }
-      if (too_small || too_big) {
-        info.pop_back();
-        continue;
-      }
-      if (paint_ccs) {
-        float cc_color = rng.UniformF(0.5, 1.0);
-        for (std::pair<uint32_t, uint32_t> p : cc) {
-          ccs.Row(p.second)[p.first] = cc_color;
-        }
-      }
+      if (too_small || too_big) continue;
+      candidate.accepted = true;
+      candidate.hash = HashPatchPixels(candidate, pixels);
     }
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0,
+                                DivCeil(candidates.size(), kCandidatesPerTask),
+                                ThreadPool::NoInit, process_candidates,
+                                "PatchCandidates"));
 
   if (paint_ccs) {
+    for (size_t i = 0; i < candidates.size(); i++) {
+      if (!candidates[i].accepted) continue;
+      float cc_color = rng.UniformF(0.5, 1.0);
+      for (std::pair<uint32_t, uint32_t> p : candidate_ccs[i]) {
+        ccs.Row(p.second)[p.first] = cc_color;
+      }
+    }
     JXL_ENSURE(WantDebugOutput(cparams));
     JXL_RETURN_IF_ERROR(DumpPlaneNormalized(cparams, "ccs", ccs));
   }
-  if (info.empty()) {
-    return info;
+
+  // Group the candidates with equal quantized pixels; each group lists its
+  // candidates in raster order of their top-left corner.
+  std::vector<std::vector<size_t>> groups;
+  std::unordered_map<uint64_t, std::vector<size_t>> groups_by_hash;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    const PatchCandidate& candidate = candidates[i];
+    if (!candidate.accepted) continue;
+    std::vector<size_t>& bucket = groups_by_hash[candidate.hash];
+    bool found = false;
+    for (size_t group : bucket) {
+      const PatchCandidate& other = candidates[groups[group][0]];
+      if (other.xsize == candidate.xsize && other.ysize == candidate.ysize &&
+          memcmp(quantized.data() + other.pixels_offset,
+                 quantized.data() + candidate.pixels_offset,
+                 3 * candidate.xsize * candidate.ysize) == 0) {
+        groups[group].push_back(i);
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      bucket.push_back(groups.size());
+      groups.emplace_back(1, i);
+    }
   }
 
-  // Remove duplicates.
+  // Keep patches that occur often enough. The occurrences are listed, and the
+  // first one gives the pixels of the patch, in the order of their positions.
   constexpr size_t kMinPatchOccurrences = 2;
-  std::sort(info.begin(), info.end());
-  size_t unique = 0;
-  for (size_t i = 1; i < info.size(); i++) {
-    if (info[i].first == info[unique].first) {
-      info[unique].second.insert(info[unique].second.end(),
-                                 info[i].second.begin(), info[i].second.end());
-    } else {
-      if (info[unique].second.size() >= kMinPatchOccurrences) {
-        unique++;
+  for (std::vector<size_t>& group : groups) {
+    if (group.size() < kMinPatchOccurrences) continue;
+    std::sort(group.begin(), group.end(), [&](size_t a, size_t b) {
+      return std::make_pair(candidates[a].x0, candidates[a].y0) <
+             std::make_pair(candidates[b].x0, candidates[b].y0);
+    });
+    const PatchCandidate& first = candidates[group[0]];
+    const size_t area = first.xsize * first.ysize;
+    info.emplace_back();
+    QuantizedPatch& patch = info.back().first;
+    patch.xsize = first.xsize;
+    patch.ysize = first.ysize;
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t iy = 0; iy < first.ysize; iy++) {
+        const float* JXL_RESTRICT row =
+            opsin_rows[c] + (first.y0 + iy) * opsin_stride + first.x0;
+        for (size_t ix = 0; ix < first.xsize; ix++) {
+          size_t offset = iy * first.xsize + ix;
+          patch.fpixels[c][offset] = row[ix] - first.ref[c];
+          patch.pixels[c][offset] =
+              quantized[first.pixels_offset + c * area + offset];
+        }
       }
-      info[unique] = info[i];
+    }
+    for (size_t i : group) {
+      info.back().second.emplace_back(candidates[i].x0, candidates[i].y0);
     }
   }
-  if (info[unique].second.size() >= kMinPatchOccurrences) {
-    unique++;
+  if (info.empty()) {
+    return info;
   }
-  info.resize(unique);
+  // Distinct patches, so this only depends on the pixels.
+  std::sort(info.begin(), info.end());
 
   size_t max_patch_size = 0;
 
@@ -7,12 +7,14 @@
 
 #include <jxl/cms_interface.h>
 #include <jxl/memory_manager.h>
+#include <jxl/types.h>
 
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
 
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/image.h"
@@ -287,6 +289,104 @@ Status ToXYB(const ColorEncoding& c_current, float intensity_target,
   return true;
 }
 
+Status ExternalToXYB(const uint8_t* data, size_t stride,
+                     const JxlPixelFormat& format, size_t bits_per_sample,
+                     const ColorEncoding& c_current, float intensity_target,
+                     ThreadPool* pool, Image3F* JXL_RESTRICT image,
+                     Image3F* JXL_RESTRICT linear) {
+  JXL_ENSURE(CanConvertExternalToXYB(c_current, format, bits_per_sample));
+  if (linear) JXL_ENSURE(SameSize(*image, *linear));
+  const size_t xsize = image->xsize();
+  const size_t bytes_per_sample = format.data_type == JXL_TYPE_UINT8 ? 1 : 2;
+  const size_t bytes_per_pixel = format.num_channels * bytes_per_sample;
+  size_t bytes_per_row;
+  if (!SafeMul(xsize, bytes_per_pixel, bytes_per_row)) {
+    return JXL_FAILURE("Image dimensions are too large");
+  }
+  JXL_ENSURE(bytes_per_row <= stride);
+
+  JxlMemoryManager* memory_manager = image->memory_manager();
+  const HWY_FULL(float) d;
+  JXL_ASSIGN_OR_RETURN(
+      AlignedMemory mem,
+      AlignedMemory::Create(memory_manager, Lanes(d) * 12 * sizeof(float)));
+  float* premul_absorb = mem.address<float>();
+  ComputePremulAbsorb(intensity_target, premul_absorb);
+
+  const bool is_srgb = c_current.IsSRGB();
+  const bool is_8bit = format.data_type == JXL_TYPE_UINT8;
+  const bool little_endian =
+      format.endianness == JXL_LITTLE_ENDIAN ||
+      (format.endianness == JXL_NATIVE_ENDIAN && IsLittleEndian());
+  // Same scaling as ConvertFromExternalPlaneNoSizeCheck.
+  const float scale = 1.0f / ((1ull << bits_per_sample) - 1);
+  // 8-bit samples are decoded (including the sRGB transfer function) with a
+  // table lookup.
+  HWY_ALIGN float lut[256];
+  if (is_8bit) {
+    for (size_t i = 0; i < 256; ++i) lut[i] = i * scale;
+    if (is_srgb) {
+      for (size_t i = 0; i < 256; i += Lanes(d)) {
+        Store(LinearFromSRGB(Load(d, lut + i)), d, lut + i);
+      }
+    }
+  }
+
+  const auto process_row = [&](const uint32_t task,
+                               size_t /*thread*/) -> Status {
+    const size_t y = static_cast<size_t>(task);
+    const uint8_t* JXL_RESTRICT row_in = data + y * stride;
+    float* JXL_RESTRICT row0 = image->PlaneRow(0, y);
+    float* JXL_RESTRICT row1 = image->PlaneRow(1, y);
+    float* JXL_RESTRICT row2 = image->PlaneRow(2, y);
+    if (is_8bit) {
+      for (size_t x = 0; x < xsize; ++x) {
+        const uint8_t* JXL_RESTRICT pixel = row_in + x * bytes_per_pixel;
+        row0[x] = lut[pixel[0]];
+        row1[x] = lut[pixel[1]];
+        row2[x] = lut[pixel[2]];
+      }
+    } else if (little_endian) {
+      for (size_t x = 0; x < xsize; ++x) {
+        const uint8_t* JXL_RESTRICT pixel = row_in + x * bytes_per_pixel;
+        row0[x] = LoadLE16(pixel) * scale;
+        row1[x] = LoadLE16(pixel + 2) * scale;
+        row2[x] = LoadLE16(pixel + 4) * scale;
+      }
+    } else {
+      for (size_t x = 0; x < xsize; ++x) {
+        const uint8_t* JXL_RESTRICT pixel = row_in + x * bytes_per_pixel;
+        row0[x] = LoadBE16(pixel) * scale;
+        row1[x] = LoadBE16(pixel + 2) * scale;
+        row2[x] = LoadBE16(pixel + 4) * scale;
+      }
+    }
+    // The row was just written, so it is still in cache.
+    const bool needs_tf = is_srgb && !is_8bit;
+    for (size_t x = 0; x < xsize; x += Lanes(d)) {
+      auto r = Load(d, row0 + x);
+      auto g = Load(d, row1 + x);
+      auto b = Load(d, row2 + x);
+      if (needs_tf) {
+        r = LinearFromSRGB(r);
+        g = LinearFromSRGB(g);
+        b = LinearFromSRGB(b);
+      }
+      if (linear) {
+        Store(r, d, linear->PlaneRow(0, y) + x);
+        Store(g, d, linear->PlaneRow(1, y) + x);
+        Store(b, d, linear->PlaneRow(2, y) + x);
+      }
+      LinearRGBToXYB(r, g, b, premul_absorb, row0 + x, row1 + x, row2 + x);
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(image->ysize()),
+                                ThreadPool::NoInit, process_row,
+                                "ExternalToXYB"));
+  return true;
+}
+
 // Transform RGB to YCbCr.
 // Could be performed in-place (i.e. Y, Cb and Cr could alias R, B and B).
 Status RgbToYcbcr(const ImageF& r_plane, const ImageF& g_plane,
@@ -365,6 +465,34 @@ Status ToXYB(const ColorEncoding& c_current, float intensity_target,
                                      image, cms, linear);
 }
 
+bool CanConvertExternalToXYB(const ColorEncoding& c_current,
+                             const JxlPixelFormat& format,
+                             size_t bits_per_sample) {
+  if (format.num_channels < 3) return false;
+  if (format.data_type == JXL_TYPE_UINT8) {
+    if (bits_per_sample == 0 || bits_per_sample > 8) return false;
+  } else if (format.data_type == JXL_TYPE_UINT16) {
+    if (bits_per_sample <= 8 || bits_per_sample > 16) return false;
+  } else {
+    return false;
+  }
+  if (c_current.IsGray()) return false;
+  return c_current.IsSRGB() ||
+         ColorEncoding::LinearSRGB(false).SameColorEncoding(c_current);
+}
+
+HWY_EXPORT(ExternalToXYB);
+Status ExternalToXYB(const uint8_t* data, size_t stride,
+                     const JxlPixelFormat& format, size_t bits_per_sample,
+                     const ColorEncoding& c_current, float intensity_target,
+                     ThreadPool* pool, Image3F* JXL_RESTRICT image,
+                     Image3F* JXL_RESTRICT linear) {
+  return HWY_DYNAMIC_DISPATCH(ExternalToXYB)(data, stride, format,
+                                             bits_per_sample, c_current,
+                                             intensity_target, pool, image,
+                                             linear);
+}
+
 HWY_EXPORT(LinearRGBRowToXYB);
 void LinearRGBRowToXYB(float* JXL_RESTRICT row0, float* JXL_RESTRICT row1,
                        float* JXL_RESTRICT row2,
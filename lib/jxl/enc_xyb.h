@@ -9,8 +9,10 @@
 // Converts to XYB color space.
 
 #include <jxl/cms_interface.h>
+#include <jxl/types.h>
 
 #include <cstddef>
+#include <cstdint>
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
@@ -26,6 +28,22 @@ Status ToXYB(const ColorEncoding& c_current, float intensity_target,
              const ImageF* black, ThreadPool* pool, Image3F* JXL_RESTRICT image,
              const JxlCmsInterface& cms, Image3F* JXL_RESTRICT linear);
 
+// Returns whether ExternalToXYB supports interleaved `format` samples in the
+// `c_current` color encoding: 8 or 16-bit RGB(A) in sRGB or linear sRGB.
+bool CanConvertExternalToXYB(const ColorEncoding& c_current,
+                             const JxlPixelFormat& format,
+                             size_t bits_per_sample);
+
+// Same result as converting the color channels of the interleaved buffer
+// `data` (`stride` bytes per row) to float planes and calling ToXYB on them,
+// but in a single pass over each row, without the intermediate float image.
+// The size of `image` determines how many pixels are read.
+Status ExternalToXYB(const uint8_t* data, size_t stride,
+                     const JxlPixelFormat& format, size_t bits_per_sample,
+                     const ColorEncoding& c_current, float intensity_target,
+                     ThreadPool* pool, Image3F* JXL_RESTRICT image,
+                     Image3F* JXL_RESTRICT linear);
+
 void LinearRGBRowToXYB(float* JXL_RESTRICT row0, float* JXL_RESTRICT row1,
                        float* JXL_RESTRICT row2,
                        const float* JXL_RESTRICT premul_absorb, size_t xsize);
@@ -38,6 +38,7 @@
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/cms/color_encoding_cms.h"
 #include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_cache.h"
@@ -2181,7 +2182,8 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
   auto decode_jpg = [&]() -> jxl::Status {
     JXL_ASSIGN_OR_RETURN(
         jpeg_data,
-        jxl::jpeg::ParseJPG(memory_manager, jxl::Bytes(buffer, size)));
+        jxl::jpeg::ParseJPG(memory_manager, jxl::Bytes(buffer, size),
+                            frame_settings->enc->thread_pool.get()));
     return true;
   };
   jxl::Status status = decode_jpg();
@@ -2804,6 +2806,24 @@ JXL_EXPORT void JxlEncoderSetDebugImageCallback(
   frame_settings->values.cparams.debug_image_opaque = opaque;
 }
 
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetAcEntropyPreset(
+    JxlEncoderFrameSettings* frame_settings, const uint8_t* data, size_t size) {
+  if (data == nullptr) {
+    frame_settings->values.cparams.ac_entropy_preset.reset();
+    return JxlErrorOrStatus::Success();
+  }
+  jxl::StatusOr<jxl::EntropyCodePreset> preset =
+      jxl::EntropyCodePreset::Deserialize(jxl::Bytes(data, size));
+  if (!preset.ok()) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "invalid AC entropy preset");
+  }
+  frame_settings->values.cparams.ac_entropy_preset =
+      std::make_shared<const jxl::EntropyCodePreset>(
+          std::move(preset).value_());
+  return JxlErrorOrStatus::Success();
+}
+
 JXL_EXPORT JxlEncoderStats* JxlEncoderStatsCreate() {
   JxlEncoderStats* result = new JxlEncoderStats();
   result->aux_out = jxl::make_unique<jxl::AuxOut>();
@@ -2875,6 +2895,8 @@ JXL_EXPORT size_t JxlEncoderStatsGet(const JxlEncoderStats* stats,
       return aux_out.num_dct64_blocks;
     case JXL_ENC_STAT_NUM_BUTTERAUGLI_ITERS:
       return aux_out.num_butteraugli_iters;
+    case JXL_ENC_STAT_NUM_FLAT_BLOCKS:
+      return aux_out.num_flat_blocks;
     default:
       return 0;
   }
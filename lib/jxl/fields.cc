@@ -451,6 +451,57 @@ uint32_t U32Coder::Read(const U32Enc enc, BitReader* JXL_RESTRICT reader) {
   }
 }
 
+namespace {
+
+template <bool kUnchecked>
+void ReadManyU32(const uint32_t* JXL_RESTRICT offsets,
+                 const uint32_t* JXL_RESTRICT extra_bits,
+                 size_t values_per_refill, size_t count,
+                 BitReader* JXL_RESTRICT reader,
+                 uint32_t* JXL_RESTRICT values) {
+  for (size_t i = 0; i < count;) {
+    if (kUnchecked) {
+      reader->RefillUnchecked();
+    } else {
+      reader->Refill();
+    }
+    const size_t end = std::min(count, i + values_per_refill);
+    for (; i < end; ++i) {
+      const size_t selector = reader->PeekFixedBits<2>();
+      reader->Consume(2);
+      const size_t nbits = extra_bits[selector];
+      values[i] = reader->PeekBits(nbits) + offsets[selector];
+      reader->Consume(nbits);
+    }
+  }
+}
+
+}  // namespace
+
+void U32Coder::ReadMany(const U32Enc enc, const size_t count,
+                        BitReader* JXL_RESTRICT reader,
+                        uint32_t* JXL_RESTRICT values) {
+  // Direct distributions are read as zero extra bits plus an offset.
+  uint32_t offsets[4];
+  uint32_t extra_bits[4];
+  for (uint32_t selector = 0; selector < 4; ++selector) {
+    const U32Distr d = enc.GetDistr(selector);
+    offsets[selector] = d.IsDirect() ? d.Direct() : d.Offset();
+    extra_bits[selector] = d.IsDirect() ? 0 : d.ExtraBits();
+  }
+  const size_t max_bits = MaxEncodedBits(enc);
+  // Refill() guarantees at least kMaxBitsPerCall bits in the buffer.
+  const size_t values_per_refill =
+      std::max<size_t>(1, BitReader::kMaxBitsPerCall / max_bits);
+  if (reader->CanRefillUnchecked(count * max_bits)) {
+    ReadManyU32</*kUnchecked=*/true>(offsets, extra_bits, values_per_refill,
+                                     count, reader, values);
+  } else {
+    ReadManyU32</*kUnchecked=*/false>(offsets, extra_bits, values_per_refill,
+                                      count, reader, values);
+  }
+}
+
 Status U32Coder::ChooseSelector(const U32Enc enc, const uint32_t value,
                                 uint32_t* JXL_RESTRICT selector,
                                 size_t* JXL_RESTRICT total_bits) {
@@ -60,6 +60,12 @@ size_t MaxEncodedBits(U32Enc enc);
 Status CanEncode(U32Enc enc, uint32_t value, size_t* JXL_RESTRICT encoded_bits);
 uint32_t Read(U32Enc enc, BitReader* JXL_RESTRICT reader);
 
+// Equivalent to calling Read `count` times, but decodes the selectors without
+// branches, shares each refill among as many values as fit in the bit buffer
+// and skips the per-refill bounds check when the input is long enough.
+void ReadMany(U32Enc enc, size_t count, BitReader* JXL_RESTRICT reader,
+              uint32_t* JXL_RESTRICT values);
+
 // Returns false if the value is too large to encode.
 Status Write(U32Enc enc, uint32_t value, BitWriter* JXL_RESTRICT writer);
 
@@ -10,9 +10,11 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/random.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_bit_reader.h"
@@ -65,6 +67,48 @@ TEST(FieldsTest, U32CoderTest) {
   TestU32Coder(0xFFFFFFFFu, 34);
 }
 
+// ReadMany is the same as reading the values one by one, both when the input
+// is long enough to skip bounds checks and when it is not.
+TEST(FieldsTest, U32CoderReadManyTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const U32Enc enc(Bits(10), BitsOffset(14, 1024), Val(7), Bits(32));
+  for (size_t count : {1, 3, 17, 1000}) {
+    for (bool padded : {false, true}) {
+      Rng rng(1234 + count);
+      std::vector<uint32_t> values(count);
+      const size_t max_bits = count * U32Coder::MaxEncodedBits(enc);
+      // Trailing data allows ReadMany to skip the bounds checks.
+      const size_t padding_words = padded ? max_bits / 32 + 8 : 0;
+      BitWriter writer{memory_manager};
+      ASSERT_TRUE(writer.WithMaxBits(
+          RoundUpBitsToByteMultiple(max_bits + padding_words * 32),
+          LayerType::Header, nullptr, [&] {
+            for (uint32_t& value : values) {
+              const uint32_t selector = rng.UniformU(0, 4);
+              value = selector == 0   ? rng.UniformU(0, 1024)
+                      : selector == 1 ? rng.UniformU(1024, 1024 + (1 << 14))
+                      : selector == 2 ? 7
+                                      : rng.UniformU(0, 1ULL << 32);
+              EXPECT_TRUE(U32Coder::Write(enc, value, &writer));
+            }
+            for (size_t i = 0; i < padding_words; ++i) {
+              writer.Write(32, 0);
+            }
+            writer.ZeroPadToByte();
+            return true;
+          }));
+
+      BitReader reader(writer.GetSpan());
+      EXPECT_EQ(padded, reader.CanRefillUnchecked(max_bits));
+      std::vector<uint32_t> decoded(count);
+      U32Coder::ReadMany(enc, count, &reader, decoded.data());
+      EXPECT_EQ(values, decoded);
+      EXPECT_TRUE(reader.AllReadsWithinBounds());
+      EXPECT_TRUE(reader.Close());
+    }
+  }
+}
+
 void TestU64Coder(const uint64_t value, const size_t expected_bits_written) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   BitWriter writer{memory_manager};
@@ -8,6 +8,7 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -20,6 +21,7 @@
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/jpeg/dec_jpeg_output_chunk.h"
@@ -43,6 +45,10 @@ const int kJpegPrecision = 8;
 // JpegBitWriter: buffer size
 const size_t kJpegBitWriterChunkSize = 16384;
 
+// Scans stop after an MCU row once this many chunks are waiting to be output,
+// and continue after the output queue has been drained.
+const size_t kMaxQueuedChunks = 16;
+
 // Returns non-zero if and only if x has a zero byte, i.e. one of
 // x & 0xff, x & 0xff00, ..., x & 0xff00000000000000 is zero.
 JXL_INLINE uint64_t HasZeroByte(uint64_t x) {
@@ -194,13 +200,57 @@ void DCTCodingStateInit(DCTCodingState* s) {
   s->refinement_bits_.reserve(64);
 }
 
-JXL_INLINE void WriteSymbol(int symbol, HuffmanCodeTable* table,
-                            JpegBitWriter* bw) {
+// Bits of a part of a sequential scan encoded in parallel with the other
+// parts, without byte stuffing: see EncodeSequentialScanParallel.
+struct RawBits {
+  std::vector<uint64_t> words;
+  uint64_t put_buffer = 0;
+  int put_bits = 64;
+
+  size_t NumBits() const { return words.size() * 64 + 64 - put_bits; }
+  uint64_t Word(size_t i) const {
+    if (i < words.size()) return words[i];
+    return i == words.size() ? put_buffer : 0;
+  }
+};
+
+// Same as WriteBits for JpegBitWriter, for up to 32 bits.
+JXL_INLINE void WriteBits(RawBits* bw, int nbits, uint64_t bits) {
+  JXL_DASSERT(nbits > 0 && nbits <= 32);
+  bw->put_bits -= nbits;
+  if (JXL_UNLIKELY(bw->put_bits < 0)) {
+    bw->put_buffer |= (bits >> -bw->put_bits);
+    bw->words.push_back(bw->put_buffer);
+    bw->put_bits += 64;
+    bw->put_buffer = bits << bw->put_bits;
+  } else {
+    bw->put_buffer |= (bits << bw->put_bits);
+  }
+}
+
+// Appends bits [begin, end) of `raw` to `bw`.
+void AppendBits(const RawBits& raw, size_t begin, size_t end,
+                JpegBitWriter* bw) {
+  while (begin < end) {
+    const size_t nbits = std::min<size_t>(32, end - begin);
+    const size_t i = begin / 64;
+    const size_t shift = begin % 64;
+    uint64_t bits = raw.Word(i) << shift;
+    if (shift != 0) bits |= raw.Word(i + 1) >> (64 - shift);
+    Reserve(bw, 16);
+    WriteBits(bw, nbits, bits >> (64 - nbits));
+    begin += nbits;
+  }
+}
+
+template <typename Writer>
+JXL_INLINE void WriteSymbol(int symbol, HuffmanCodeTable* table, Writer* bw) {
   WriteBits(bw, table->depth[symbol], table->code[symbol]);
 }
 
+template <typename Writer>
 JXL_INLINE void WriteSymbolBits(int symbol, HuffmanCodeTable* table,
-                                JpegBitWriter* bw, int nbits, uint64_t bits) {
+                                Writer* bw, int nbits, uint64_t bits) {
   WriteBits(bw, nbits + table->depth[symbol],
             bits | (table->code[symbol] << nbits));
 }
@@ -524,9 +574,10 @@ bool EncodeInterMarkerData(const JPEGData& jpg, SerializationState* state) {
   return true;
 }
 
+template <typename Writer>
 bool EncodeDCTBlockSequential(const coeff_t* coeffs, HuffmanCodeTable* dc_huff,
                               HuffmanCodeTable* ac_huff, int num_zero_runs,
-                              coeff_t* last_dc_coeff, JpegBitWriter* bw) {
+                              coeff_t* last_dc_coeff, Writer* bw) {
   coeff_t temp2;
   coeff_t temp;
   coeff_t litmus = 0;
@@ -729,6 +780,29 @@ bool EncodeRefinementBits(const coeff_t* coeffs, HuffmanCodeTable* ac_huff,
   return true;
 }
 
+// Returns the number of leading MCU rows of the scan that lie within the first
+// state.num_available_rows rows of the image.
+int NumAvailableMcuRows(const JPEGData& jpg, const JPEGScanInfo& scan_info,
+                        const SerializationState& state) {
+  int MCUs_per_row = 0;
+  int MCU_rows = 0;
+  jpg.CalculateMcuSize(scan_info, &MCUs_per_row, &MCU_rows);
+  if (state.num_available_rows >= static_cast<size_t>(jpg.height)) {
+    return MCU_rows;
+  }
+  int max_v_samp_factor = 1;
+  for (const auto& c : jpg.components) {
+    max_v_samp_factor = std::max(c.v_samp_factor, max_v_samp_factor);
+  }
+  const bool is_interleaved = (scan_info.num_components > 1);
+  const int v_group =
+      is_interleaved
+          ? 1
+          : jpg.components[scan_info.components[0].comp_idx].v_samp_factor;
+  const size_t mcu_height = 8 * max_v_samp_factor / v_group;
+  return std::min<size_t>(MCU_rows, state.num_available_rows / mcu_height);
+}
+
 template <int kMode>
 SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
                                               SerializationState* state) {
@@ -801,12 +875,8 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
   // When "incomplete" |ac_dc| tracks information about current ("incomplete")
   // band parsing progress.
 
-  // FIXME: Is this always complete?
-  // const int last_mcu_y =
-  //     complete ? MCU_rows : parsing_state.internal->ac_dc.next_mcu_y *
-  //     v_group;
   (void)complete;
-  const int last_mcu_y = complete ? MCU_rows : 0;
+  const int last_mcu_y = NumAvailableMcuRows(jpg, scan_info, *state);
 
   for (; ss.mcu_y < last_mcu_y; ++ss.mcu_y) {
     for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
@@ -880,6 +950,12 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
       }
       --ss.restarts_to_go;
     }
+    if (state->output_queue.size() >= kMaxQueuedChunks &&
+        ss.mcu_y + 1 < last_mcu_y) {
+      ++ss.mcu_y;
+      if (!bw->healthy) return SerializationStatus::ERROR;
+      return SerializationStatus::NEEDS_MORE_OUTPUT;
+    }
   }
   if (ss.mcu_y < MCU_rows) {
     if (!bw->healthy) return SerializationStatus::ERROR;
@@ -897,6 +973,220 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
   return SerializationStatus::DONE;
 }
 
+// Sequential scans are encoded in parallel parts of at least
+// kMinMcusPerScanPart MCUs; at most kMaxMcusPerScanPart MCUs per part are
+// buffered at a time.
+constexpr size_t kMaxScanParts = 64;
+constexpr size_t kMinMcusPerScanPart = 256;
+constexpr size_t kMaxMcusPerScanPart = 1024;
+
+// A task of EncodeSequentialScanParallel: the bits of a range of MCUs, and the
+// bit positions at which restart markers follow.
+struct SequentialScanPart {
+  RawBits bits;
+  std::vector<size_t> restarts;
+};
+
+// Encodes the MCUs [mcu_begin, mcu_end) of a sequential scan.
+bool EncodeSequentialScanPart(const JPEGData& jpg, SerializationState* state,
+                              int restart_interval, size_t mcu_begin,
+                              size_t mcu_end, SequentialScanPart* part) {
+  const JPEGScanInfo& scan_info = jpg.scan_info[state->scan_index];
+  const bool is_interleaved = (scan_info.num_components > 1);
+  int MCUs_per_row = 0;
+  int MCU_rows = 0;
+  jpg.CalculateMcuSize(scan_info, &MCUs_per_row, &MCU_rows);
+  const size_t num_mcus = static_cast<size_t>(MCUs_per_row) * MCU_rows;
+
+  size_t blocks_per_mcu = 0;
+  for (size_t i = 0; i < scan_info.num_components; ++i) {
+    const JPEGComponent& c = jpg.components[scan_info.components[i].comp_idx];
+    blocks_per_mcu += is_interleaved ? c.h_samp_factor * c.v_samp_factor : 1;
+  }
+  size_t block_scan_index = mcu_begin * blocks_per_mcu;
+  const auto& extra_zero_runs = scan_info.extra_zero_runs;
+  size_t extra_zero_runs_pos =
+      std::lower_bound(extra_zero_runs.begin(), extra_zero_runs.end(),
+                       block_scan_index,
+                       [](const JPEGScanInfo::ExtraZeroRunInfo& info,
+                          size_t index) { return info.block_idx < index; }) -
+      extra_zero_runs.begin();
+
+  // Without restarts, the DC coefficients are predicted from the last block of
+  // the previous MCU.
+  coeff_t last_dc_coeff[kMaxComponents] = {0};
+  if (restart_interval == 0 && mcu_begin > 0) {
+    const int mcu_y = (mcu_begin - 1) / MCUs_per_row;
+    const int mcu_x = (mcu_begin - 1) % MCUs_per_row;
+    for (size_t i = 0; i < scan_info.num_components; ++i) {
+      const JPEGComponentScanInfo& si = scan_info.components[i];
+      const JPEGComponent& c = jpg.components[si.comp_idx];
+      int n_blocks_y = is_interleaved ? c.v_samp_factor : 1;
+      int n_blocks_x = is_interleaved ? c.h_samp_factor : 1;
+      size_t block_y = (mcu_y + 1) * n_blocks_y - 1;
+      size_t block_x = (mcu_x + 1) * n_blocks_x - 1;
+      size_t block_idx = block_y * c.width_in_blocks + block_x;
+      last_dc_coeff[si.comp_idx] = c.coeffs[block_idx << 6];
+    }
+  }
+
+  RawBits* bw = &part->bits;
+  for (size_t mcu = mcu_begin; mcu < mcu_end; ++mcu) {
+    const int mcu_y = mcu / MCUs_per_row;
+    const int mcu_x = mcu % MCUs_per_row;
+    for (size_t i = 0; i < scan_info.num_components; ++i) {
+      const JPEGComponentScanInfo& si = scan_info.components[i];
+      const JPEGComponent& c = jpg.components[si.comp_idx];
+      HuffmanCodeTable* dc_huff = &state->dc_huff_table[si.dc_tbl_idx];
+      HuffmanCodeTable* ac_huff = &state->ac_huff_table[si.ac_tbl_idx];
+      int n_blocks_y = is_interleaved ? c.v_samp_factor : 1;
+      int n_blocks_x = is_interleaved ? c.h_samp_factor : 1;
+      for (int iy = 0; iy < n_blocks_y; ++iy) {
+        for (int ix = 0; ix < n_blocks_x; ++ix) {
+          int block_y = mcu_y * n_blocks_y + iy;
+          int block_x = mcu_x * n_blocks_x + ix;
+          size_t block_idx = static_cast<size_t>(block_y) * c.width_in_blocks +
+                             static_cast<size_t>(block_x);
+          int num_zero_runs = 0;
+          if (extra_zero_runs_pos < extra_zero_runs.size() &&
+              extra_zero_runs[extra_zero_runs_pos].block_idx ==
+                  block_scan_index) {
+            num_zero_runs =
+                extra_zero_runs[extra_zero_runs_pos].num_extra_zero_runs;
+            ++extra_zero_runs_pos;
+          }
+          const coeff_t* coeffs = &c.coeffs[block_idx << 6];
+          if (!EncodeDCTBlockSequential(coeffs, dc_huff, ac_huff,
+                                        num_zero_runs,
+                                        last_dc_coeff + si.comp_idx, bw)) {
+            return false;
+          }
+          ++block_scan_index;
+        }
+      }
+    }
+    if (restart_interval > 0 && (mcu + 1) % restart_interval == 0 &&
+        mcu + 1 < num_mcus) {
+      part->restarts.push_back(bw->NumBits());
+      memset(last_dc_coeff, 0, sizeof(last_dc_coeff));
+    }
+  }
+  return true;
+}
+
+// Same as DoEncodeScan<0>, but encodes windows of the scan in parallel parts,
+// and then appends their bits to the output, inserting the padding bits and
+// restart markers between restart intervals.
+SerializationStatus EncodeSequentialScanParallel(const JPEGData& jpg,
+                                                 SerializationState* state) {
+  const JPEGScanInfo& scan_info = jpg.scan_info[state->scan_index];
+  EncodeScanState& ss = state->scan_state;
+  const int restart_interval =
+      state->seen_dri_marker ? jpg.restart_interval : 0;
+  int MCUs_per_row = 0;
+  int MCU_rows = 0;
+  jpg.CalculateMcuSize(scan_info, &MCUs_per_row, &MCU_rows);
+  const size_t num_mcus = static_cast<size_t>(MCUs_per_row) * MCU_rows;
+
+  if (ss.stage == EncodeScanState::HEAD) {
+    for (size_t i = 0; i < scan_info.num_components; ++i) {
+      const JPEGComponentScanInfo& si = scan_info.components[i];
+      if (!state->dc_huff_table[si.dc_tbl_idx].initialized ||
+          !state->ac_huff_table[si.ac_tbl_idx].initialized) {
+        return SerializationStatus::ERROR;
+      }
+    }
+    if (!EncodeSOS(jpg, scan_info, state)) return SerializationStatus::ERROR;
+    JpegBitWriterInit(&ss.bw, &state->output_queue);
+    ss.next_restart_marker = 0;
+    ss.next_mcu = 0;
+    ss.stage = EncodeScanState::BODY;
+  }
+  JpegBitWriter* bw = &ss.bw;
+
+  if (ss.stage != EncodeScanState::BODY) return SerializationStatus::ERROR;
+
+  // With restarts, parts start at restart intervals.
+  const size_t granularity = restart_interval > 0 ? restart_interval : 1;
+  const size_t num_units = DivCeil(num_mcus, granularity);
+  const size_t first_unit = ss.next_mcu / granularity;
+  const size_t max_units_per_part =
+      DivCeil(kMaxMcusPerScanPart, granularity);
+  const size_t window_units = std::min(
+      num_units - first_unit, ss.num_parallel_tasks * max_units_per_part);
+  const size_t num_parts = std::min(ss.num_parallel_tasks, window_units);
+  std::vector<SequentialScanPart> parts(num_parts);
+  std::atomic<bool> ok{true};
+  const auto encode_part = [&](const uint32_t task,
+                               size_t /* thread */) -> Status {
+    const size_t unit_begin = first_unit + task * window_units / num_parts;
+    const size_t unit_end = first_unit + (task + 1) * window_units / num_parts;
+    const size_t mcu_end = std::min(num_mcus, unit_end * granularity);
+    if (!EncodeSequentialScanPart(jpg, state, restart_interval,
+                                  unit_begin * granularity, mcu_end,
+                                  &parts[task])) {
+      ok = false;
+    }
+    return true;
+  };
+  if (!RunOnPool(state->pool, 0, num_parts, ThreadPool::NoInit, encode_part,
+                 "EncodeSequentialScan") ||
+      !ok) {
+    return SerializationStatus::ERROR;
+  }
+
+  for (const SequentialScanPart& part : parts) {
+    size_t pos = 0;
+    for (size_t restart : part.restarts) {
+      AppendBits(part.bits, pos, restart, bw);
+      pos = restart;
+      if (!JumpToByteBoundary(bw, &state->pad_bits, state->pad_bits_end)) {
+        return SerializationStatus::ERROR;
+      }
+      EmitMarker(bw, 0xD0 + ss.next_restart_marker);
+      ss.next_restart_marker = (ss.next_restart_marker + 1) & 0x7;
+    }
+    AppendBits(part.bits, pos, part.bits.NumBits(), bw);
+  }
+  ss.next_mcu = std::min(num_mcus, (first_unit + window_units) * granularity);
+  if (ss.next_mcu < num_mcus) {
+    if (!bw->healthy) return SerializationStatus::ERROR;
+    return SerializationStatus::NEEDS_MORE_OUTPUT;
+  }
+
+  if (!JumpToByteBoundary(bw, &state->pad_bits, state->pad_bits_end)) {
+    return SerializationStatus::ERROR;
+  }
+  JpegBitWriterFinish(bw);
+  ss.stage = EncodeScanState::HEAD;
+  state->scan_index++;
+  if (!bw->healthy) return SerializationStatus::ERROR;
+
+  return SerializationStatus::DONE;
+}
+
+// Returns the number of parts EncodeSequentialScanParallel should encode in
+// parallel, or 0 if the scan should be encoded serially.
+size_t NumSequentialScanTasks(const JPEGData& jpg,
+                              const SerializationState& state) {
+  if (state.pool == nullptr) return 0;
+  // Parts are encoded only once all the coefficients are available.
+  if (state.num_available_rows < static_cast<size_t>(jpg.height)) return 0;
+  const JPEGScanInfo& scan_info = jpg.scan_info[state.scan_index];
+  // The parts find their extra zero runs by binary search.
+  const auto& extra_zero_runs = scan_info.extra_zero_runs;
+  for (size_t i = 1; i < extra_zero_runs.size(); ++i) {
+    if (extra_zero_runs[i].block_idx <= extra_zero_runs[i - 1].block_idx) {
+      return 0;
+    }
+  }
+  int MCUs_per_row = 0;
+  int MCU_rows = 0;
+  jpg.CalculateMcuSize(scan_info, &MCUs_per_row, &MCU_rows);
+  const size_t num_mcus = static_cast<size_t>(MCUs_per_row) * MCU_rows;
+  return std::min(kMaxScanParts, num_mcus / kMinMcusPerScanPart);
+}
+
 SerializationStatus JXL_INLINE EncodeScan(const JPEGData& jpg,
                                           SerializationState* state) {
   const JPEGScanInfo& scan_info = jpg.scan_info[state->scan_index];
@@ -908,6 +1198,13 @@ SerializationStatus JXL_INLINE EncodeScan(const JPEGData& jpg,
   const bool need_sequential =
       !is_progressive || (Ah == 0 && Al == 0 && Ss == 0 && Se == 63);
   if (need_sequential) {
+    EncodeScanState& ss = state->scan_state;
+    if (ss.stage == EncodeScanState::HEAD) {
+      ss.num_parallel_tasks = NumSequentialScanTasks(jpg, *state);
+    }
+    if (ss.num_parallel_tasks > 1) {
+      return EncodeSequentialScanParallel(jpg, state);
+    }
     return DoEncodeScan<0>(jpg, state);
   } else if (Ah == 0) {
     return DoEncodeScan<1>(jpg, state);
@@ -984,7 +1281,6 @@ SerializationStatus SerializeSection(uint8_t marker, SerializationState* state,
   }
 }
 
-// TODO(veluca): add streaming support again.
 Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
                          SerializationState* ss) {
   const auto maybe_push_output = [&]() -> Status {
@@ -995,6 +1291,7 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
         if (num_written == 0 && chunk.len > 0) {
           return JXL_NOT_ENOUGH_BYTES("Failed to write output");
         }
+        chunk.next += num_written;
         chunk.len -= num_written;
         if (chunk.len == 0) {
           ss->output_queue.pop_front();
@@ -1004,6 +1301,8 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
     return true;
   };
 
+  // Output left over from a previous call goes first.
+  JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
   while (true) {
     switch (ss->stage) {
       case SerializationState::STAGE_INIT: {
@@ -1022,8 +1321,8 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
         }
 
         EncodeSOI(ss);
-        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         ss->stage = SerializationState::STAGE_SERIALIZE_SECTION;
+        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         break;
       }
 
@@ -1039,15 +1338,11 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
           ss->stage = SerializationState::STAGE_ERROR;
           break;
         }
+        if (status == SerializationStatus::DONE) ++ss->section_index;
         JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         if (status == SerializationStatus::NEEDS_MORE_INPUT) {
-          return JXL_FAILURE("Incomplete serialization data");
-        } else if (status != SerializationStatus::DONE) {
-          ss->stage = SerializationState::STAGE_ERROR;
-          return JXL_FAILURE("Internal logic error");
-          break;
+          return JXL_NOT_ENOUGH_BYTES("Coefficients not available yet");
         }
-        ++ss->section_index;
         break;
       }
 
@@ -1066,10 +1361,16 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
 
 }  // namespace
 
-Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out) {
+Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out, ThreadPool* pool) {
   auto ss = jxl::make_unique<SerializationState>();
+  ss->pool = pool;
   return WriteJpegInternal(jpg, out, ss.get());
 }
 
+Status WriteJpegIncrementally(const JPEGData& jpg, const JPEGOutput& out,
+                              SerializationState* ss) {
+  return WriteJpegInternal(jpg, out, ss);
+}
+
 }  // namespace jpeg
 }  // namespace jxl
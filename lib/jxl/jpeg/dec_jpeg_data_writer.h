@@ -12,7 +12,9 @@
 #include <cstdint>
 #include <functional>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
 namespace jxl {
@@ -22,7 +24,16 @@ namespace jpeg {
 // written.
 using JPEGOutput = std::function<size_t(const uint8_t* buf, size_t len)>;
 
-Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out);
+// Sequential scans are encoded in parallel on `pool`, if not null.
+Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out,
+                 ThreadPool* pool = nullptr);
+
+// Same as WriteJpeg, but stops when `out` does not accept more bytes, or when
+// a scan needs coefficients beyond ss->num_available_rows, and then returns a
+// StatusCode::kNotEnoughBytes error. Calling it again with the same `ss`
+// continues where it stopped; `jpg` must stay alive until the JPEG is done.
+Status WriteJpegIncrementally(const JPEGData& jpg, const JPEGOutput& out,
+                              SerializationState* ss);
 
 }  // namespace jpeg
 }  // namespace jxl
@@ -10,8 +10,10 @@
 #include <cstddef>
 #include <cstdint>
 #include <deque>
+#include <limits>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/jpeg/dec_jpeg_output_chunk.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
@@ -66,6 +68,10 @@ struct EncodeScanState {
   int next_extra_zero_run_index;
   size_t next_reset_point_pos;
   int next_reset_point;
+  // Sequential scans encoded in parallel: the number of parts per window, and
+  // the first MCU of the next window.
+  size_t num_parallel_tasks = 0;
+  size_t next_mcu = 0;
 };
 
 struct SerializationState {
@@ -93,6 +99,10 @@ struct SerializationState {
   const uint8_t* pad_bits_end = nullptr;
   bool seen_dri_marker = false;
   bool is_progressive = false;
+  ThreadPool* pool = nullptr;
+  // Only the coefficients of the first num_available_rows rows of the image
+  // are final; scans stop at the last MCU row within them.
+  size_t num_available_rows = std::numeric_limits<size_t>::max();
 
   EncodeScanState scan_state;
 };
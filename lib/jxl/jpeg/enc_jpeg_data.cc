@@ -362,12 +362,13 @@ Status EncodeJPEGData(JxlMemoryManager* memory_manager, JPEGData& jpeg_data,
 }
 
 StatusOr<std::unique_ptr<JPEGData>> ParseJPG(JxlMemoryManager* memory_manager,
-                                             const Bytes bytes) {
+                                             const Bytes bytes,
+                                             ThreadPool* pool) {
   if (!IsJPG(bytes)) return JXL_FAILURE("Not JPEG");
   auto jpeg_data = jxl::make_unique<jxl::jpeg::JPEGData>();
   JXL_RETURN_IF_ERROR(jpeg::ReadJpeg(bytes.data(), bytes.size(),
                                      jpeg::JpegReadMode::kReadAll,
-                                     jpeg_data.get()));
+                                     jpeg_data.get(), pool));
   return jpeg_data;
 }
 
@@ -12,6 +12,7 @@
 #include <memory>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
@@ -45,10 +46,12 @@ Status SetColorTransformFromJpegData(const JPEGData& jpg,
 
 /**
  * Decodes bytes containing JPEG codestream as coefficients only,
- * for lossless JPEG transcoding.
+ * for lossless JPEG transcoding. Scans with restart markers are decoded on
+ * pool, if not null.
  */
 StatusOr<std::unique_ptr<JPEGData>> ParseJPG(JxlMemoryManager* memory_manager,
-                                             Bytes bytes);
+                                             Bytes bytes,
+                                             ThreadPool* pool = nullptr);
 Status SetBlobsFromJpegData(const jpeg::JPEGData& jpeg_data, Blobs* blobs);
 
 }  // namespace jpeg
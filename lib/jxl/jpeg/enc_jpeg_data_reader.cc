@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/frame_dimensions.h"
@@ -377,6 +378,15 @@ Status ProcessCOM(const uint8_t* data, const size_t len, size_t* pos,
   return true;
 }
 
+// Information about the entropy coded data of (a part of) a scan that is
+// needed to reconstruct it exactly, besides the coefficients.
+struct ScanSideInfo {
+  std::vector<uint32_t> reset_points;
+  std::vector<JPEGScanInfo::ExtraZeroRunInfo> extra_zero_runs;
+  std::vector<uint8_t> padding_bits;
+  bool has_zero_padding_bit = false;
+};
+
 // Helper structure to read bits from the entropy coded data segment.
 struct BitReaderState {
   BitReaderState(const uint8_t* data, const size_t len, size_t pos)
@@ -433,16 +443,16 @@ struct BitReaderState {
   // Enqueue the padding bits seen (0 or 1).
   // Returns false if there is inconsistent or invalid padding or the stream
   // ended too early.
-  bool FinishStream(JPEGData* jpg, size_t* pos) {
+  bool FinishStream(ScanSideInfo* side_info, size_t* pos) {
     int npadbits = bits_left_ & 7;
     if (npadbits > 0) {
       uint64_t padmask = (1ULL << npadbits) - 1;
       uint64_t padbits = (val_ >> (bits_left_ - npadbits)) & padmask;
       if (padbits != padmask) {
-        jpg->has_zero_padding_bit = true;
+        side_info->has_zero_padding_bit = true;
       }
       for (int i = npadbits - 1; i >= 0; --i) {
-        jpg->padding_bits.push_back((padbits >> i) & 1);
+        side_info->padding_bits.push_back((padbits >> i) & 1);
       }
     }
     // Give back some bytes that we did not use.
@@ -722,11 +732,13 @@ Status RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
   return true;
 }
 
+// Finishes the entropy coded data of a restart interval and resets br to the
+// start of the next one, which is also stored in *next_pos.
 bool ProcessRestart(const uint8_t* data, const size_t len,
                     int* next_restart_marker, BitReaderState* br,
-                    JPEGData* jpg) {
+                    size_t* next_pos, ScanSideInfo* side_info) {
   size_t pos = 0;
-  if (!br->FinishStream(jpg, &pos)) {
+  if (!br->FinishStream(side_info, &pos)) {
     return JXL_FAILURE("Invalid scan");
   }
   int expected_marker = 0xd0 + *next_restart_marker;
@@ -736,17 +748,159 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
     return JXL_FAILURE("Did not find expected restart marker %d actual %d",
                        expected_marker, marker);
   }
-  br->Reset(pos + 2);
+  *next_pos = pos + 2;
+  br->Reset(*next_pos);
   *next_restart_marker += 1;
   *next_restart_marker &= 0x7;
   return true;
 }
 
+// Parameters of the scan being decoded, shared by all its MCU ranges.
+struct ScanParams {
+  const std::vector<HuffmanTableEntry>* dc_huff_lut;
+  const std::vector<HuffmanTableEntry>* ac_huff_lut;
+  const JPEGScanInfo* scan_info;
+  bool is_interleaved;
+  int Ss;
+  int Se;
+  int Al;
+  int Ah;
+  size_t MCUs_per_row;
+  size_t blocks_per_mcu;
+};
+
+// Decodes the MCUs [mcu_begin, mcu_end) of the scan from the entropy coded data
+// at br, which has to be the start of the scan or of a restart interval. If
+// at_restart_marker is set, the restart marker that follows mcu_end is consumed
+// too, otherwise the scan is finished. Sets *pos to where parsing continues.
+Status DecodeMCURange(const uint8_t* data, const size_t len,
+                      const ScanParams& sp, size_t mcu_begin, size_t mcu_end,
+                      bool at_restart_marker, BitReaderState* br, size_t* pos,
+                      ScanSideInfo* side_info, JPEGData* jpg) {
+  const JPEGScanInfo* scan_info = sp.scan_info;
+  coeff_t last_dc_coeff[kMaxComponents] = {0};
+  int restarts_to_go = jpg->restart_interval;
+  int next_restart_marker =
+      jpg->restart_interval > 0
+          ? static_cast<int>((mcu_begin / jpg->restart_interval) & 0x7)
+          : 0;
+  int eobrun = -1;
+  const auto restart = [&]() -> Status {
+    if (!ProcessRestart(data, len, &next_restart_marker, br, pos, side_info)) {
+      return JXL_FAILURE("Could not process restart.");
+    }
+    restarts_to_go = jpg->restart_interval;
+    memset(static_cast<void*>(last_dc_coeff), 0, sizeof(last_dc_coeff));
+    if (eobrun > 0) {
+      return JXL_FAILURE("End-of-block run too long.");
+    }
+    eobrun = -1;  // fresh start
+    return true;
+  };
+  size_t block_scan_index = mcu_begin * sp.blocks_per_mcu;
+  for (size_t mcu = mcu_begin; mcu < mcu_end; ++mcu) {
+    const size_t mcu_y = mcu / sp.MCUs_per_row;
+    const size_t mcu_x = mcu % sp.MCUs_per_row;
+    // Handle the restart intervals.
+    if (jpg->restart_interval > 0) {
+      if (restarts_to_go == 0) {
+        JXL_RETURN_IF_ERROR(restart());
+      }
+      --restarts_to_go;
+    }
+    // Decode one MCU.
+    for (size_t i = 0; i < scan_info->num_components; ++i) {
+      const JPEGComponentScanInfo* si = &scan_info->components[i];
+      JPEGComponent* c = &jpg->components[si->comp_idx];
+      const HuffmanTableEntry* dc_lut =
+          &(*sp.dc_huff_lut)[si->dc_tbl_idx * kJpegHuffmanLutSize];
+      const HuffmanTableEntry* ac_lut =
+          &(*sp.ac_huff_lut)[si->ac_tbl_idx * kJpegHuffmanLutSize];
+      size_t nblocks_y = sp.is_interleaved ? c->v_samp_factor : 1;
+      size_t nblocks_x = sp.is_interleaved ? c->h_samp_factor : 1;
+      for (size_t iy = 0; iy < nblocks_y; ++iy) {
+        for (size_t ix = 0; ix < nblocks_x; ++ix) {
+          size_t block_y = mcu_y * nblocks_y + iy;
+          size_t block_x = mcu_x * nblocks_x + ix;
+          size_t block_idx = block_y * c->width_in_blocks + block_x;
+          bool reset_state = false;
+          int num_zero_runs = 0;
+          coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
+          if (sp.Ah == 0) {
+            JXL_RETURN_IF_ERROR(DecodeDCTBlock(
+                dc_lut, ac_lut, sp.Ss, sp.Se, sp.Al, &eobrun, &reset_state,
+                &num_zero_runs, br, jpg, &last_dc_coeff[si->comp_idx],
+                coeffs));
+          } else {
+            JXL_RETURN_IF_ERROR(RefineDCTBlock(ac_lut, sp.Ss, sp.Se, sp.Al,
+                                               &eobrun, &reset_state, br, jpg,
+                                               coeffs));
+          }
+          if (reset_state) {
+            side_info->reset_points.emplace_back(block_scan_index);
+          }
+          if (num_zero_runs > 0) {
+            JPEGScanInfo::ExtraZeroRunInfo info;
+            info.block_idx = block_scan_index;
+            info.num_extra_zero_runs = num_zero_runs;
+            side_info->extra_zero_runs.push_back(info);
+          }
+          ++block_scan_index;
+        }
+      }
+    }
+  }
+  if (at_restart_marker) {
+    return restart();
+  }
+  if (eobrun > 0) {
+    return JXL_FAILURE("End-of-block run too long.");
+  }
+  if (!br->FinishStream(side_info, pos)) {
+    return JXL_FAILURE("Invalid scan.");
+  }
+  return true;
+}
+
+// Upper bound on the number of parallel tasks a scan is split into, and lower
+// bound on the number of MCUs per task, so that tasks amortize the pre-scan
+// for restart markers and the merging of their side information.
+constexpr size_t kMaxScanTasks = 64;
+constexpr size_t kMinMCUsPerScanTask = 256;
+
+// Finds the positions of the entropy coded data of the restart intervals
+// 0, intervals_per_task, 2 * intervals_per_task, ... of the scan starting at
+// pos. Returns false if some restart marker is missing or out of order, in
+// which case the scan is decoded serially to report the error.
+bool FindScanTaskStarts(const uint8_t* data, const size_t len, size_t pos,
+                        size_t num_intervals, size_t intervals_per_task,
+                        std::vector<size_t>* task_starts) {
+  task_starts->assign(1, pos);
+  // Bytes after len - 2 are never read by BitReaderState.
+  const size_t end = len < 2 ? 0 : len - 2;
+  for (size_t interval = 1; interval < num_intervals; ++interval) {
+    // Skip to the next 0xff that is not followed by a 0x00 stuffing byte.
+    while (true) {
+      if (pos >= end) return false;
+      const void* ff = memchr(data + pos, 0xff, end - pos);
+      if (ff == nullptr) return false;
+      pos = static_cast<const uint8_t*>(ff) - data;
+      if (data[pos + 1] != 0) break;
+      pos += 2;
+    }
+    if (data[pos + 1] != 0xd0 + ((interval - 1) & 0x7)) return false;
+    pos += 2;
+    if (interval % intervals_per_task == 0) task_starts->push_back(pos);
+  }
+  return true;
+}
+
 Status ProcessScan(const uint8_t* data, const size_t len,
                    const std::vector<HuffmanTableEntry>& dc_huff_lut,
                    const std::vector<HuffmanTableEntry>& ac_huff_lut,
                    uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
-                   bool is_progressive, size_t* pos, JPEGData* jpg) {
+                   bool is_progressive, ThreadPool* pool, size_t* pos,
+                   JPEGData* jpg) {
   JXL_RETURN_IF_ERROR(ProcessSOS(data, len, pos, jpg));
   JPEGScanInfo* scan_info = &jpg->scan_info.back();
   bool is_interleaved = (scan_info->num_components > 1);
@@ -764,12 +918,6 @@ Status ProcessScan(const uint8_t* data, const size_t len,
     MCUs_per_row = DivCeil(jpg->width * c.h_samp_factor, 8 * max_h_samp_factor);
     MCU_rows = DivCeil(jpg->height * c.v_samp_factor, 8 * max_v_samp_factor);
   }
-  coeff_t last_dc_coeff[kMaxComponents] = {0};
-  BitReaderState br(data, len, *pos);
-  int restarts_to_go = jpg->restart_interval;
-  int next_restart_marker = 0;
-  int eobrun = -1;
-  int block_scan_index = 0;
   const int Al = is_progressive ? scan_info->Al : 0;
   const int Ah = is_progressive ? scan_info->Ah : 0;
   const int Ss = is_progressive ? scan_info->Ss : 0;
@@ -805,73 +953,80 @@ Status ProcessScan(const uint8_t* data, const size_t len,
     }
   }
 
-  for (int mcu_y = 0; mcu_y < MCU_rows; ++mcu_y) {
-    for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
-      // Handle the restart intervals.
-      if (jpg->restart_interval > 0) {
-        if (restarts_to_go == 0) {
-          if (ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
-            restarts_to_go = jpg->restart_interval;
-            memset(static_cast<void*>(last_dc_coeff), 0, sizeof(last_dc_coeff));
-            if (eobrun > 0) {
-              return JXL_FAILURE("End-of-block run too long.");
-            }
-            eobrun = -1;  // fresh start
-          } else {
-            return JXL_FAILURE("Could not process restart.");
-          }
-        }
-        --restarts_to_go;
-      }
-      // Decode one MCU.
-      for (size_t i = 0; i < scan_info->num_components; ++i) {
-        JPEGComponentScanInfo* si = &scan_info->components[i];
-        JPEGComponent* c = &jpg->components[si->comp_idx];
-        const HuffmanTableEntry* dc_lut =
-            &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
-        const HuffmanTableEntry* ac_lut =
-            &ac_huff_lut[si->ac_tbl_idx * kJpegHuffmanLutSize];
-        int nblocks_y = is_interleaved ? c->v_samp_factor : 1;
-        int nblocks_x = is_interleaved ? c->h_samp_factor : 1;
-        for (int iy = 0; iy < nblocks_y; ++iy) {
-          for (int ix = 0; ix < nblocks_x; ++ix) {
-            int block_y = mcu_y * nblocks_y + iy;
-            int block_x = mcu_x * nblocks_x + ix;
-            size_t block_idx =
-                static_cast<size_t>(block_y) * c->width_in_blocks +
-                static_cast<size_t>(block_x);
-            bool reset_state = false;
-            int num_zero_runs = 0;
-            coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
-            if (Ah == 0) {
-              JXL_RETURN_IF_ERROR(
-                  DecodeDCTBlock(dc_lut, ac_lut, Ss, Se, Al, &eobrun,
-                                 &reset_state, &num_zero_runs, &br, jpg,
-                                 &last_dc_coeff[si->comp_idx], coeffs));
-            } else {
-              JXL_RETURN_IF_ERROR(RefineDCTBlock(
-                  ac_lut, Ss, Se, Al, &eobrun, &reset_state, &br, jpg, coeffs));
-            }
-            if (reset_state) {
-              scan_info->reset_points.emplace_back(block_scan_index);
-            }
-            if (num_zero_runs > 0) {
-              JPEGScanInfo::ExtraZeroRunInfo info;
-              info.block_idx = block_scan_index;
-              info.num_extra_zero_runs = num_zero_runs;
-              scan_info->extra_zero_runs.push_back(info);
-            }
-            ++block_scan_index;
-          }
-        }
-      }
+  ScanParams sp;
+  sp.dc_huff_lut = &dc_huff_lut;
+  sp.ac_huff_lut = &ac_huff_lut;
+  sp.scan_info = scan_info;
+  sp.is_interleaved = is_interleaved;
+  sp.Ss = Ss;
+  sp.Se = Se;
+  sp.Al = Al;
+  sp.Ah = Ah;
+  sp.MCUs_per_row = MCUs_per_row;
+  sp.blocks_per_mcu = 0;
+  for (size_t i = 0; i < scan_info->num_components; ++i) {
+    const JPEGComponent& c = jpg->components[scan_info->components[i].comp_idx];
+    sp.blocks_per_mcu +=
+        is_interleaved ? c.h_samp_factor * c.v_samp_factor : 1;
+  }
+  const size_t num_mcus = static_cast<size_t>(MCU_rows) * MCUs_per_row;
+
+  // Restart intervals can be decoded independently of each other, so split
+  // the scan into tasks of whole intervals once their positions are known.
+  size_t mcus_per_task = num_mcus;
+  std::vector<size_t> task_starts(1, *pos);
+  if (pool != nullptr && jpg->restart_interval > 0) {
+    const size_t restart_interval = jpg->restart_interval;
+    const size_t num_intervals = DivCeil(num_mcus, restart_interval);
+    const size_t intervals_per_task =
+        std::max(DivCeil(num_intervals, kMaxScanTasks),
+                 DivCeil(kMinMCUsPerScanTask, restart_interval));
+    if (num_intervals > intervals_per_task &&
+        FindScanTaskStarts(data, len, *pos, num_intervals, intervals_per_task,
+                           &task_starts)) {
+      mcus_per_task = intervals_per_task * restart_interval;
+    } else {
+      task_starts.assign(1, *pos);
     }
   }
-  if (eobrun > 0) {
-    return JXL_FAILURE("End-of-block run too long.");
+  const size_t num_tasks = task_starts.size();
+  std::vector<ScanSideInfo> side_infos(num_tasks);
+  const auto decode_task = [&](const uint32_t task,
+                               size_t /* thread */) -> Status {
+    const size_t mcu_begin = task * mcus_per_task;
+    const size_t mcu_end = std::min(num_mcus, mcu_begin + mcus_per_task);
+    BitReaderState br(data, len, task_starts[task]);
+    if (task + 1 == num_tasks) {
+      return DecodeMCURange(data, len, sp, mcu_begin, mcu_end,
+                            /*at_restart_marker=*/false, &br, pos,
+                            &side_infos[task], jpg);
+    }
+    size_t next_pos = 0;
+    JXL_RETURN_IF_ERROR(DecodeMCURange(data, len, sp, mcu_begin, mcu_end,
+                                       /*at_restart_marker=*/true, &br,
+                                       &next_pos, &side_infos[task], jpg));
+    if (next_pos != task_starts[task + 1]) {
+      return JXL_FAILURE("Unexpected restart marker position.");
+    }
+    return true;
+  };
+  if (num_tasks == 1) {
+    JXL_RETURN_IF_ERROR(decode_task(0, 0));
+  } else {
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_tasks, ThreadPool::NoInit,
+                                  decode_task, "DecodeJpegScan"));
   }
-  if (!br.FinishStream(jpg, pos)) {
-    return JXL_FAILURE("Invalid scan.");
+  for (ScanSideInfo& side_info : side_infos) {
+    scan_info->reset_points.insert(scan_info->reset_points.end(),
+                                   side_info.reset_points.begin(),
+                                   side_info.reset_points.end());
+    scan_info->extra_zero_runs.insert(scan_info->extra_zero_runs.end(),
+                                      side_info.extra_zero_runs.begin(),
+                                      side_info.extra_zero_runs.end());
+    jpg->padding_bits.insert(jpg->padding_bits.end(),
+                             side_info.padding_bits.begin(),
+                             side_info.padding_bits.end());
+    jpg->has_zero_padding_bit |= side_info.has_zero_padding_bit;
   }
   if (*pos > len) {
     return JXL_FAILURE("Unexpected end of file during scan. pos=%" PRIuS
@@ -921,7 +1076,7 @@ size_t FindNextMarker(const uint8_t* data, const size_t len, size_t pos) {
 }  // namespace
 
 Status ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
-                JPEGData* jpg) {
+                JPEGData* jpg, ThreadPool* pool) {
   size_t pos = 0;
   // Check SOI marker.
   JXL_JPEG_EXPECT_MARKER();
@@ -981,7 +1136,7 @@ Status ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
         if (mode == JpegReadMode::kReadAll) {
           JXL_RETURN_IF_ERROR(ProcessScan(data, len, dc_huff_lut, ac_huff_lut,
                                           scan_progression, is_progressive,
-                                          &pos, jpg));
+                                          pool, &pos, jpg));
         }
         found_sos = true;
         break;
@@ -11,6 +11,7 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
@@ -28,8 +29,10 @@ enum class JpegReadMode {
 // If mode is kReadHeader, it fills in only the image dimensions in *jpg.
 // Returns false if the data is not valid JPEG, or if it contains an unsupported
 // JPEG feature.
+// If pool is not null, scans with restart markers are decoded in parallel,
+// split at the restart interval boundaries.
 Status ReadJpeg(const uint8_t* data, size_t len, JpegReadMode mode,
-                JPEGData* jpg);
+                JPEGData* jpg, ThreadPool* pool = nullptr);
 
 }  // namespace jpeg
 }  // namespace jxl
@@ -0,0 +1,105 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/jpeg/enc_jpeg_data_reader.h"
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/enc_params.h"
+#include "lib/jxl/jpeg/dec_jpeg_data_writer.h"
+#include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/jpeg_data.h"
+#include "lib/jxl/test_memory_manager.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace {
+
+using test::ThreadPoolForTests;
+
+std::vector<uint8_t> SerializedJPEGData(const jpeg::JPEGData& jpeg_data) {
+  // EncodeJPEGData moves some fields out of its argument.
+  jpeg::JPEGData copy = jpeg_data;
+  std::vector<uint8_t> bytes;
+  EXPECT_TRUE(jpeg::EncodeJPEGData(jxl::test::MemoryManager(), copy, &bytes,
+                                   CompressParams()));
+  return bytes;
+}
+
+void ExpectSameJPEGData(const jpeg::JPEGData& expected,
+                        const jpeg::JPEGData& actual) {
+  EXPECT_EQ(SerializedJPEGData(expected), SerializedJPEGData(actual));
+  // The coefficients and the scan side information are filled in by the scan
+  // decoder; they are not part of the serialized fields.
+  ASSERT_EQ(expected.components.size(), actual.components.size());
+  for (size_t c = 0; c < expected.components.size(); ++c) {
+    EXPECT_EQ(expected.components[c].coeffs, actual.components[c].coeffs);
+  }
+  ASSERT_EQ(expected.scan_info.size(), actual.scan_info.size());
+  for (size_t i = 0; i < expected.scan_info.size(); ++i) {
+    const jpeg::JPEGScanInfo& expected_scan = expected.scan_info[i];
+    const jpeg::JPEGScanInfo& actual_scan = actual.scan_info[i];
+    EXPECT_EQ(expected_scan.reset_points, actual_scan.reset_points);
+    ASSERT_EQ(expected_scan.extra_zero_runs.size(),
+              actual_scan.extra_zero_runs.size());
+    for (size_t j = 0; j < expected_scan.extra_zero_runs.size(); ++j) {
+      EXPECT_EQ(expected_scan.extra_zero_runs[j].block_idx,
+                actual_scan.extra_zero_runs[j].block_idx);
+      EXPECT_EQ(expected_scan.extra_zero_runs[j].num_extra_zero_runs,
+                actual_scan.extra_zero_runs[j].num_extra_zero_runs);
+    }
+  }
+  EXPECT_EQ(expected.has_zero_padding_bit, actual.has_zero_padding_bit);
+  EXPECT_EQ(expected.padding_bits, actual.padding_bits);
+}
+
+// Parses `jpeg_bytes` with and without a thread pool, and checks that both
+// results are the same and reconstruct `jpeg_bytes` exactly.
+void TestParseWithPool(const std::vector<uint8_t>& jpeg_bytes) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  ThreadPoolForTests pool(8);
+  JXL_TEST_ASSIGN_OR_DIE(std::unique_ptr<jpeg::JPEGData> serial,
+                         jpeg::ParseJPG(memory_manager, Bytes(jpeg_bytes)));
+  JXL_TEST_ASSIGN_OR_DIE(
+      std::unique_ptr<jpeg::JPEGData> parallel,
+      jpeg::ParseJPG(memory_manager, Bytes(jpeg_bytes), pool.get()));
+  ExpectSameJPEGData(*serial, *parallel);
+
+  std::vector<uint8_t> reconstructed;
+  ASSERT_TRUE(jpeg::WriteJpeg(
+      *parallel, [&reconstructed](const uint8_t* buf, size_t len) {
+        reconstructed.insert(reconstructed.end(), buf, buf + len);
+        return len;
+      }));
+  EXPECT_EQ(reconstructed, jpeg_bytes);
+}
+
+JXL_TRANSCODE_JPEG_TEST(JPEGReaderTest, ParseWithPool) {
+  TEST_LIBJPEG_SUPPORT();
+  for (bool progressive : {false, true}) {
+    // No restart markers, intervals of a single MCU, and intervals that do not
+    // divide the MCU rows.
+    for (uint32_t restart_interval : {0, 1, 37}) {
+      SCOPED_TRACE(testing::Message() << "progressive: " << progressive
+                                      << " restart_interval: "
+                                      << restart_interval);
+      JXL_TEST_ASSIGN_OR_DIE(
+          std::vector<uint8_t> jpeg_bytes,
+          test::EncodeTestJpeg("jxl/flower/flower.png", restart_interval,
+                               progressive));
+      TestParseWithPool(jpeg_bytes);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace jxl
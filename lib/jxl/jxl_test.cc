@@ -9,6 +9,7 @@
 #include <jxl/color_encoding.h>
 #include <jxl/encode.h>
 #include <jxl/memory_manager.h>
+#include <jxl/stats.h>
 #include <jxl/types.h>
 
 #include <algorithm>
@@ -37,7 +38,11 @@
 #include "lib/jxl/butteraugli/butteraugli.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_ans_params.h"
+#include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/encode_internal.h"
 #include "lib/jxl/fake_parallel_runner_testonly.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
@@ -306,6 +311,91 @@ TEST(JxlTest, RoundtripUnalignedD2) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 1.72);
 }
 
+TEST(JxlTest, RoundtripFlatTiles) {
+  TestImage t;
+  ASSERT_TRUE(t.SetDimensions(256, 256));
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, t.AddFrame());
+  frame.RandomFill();
+  // The top half is constant; only the first row of 64x64 tiles stays flat
+  // after Gaborish, which looks at the noisy rows below.
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < 128; ++y) {
+      for (size_t x = 0; x < 256; ++x) {
+        ASSERT_TRUE(frame.SetValue(y, x, c, 0.5f));
+      }
+    }
+  }
+
+  for (int decoding_speed : {0, 2}) {
+    JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_DECODING_SPEED, decoding_speed);
+    JxlEncoderStats* stats = JxlEncoderStatsCreate();
+    cparams.stats = stats;
+    extras::JXLDecompressParams dparams;
+
+    PackedPixelFile ppf_out;
+    EXPECT_GT(Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_out), 0u);
+    const size_t num_flat_blocks =
+        JxlEncoderStatsGet(stats, JXL_ENC_STAT_NUM_FLAT_BLOCKS);
+    EXPECT_GE(num_flat_blocks, 32u * 8u);
+    EXPECT_LE(num_flat_blocks, 32u * 16u);
+    // Flat tiles must respect the transform sizes allowed at this decoding
+    // speed.
+    const size_t num_dct64_blocks =
+        JxlEncoderStatsGet(stats, JXL_ENC_STAT_NUM_DCT64_BLOCKS);
+    if (decoding_speed == 0) {
+      EXPECT_GT(num_dct64_blocks, 0u);
+    } else {
+      EXPECT_EQ(num_dct64_blocks, 0u);
+      EXPECT_EQ(JxlEncoderStatsGet(stats, JXL_ENC_STAT_NUM_DCT32X64_BLOCKS),
+                0u);
+    }
+    JxlEncoderStatsDestroy(stats);
+  }
+}
+
+TEST(JxlTest, RoundtripAcEntropyPreset) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  ASSERT_TRUE(t.SetDimensions(512, 512));
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);
+  // Streaming encoding clusters histograms per DC group.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_BUFFERING, 0);
+  JxlEncoderStats* stats = JxlEncoderStatsCreate();
+  stats->aux_out->collect_ac_histograms = true;
+  cparams.stats = stats;
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(extras::EncodeImageJXL(cparams, t.ppf(), /*jpeg_bytes=*/nullptr,
+                                     &compressed));
+  const std::vector<Histogram> histograms = stats->aux_out->ac_histograms;
+  JxlEncoderStatsDestroy(stats);
+  cparams.stats = nullptr;
+  ASSERT_FALSE(histograms.empty());
+
+  // A preset trained on the image itself always fits it.
+  HistogramParams params;
+  JXL_TEST_ASSIGN_OR_DIE(EntropyCodePreset preset,
+                         EntropyCodePreset::Train(params, histograms));
+  ASSERT_TRUE(preset.Fits(histograms));
+  cparams.ac_entropy_preset = preset.Serialize();
+
+  extras::JXLDecompressParams dparams;
+  PackedPixelFile ppf_out;
+  EXPECT_NEAR(Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_out),
+              compressed.size(), compressed.size() / 20);
+  EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 1.3);
+
+  // Presets that do not parse are rejected.
+  cparams.ac_entropy_preset = {1, 2, 3};
+  EXPECT_FALSE(extras::EncodeImageJXL(cparams, t.ppf(),
+                                      /*jpeg_bytes=*/nullptr, &compressed));
+}
+
 TEST(JxlTest, RoundtripMultiGroup) {
   const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
   TestImage t;
@@ -1276,6 +1366,30 @@ TEST(JxlTest, RoundtripDots) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 0.165);
 }
 
+TEST(JxlTest, RoundtripDotsThreads) {
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/cvo9xd_keong_macan_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);  // kSquirrel
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_DOTS, 1);
+  cparams.distance = 0.05;
+  extras::JXLDecompressParams dparams;
+
+  // Dot detection does not depend on the number of threads.
+  PackedPixelFile ppf_out;
+  size_t compressed_size =
+      Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_out);
+  ThreadPoolForTests pool(8);
+  PackedPixelFile ppf_out_threads;
+  EXPECT_EQ(Roundtrip(t.ppf(), cparams, dparams, pool.get(), &ppf_out_threads),
+            compressed_size);
+  EXPECT_TRUE(test::SamePixels(ppf_out, ppf_out_threads));
+}
+
 TEST(JxlTest, RoundtripDisablePerceptual) {
   ThreadPool* pool = nullptr;
   const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
@@ -1720,6 +1834,29 @@ TEST(JxlTest, RoundtripProgressive) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 1.2);
 }
 
+TEST(JxlTest, RetokenizedACSameBitstream) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  // Few enough groups that buffering mode 2 does not enable streaming.
+  ASSERT_TRUE(t.SetDimensions(512, 512));
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_PROGRESSIVE_AC, 1);
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(extras::EncodeImageJXL(cparams, t.ppf(), /*jpeg_bytes=*/nullptr,
+                                     &compressed));
+
+  // Buffering mode 2 keeps only AC histograms and re-tokenizes each group
+  // when writing it; the resulting codestream must not change.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_BUFFERING, 2);
+  std::vector<uint8_t> compressed_retokenized;
+  ASSERT_TRUE(extras::EncodeImageJXL(cparams, t.ppf(), /*jpeg_bytes=*/nullptr,
+                                     &compressed_retokenized));
+  EXPECT_EQ(compressed, compressed_retokenized);
+}
+
 TEST(JxlTest, RoundtripProgressiveLevel2Slow) {
   ThreadPoolForTests pool(8);
   const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
@@ -5,18 +5,24 @@
 
 #include <jxl/cms.h>
 #include <jxl/memory_manager.h>
+#include <jxl/types.h>
 
 #include <cstddef>
+#include <cstdint>
+#include <vector>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/matrix_ops.h"
+#include "lib/jxl/base/random.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/cms/opsin_params.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/dec_xyb.h"
+#include "lib/jxl/enc_external_image.h"
 #include "lib/jxl/enc_xyb.h"
 #include "lib/jxl/image.h"
+#include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/opsin_params.h"
 #include "lib/jxl/test_memory_manager.h"
 #include "lib/jxl/test_utils.h"
@@ -131,5 +137,67 @@ TEST(OpsinImageTest, VerifyGray) {
   }
 }
 
+void ExternalToXYBTest(const ColorEncoding& c_current, JxlPixelFormat format,
+                       size_t bits_per_sample) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 67;
+  const size_t ysize = 5;
+  const size_t bytes_per_sample = format.data_type == JXL_TYPE_UINT8 ? 1 : 2;
+  const size_t stride = xsize * format.num_channels * bytes_per_sample + 3;
+  std::vector<uint8_t> data(stride * ysize);
+  Rng rng(bits_per_sample * 4 + format.num_channels);
+  for (uint8_t& byte : data) byte = rng.UniformU(0, 256);
+  if (format.data_type == JXL_TYPE_UINT16 && bits_per_sample < 16) {
+    // Keep the samples within range.
+    for (size_t i = 0; i < data.size(); i += 2) {
+      data[i + (format.endianness == JXL_BIG_ENDIAN ? 0 : 1)] &=
+          (1 << (bits_per_sample - 8)) - 1;
+    }
+  }
+
+  JXL_TEST_ASSIGN_OR_DIE(Image3F expected,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F expected_linear,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  for (size_t c = 0; c < 3; ++c) {
+    ASSERT_TRUE(ConvertFromExternalPlaneNoSizeCheck(
+        data.data(), xsize, ysize, stride, bits_per_sample, format, c, nullptr,
+        &expected.Plane(c)));
+  }
+  ASSERT_TRUE(ToXYB(c_current, kDefaultIntensityTarget, nullptr, nullptr,
+                    &expected, *JxlGetDefaultCms(), &expected_linear));
+
+  ASSERT_TRUE(CanConvertExternalToXYB(c_current, format, bits_per_sample));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F actual,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F actual_linear,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(ExternalToXYB(data.data(), stride, format, bits_per_sample,
+                            c_current, kDefaultIntensityTarget, nullptr,
+                            &actual, &actual_linear));
+  JXL_TEST_ASSERT_OK(VerifyRelativeError(expected, actual, 0, 0, _));
+  JXL_TEST_ASSERT_OK(
+      VerifyRelativeError(expected_linear, actual_linear, 0, 0, _));
+}
+
+TEST(OpsinImageTest, ExternalToXYB) {
+  const ColorEncoding& srgb = ColorEncoding::SRGB();
+  const ColorEncoding& linear = ColorEncoding::LinearSRGB();
+  ExternalToXYBTest(srgb, {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}, 8);
+  ExternalToXYBTest(srgb, {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}, 8);
+  ExternalToXYBTest(linear, {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}, 8);
+  ExternalToXYBTest(srgb, {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0}, 16);
+  ExternalToXYBTest(srgb, {4, JXL_TYPE_UINT16, JXL_LITTLE_ENDIAN, 0}, 12);
+  ExternalToXYBTest(linear, {3, JXL_TYPE_UINT16, JXL_LITTLE_ENDIAN, 0}, 16);
+
+  EXPECT_FALSE(CanConvertExternalToXYB(
+      srgb, {2, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}, 8));
+  EXPECT_FALSE(CanConvertExternalToXYB(
+      srgb, {3, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0}, 32));
+  EXPECT_FALSE(CanConvertExternalToXYB(
+      ColorEncoding::SRGB(/*is_gray=*/true),
+      {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}, 8));
+}
+
 }  // namespace
 }  // namespace jxl
@@ -27,6 +27,7 @@ using ::jxl::test::ButteraugliDistance;
 using ::jxl::test::GetImage;
 using ::jxl::test::ReadTestData;
 using ::jxl::test::Roundtrip;
+using ::jxl::test::ThreadPoolForTests;
 
 TEST(PatchDictionaryTest, GrayscaleModular) {
   const std::vector<uint8_t> orig = ReadTestData("jxl/grayscale_patches.png");
@@ -63,5 +64,26 @@ TEST(PatchDictionaryTest, GrayscaleVarDCT) {
   EXPECT_LE(ButteraugliDistance(ppf, ppf2), 1.1);
 }
 
+TEST(PatchDictionaryTest, GrayscaleVarDCTThreads) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/grayscale_patches.png");
+  extras::PackedPixelFile ppf;
+  ASSERT_TRUE(DecodeBytes(Bytes(orig), jxl::extras::ColorHints(), &ppf));
+
+  extras::JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_PATCHES, 1);
+  extras::JXLDecompressParams dparams;
+
+  // Patch detection does not depend on the number of threads.
+  extras::PackedPixelFile ppf2;
+  size_t compressed_size = Roundtrip(ppf, cparams, dparams, nullptr, &ppf2);
+  ThreadPoolForTests pool(4);
+  extras::PackedPixelFile ppf3;
+  EXPECT_EQ(Roundtrip(ppf, cparams, dparams, pool.get(), &ppf3),
+            compressed_size);
+  JXL_TEST_ASSIGN_OR_DIE(ImageF image2, GetImage(ppf2));
+  JXL_TEST_ASSIGN_OR_DIE(ImageF image3, GetImage(ppf3));
+  JXL_TEST_ASSERT_OK(VerifyRelativeError(image2, image3, 0.0f, 0.0f, _));
+}
+
 }  // namespace
 }  // namespace jxl
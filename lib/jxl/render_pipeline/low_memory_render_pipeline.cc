@@ -354,6 +354,17 @@ Status LowMemoryRenderPipeline::Init() {
     image_rect_[i] = Rect(0, 0, x1, y1);
   }
 
+  // Trailing stages with the same scaling factors all see the same pixels,
+  // up to the switch to image dimensions.
+  fused_run_end_.assign(stages_.size(), stages_.size());
+  for (size_t i = stages_.size(); i-- > first_trailing_stage_;) {
+    size_t next = i + 1;
+    bool fuse = next < stages_.size() && next != first_image_dim_stage_ &&
+                channel_shifts_[next][anyc_[next]] ==
+                    channel_shifts_[i][anyc_[i]];
+    fused_run_end_[i] = fuse ? fused_run_end_[next] : next;
+  }
+
   virtual_ypadding_for_output_.resize(stages_.size());
   // How many "xextra" pixels to be processed by the stage to have enough
   // "xextra" plus "border_x" pixels initialized for the next stage(s).
@@ -664,6 +675,8 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
   // Maximum possible shift is 3.
   RenderPipelineStage::RowInfo output_rows(input_data.size(),
                                            std::vector<float*>(8));
+  RenderPipelineStage::RowInfo strip_rows(input_data.size(),
+                                          std::vector<float*>(1));
 
   // Fills in input_rows and output_rows for a given y value (relative to the
   // start of the group, measured in actual pixels at the appropriate vertical
@@ -720,6 +733,10 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
   int num_extra_rows = *std::max_element(virtual_ypadding_for_output_.begin(),
                                          virtual_ypadding_for_output_.end());
 
+  for (size_t i = 0; i < first_trailing_stage_; i++) {
+    stages_[i]->StartRect(thread_id);
+  }
+
   for (int vy = -num_extra_rows;
        vy < static_cast<int>(image_area_rect.ysize()) + num_extra_rows; vy++) {
     for (size_t i = 0; i < first_trailing_stage_; i++) {
@@ -773,14 +790,10 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       continue;
     }
 
-    for (size_t i = first_trailing_stage_; i < first_image_dim_stage_; i++) {
-      if (span[i].xsize() == 0) continue;
-      size_t y0 = image_area_rect.y0() + y;
-      if (y0 >= span[i].y1()) continue;
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows[first_trailing_stage_], output_rows, /*xextra_left=*/0,
-          /*xextra_right=*/0, span[i].xsize(), span[i].x0(), y0, thread_id));
-    }
+    JXL_RETURN_IF_ERROR(RenderTrailingStages(
+        thread_id, first_trailing_stage_, first_image_dim_stage_, span,
+        image_area_rect.y0() + y, input_rows[first_trailing_stage_],
+        output_rows, &strip_rows));
 
     if (first_image_dim_stage_ == stages_.size()) continue;
 
@@ -795,23 +808,21 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
     ptrdiff_t full_image_y = frame_origin_.y0 + image_area_rect.y0() + y;
     if (full_image_y < 0) continue;
 
-    for (size_t i = first_image_dim_stage_; i < stages_.size(); i++) {
-      if (span[i].xsize() == 0) continue;
-      if (full_image_y >= static_cast<ptrdiff_t>(span[i].y1())) continue;
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows[first_trailing_stage_], output_rows, /*xextra_left=*/0,
-          /*xextra_right=*/0, span[i].xsize(), span[i].x0(), full_image_y,
-          thread_id));
-    }
+    JXL_RETURN_IF_ERROR(RenderTrailingStages(
+        thread_id, first_image_dim_stage_, stages_.size(), span, full_image_y,
+        input_rows[first_trailing_stage_], output_rows, &strip_rows));
   }
   return true;
 }
 
 Status LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
-  if (rect.xsize() == 0) return true;
+  if (restrict_padding_) rect = rect.Intersection(padding_rect_);
+  if (rect.xsize() == 0 || rect.ysize() == 0) return true;
   size_t numc = channel_shifts_[0].size();
   RenderPipelineStage::RowInfo input_rows(numc, std::vector<float*>(1));
   RenderPipelineStage::RowInfo output_rows;
+  RenderPipelineStage::RowInfo strip_rows(numc, std::vector<float*>(1));
+  std::vector<Rect> span(stages_.size(), rect);
 
   for (size_t c = 0; c < numc; c++) {
     input_rows[c][0] = out_of_frame_data_[thread_id].Row(c);
@@ -820,11 +831,52 @@ Status LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
   for (size_t y = 0; y < rect.ysize(); y++) {
     stages_[first_image_dim_stage_ - 1]->ProcessPaddingRow(
         input_rows, rect.xsize(), rect.x0(), rect.y0() + y);
-    for (size_t i = first_image_dim_stage_; i < stages_.size(); i++) {
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows, output_rows, /*xextra_left=*/0, /*xextra_right=*/0,
-          rect.xsize(), rect.x0(), rect.y0() + y, thread_id));
+    JXL_RETURN_IF_ERROR(RenderTrailingStages(
+        thread_id, first_image_dim_stage_, stages_.size(), span, rect.y0() + y,
+        input_rows, output_rows, &strip_rows));
+  }
+  return true;
+}
+
+Status LowMemoryRenderPipeline::RenderTrailingStages(
+    size_t thread_id, size_t begin, size_t end, const std::vector<Rect>& span,
+    size_t ypos, const RenderPipelineStage::RowInfo& rows,
+    const RenderPipelineStage::RowInfo& output_rows,
+    RenderPipelineStage::RowInfo* strip_rows) {
+  // Trailing stages work in place on `rows` and have no borders, so a run of
+  // them can process a row strip by strip instead of stage by stage: each
+  // strip then stays in L1 cache from the first stage of the run (e.g. XYB)
+  // to the last one (e.g. conversion to the output format). The strip size
+  // must be a multiple of the vector size, as stages may process up to a full
+  // vector past `xsize`.
+  constexpr size_t kStripSize = 256;
+  for (size_t i = begin; i < end;) {
+    size_t run_end = std::min(fused_run_end_[i], end);
+    const Rect& r = span[i];
+    if (r.xsize() == 0 || ypos >= r.y1()) {
+      i = run_end;
+      continue;
+    }
+    if (run_end == i + 1 || r.xsize() <= kStripSize) {
+      for (; i < run_end; i++) {
+        JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
+            rows, output_rows, /*xextra_left=*/0, /*xextra_right=*/0,
+            r.xsize(), r.x0(), ypos, thread_id));
+      }
+      continue;
+    }
+    for (size_t x = 0; x < r.xsize(); x += kStripSize) {
+      size_t xsize = std::min(kStripSize, r.xsize() - x);
+      for (size_t c = 0; c < rows.size(); c++) {
+        (*strip_rows)[c][0] = rows[c][0] + x;
+      }
+      for (size_t j = i; j < run_end; j++) {
+        JXL_RETURN_IF_ERROR(stages_[j]->ProcessRow(
+            *strip_rows, output_rows, /*xextra_left=*/0, /*xextra_right=*/0,
+            xsize, r.x0() + x, ypos, thread_id));
+      }
     }
+    i = run_end;
   }
   return true;
 }
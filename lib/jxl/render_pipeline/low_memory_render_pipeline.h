@@ -48,6 +48,11 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
                     Rect data_max_color_channel_rect,
                     Rect image_max_color_channel_rect);
   Status RenderPadding(size_t thread_id, Rect rect);
+  Status RenderTrailingStages(size_t thread_id, size_t begin, size_t end,
+                              const std::vector<Rect>& span, size_t ypos,
+                              const RenderPipelineStage::RowInfo& rows,
+                              const RenderPipelineStage::RowInfo& output_rows,
+                              RenderPipelineStage::RowInfo* strip_rows);
 
   Status SaveBorders(size_t group_id, size_t c, const ImageF& in);
   Status LoadBorders(size_t group_id, size_t c, const Rect& r, ImageF* out);
@@ -112,6 +117,11 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
   // First stage that doesn't have any kInOut channel.
   size_t first_trailing_stage_ = 0;
 
+  // For each trailing stage, one past the last stage of the run of
+  // consecutive trailing stages it belongs to. Stages of a run operate on the
+  // same pixels, and are executed together on one strip of a row at a time.
+  std::vector<size_t> fused_run_end_;
+
   // Origin and size of the frame after switching to image dimensions.
   FrameOrigin frame_origin_ = {0, 0};
   size_t full_image_xsize_ = 0;
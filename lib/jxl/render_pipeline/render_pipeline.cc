@@ -68,6 +68,8 @@ StatusOr<std::unique_ptr<RenderPipeline>> RenderPipeline::Builder::Finalize(
   }
 
   res->frame_dimensions_ = frame_dimensions;
+  res->restrict_padding_ = restrict_padding_;
+  res->padding_rect_ = padding_rect_;
   res->group_completed_passes_.resize(frame_dimensions.num_groups);
   res->channel_shifts_.resize(stages_.size());
   res->channel_shifts_[0].resize(num_c_);
@@ -74,6 +74,14 @@ class RenderPipeline {
     // the pipeline.
     void UseSimpleImplementation() { use_simple_implementation_ = true; }
 
+    // Only renders the part of the image area outside of the frame (see
+    // RenderPipelineStage::SwitchToImageDimensions) that intersects `rect`,
+    // in image coordinates. The simple implementation renders all of it.
+    void RestrictPaddingTo(const Rect& rect) {
+      restrict_padding_ = true;
+      padding_rect_ = rect;
+    }
+
     // Finalizes setup of the pipeline. Shifts for all channels should be 0 at
     // this point.
     StatusOr<std::unique_ptr<RenderPipeline>> Finalize(
@@ -84,6 +92,8 @@ class RenderPipeline {
     std::vector<std::unique_ptr<RenderPipelineStage>> stages_;
     size_t num_c_;
     bool use_simple_implementation_ = false;
+    bool restrict_padding_ = false;
+    Rect padding_rect_;
   };
 
   friend class Builder;
@@ -133,6 +143,10 @@ class RenderPipeline {
 
   std::vector<uint8_t> group_completed_passes_;
 
+  // See Builder::RestrictPaddingTo.
+  bool restrict_padding_ = false;
+  Rect padding_rect_;
+
   friend class RenderPipelineInput;
 
  private:
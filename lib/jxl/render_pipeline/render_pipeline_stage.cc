@@ -23,6 +23,8 @@ Status RenderPipelineStage::PrepareForThreads(size_t num_threads) {
   return true;
 }
 
+void RenderPipelineStage::StartRect(size_t thread_id) const {}
+
 Status RenderPipelineStage::IsInitialized() const { return true; }
 
 RenderPipelineStage::~RenderPipelineStage() = default;
@@ -55,6 +55,7 @@ class RenderPipeline;
   | UpsamplingStage                 | 2 | 2 | N | N | InOut, Ignored          |
   | HorizontalChromaUpsamplingStage | 1 | 0 | 1 | 0 | InOut, Ignored          |
   | VerticalChromaUpsamplingStage   | 0 | 1 | 0 | 1 | InOut, Ignored          |
+  | ChromaUpsampling2DStage         | 1 | 1 | 1 | 1 | InOut, Ignored          |
   | UpsampleXSlowStage (test)       | 1 | 0 | 1 | 0 | InOut                   |
   | UpsampleYSlowStage (test)       | 0 | 1 | 0 | 1 | InOut                   |
   | EPF0Stage                       | 3 | 3 | 0 | 0 | InOut, Ignored          |
@@ -159,6 +160,11 @@ class RenderPipelineStage {
 
   virtual Status PrepareForThreads(size_t num_threads);
 
+  // Called before `thread_id` starts processing the rows of a new rect, in
+  // increasing `ypos` order. Stages that reuse computations done for the
+  // previous row must not reuse anything computed before this call.
+  virtual void StartRect(size_t thread_id) const;
+
   // Returns a pointer to the input row of channel `c` with offset `y`.
   // `y` must be in [-settings_.border_y, settings_.border_y]. `c` must be such
   // that `GetChannelMode(c) != kIgnored`. The returned pointer points to the
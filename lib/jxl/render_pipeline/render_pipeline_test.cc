@@ -23,6 +23,8 @@
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/override.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/chroma_from_luma.h"
@@ -43,6 +45,8 @@
 #include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
+#include "lib/jxl/render_pipeline/stage_chroma_upsampling.h"
+#include "lib/jxl/render_pipeline/stage_write.h"
 #include "lib/jxl/render_pipeline/test_render_pipeline_stages.h"
 #include "lib/jxl/splines.h"
 #include "lib/jxl/test_memory_manager.h"
@@ -191,6 +195,70 @@ TEST(RenderPipelineTest, CallAllGroupsFast) {
   EXPECT_EQ(pipeline->PassesWithAllInput(), 1u);
 }
 
+// Runs a 4:2:0 frame through a pipeline that upsamples the X and B channels
+// either with the combined 2D stage or with separate horizontal and vertical
+// stages, and returns the upsampled image.
+StatusOr<Image3F> Upsample420(bool use_2d_stage, bool use_simple_pipeline,
+                              size_t xsize, size_t ysize) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  Image3F output;
+  RenderPipeline::Builder builder(memory_manager, /*num_c=*/3);
+  for (size_t c : {0, 2}) {
+    if (use_2d_stage) {
+      JXL_RETURN_IF_ERROR(builder.AddStage(GetChromaUpsampling2DStage(c)));
+    } else {
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetChromaUpsamplingStage(c, /*horizontal=*/true)));
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetChromaUpsamplingStage(c, /*horizontal=*/false)));
+    }
+  }
+  JXL_RETURN_IF_ERROR(
+      builder.AddStage(GetWriteToImage3FStage(memory_manager, &output)));
+  if (use_simple_pipeline) builder.UseSimpleImplementation();
+  FrameDimensions frame_dimensions;
+  frame_dimensions.Set(xsize, ysize, /*group_size_shift=*/0,
+                       /*max_hshift=*/1, /*max_vshift=*/1,
+                       /*modular_mode=*/false, /*upsampling=*/1);
+  JXL_ASSIGN_OR_RETURN(auto pipeline,
+                       std::move(builder).Finalize(frame_dimensions));
+  JXL_RETURN_IF_ERROR(
+      pipeline->PrepareForThreads(1, /*use_group_ids=*/false));
+  for (size_t i = 0; i < frame_dimensions.num_groups; i++) {
+    auto input_buffers = pipeline->GetInputBuffers(i, 0);
+    for (size_t c = 0; c < 3; c++) {
+      const auto& buffer = input_buffers.GetBuffer(c);
+      Rng rng(i * 3 + c);
+      for (size_t y = 0; y < buffer.second.ysize(); y++) {
+        float* JXL_RESTRICT row = buffer.second.Row(buffer.first, y);
+        for (size_t x = 0; x < buffer.second.xsize(); x++) {
+          row[x] = rng.UniformF(-1.0f, 1.0f);
+        }
+      }
+    }
+    JXL_RETURN_IF_ERROR(input_buffers.Done());
+  }
+  return output;
+}
+
+TEST(RenderPipelineTest, ChromaUpsampling2DMatchesSeparable) {
+  // Odd sizes and several groups, so that the image and group borders are
+  // covered as well.
+  const size_t xsize = 301;
+  const size_t ysize = 267;
+  for (bool use_simple_pipeline : {true, false}) {
+    JXL_TEST_ASSIGN_OR_DIE(
+        Image3F separable,
+        Upsample420(/*use_2d_stage=*/false, use_simple_pipeline, xsize, ysize));
+    JXL_TEST_ASSIGN_OR_DIE(
+        Image3F combined,
+        Upsample420(/*use_2d_stage=*/true, use_simple_pipeline, xsize, ysize));
+    ASSERT_EQ(combined.xsize(), xsize);
+    ASSERT_EQ(combined.ysize(), ysize);
+    JXL_TEST_ASSERT_OK(SamePixels(separable, combined, _));
+  }
+}
+
 struct RenderPipelineTestInputSettings {
   // Input image.
   std::string input_path;
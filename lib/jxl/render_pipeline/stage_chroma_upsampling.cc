@@ -114,6 +114,64 @@ class VerticalChromaUpsamplingStage : public RenderPipelineStage {
   size_t c_;
 };
 
+// Same as a HorizontalChromaUpsamplingStage followed by a
+// VerticalChromaUpsamplingStage, with identical results, but in a single pass
+// and without the intermediate rows.
+class ChromaUpsampling2DStage : public RenderPipelineStage {
+ public:
+  explicit ChromaUpsampling2DStage(size_t channel)
+      : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
+            /*shift=*/1, /*border=*/1)),
+        c_(channel) {}
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra_left, size_t xextra_right, size_t xsize,
+                    size_t xpos, size_t ypos, size_t thread_id) const final {
+    HWY_FULL(float) df;
+    ptrdiff_t x_start =
+        -static_cast<ptrdiff_t>(RoundUpTo(xextra_left, Lanes(df)));
+    ptrdiff_t x_end = static_cast<ptrdiff_t>(xsize + xextra_right);
+
+    auto threefour = Set(df, 0.75f);
+    auto onefour = Set(df, 0.25f);
+    const float* row_top = GetInputRow(input_rows, c_, -1);
+    const float* row_mid = GetInputRow(input_rows, c_, 0);
+    const float* row_bot = GetInputRow(input_rows, c_, 1);
+    float* row_out0 = GetOutputRow(output_rows, c_, 0);
+    float* row_out1 = GetOutputRow(output_rows, c_, 1);
+    using V = decltype(threefour);
+    const auto upsample_h = [&](const float* row, ptrdiff_t x, V* left,
+                                V* right) {
+      auto current = Mul(LoadU(df, row + x), threefour);
+      *left = MulAdd(onefour, LoadU(df, row + x - 1), current);
+      *right = MulAdd(onefour, LoadU(df, row + x + 1), current);
+    };
+    for (ptrdiff_t x = x_start; x < x_end; x += Lanes(df)) {
+      V tl, tr, ml, mr, bl, br;
+      upsample_h(row_top, x, &tl, &tr);
+      upsample_h(row_mid, x, &ml, &mr);
+      upsample_h(row_bot, x, &bl, &br);
+      auto ml_scaled = Mul(ml, threefour);
+      auto mr_scaled = Mul(mr, threefour);
+      StoreInterleaved(df, MulAdd(tl, onefour, ml_scaled),
+                       MulAdd(tr, onefour, mr_scaled), row_out0 + x * 2);
+      StoreInterleaved(df, MulAdd(bl, onefour, ml_scaled),
+                       MulAdd(br, onefour, mr_scaled), row_out1 + x * 2);
+    }
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c == c_ ? RenderPipelineChannelMode::kInOut
+                   : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "HVChromaUps"; }
+
+ private:
+  size_t c_;
+};
+
 std::unique_ptr<RenderPipelineStage> GetChromaUpsamplingStage(size_t channel,
                                                               bool horizontal) {
   if (horizontal) {
@@ -123,6 +181,11 @@ std::unique_ptr<RenderPipelineStage> GetChromaUpsamplingStage(size_t channel,
   }
 }
 
+std::unique_ptr<RenderPipelineStage> GetChromaUpsampling2DStage(
+    size_t channel) {
+  return jxl::make_unique<ChromaUpsampling2DStage>(channel);
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -138,5 +201,12 @@ std::unique_ptr<RenderPipelineStage> GetChromaUpsamplingStage(size_t channel,
   return HWY_DYNAMIC_DISPATCH(GetChromaUpsamplingStage)(channel, horizontal);
 }
 
+HWY_EXPORT(GetChromaUpsampling2DStage);
+
+std::unique_ptr<RenderPipelineStage> GetChromaUpsampling2DStage(
+    size_t channel) {
+  return HWY_DYNAMIC_DISPATCH(GetChromaUpsampling2DStage)(channel);
+}
+
 }  // namespace jxl
 #endif
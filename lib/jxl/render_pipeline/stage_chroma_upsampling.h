@@ -17,6 +17,10 @@ namespace jxl {
 // channel.
 std::unique_ptr<RenderPipelineStage> GetChromaUpsamplingStage(size_t channel,
                                                               bool horizontal);
+
+// Upsamples the channel in both directions; equivalent to the horizontal
+// followed by the vertical stage above.
+std::unique_ptr<RenderPipelineStage> GetChromaUpsampling2DStage(size_t channel);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_CHROMA_UPSAMPLING_H_
@@ -5,10 +5,15 @@
 
 #include "lib/jxl/render_pipeline/stage_epf.h"
 
+#include <jxl/memory_manager.h>
+
 #include <array>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
@@ -19,6 +24,7 @@
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/loop_filter.h"
+#include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
 
 #undef HWY_TARGET_INCLUDE
@@ -49,6 +55,30 @@ JXL_INLINE Vec<DF> Weight(Vec<DF> sad, Vec<DF> inv_sigma, Vec<DF> thres) {
   return ZeroIfNegative(v);
 }
 
+// Returns the position of the first vector after the one at `x` that lies in a
+// block with a sigma large enough for EPF to change it, or a position not
+// smaller than `x_end` if there is none.
+JXL_INLINE ptrdiff_t UnfilteredRunEnd(const float* JXL_RESTRICT row_sigma,
+                                      size_t xpos, ptrdiff_t x,
+                                      ptrdiff_t x_end) {
+  const DF df;
+  do {
+    x += Lanes(df);
+  } while (x < x_end &&
+           row_sigma[(x + xpos + kSigmaPadding * kBlockDim) / kBlockDim] <
+               kMinSigma);
+  return x;
+}
+
+// Copies the pixels in [x, x_end) of the center input row to the output.
+JXL_INLINE void CopyUnfiltered(float* JXL_RESTRICT const* in,
+                               float* JXL_RESTRICT const* out, ptrdiff_t x,
+                               ptrdiff_t x_end) {
+  for (size_t c = 0; c < 3; c++) {
+    memcpy(out[c] + x, in[c] + x, (x_end - x) * sizeof(float));
+  }
+}
+
 // 5x5 plus-shaped kernel with 5 SADs per pixel (3x3 plus-shaped). So this makes
 // this filter a 7x7 filter.
 class EPF0Stage : public RenderPipelineStage {
@@ -108,6 +138,10 @@ class EPF0Stage : public RenderPipelineStage {
         rows[c][i] = GetInputRow(input_rows, c, i - 3);
       }
     }
+    float* JXL_RESTRICT center_rows[3] = {rows[0][3], rows[1][3], rows[2][3]};
+    float* JXL_RESTRICT out_rows[3] = {GetOutputRow(output_rows, 0, 0),
+                                       GetOutputRow(output_rows, 1, 0),
+                                       GetOutputRow(output_rows, 2, 0)};
 
     const float* sad_mul =
         (ypos % kBlockDim == 0 || ypos % kBlockDim == kBlockDim - 1)
@@ -119,11 +153,9 @@ class EPF0Stage : public RenderPipelineStage {
       size_t ix = (x + xpos) % kBlockDim;
 
       if (row_sigma[bx] < kMinSigma) {
-        for (size_t c = 0; c < 3; c++) {
-          auto px = Load(df, rows[c][3 + 0] + x);
-          // TODO(eustas): why unaligned?
-          StoreU(px, df, GetOutputRow(output_rows, c, 0) + x);
-        }
+        ptrdiff_t run_end = UnfilteredRunEnd(row_sigma, xpos, x, x_end);
+        CopyUnfiltered(center_rows, out_rows, x, run_end);
+        x = run_end - Lanes(df);
         continue;
       }
 
@@ -194,13 +226,19 @@ class EPF0Stage : public RenderPipelineStage {
 
 // 3x3 plus-shaped kernel with 5 SADs per pixel (also 3x3 plus-shaped). So this
 // makes this filter a 5x5 filter.
+//
+// Each absolute difference of two adjacent pixels contributes to the SADs of
+// up to three consecutive rows, so they are computed once per input row and
+// kept in a per-thread sliding window of rows.
 class EPF1Stage : public RenderPipelineStage {
  public:
-  EPF1Stage(LoopFilter lf, const ImageF& sigma)
+  EPF1Stage(JxlMemoryManager* memory_manager, LoopFilter lf,
+            const ImageF& sigma)
       : RenderPipelineStage(
             RenderPipelineStage::Settings::SymmetricBorderOnly(2)),
         lf_(std::move(lf)),
-        sigma_(&sigma) {}
+        sigma_(&sigma),
+        memory_manager_(memory_manager) {}
 
   template <bool aligned>
   JXL_INLINE void AddPixel(int row, float* JXL_RESTRICT rows[3][5], ptrdiff_t x,
@@ -248,22 +286,48 @@ class EPF1Stage : public RenderPipelineStage {
         rows[c][i] = GetInputRow(input_rows, c, i - 2);
       }
     }
+    float* JXL_RESTRICT center_rows[3] = {rows[0][2], rows[1][2], rows[2][2]};
+    float* JXL_RESTRICT out_rows[3] = {GetOutputRow(output_rows, 0, 0),
+                                       GetOutputRow(output_rows, 1, 0),
+                                       GetOutputRow(output_rows, 2, 0)};
 
     const float* sad_mul =
         (ypos % kBlockDim == 0 || ypos % kBlockDim == kBlockDim - 1)
             ? sad_mul_border
             : sad_mul_center;
 
-    // TODO(eustas): cache GetOutputRow
+    JXL_ENSURE(thread_id < diff_cache_.size());
+    DiffCache& cache = diff_cache_[thread_id];
+    // Checks all the vectors from x_start on.
+    if (UnfilteredRunEnd(row_sigma, xpos, x_start - Lanes(df), x_end) >=
+        x_end) {
+      // Nothing to filter; the next row has to start a new window.
+      CopyUnfiltered(center_rows, out_rows, x_start, x_end);
+      cache.valid = false;
+      return true;
+    }
+    JXL_RETURN_IF_ERROR(
+        UpdateDiffs(rows, x_start, x_end, xpos, ypos, &cache));
+    const float* JXL_RESTRICT diff_rows[3][7];
+    for (size_t c = 0; c < 3; c++) {
+      // Horizontal differences of rows -1, 0 and 1, then vertical differences
+      // of rows -2 and -1, -1 and 0, 0 and 1, 1 and 2.
+      for (int i = 0; i < 3; i++) {
+        diff_rows[c][i] = cache.Row(c, /*vertical=*/false, ypos + i - 1);
+      }
+      for (int i = 0; i < 4; i++) {
+        diff_rows[c][3 + i] = cache.Row(c, /*vertical=*/true, ypos + i - 2);
+      }
+    }
+
     for (ptrdiff_t x = x_start; x < x_end; x += Lanes(df)) {
       size_t bx = (x + xpos + kSigmaPadding * kBlockDim) / kBlockDim;
       size_t ix = (x + xpos) % kBlockDim;
 
       if (row_sigma[bx] < kMinSigma) {
-        for (size_t c = 0; c < 3; c++) {
-          auto px = Load(df, rows[c][2 + 0] + x);
-          Store(px, df, GetOutputRow(output_rows, c, 0) + x);
-        }
+        ptrdiff_t run_end = UnfilteredRunEnd(row_sigma, xpos, x, x_end);
+        CopyUnfiltered(center_rows, out_rows, x, run_end);
+        x = run_end - Lanes(df);
         continue;
       }
 
@@ -274,59 +338,43 @@ class EPF1Stage : public RenderPipelineStage {
       auto sad2 = Zero(df);
       auto sad3 = Zero(df);
 
-      // compute sads
+      // compute sads; center px = 22, px above = 21. The differences are
+      // added in the same order as if they were computed from the pixels.
       for (size_t c = 0; c < 3; c++) {
-        // center px = 22, px above = 21
-        auto t = Undefined(df);
-
-        const auto p20 = Load(df, rows[c][2 + -2] + x);
-        const auto p21 = Load(df, rows[c][2 + -1] + x);
-        auto sad0c = AbsDiff(p20, p21);  // SAD 2, 1
-
-        const auto p11 = LoadU(df, rows[c][2 + -1] + x - 1);
-        auto sad1c = AbsDiff(p11, p21);  // SAD 1, 2
-
-        const auto p31 = LoadU(df, rows[c][2 + -1] + x + 1);
-        auto sad2c = AbsDiff(p31, p21);  // SAD 3, 2
-
-        const auto p02 = LoadU(df, rows[c][2 + 0] + x - 2);
-        const auto p12 = LoadU(df, rows[c][2 + 0] + x - 1);
-        sad1c = Add(sad1c, AbsDiff(p02, p12));  // SAD 1, 2
-        sad0c = Add(sad0c, AbsDiff(p11, p12));  // SAD 2, 1
-
-        // TODO(eustas): why unaligned?
-        const auto p22 = LoadU(df, rows[c][2 + 0] + x);
-        t = AbsDiff(p12, p22);
-        sad1c = Add(sad1c, t);  // SAD 1, 2
-        sad2c = Add(sad2c, t);  // SAD 3, 2
-        t = AbsDiff(p22, p21);
-        auto sad3c = t;         // SAD 2, 3
-        sad0c = Add(sad0c, t);  // SAD 2, 1
-
-        const auto p32 = LoadU(df, rows[c][2 + 0] + x + 1);
-        sad0c = Add(sad0c, AbsDiff(p31, p32));  // SAD 2, 1
-        t = AbsDiff(p22, p32);
-        sad1c = Add(sad1c, t);  // SAD 1, 2
-        sad2c = Add(sad2c, t);  // SAD 3, 2
-
-        const auto p42 = LoadU(df, rows[c][2 + 0] + x + 2);
-        sad2c = Add(sad2c, AbsDiff(p42, p32));  // SAD 3, 2
-
-        const auto p13 = LoadU(df, rows[c][2 + 1] + x - 1);
-        sad3c = Add(sad3c, AbsDiff(p13, p12));  // SAD 2, 3
-
-        const auto p23 = Load(df, rows[c][2 + 1] + x);
-        t = AbsDiff(p22, p23);
-        sad0c = Add(sad0c, t);                  // SAD 2, 1
-        sad3c = Add(sad3c, t);                  // SAD 2, 3
-        sad1c = Add(sad1c, AbsDiff(p13, p23));  // SAD 1, 2
-
-        const auto p33 = LoadU(df, rows[c][2 + 1] + x + 1);
-        sad2c = Add(sad2c, AbsDiff(p33, p23));  // SAD 3, 2
-        sad3c = Add(sad3c, AbsDiff(p33, p32));  // SAD 2, 3
-
-        const auto p24 = Load(df, rows[c][2 + 2] + x);
-        sad3c = Add(sad3c, AbsDiff(p24, p23));  // SAD 2, 3
+        const float* JXL_RESTRICT h1 = diff_rows[c][0];
+        const float* JXL_RESTRICT h2 = diff_rows[c][1];
+        const float* JXL_RESTRICT h3 = diff_rows[c][2];
+        const float* JXL_RESTRICT v0 = diff_rows[c][3];
+        const float* JXL_RESTRICT v1 = diff_rows[c][4];
+        const float* JXL_RESTRICT v2 = diff_rows[c][5];
+        const float* JXL_RESTRICT v3 = diff_rows[c][6];
+
+        auto sad0c = Load(df, v0 + x);                // 20, 21
+        sad0c = Add(sad0c, LoadU(df, v1 + x - 1));  // 11, 12
+        const auto d21_22 = Load(df, v1 + x);
+        sad0c = Add(sad0c, d21_22);
+        sad0c = Add(sad0c, LoadU(df, v1 + x + 1));  // 31, 32
+        const auto d22_23 = Load(df, v2 + x);
+        sad0c = Add(sad0c, d22_23);  // SAD 2, 1
+
+        auto sad1c = LoadU(df, h1 + x - 1);         // 11, 21
+        sad1c = Add(sad1c, LoadU(df, h2 + x - 2));  // 02, 12
+        const auto d12_22 = LoadU(df, h2 + x - 1);
+        sad1c = Add(sad1c, d12_22);
+        const auto d22_32 = Load(df, h2 + x);
+        sad1c = Add(sad1c, d22_32);
+        sad1c = Add(sad1c, LoadU(df, h3 + x - 1));  // 13, 23; SAD 1, 2
+
+        auto sad2c = Load(df, h1 + x);  // 21, 31
+        sad2c = Add(sad2c, d12_22);
+        sad2c = Add(sad2c, d22_32);
+        sad2c = Add(sad2c, LoadU(df, h2 + x + 1));  // 32, 42
+        sad2c = Add(sad2c, Load(df, h3 + x));       // 23, 33; SAD 3, 2
+
+        auto sad3c = Add(d21_22, LoadU(df, v2 + x - 1));  // 12, 13
+        sad3c = Add(sad3c, d22_23);
+        sad3c = Add(sad3c, LoadU(df, v2 + x + 1));  // 32, 33
+        sad3c = Add(sad3c, Load(df, v3 + x));       // 23, 24; SAD 2, 3
 
         auto scale = Set(df, lf_.epf_channel_scale[c]);
         sad0 = MulAdd(sad0c, scale, sad0);
@@ -359,9 +407,9 @@ class EPF1Stage : public RenderPipelineStage {
 #else
       auto inv_w = ApproximateReciprocal(w);
 #endif
-      Store(Mul(X, inv_w), df, GetOutputRow(output_rows, 0, 0) + x);
-      Store(Mul(Y, inv_w), df, GetOutputRow(output_rows, 1, 0) + x);
-      Store(Mul(B, inv_w), df, GetOutputRow(output_rows, 2, 0) + x);
+      Store(Mul(X, inv_w), df, out_rows[0] + x);
+      Store(Mul(Y, inv_w), df, out_rows[1] + x);
+      Store(Mul(B, inv_w), df, out_rows[2] + x);
     }
     return true;
   }
@@ -374,8 +422,108 @@ class EPF1Stage : public RenderPipelineStage {
   const char* GetName() const override { return "EPF1"; }
 
  private:
+  // Absolute differences of horizontally and vertically adjacent pixels of
+  // the last 4 input rows, for each channel. The difference at `x` of a row
+  // is the one between pixels `x` and `x+1` (horizontal), or between pixel
+  // `x` of the row and of the row below (vertical).
+  struct DiffCache {
+    AlignedMemory memory;
+    size_t capacity = 0;
+    size_t row_stride = 0;
+    // Offset of x = 0 in each row.
+    ptrdiff_t x_offset = 0;
+    // Whether the rows hold the differences that row `ypos` uses, for the
+    // given x range.
+    bool valid = false;
+    size_t ypos = 0;
+    size_t xpos = 0;
+    ptrdiff_t x_start = 0;
+    ptrdiff_t x_end = 0;
+
+    float* Row(size_t c, bool vertical, size_t y) const {
+      size_t row = (c * 2 + (vertical ? 1 : 0)) * 4 + y % 4;
+      return memory.address<float>() + row * row_stride + x_offset;
+    }
+  };
+
+  void StartRect(size_t thread_id) const override {
+    diff_cache_[thread_id].valid = false;
+  }
+
+  Status PrepareForThreads(size_t num_threads) override {
+    diff_cache_.resize(num_threads);
+    for (DiffCache& cache : diff_cache_) cache.valid = false;
+    return true;
+  }
+
+  // Computes the differences of row `y` of `rows` (in [-2, 1]) with the row
+  // below and, if `hdiff` is not null, with the right neighbours, for all the
+  // pixels that the SADs of [x_start, x_end) use.
+  static void ComputeDiffs(float* JXL_RESTRICT const* rows, int y,
+                           ptrdiff_t x_start, ptrdiff_t x_end,
+                           float* JXL_RESTRICT hdiff,
+                           float* JXL_RESTRICT vdiff) {
+    const DF df;
+    const float* JXL_RESTRICT row = rows[2 + y];
+    const float* JXL_RESTRICT row_below = rows[3 + y];
+    ptrdiff_t x = x_start;
+    for (; x < x_end; x += Lanes(df)) {
+      const auto p = Load(df, row + x);
+      if (hdiff) Store(AbsDiff(LoadU(df, row + x + 1), p), df, hdiff + x);
+      Store(AbsDiff(Load(df, row_below + x), p), df, vdiff + x);
+    }
+    // Differences just outside of the vectors of [x_start, x_end).
+    if (hdiff) {
+      for (ptrdiff_t i : {x_start - 2, x_start - 1, x}) {
+        hdiff[i] = std::abs(row[i + 1] - row[i]);
+      }
+    }
+    for (ptrdiff_t i : {x_start - 1, x}) {
+      vdiff[i] = std::abs(row_below[i] - row[i]);
+    }
+  }
+
+  Status UpdateDiffs(float* JXL_RESTRICT rows[3][5], ptrdiff_t x_start,
+                     ptrdiff_t x_end, size_t xpos, size_t ypos,
+                     DiffCache* cache) const {
+    const DF df;
+    size_t padding = RoundUpTo(2, Lanes(df));
+    size_t row_stride = RoundUpTo(x_end - x_start, Lanes(df)) + 2 * padding;
+    size_t alloc_size = sizeof(float) * row_stride * 3 * 2 * 4;
+    if (alloc_size > cache->capacity) {
+      JXL_ASSIGN_OR_RETURN(cache->memory,
+                           AlignedMemory::Create(memory_manager_, alloc_size));
+      cache->capacity = alloc_size;
+      cache->valid = false;
+    }
+    bool next_row = cache->valid && cache->ypos + 1 == ypos &&
+                    cache->xpos == xpos && cache->x_start == x_start &&
+                    cache->x_end == x_end;
+    cache->row_stride = row_stride;
+    cache->x_offset = padding - x_start;
+    cache->valid = true;
+    cache->ypos = ypos;
+    cache->xpos = xpos;
+    cache->x_start = x_start;
+    cache->x_end = x_end;
+    for (size_t c = 0; c < 3; c++) {
+      // Horizontal differences are needed for rows [-1, 1], vertical ones for
+      // rows [-2, 1]; only those of the last row are new for the next row.
+      for (int y = next_row ? 1 : -2; y <= 1; y++) {
+        ComputeDiffs(
+            rows[c], y, x_start, x_end,
+            y >= -1 ? cache->Row(c, /*vertical=*/false, ypos + y) : nullptr,
+            cache->Row(c, /*vertical=*/true, ypos + y));
+      }
+    }
+    return true;
+  }
+
   LoopFilter lf_;
   const ImageF* sigma_;
+  JxlMemoryManager* memory_manager_;
+  // Per thread; only accessed by the thread that renders the rows.
+  mutable std::vector<DiffCache> diff_cache_;
 };
 
 // 3x3 plus-shaped kernel with 1 SAD per pixel. So this makes this filter a 3x3
@@ -439,6 +587,10 @@ class EPF2Stage : public RenderPipelineStage {
         rows[c][i] = GetInputRow(input_rows, c, i - 1);
       }
     }
+    float* JXL_RESTRICT center_rows[3] = {rows[0][1], rows[1][1], rows[2][1]};
+    float* JXL_RESTRICT out_rows[3] = {GetOutputRow(output_rows, 0, 0),
+                                       GetOutputRow(output_rows, 1, 0),
+                                       GetOutputRow(output_rows, 2, 0)};
 
     const float* sad_mul =
         (ypos % kBlockDim == 0 || ypos % kBlockDim == kBlockDim - 1)
@@ -451,10 +603,9 @@ class EPF2Stage : public RenderPipelineStage {
       size_t ix = (x + xpos) % kBlockDim;
 
       if (row_sigma[bx] < kMinSigma) {
-        for (size_t c = 0; c < 3; c++) {
-          auto px = Load(df, rows[c][1 + 0] + x);
-          Store(px, df, GetOutputRow(output_rows, c, 0) + x);
-        }
+        ptrdiff_t run_end = UnfilteredRunEnd(row_sigma, xpos, x, x_end);
+        CopyUnfiltered(center_rows, out_rows, x, run_end);
+        x = run_end - Lanes(df);
         continue;
       }
 
@@ -505,18 +656,21 @@ class EPF2Stage : public RenderPipelineStage {
   const ImageF* sigma_;
 };
 
-std::unique_ptr<RenderPipelineStage> GetEPFStage0(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
+std::unique_ptr<RenderPipelineStage> GetEPFStage0(
+    JxlMemoryManager* memory_manager, const LoopFilter& lf,
+    const ImageF& sigma) {
   return jxl::make_unique<EPF0Stage>(lf, sigma);
 }
 
-std::unique_ptr<RenderPipelineStage> GetEPFStage1(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
-  return jxl::make_unique<EPF1Stage>(lf, sigma);
+std::unique_ptr<RenderPipelineStage> GetEPFStage1(
+    JxlMemoryManager* memory_manager, const LoopFilter& lf,
+    const ImageF& sigma) {
+  return jxl::make_unique<EPF1Stage>(memory_manager, lf, sigma);
 }
 
-std::unique_ptr<RenderPipelineStage> GetEPFStage2(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
+std::unique_ptr<RenderPipelineStage> GetEPFStage2(
+    JxlMemoryManager* memory_manager, const LoopFilter& lf,
+    const ImageF& sigma) {
   return jxl::make_unique<EPF2Stage>(lf, sigma);
 }
 
@@ -532,17 +686,17 @@ HWY_EXPORT(GetEPFStage0);
 HWY_EXPORT(GetEPFStage1);
 HWY_EXPORT(GetEPFStage2);
 
-std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
-                                                 const ImageF& sigma,
-                                                 EpfStage epf_stage) {
+std::unique_ptr<RenderPipelineStage> GetEPFStage(
+    JxlMemoryManager* memory_manager, const LoopFilter& lf, const ImageF& sigma,
+    EpfStage epf_stage) {
   if (lf.epf_iters == 0) return nullptr;
   switch (epf_stage) {
     case EpfStage::Zero:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage0)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage0)(memory_manager, lf, sigma);
     case EpfStage::One:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage1)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage1)(memory_manager, lf, sigma);
     case EpfStage::Two:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage2)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage2)(memory_manager, lf, sigma);
   }
   JXL_DEBUG_ABORT("internal: unexpected EpfStage: %d",
                   static_cast<int>(epf_stage));
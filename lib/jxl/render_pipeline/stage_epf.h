@@ -6,6 +6,8 @@
 #ifndef LIB_JXL_RENDER_PIPELINE_STAGE_EPF_H_
 #define LIB_JXL_RENDER_PIPELINE_STAGE_EPF_H_
 
+#include <jxl/memory_manager.h>
+
 #include <cstdint>
 #include <memory>
 
@@ -21,9 +23,9 @@ enum class EpfStage : uint8_t { Zero, One, Two };
 // `sigma` will be accessed with an offset of (kSigmaPadding, kSigmaPadding),
 // and should have (kSigmaBorder, kSigmaBorder) mirrored sigma values available
 // around the main image. See also filters.(h|cc)
-std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
-                                                 const ImageF& sigma,
-                                                 EpfStage epf_stage);
+std::unique_ptr<RenderPipelineStage> GetEPFStage(
+    JxlMemoryManager* memory_manager, const LoopFilter& lf, const ImageF& sigma,
+    EpfStage epf_stage);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_EPF_H_
@@ -5,12 +5,16 @@
 
 #include "lib/jxl/render_pipeline/stage_ycbcr.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
 
 #undef HWY_TARGET_INCLUDE
@@ -24,7 +28,13 @@ namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Clamp;
+using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::NearestInt;
+using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::RebindToUnsigned;
+using hwy::HWY_NAMESPACE::VFromD;
 
 class kYCbCrStage : public RenderPipelineStage {
  public:
@@ -74,6 +84,103 @@ std::unique_ptr<RenderPipelineStage> GetYCbCrStage() {
   return jxl::make_unique<kYCbCrStage>();
 }
 
+#if !JXL_HIGH_PRECISION
+// Converts from YCbCr and writes 8-bit RGB(A) straight to the output buffer,
+// without the dithering and the intermediate rows of the regular write stage.
+class FastYCbCrStage : public RenderPipelineStage {
+ public:
+  FastYCbCrStage(uint8_t* rgb, size_t stride, size_t width, size_t height,
+                 bool rgba, bool has_alpha, size_t alpha_c)
+      : RenderPipelineStage(RenderPipelineStage::Settings()),
+        rgb_(rgb),
+        stride_(stride),
+        width_(width),
+        height_(height),
+        rgba_(rgba),
+        has_alpha_(has_alpha),
+        alpha_c_(alpha_c) {}
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra_left, size_t xextra_right, size_t xsize,
+                    size_t xpos, size_t ypos, size_t thread_id) const final {
+    if (ypos >= height_ || xpos >= width_) return true;
+    JXL_ENSURE(xextra_left == 0 && xextra_right == 0);
+    const HWY_FULL(float) df;
+    const Rebind<uint8_t, decltype(df)> du8;
+    const RebindToUnsigned<decltype(df)> du32;
+    const size_t N = Lanes(df);
+
+    // Same conversion as kYCbCrStage.
+    const auto c128 = Set(df, 128.0f / 255);
+    const auto crcr = Set(df, 1.402f);
+    const auto cgcb = Set(df, -0.114f * 1.772f / 0.587f);
+    const auto cgcr = Set(df, -0.299f * 1.402f / 0.587f);
+    const auto cbcb = Set(df, 1.772f);
+    const auto c255 = Set(df, 255.0f);
+    const auto zero = Zero(df);
+    const auto to_u8 = [&](VFromD<decltype(df)> v) {
+      v = Clamp(Mul(v, c255), zero, c255);
+      return DemoteTo(du8, BitCast(du32, NearestInt(v)));
+    };
+    const float* JXL_RESTRICT row0 = GetInputRow(input_rows, 0, 0);
+    const float* JXL_RESTRICT row1 = GetInputRow(input_rows, 1, 0);
+    const float* JXL_RESTRICT row2 = GetInputRow(input_rows, 2, 0);
+    const float* JXL_RESTRICT row_a =
+        has_alpha_ ? GetInputRow(input_rows, alpha_c_, 0) : nullptr;
+    const size_t num_channels = rgba_ ? 4 : 3;
+    uint8_t* out = rgb_ + stride_ * ypos + num_channels * xpos;
+    const size_t x_span = std::min<size_t>(xsize, width_ - xpos);
+    // The last, partial vector goes through `tail` so that no bytes past the
+    // end of the row are written.
+    HWY_ALIGN uint8_t tail[4 * HWY_MAX_BYTES / sizeof(float)];
+    for (size_t x = 0; x < x_span; x += N) {
+      const auto y_vec = Add(LoadU(df, row1 + x), c128);
+      const auto cb_vec = LoadU(df, row0 + x);
+      const auto cr_vec = LoadU(df, row2 + x);
+      const auto r = to_u8(MulAdd(crcr, cr_vec, y_vec));
+      const auto g = to_u8(MulAdd(cgcr, cr_vec, MulAdd(cgcb, cb_vec, y_vec)));
+      const auto b = to_u8(MulAdd(cbcb, cb_vec, y_vec));
+      const bool is_tail = x + N > x_span;
+      uint8_t* dst = is_tail ? tail : out + num_channels * x;
+      if (rgba_) {
+        const auto a = row_a ? to_u8(LoadU(df, row_a + x)) : Set(du8, 255);
+        StoreInterleaved4(r, g, b, a, du8, dst);
+      } else {
+        StoreInterleaved3(r, g, b, du8, dst);
+      }
+      if (is_tail) {
+        memcpy(out + num_channels * x, tail, num_channels * (x_span - x));
+      }
+    }
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 || (has_alpha_ && c == alpha_c_)
+               ? RenderPipelineChannelMode::kInput
+               : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "FastYCbCr"; }
+
+ private:
+  uint8_t* rgb_;
+  size_t stride_;
+  size_t width_;
+  size_t height_;
+  bool rgba_;
+  bool has_alpha_;
+  size_t alpha_c_;
+};
+
+std::unique_ptr<RenderPipelineStage> GetFastYCbCrToRGB8Stage(
+    uint8_t* rgb, size_t stride, size_t width, size_t height, bool rgba,
+    bool has_alpha, size_t alpha_c) {
+  return jxl::make_unique<FastYCbCrStage>(rgb, stride, width, height, rgba,
+                                          has_alpha, alpha_c);
+}
+#endif  // !JXL_HIGH_PRECISION
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -88,5 +195,16 @@ std::unique_ptr<RenderPipelineStage> GetYCbCrStage() {
   return HWY_DYNAMIC_DISPATCH(GetYCbCrStage)();
 }
 
+#if !JXL_HIGH_PRECISION
+HWY_EXPORT(GetFastYCbCrToRGB8Stage);
+
+std::unique_ptr<RenderPipelineStage> GetFastYCbCrToRGB8Stage(
+    uint8_t* rgb, size_t stride, size_t width, size_t height, bool rgba,
+    bool has_alpha, size_t alpha_c) {
+  return HWY_DYNAMIC_DISPATCH(GetFastYCbCrToRGB8Stage)(
+      rgb, stride, width, height, rgba, has_alpha, alpha_c);
+}
+#endif  // !JXL_HIGH_PRECISION
+
 }  // namespace jxl
 #endif
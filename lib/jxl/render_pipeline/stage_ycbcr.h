@@ -6,6 +6,8 @@
 #ifndef LIB_JXL_RENDER_PIPELINE_STAGE_YCBCR_H_
 #define LIB_JXL_RENDER_PIPELINE_STAGE_YCBCR_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
@@ -14,6 +16,13 @@ namespace jxl {
 
 // Converts the color channels from YCbCr to RGB.
 std::unique_ptr<RenderPipelineStage> GetYCbCrStage();
+
+// Gets a stage to convert from YCbCr to 8-bit RGB(A) and write to a uint8
+// buffer. Only available if JXL_HIGH_PRECISION is 0, as it skips the dithering
+// of the regular output stage.
+std::unique_ptr<RenderPipelineStage> GetFastYCbCrToRGB8Stage(
+    uint8_t* rgb, size_t stride, size_t width, size_t height, bool rgba,
+    bool has_alpha, size_t alpha_c);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_YCBCR_H_
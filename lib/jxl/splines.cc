@@ -20,6 +20,7 @@
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
@@ -174,10 +175,29 @@ void DrawSegments(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
                   float* JXL_RESTRICT row_b, size_t y, size_t x0, size_t x1,
                   const bool add, const SplineSegment* segments,
                   const size_t* segment_indices,
-                  const ptrdiff_t* segment_y_start) {
-  float* JXL_RESTRICT rows[3] = {row_x, row_y, row_b};
-  for (ptrdiff_t i = segment_y_start[y]; i < segment_y_start[y + 1]; i++) {
-    DrawSegment(segments[segment_indices[i]], add, y, x0, x1, rows);
+                  const ptrdiff_t* segment_bucket_start, size_t num_buckets) {
+  if (x1 <= x0) return;
+  const size_t first_bucket =
+      std::min(x0 / kSplineBucketXSize, num_buckets - 1);
+  const size_t last_bucket =
+      std::min((x1 - 1) / kSplineBucketXSize, num_buckets - 1);
+  const ptrdiff_t* bucket_start = segment_bucket_start + y * num_buckets;
+  // Each pixel is only drawn from the bucket that contains it, with the
+  // segments in the same order as they were generated.
+  for (size_t bucket = first_bucket; bucket <= last_bucket; ++bucket) {
+    const size_t bucket_x0 = std::max(x0, bucket * kSplineBucketXSize);
+    const size_t bucket_x1 =
+        bucket + 1 == num_buckets
+            ? x1
+            : std::min(x1, (bucket + 1) * kSplineBucketXSize);
+    float* JXL_RESTRICT rows[3] = {row_x + (bucket_x0 - x0),
+                                   row_y + (bucket_x0 - x0),
+                                   row_b + (bucket_x0 - x0)};
+    for (ptrdiff_t i = bucket_start[bucket]; i < bucket_start[bucket + 1];
+         i++) {
+      DrawSegment(segments[segment_indices[i]], add, y, bucket_x0, bucket_x1,
+                  rows);
+    }
   }
 }
 
@@ -594,7 +614,8 @@ void Splines::Clear() {
   data_ = {};
   segments_.clear();
   segment_indices_ = AlignedMemory();
-  segment_y_start_ = AlignedMemory();
+  segment_bucket_start_ = AlignedMemory();
+  num_buckets_ = 0;
 }
 
 Status Splines::Decode(jxl::BitReader* br, const size_t num_pixels) {
@@ -656,14 +677,15 @@ void Splines::SubtractFrom(Image3F* const opsin) const {
 
 Status Splines::InitializeDrawCache(const size_t image_xsize,
                                     const size_t image_ysize,
-                                    const ColorCorrelation& color_correlation) {
+                                    const ColorCorrelation& color_correlation,
+                                    ThreadPool* pool) {
   // TODO(veluca): avoid storing segments that are entirely outside image
   // boundaries.
   segments_.clear();
   segment_indices_ = AlignedMemory();
-  segment_y_start_ = AlignedMemory();
+  segment_bucket_start_ = AlignedMemory();
+  num_buckets_ = 0;
   std::vector<SplineSegmentSpan> segments_spans;
-  std::vector<Spline::Point> intermediate_points;
   uint64_t total_estimated_area_reached = 0;
   std::vector<Spline> splines;
   for (size_t i = 0; i < data_.splines.size(); ++i) {
@@ -695,12 +717,19 @@ Status Splines::InitializeDrawCache(const size_t image_xsize,
 #endif
   }
 
-  for (Spline& spline : splines) {
+  // Segments are generated independently for each spline, and then
+  // concatenated in spline order.
+  std::vector<std::vector<SplineSegment>> spline_segments(splines.size());
+  std::vector<std::vector<SplineSegmentSpan>> spline_segment_spans(
+      splines.size());
+  const auto compute_segments = [&](const uint32_t i,
+                                    size_t /* thread */) -> Status {
+    const Spline& spline = splines[i];
     std::vector<std::pair<Spline::Point, float>> points_to_draw;
     auto add_point = [&](const Spline::Point& point, const float multiplier) {
       points_to_draw.emplace_back(point, multiplier);
     };
-    intermediate_points.clear();
+    std::vector<Spline::Point> intermediate_points;
     DrawCentripetalCatmullRomSpline(spline.control_points, intermediate_points);
     JXL_RETURN_IF_ERROR(
         ForEachEquallySpacedPoint(intermediate_points, add_point));
@@ -709,48 +738,87 @@ Status Splines::InitializeDrawCache(const size_t image_xsize,
         points_to_draw.back().second;
     if (arc_length <= 0.f) {
       // This spline wouldn't have any effect.
-      continue;
+      return true;
     }
     HWY_DYNAMIC_DISPATCH(SegmentsFromPoints)
-    (image_ysize, spline, points_to_draw, arc_length, segments_,
-     segments_spans);
-  }
-
-  size_t segment_y_start_num_bytes = (image_ysize + 2) * sizeof(ptrdiff_t);
+    (image_ysize, spline, points_to_draw, arc_length, spline_segments[i],
+     spline_segment_spans[i]);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, splines.size(), ThreadPool::NoInit,
+                                compute_segments, "ComputeSplineSegments"));
+  size_t num_segments = 0;
+  for (const auto& segments : spline_segments) num_segments += segments.size();
+  segments_.reserve(num_segments);
+  segments_spans.reserve(num_segments);
+  for (size_t i = 0; i < splines.size(); ++i) {
+    segments_.insert(segments_.end(), spline_segments[i].begin(),
+                     spline_segments[i].end());
+    segments_spans.insert(segments_spans.end(),
+                          spline_segment_spans[i].begin(),
+                          spline_segment_spans[i].end());
+    spline_segments[i] = std::vector<SplineSegment>();
+    spline_segment_spans[i] = std::vector<SplineSegmentSpan>();
+  }
+
+  // Index the segments by row and by bucket of kSplineBucketXSize columns, so
+  // that drawing a part of a row only visits the segments that can touch it.
+  // The last bucket of a row also covers everything to its right.
+  num_buckets_ = std::max<size_t>(DivCeil(image_xsize, kSplineBucketXSize), 1);
+  const auto bucket_range = [&](const SplineSegment& segment,
+                                size_t* first_bucket, size_t* last_bucket) {
+    // Same as the pixel span of the segment in DrawSegment.
+    ptrdiff_t start = std::llround(segment.center_x - segment.maximum_distance);
+    ptrdiff_t end = std::llround(segment.center_x + segment.maximum_distance);
+    if (end < 0) return false;
+    const ptrdiff_t last = num_buckets_ - 1;
+    *first_bucket = std::min<ptrdiff_t>(
+        std::max<ptrdiff_t>(start, 0) / kSplineBucketXSize, last);
+    *last_bucket = std::min<ptrdiff_t>(end / kSplineBucketXSize, last);
+    return true;
+  };
+  const size_t num_cells = image_ysize * num_buckets_;
+  size_t segment_bucket_start_num_bytes = (num_cells + 2) * sizeof(ptrdiff_t);
   JXL_ASSIGN_OR_RETURN(
-      segment_y_start_,
-      AlignedMemory::Create(memory_manager_, segment_y_start_num_bytes));
-  ptrdiff_t* segment_y_start = segment_y_start_.address<ptrdiff_t>();
-  memset(segment_y_start, 0, segment_y_start_num_bytes);
-  ptrdiff_t* population = segment_y_start + 1;
-  for (const auto& segment_span : segments_spans) {
-    population[segment_span.start]++;
-    population[segment_span.end]--;
+      segment_bucket_start_,
+      AlignedMemory::Create(memory_manager_, segment_bucket_start_num_bytes));
+  ptrdiff_t* segment_bucket_start = segment_bucket_start_.address<ptrdiff_t>();
+  memset(segment_bucket_start, 0, segment_bucket_start_num_bytes);
+  // population[cell] is first the number of segments in the cell, and then,
+  // while placing the segments, the index of the next one. Its final value is
+  // the start of the next cell, so segment_bucket_start needs no offset.
+  ptrdiff_t* population = segment_bucket_start + 1;
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    size_t first_bucket;
+    size_t last_bucket;
+    if (!bucket_range(segments_[i], &first_bucket, &last_bucket)) continue;
+    const auto& segment_span = segments_spans[i];
+    for (size_t y = segment_span.start; y < segment_span.end; y++) {
+      for (size_t b = first_bucket; b <= last_bucket; ++b) {
+        population[y * num_buckets_ + b]++;
+      }
+    }
   }
   // Turn to cumulative.
   size_t total = 0;
-  ptrdiff_t coverage = 0;
-  for (size_t y = 0; y < image_ysize; y++) {
-    if (population[y] < 0) {
-      JXL_ENSURE(coverage >= -population[y]);
-    }
-    coverage += population[y];
-    population[y] = total;
-    total += coverage;
-  }
-  // population[0] == 0 (that is segment_y_start[1])
-  // We are going to place segments using population[y] as index for elements
-  // of y-th line (and increment them); that way final value of population[y]
-  // is the staring index for (y+1)-th line. Thus segment_y_start will contain
-  // indices without an offset.
+  for (size_t cell = 0; cell < num_cells; cell++) {
+    const size_t count = population[cell];
+    population[cell] = total;
+    total += count;
+  }
   JXL_ASSIGN_OR_RETURN(
       segment_indices_,
       AlignedMemory::Create(memory_manager_, total * sizeof(size_t)));
   size_t* segment_indices = segment_indices_.address<size_t>();
   for (size_t i = 0; i < segments_.size(); ++i) {
+    size_t first_bucket;
+    size_t last_bucket;
+    if (!bucket_range(segments_[i], &first_bucket, &last_bucket)) continue;
     const auto& segment_span = segments_spans[i];
     for (size_t y = segment_span.start; y < segment_span.end; y++) {
-      segment_indices[population[y]++] = i;
+      for (size_t b = first_bucket; b <= last_bucket; ++b) {
+        segment_indices[population[y * num_buckets_ + b]++] = i;
+      }
     }
   }
 
@@ -764,7 +832,8 @@ void Splines::ApplyToRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
   if (segments_.empty()) return;
   HWY_DYNAMIC_DISPATCH(DrawSegments)
   (row_x, row_y, row_b, y, x0, x1, add, segments_.data(),
-   segment_indices_.address<size_t>(), segment_y_start_.address<ptrdiff_t>());
+   segment_indices_.address<size_t>(),
+   segment_bucket_start_.address<ptrdiff_t>(), num_buckets_);
 }
 
 template <bool add>
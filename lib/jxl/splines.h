@@ -16,6 +16,7 @@
 #include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
@@ -30,6 +31,10 @@ class BitReader;
 
 static constexpr float kDesiredRenderingDistance = 1.f;
 
+// Width of the column buckets by which segments are indexed for drawing; the
+// same as the default group size.
+static constexpr size_t kSplineBucketXSize = 256;
+
 using Dct32 = std::array<float, 32>;
 
 enum SplineEntropyContexts : size_t {
@@ -149,8 +154,11 @@ class Splines {
 
   int32_t GetQuantizationAdjustment() const { return quantization_adjustment_; }
 
+  // Computes the segments of all splines, on `pool` if not null, and indexes
+  // them for drawing.
   Status InitializeDrawCache(size_t image_xsize, size_t image_ysize,
-                             const ColorCorrelation& color_correlation);
+                             const ColorCorrelation& color_correlation,
+                             ThreadPool* pool = nullptr);
 
  private:
   template <bool>
@@ -173,8 +181,12 @@ class Splines {
 
   SplineDataView data_;
   std::vector<SplineSegment> segments_;
+  // Indices of the segments that intersect row y and bucket b are at
+  // [segment_bucket_start_[y * num_buckets_ + b],
+  //  segment_bucket_start_[y * num_buckets_ + b + 1]) in segment_indices_.
   AlignedMemory /*size_t*/ segment_indices_;
-  AlignedMemory /*ptrdiff_t*/ segment_y_start_;
+  AlignedMemory /*ptrdiff_t*/ segment_bucket_start_;
+  size_t num_buckets_ = 0;
 };
 
 }  // namespace jxl
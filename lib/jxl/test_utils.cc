@@ -28,7 +28,11 @@
 #include <vector>
 
 #include "lib/extras/codec_in_out.h"
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/decode.h"
 #include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/encode.h"
+#include "lib/extras/enc/jpg.h"
 #include "lib/extras/enc/jxl.h"
 #include "lib/extras/metrics.h"
 #include "lib/extras/packed_image.h"
@@ -970,6 +974,24 @@ Status JpegDataToCodecInOut(std::unique_ptr<jxl::jpeg::JPEGData>&& data,
   return true;
 }
 
+StatusOr<std::vector<uint8_t>> EncodeTestJpeg(const std::string& path,
+                                              uint32_t restart_interval,
+                                              bool progressive) {
+  extras::PackedPixelFile ppf;
+  JXL_RETURN_IF_ERROR(extras::DecodeBytes(Bytes(ReadTestData(path)),
+                                          extras::ColorHints(), &ppf));
+  std::unique_ptr<extras::Encoder> encoder = extras::GetJPEGEncoder();
+  JXL_ENSURE(encoder);
+  encoder->SetOption("q", "85");
+  encoder->SetOption("chroma_subsampling", "420");
+  encoder->SetOption("restart_interval", std::to_string(restart_interval));
+  if (progressive) encoder->SetOption("progressive", "0");
+  extras::EncodedImage encoded;
+  JXL_RETURN_IF_ERROR(encoder->Encode(ppf, &encoded, /*pool=*/nullptr));
+  JXL_ENSURE(encoded.bitstreams.size() == 1);
+  return std::move(encoded.bitstreams[0]);
+}
+
 }  // namespace test
 
 bool operator==(const jxl::Bytes& a, const jxl::Bytes& b) {
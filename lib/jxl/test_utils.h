@@ -251,6 +251,13 @@ constexpr const char* BoolToCStr(bool b) { return b ? "true" : "false"; }
 Status JpegDataToCodecInOut(std::unique_ptr<jxl::jpeg::JPEGData>&& data,
                             CodecInOut* io);
 
+// Encodes the test image at `path` with libjpeg, at quality 85 with 4:2:0
+// chroma subsampling, and with a restart marker every `restart_interval` MCUs
+// if it is not zero. Requires TEST_LIBJPEG_SUPPORT().
+StatusOr<std::vector<uint8_t>> EncodeTestJpeg(const std::string& path,
+                                              uint32_t restart_interval,
+                                              bool progressive);
+
 }  // namespace test
 
 bool operator==(const jxl::Bytes& a, const jxl::Bytes& b);
@@ -64,9 +64,7 @@ Status ReadToc(JxlMemoryManager* memory_manager, size_t toc_entries,
   }
   JXL_RETURN_IF_ERROR(reader->JumpToByteBoundary());
   JXL_RETURN_IF_ERROR(check_bit_budget(toc_entries));
-  for (size_t i = 0; i < toc_entries; ++i) {
-    (*sizes)[i] = U32Coder::Read(kTocDist, reader);
-  }
+  U32Coder::ReadMany(kTocDist, toc_entries, reader, sizes->data());
   JXL_RETURN_IF_ERROR(reader->JumpToByteBoundary());
   JXL_RETURN_IF_ERROR(check_bit_budget(0));
   return true;
@@ -511,9 +511,11 @@ set(JPEGXL_INTERNAL_TESTS
   jxl/dct_test.cc
   jxl/decode_test.cc
   jxl/enc_bit_writer_test.cc
+  jxl/enc_chroma_from_luma_test.cc
   jxl/enc_external_image_test.cc
   jxl/enc_gaborish_test.cc
   jxl/enc_linalg_test.cc
+  jxl/enc_noise_test.cc
   jxl/enc_optimize_test.cc
   jxl/enc_photon_noise_test.cc
   jxl/encode_test.cc
@@ -526,6 +528,7 @@ set(JPEGXL_INTERNAL_TESTS
   jxl/icc_codec_test.cc
   jxl/image_bundle_test.cc
   jxl/image_ops_test.cc
+  jxl/jpeg/enc_jpeg_data_reader_test.cc
   jxl/jxl_test.cc
   jxl/lehmer_code_test.cc
   jxl/modular_test.cc
@@ -56,6 +56,7 @@ struct JxlArgs {
   Override patches;
 
   std::string debug_image_dir;
+  std::string ac_entropy_preset;
 };
 
 static JxlArgs* const jxlargs = new JxlArgs;
@@ -80,6 +81,10 @@ Status AddCommandLineOptionsJxlCodec(BenchmarkArgs* args) {
       "If not empty, saves debug images for each "
       "input image and each codec that provides it to this directory.");
 
+  args->AddString(&jxlargs->ac_entropy_preset, "ac_entropy_preset",
+                  "If not empty, AC entropy preset written by "
+                  "train_entropy_preset to use for VarDCT frames.");
+
   return true;
 }
 
@@ -284,6 +289,11 @@ class JxlCodec : public ImageCodec {
                        TO_JXL_BOOL(jxlargs->qprogressive));
     cparams_.AddOption(JXL_ENC_FRAME_SETTING_PROGRESSIVE_DC,
                        jxlargs->progressive_dc);
+    if (!jxlargs->ac_entropy_preset.empty() &&
+        cparams_.ac_entropy_preset.empty()) {
+      JXL_RETURN_IF_ERROR(jpegxl::tools::ReadFile(
+          jxlargs->ac_entropy_preset, &cparams_.ac_entropy_preset));
+    }
     if (butteraugli_target_ > 0.f && modular_mode_ && !has_ctransform_) {
       // Reset color transform to default XYB for lossy modular.
       cparams_.AddOption(JXL_ENC_FRAME_SETTING_COLOR_TRANSFORM, -1);
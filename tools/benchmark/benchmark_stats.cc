@@ -55,6 +55,7 @@ const char* JxlStatsName(JxlEncoderStatsKey key) {
     ADD_NAME(NUM_DCT32X64_BLOCKS, "Number of 32x64 blocks");
     ADD_NAME(NUM_DCT64_BLOCKS, "Number of 64x64 blocks");
     ADD_NAME(NUM_BUTTERAUGLI_ITERS, "Butteraugli iters");
+    ADD_NAME(NUM_FLAT_BLOCKS, "Number of flat blocks");
     default:
       return "";
   };
@@ -399,6 +399,13 @@ struct CompressArgs {
         "    frame will be indexed in the frame index box.",
         &frame_indexing, &ParseString, 3);
 
+    cmdline->AddOptionValue(
+        '\0', "ac_entropy_preset", "FILE",
+        "Use the AC context map and histograms trained by "
+        "train_entropy_preset\n"
+        "    whenever the statistics of a VarDCT frame fit them.",
+        &ac_entropy_preset, &ParseString, 3);
+
     cmdline->AddOptionFlag(
         '\0', "allow_expert_options",
         "Allow setting effort to 11 for somewhat denser lossless "
@@ -562,6 +569,7 @@ struct CompressArgs {
   size_t effort = 7;
   size_t brotli_effort = 9;
   std::string frame_indexing;
+  std::string ac_entropy_preset;
 
   // References (ids) of specific options to check if they were matched.
   CommandLineParser::OptionId opt_lossless_jpeg_id = -1;
@@ -918,6 +926,12 @@ void ProcessFlags(const jxl::extras::Codec codec,
       params->options.emplace_back(JXL_ENC_FRAME_INDEX_BOX, value, num_frame);
     }
   }
+  if (!args->ac_entropy_preset.empty() &&
+      !jpegxl::tools::ReadFile(args->ac_entropy_preset,
+                               &params->ac_entropy_preset)) {
+    std::cerr << "Reading --ac_entropy_preset failed.\n";
+    exit(EXIT_FAILURE);
+  }
   // Copy over the rest of the non-option params.
   params->use_container = args->container == jxl::Override::kOn;
   params->jpeg_store_metadata = FROM_JXL_BOOL(args->allow_jpeg_reconstruction);
@@ -0,0 +1,185 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Derives an EntropyCodePreset for the AC tokens of VarDCT frames from a
+// corpus of images, to be passed to JxlEncoderSetAcEntropyPreset (or
+// cjxl --ac_entropy_preset) when encoding similar images with the same effort
+// and distance.
+
+#include <jxl/encode.h>
+#include <jxl/stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/decode.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_ans_params.h"
+#include "lib/jxl/enc_aux_out.h"
+#include "lib/jxl/encode_internal.h"
+#include "tools/file_io.h"
+#include "tools/thread_pool_internal.h"
+
+namespace {
+
+// Per-context symbol counts summed over a corpus. Corpora can be large enough
+// to overflow the 32-bit bins of jxl::Histogram, so counts are kept in 64 bits
+// until the preset is trained.
+struct CorpusCounts {
+  std::vector<std::vector<uint64_t>> counts;
+  uint64_t total_count = 0;
+
+  void Add(const std::vector<jxl::Histogram>& histograms) {
+    if (counts.empty()) counts.resize(histograms.size());
+    for (size_t c = 0; c < histograms.size(); ++c) {
+      const std::vector<jxl::ANSHistBin>& in = histograms[c].counts;
+      if (counts[c].size() < in.size()) counts[c].resize(in.size());
+      for (size_t i = 0; i < in.size(); ++i) counts[c][i] += in[i];
+      total_count += histograms[c].total_count;
+    }
+  }
+
+  // Scales the counts down so that the sum over all contexts, and hence any
+  // histogram clustered from them, fits in a bin. Nonzero counts stay nonzero.
+  std::vector<jxl::Histogram> Normalize() const {
+    constexpr uint64_t kMaxTotalCount = uint64_t{1} << 30;
+    const double scale =
+        total_count > kMaxTotalCount
+            ? static_cast<double>(kMaxTotalCount) / total_count
+            : 1.0;
+    std::vector<jxl::Histogram> histograms(counts.size());
+    for (size_t c = 0; c < counts.size(); ++c) {
+      jxl::Histogram& histogram = histograms[c];
+      histogram.EnsureCapacity(counts[c].size());
+      for (size_t i = 0; i < counts[c].size(); ++i) {
+        if (counts[c][i] == 0) continue;
+        const auto scaled =
+            static_cast<jxl::ANSHistBin>(std::llround(counts[c][i] * scale));
+        const jxl::ANSHistBin count = std::max<jxl::ANSHistBin>(1, scaled);
+        histogram.counts[i] = count;
+        histogram.total_count += count;
+      }
+    }
+    return histograms;
+  }
+};
+
+// Encodes `ppf` and returns its per-context AC histograms in `histograms`.
+bool CollectHistograms(const jxl::extras::PackedPixelFile& ppf, int effort,
+                       float distance, jpegxl::tools::ThreadPoolInternal* pool,
+                       std::vector<jxl::Histogram>* histograms) {
+  JxlEncoderStats* stats = JxlEncoderStatsCreate();
+  stats->aux_out->collect_ac_histograms = true;
+  jxl::extras::JXLCompressParams params;
+  params.distance = distance;
+  params.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, effort);
+  // Streaming encoding clusters histograms per DC group.
+  params.AddOption(JXL_ENC_FRAME_SETTING_BUFFERING, 0);
+  params.runner = JxlThreadParallelRunner;
+  params.runner_opaque = pool->get()->runner_opaque();
+  params.stats = stats;
+  std::vector<uint8_t> compressed;
+  bool ok = jxl::extras::EncodeImageJXL(params, ppf, /*jpeg_bytes=*/nullptr,
+                                        &compressed);
+  if (ok) *histograms = std::move(stats->aux_out->ac_histograms);
+  JxlEncoderStatsDestroy(stats);
+  return ok;
+}
+
+int Train(int argc, char** argv) {
+  int effort = 7;
+  float distance = 1.0f;
+  int arg = 1;
+  for (; arg < argc; ++arg) {
+    if (strncmp(argv[arg], "--effort=", 9) == 0) {
+      effort = std::atoi(argv[arg] + 9);
+    } else if (strncmp(argv[arg], "--distance=", 11) == 0) {
+      distance = std::atof(argv[arg] + 11);
+    } else {
+      break;
+    }
+  }
+  if (argc - arg < 2 || effort < 1 || effort > 8 || distance <= 0) {
+    fprintf(stderr,
+            "Args: [--effort=1..8] [--distance=D] output.preset input...\n");
+    return 1;
+  }
+  const std::string pathname_out = argv[arg++];
+  jpegxl::tools::ThreadPoolInternal pool;
+
+  std::vector<std::vector<jxl::Histogram>> image_histograms;
+  CorpusCounts corpus;
+  for (; arg < argc; ++arg) {
+    std::vector<uint8_t> encoded;
+    jxl::extras::PackedPixelFile ppf;
+    if (!jpegxl::tools::ReadFile(argv[arg], &encoded) ||
+        !jxl::extras::DecodeBytes(jxl::Bytes(encoded),
+                                  jxl::extras::ColorHints(), &ppf)) {
+      fprintf(stderr, "Failed to read %s, skipping\n", argv[arg]);
+      continue;
+    }
+    std::vector<jxl::Histogram> histograms;
+    if (!CollectHistograms(ppf, effort, distance, &pool, &histograms)) {
+      fprintf(stderr, "Failed to encode %s, skipping\n", argv[arg]);
+      continue;
+    }
+    if (histograms.empty()) {
+      fprintf(stderr, "No VarDCT frame in %s, skipping\n", argv[arg]);
+      continue;
+    }
+    if (!corpus.counts.empty() && histograms.size() != corpus.counts.size()) {
+      fprintf(stderr, "%s uses a different AC context map, skipping\n",
+              argv[arg]);
+      continue;
+    }
+    corpus.Add(histograms);
+    image_histograms.push_back(std::move(histograms));
+  }
+  if (corpus.counts.empty()) {
+    fprintf(stderr, "No usable input\n");
+    return 1;
+  }
+
+  // Clustering is done once, offline, so use the best method.
+  jxl::HistogramParams params;
+  jxl::StatusOr<jxl::EntropyCodePreset> trained =
+      jxl::EntropyCodePreset::Train(params, corpus.Normalize());
+  if (!trained.ok()) {
+    fprintf(stderr, "Failed to train preset\n");
+    return 1;
+  }
+  const jxl::EntropyCodePreset preset = std::move(trained).value_();
+  size_t num_fit = 0;
+  for (const auto& histograms : image_histograms) {
+    if (preset.Fits(histograms)) ++num_fit;
+  }
+  fprintf(stderr,
+          "%zu contexts, %zu histograms; preset fits %zu of %zu images\n",
+          preset.context_map.size(), preset.histograms.size(), num_fit,
+          image_histograms.size());
+
+  if (!jpegxl::tools::WriteFile(pathname_out, preset.Serialize())) {
+    fprintf(stderr, "Failed to write %s\n", pathname_out.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) { return Train(argc, argv); }